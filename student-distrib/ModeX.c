@@ -7,8 +7,10 @@
 #include "desktop.h"
 #include "blocks.h"
 #include "sys_calls.h"
+#include "ktimer.h"
 #include "vedio.h"
 #include "./dev/sound.h"
+#include "clock.h"
 
 
 #define SCROLL_SIZE             (SCROLL_X_WIDTH * SCROLL_Y_DIM)
@@ -36,6 +38,10 @@ static void fill_palette();
 static void write_font_data();
 static void copy_image(unsigned char* img, unsigned short scr_addr);
 static void copy_status_bar(unsigned char* img, unsigned short scr_addr);
+static void mark_dirty(int pos_x, int pos_y, int width, int height);
+static void copy_dirty_tiles(unsigned char* addr, int p_off, unsigned long* tiles);
+static void sprite_blit();
+static void sprite_erase();
 
 
 #define MEM_FENCE_WIDTH 0 // we do not need mem-fence for mp3
@@ -50,10 +56,50 @@ static int show_x, show_y;          /* logical view coordinates     */
 static unsigned char* mem_image;    /* pointer to start of video memory */
 static unsigned short target_img;   /* offset of displayed screen image */
 
+/*
+ * Dirty-rectangle tracking. The logical view window is split into tiles of
+ * DIRTY_TILE_X_DIM x DIRTY_TILE_Y_DIM pixels; one bit per tile, one word per
+ * row of tiles. A tile is 4 bytes wide in every plane, so copying it is one
+ * dword per row per plane. The back page was last filled two show_screen
+ * calls ago, so it misses both the tiles dirtied now and the previous ones.
+ */
+#define DIRTY_TILE_X_DIM        16
+#define DIRTY_TILE_Y_DIM        14
+#define DIRTY_TILE_X_NUM        (IMAGE_X_DIM / DIRTY_TILE_X_DIM)      /* 20 */
+#define DIRTY_TILE_Y_NUM        ((200-18) / DIRTY_TILE_Y_DIM)         /* 13 */
+static unsigned long dirty_now[DIRTY_TILE_Y_NUM];   /* changed since last show  */
+static unsigned long dirty_prev[DIRTY_TILE_Y_NUM];  /* changed in the one before */
+static int full_redraw;             /* number of pages still needing a full copy */
+
+/*
+ * Sprite layer for the mouse pointer. The sprite is never drawn into the
+ * build buffer; it goes straight to the visible page, and the pixels it
+ * covers are kept in sprite_under so moving it only rewrites the old and
+ * new 12x12 rectangles.
+ */
+#define SPRITE_X_DIM            12
+#define SPRITE_Y_DIM            12
+static int sprite_visible;          /* 1 if the sprite is on the visible page */
+static int sprite_x, sprite_y;      /* logical position of the sprite         */
+static int sprite_sx, sprite_sy;    /* screen position it was drawn at        */
+static unsigned char* sprite_img;   /* image, NULL for the translucent cursor */
+static unsigned char* sprite_mask;
+static unsigned char sprite_under[SPRITE_Y_DIM * SPRITE_X_DIM];
+
 /* pointer to start (0x900000) of temp video memory for text screen when in modeX */
 static unsigned char* mem_temp_v;    
 
 int32_t in_modex=0;
+
+/* TSC cycles per video frame drawn by refresh_mp4 / refresh_mp4_planes */
+static uint32_t mp4_blit_frames;
+static uint64_t mp4_blit_sum;
+static uint32_t mp4_blit_max;
+
+/* redraws the status bar clock while mode X is up */
+#define BAR_PERIOD MS_TO_TICKS(1000)
+static ktimer_t bar_timer;
+static void bar_tick(uint32_t data);
 extern volatile int32_t terminal_tick;      /* for the active running terminal, default the first terminal */
 extern volatile int32_t terminal_display;   /* for the displayed terminal, only change when function-key pressed */
 unsigned char palette_RGB_vedio[256][3]= {
@@ -501,6 +547,8 @@ extern int32_t switch_to_modeX(){
 
     /* One display page goes at the start of video memory. */
     target_img = 18* IMAGE_X_WIDTH; // 18 = text hight+ 2 pixel.  Here we just add offset for the bar
+    full_redraw = 2;
+    sprite_visible = 0;
 
     VGA_blank(1);                               /* blank the screen      */
     set_seq_regs_and_reset(mode_X_seq, 0x63);   /* sequencer registers   */
@@ -512,6 +560,9 @@ extern int32_t switch_to_modeX(){
     VGA_blank(0);                               /* unblank the screen    */
 
     in_modex=1;
+    ktimer_del(&bar_timer);
+    ktimer_init(&bar_timer, bar_tick, 0);
+    ktimer_add(&bar_timer, BAR_PERIOD);     /* status bar clock */
     
     /* Return success. */
     return 0;
@@ -750,6 +801,8 @@ void fill_palette_vedio() {
  *   SIDE EFFECTS: fills all 256kB of VGA video memory with zeroes
  */
 void clear_screens() {
+    full_redraw = 2;
+    sprite_visible = 0;
     /* Write to all four planes at once. */
     SET_WRITE_MASK(0x0F00);
 
@@ -843,6 +896,7 @@ extern void set_text_mode_3(int clear_scr) {
     write_font_data();                          /* copy fonts to video mem */
     VGA_blank(0);                               /* unblank the screen      */
     in_modex=0;
+    ktimer_del(&bar_timer);
 
 }
 
@@ -881,6 +935,8 @@ void set_view_window(int scr_x, int scr_y) {
     /* Keep track of the new view window. */
     show_x = scr_x;
     show_y = scr_y;
+    if (show_x != old_x || show_y != old_y)
+        full_redraw = 2;
 
     /*
      * If the new view window fits within the boundaries of the build
@@ -973,6 +1029,7 @@ void show_screen() {
     unsigned char* addr;    /* source address for copy             */
     int p_off;              /* plane offset of first display plane */
     int i;                  /* loop index over video planes        */
+    unsigned long tiles[DIRTY_TILE_Y_NUM];  /* tiles the back page misses */
 
     /*
      * Calculate offset of build buffer plane to be mapped into plane 0
@@ -980,16 +1037,38 @@ void show_screen() {
      */
     p_off = (3 - (show_x & 3));
 
+    /* The page being hidden keeps the sprite, recopy that area later. */
+    if (sprite_visible)
+        mark_dirty(sprite_x, sprite_y, SPRITE_X_DIM, SPRITE_Y_DIM);
+
     /* Switch to the other target screen in video memory. */
     target_img ^= 0x4000;
 
     /* Calculate the source address. */
     addr = img3 + (show_x >> 2) + show_y * SCROLL_X_WIDTH;
 
-    /* Draw to each plane in the video memory. */
-    for (i = 0; i < 4; i++) {
-        SET_WRITE_MASK(1 << (i + 8));
-        copy_image(addr + ((p_off - i + 4) & 3) * SCROLL_SIZE + (p_off < i), target_img);
+    for (i = 0; i < DIRTY_TILE_Y_NUM; i++) {
+        tiles[i] = dirty_now[i] | dirty_prev[i];
+        dirty_prev[i] = dirty_now[i];
+        dirty_now[i] = 0;
+    }
+
+    if (full_redraw) {
+        full_redraw--;
+        /* Draw to each plane in the video memory. */
+        for (i = 0; i < 4; i++) {
+            SET_WRITE_MASK(1 << (i + 8));
+            copy_image(addr + ((p_off - i + 4) & 3) * SCROLL_SIZE + (p_off < i), target_img);
+        }
+    } else {
+        copy_dirty_tiles(addr, p_off, tiles);
+    }
+
+    /* Put the sprite on the new page. */
+    if (sprite_visible) {
+        sprite_sx = sprite_x - show_x;
+        sprite_sy = sprite_y - show_y;
+        sprite_blit();
     }
 
     /*
@@ -1001,7 +1080,196 @@ void show_screen() {
 
 }
 
+/*
+ * mark_dirty
+ *   DESCRIPTION: Record that a rectangle of the build buffer changed, so the
+ *                next two show_screen calls copy the tiles covering it.
+ *   INPUTS: (pos_x,pos_y) -- logical coordinates of upper left corner
+ *           width, height -- size of the rectangle in pixels
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets bits in dirty_now; parts outside the view window are ignored
+ */
+static void mark_dirty(int pos_x, int pos_y, int width, int height) {
+    int x0, y0, x1, y1;     /* clipped rectangle in screen coordinates */
+    int ty;                 /* loop index over tile rows               */
+    unsigned long bits;     /* tile columns covered                    */
+
+    x0 = pos_x - show_x;
+    y0 = pos_y - show_y;
+    x1 = x0 + width - 1;
+    y1 = y0 + height - 1;
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 >= IMAGE_X_DIM) x1 = IMAGE_X_DIM - 1;
+    if (y1 >= DIRTY_TILE_Y_NUM * DIRTY_TILE_Y_DIM) y1 = DIRTY_TILE_Y_NUM * DIRTY_TILE_Y_DIM - 1;
+    if (x0 > x1 || y0 > y1)
+        return;
+
+    x0 /= DIRTY_TILE_X_DIM;
+    x1 /= DIRTY_TILE_X_DIM;
+    bits = ((2UL << x1) - 1) & ~((1UL << x0) - 1);
+    for (ty = y0 / DIRTY_TILE_Y_DIM; ty <= y1 / DIRTY_TILE_Y_DIM; ty++)
+        dirty_now[ty] |= bits;
+}
+
+/*
+ * copy_dirty_tiles
+ *   DESCRIPTION: Copy only the given tiles of the logical view window from
+ *                the build buffer to the target page, using the same plane
+ *                mapping as show_screen.
+ *   INPUTS: addr -- build buffer address of the view window's upper left pixel
+ *           p_off -- build buffer plane mapped into display plane 0
+ *           tiles -- one bit per tile, one word per row of tiles
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the target page of video memory
+ */
+static void copy_dirty_tiles(unsigned char* addr, int p_off, unsigned long* tiles) {
+    unsigned char* src;     /* build buffer plane for display plane i */
+    unsigned char* dst;     /* target page start                      */
+    int i;                  /* loop index over video planes           */
+    int tx, ty, row;        /* tile column, tile row, pixel row       */
+    int off;                /* byte offset of the tile row in a plane */
+
+    dst = mem_image + target_img;
+    for (i = 0; i < 4; i++) {
+        SET_WRITE_MASK(1 << (i + 8));
+        src = addr + ((p_off - i + 4) & 3) * SCROLL_SIZE + (p_off < i);
+        for (ty = 0; ty < DIRTY_TILE_Y_NUM; ty++) {
+            if (!tiles[ty])
+                continue;
+            for (tx = 0; tx < DIRTY_TILE_X_NUM; tx++) {
+                if (!(tiles[ty] & (1UL << tx)))
+                    continue;
+                off = ty * DIRTY_TILE_Y_DIM * SCROLL_X_WIDTH + tx * (DIRTY_TILE_X_DIM / 4);
+                for (row = 0; row < DIRTY_TILE_Y_DIM; row++, off += SCROLL_X_WIDTH)
+                    *(uint32_t*)(dst + off) = *(uint32_t*)(src + off);
+            }
+        }
+    }
+}
+
+/*
+ * sprite_move
+ *   DESCRIPTION: Move the pointer sprite, drawing it directly on the visible
+ *                page. The pixels under the old position are put back from
+ *                the save-under buffer; nothing else is copied.
+ *   INPUTS: (pos_x,pos_y) -- logical coordinates of upper left corner
+ *           img -- 12x12 image drawn where mask is 1; NULL to brighten
+ *                  (add NUM_NONTRANS_COLOR to) the pixels where mask is
+ *                  STATUS_TEXT_COLOR instead
+ *           mask -- 12x12 mask
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the visible page of video memory
+ */
+void sprite_move(int pos_x, int pos_y, unsigned char* img, unsigned char* mask) {
+    if (sprite_visible)
+        sprite_erase();
+    sprite_x = pos_x;
+    sprite_y = pos_y;
+    sprite_sx = pos_x - show_x;
+    sprite_sy = pos_y - show_y;
+    sprite_img = img;
+    sprite_mask = mask;
+    sprite_visible = 1;
+    sprite_blit();
+}
+
+/*
+ * sprite_hide
+ *   DESCRIPTION: Remove the pointer sprite from the visible page.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the visible page of video memory
+ */
+void sprite_hide() {
+    if (sprite_visible)
+        sprite_erase();
+    sprite_visible = 0;
+}
+
+/*
+ * sprite_blit
+ *   DESCRIPTION: Draw the sprite at (sprite_sx,sprite_sy) on the visible
+ *                page, one plane at a time, clipped to the view window,
+ *                saving the covered pixels in sprite_under first.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes (and reads) the visible page of video memory
+ */
+static void sprite_blit() {
+    unsigned char* vram;    /* visible page                     */
+    unsigned char* pix;     /* pixel in video memory            */
+    int plane;              /* loop index over video planes     */
+    int dx, dy;             /* position inside the sprite       */
+    int sx, sy;             /* position on screen               */
+    int idx;                /* index into sprite arrays         */
+
+    vram = mem_image + target_img;
+    for (plane = 0; plane < 4; plane++) {
+        SET_WRITE_MASK(1 << (plane + 8));
+        OUTW(0x03CE, (plane << 8) | 0x04);      /* read map select */
+        for (dy = 0; dy < SPRITE_Y_DIM; dy++) {
+            sy = sprite_sy + dy;
+            if (sy < 0 || sy >= SCROLL_Y_DIM)
+                continue;
+            /* first column of the sprite that lies in this plane */
+            for (dx = (plane - sprite_sx) & 3; dx < SPRITE_X_DIM; dx += 4) {
+                sx = sprite_sx + dx;
+                if (sx < 0 || sx >= SCROLL_X_DIM)
+                    continue;
+                idx = dy * SPRITE_X_DIM + dx;
+                pix = vram + sy * SCROLL_X_WIDTH + (sx >> 2);
+                sprite_under[idx] = *pix;
+                if (sprite_img != NULL) {
+                    if (sprite_mask[idx] == 1)
+                        *pix = sprite_img[idx];
+                } else if (sprite_mask[idx] == STATUS_TEXT_COLOR && sprite_under[idx] < NUM_NONTRANS_COLOR) {
+                    *pix = sprite_under[idx] + NUM_NONTRANS_COLOR;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * sprite_erase
+ *   DESCRIPTION: Put the saved-under pixels back where the sprite was drawn.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the visible page of video memory
+ */
+static void sprite_erase() {
+    unsigned char* vram;    /* visible page                     */
+    int plane;              /* loop index over video planes     */
+    int dx, dy;             /* position inside the sprite       */
+    int sx, sy;             /* position on screen               */
+
+    vram = mem_image + target_img;
+    for (plane = 0; plane < 4; plane++) {
+        SET_WRITE_MASK(1 << (plane + 8));
+        for (dy = 0; dy < SPRITE_Y_DIM; dy++) {
+            sy = sprite_sy + dy;
+            if (sy < 0 || sy >= SCROLL_Y_DIM)
+                continue;
+            for (dx = (plane - sprite_sx) & 3; dx < SPRITE_X_DIM; dx += 4) {
+                sx = sprite_sx + dx;
+                if (sx < 0 || sx >= SCROLL_X_DIM)
+                    continue;
+                vram[sy * SCROLL_X_WIDTH + (sx >> 2)] = sprite_under[dy * SPRITE_X_DIM + dx];
+            }
+        }
+    }
+}
+
 extern void switch_another_screen(){
+    full_redraw = 2;
+    sprite_visible = 0;
     target_img ^= 0x4000;
     /*
      * Change the VGA registers to point the top left of the screen
@@ -1013,6 +1281,8 @@ extern void switch_another_screen(){
 
 
 extern void clear_screens_manul() {
+    full_redraw = 2;
+    sprite_visible = 0;
     /* Write to all four planes at once. */
     SET_WRITE_MASK(0x0F00);
 
@@ -1056,6 +1326,7 @@ int draw_vert_line(int x) {
 
     /* Adjust x to the logical row value. */
     x += show_x;
+    mark_dirty(x, show_y, 1, SCROLL_Y_DIM);
 
     /* Get the image of the line. */
     fill_vert_buffer (x, show_y, buf);
@@ -1101,6 +1372,7 @@ int draw_horiz_line(int y) {
 
     /* Adjust y to the logical row value. */
     y += show_y;
+    mark_dirty(show_x, y, SCROLL_X_DIM, 1);
 
     /* Get the image of the line. */
     fill_horiz_buffer (show_x, y, buf);
@@ -1161,6 +1433,22 @@ extern uint8_t  ss;
 extern uint8_t  ww;
 extern uint32_t rand_seed;
 extern void update_time();
+/*
+ * bar_tick
+ *   DESCRIPTION: status bar timer callback, read the CMOS clock through
+ *                refresh_bar once a second
+ *   INPUTS: data -- unused
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: rearms itself while in mode X
+ */
+static void bar_tick(uint32_t data){
+    if (!in_modex)
+        return;
+    refresh_bar(NULL, NULL, NULL);
+    ktimer_add(&bar_timer, BAR_PERIOD);
+}
+
 /*
  * refresh_bar
  *   DESCRIPTION: 1. convert "level num_fruit time" infos into a string with 320/8=40 chracters
@@ -1279,39 +1567,119 @@ void refresh_bar(int level, int num_fruit, int time){
     }
 }
 
+/*
+ * mp4_blit_account
+ *   DESCRIPTION: add one frame to the video blit statistics
+ *   INPUTS: start -- TSC when the frame started to be drawn
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void mp4_blit_account(uint64_t start){
+    uint32_t cyc = (uint32_t)(rdtsc() - start);
+
+    mp4_blit_frames++;
+    mp4_blit_sum += cyc;
+    if (cyc > mp4_blit_max)
+        mp4_blit_max = cyc;
+}
+
+/*
+ * mp4_blit_stats
+ *   DESCRIPTION: report the video blit statistics and start over
+ *   INPUTS: none
+ *   OUTPUTS: frames -- frames drawn since the last call
+ *            avg / max -- TSC cycles per frame
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: clears the statistics
+ */
+void mp4_blit_stats(uint32_t* frames, uint32_t* avg, uint32_t* max){
+    *frames = mp4_blit_frames;
+    *avg = mp4_blit_frames ? (uint32_t)div64_32(mp4_blit_sum, mp4_blit_frames) : 0;
+    *max = mp4_blit_max;
+    mp4_blit_frames = 0;
+    mp4_blit_sum = 0;
+    mp4_blit_max = 0;
+}
+
+/*
+ * refresh_mp4
+ *   DESCRIPTION: Show a linear (row by row) 320x182 frame below the status bar.
+ *                Each plane is built straight in video memory: every dword
+ *                store takes the matching byte out of four dword loads, so
+ *                there is no intermediate planar buffer.
+ *   INPUTS: pt_2_mp4_buffer -- 320*182 bytes, one byte per pixel, dword aligned
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the back page of video memory and flips to it
+ */
 extern void refresh_mp4(unsigned char* pt_2_mp4_buffer){
-    //static unsigned char tex_buffer[320*18];                  //buffer for text graphic. size = width of bar * hight_of_bar
-    static unsigned char tex_VGA_buffer[4*(SCROLL_X_WIDTH*182)]; /* buffer for graphical image in VGA friendly farmat
-                                                          size = num_plane*(SCROLL_X_WIDTH* hight_of_bar)*/
-    int tex_buffer_idx; // idx of the pixel in tex_buffer
-    int tex_VGA_buffer_idx; // idx of the pixel in tex_VGA_buffer
-    int p_off;  // the index of the plane
-    int pixel_idx; //the index of pixel in a plane
-    unsigned char* addr; //address to the start of the plane we want to copy
-    //3. copu the data format in pt_2_mp4_buffer(tex_buffer) into tex_VGA_buffer in a format friendly to VGA
-    for ( p_off=0; p_off<4;p_off++) {  //loop through 4 planes 
-        for ( pixel_idx=0; pixel_idx< SCROLL_X_WIDTH*(200-18); pixel_idx++){ //loop through every pixel in this plane (num_of_pixel_in_plane=SCROLL_X_WIDTH*18)
-            tex_buffer_idx = p_off + pixel_idx*4; // 4 planes
-            tex_VGA_buffer_idx = p_off* (SCROLL_X_WIDTH*(200-18))+ pixel_idx;  //(num_of_pixel_in_plane=SCROLL_X_WIDTH*18)
-            tex_VGA_buffer[tex_VGA_buffer_idx]=pt_2_mp4_buffer[tex_buffer_idx]; 
-            //tex_VGA_buffer[tex_VGA_buffer_idx]= (tex_buffer[tex_buffer_idx]==COLOR_TEXT)?  a : c;
+    uint32_t* src;  // four pixels per load, one of them belongs to this plane
+    uint32_t* dst;  // four pixels of this plane per store
+    int shift;      // bit position of this plane's pixel inside a source dword
+    int p_off;      // the index of the plane
+    int i;          // index of the dword in the plane
+    uint64_t start = rdtsc();
+
+    /* Switch to the other target screen in video memory. */
+    target_img ^= 0x4000;
+    full_redraw = 2;
+    sprite_visible = 0;
+
+    /* Draw to each plane in the video memory. */
+    for ( p_off = 0; p_off < 4; p_off++) {
+        SET_WRITE_MASK(1 << (p_off + 8)); // set musk for the plane we want
+        src = (uint32_t*)pt_2_mp4_buffer;
+        dst = (uint32_t*)(mem_image + target_img);
+        shift = p_off * 8;
+        for (i = 0; i < SCROLL_X_WIDTH*182/4; i++, src += 4) {
+            /* pixels p_off, p_off+4, p_off+8, p_off+12 of this 16-pixel group */
+            dst[i] = ((src[0] >> shift) & 0xFF)
+                   | (((src[1] >> shift) & 0xFF) << 8)
+                   | (((src[2] >> shift) & 0xFF) << 16)
+                   | ((src[3] >> shift) << 24);
         }
-    }  
-    //4. do copy_mp4 four times (for each plane) to copy the status bar to the start of vedeo_mem
+    }
+    mp4_blit_account(start);
+
+    /*
+     * Change the VGA registers to point the top left of the screen
+     * to the video memory that we just filled.
+     */
+    OUTW(0x03D4, (target_img & 0xFF00) | 0x0C);
+    OUTW(0x03D4, ((target_img & 0x00FF) << 8) | 0x0D);
+}
 
+/*
+ * refresh_mp4_planes
+ *   DESCRIPTION: Show a video frame that is already stored plane by plane
+ *                (plane p holds pixels with x&3 == p). Only the planes set
+ *                in dirty_mask are copied to the back page before flipping.
+ *   INPUTS: planes -- 4 planes of (200-18)*80 bytes each
+ *           dirty_mask -- bit p set if plane p must be uploaded
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: copies dirty planes to video memory and flips the page
+ */
+extern void refresh_mp4_planes(unsigned char* planes, int dirty_mask){
+    int p_off;  // the index of the plane
+    uint64_t start = rdtsc();
 
     /* Switch to the other target screen in video memory. */
     target_img ^= 0x4000;
+    full_redraw = 2;
+    sprite_visible = 0;
 
-
-    /* Draw to each plane in the video memory. */
+    /* Only touch the planes that changed since this page was last shown */
     for ( p_off = 0; p_off < 4; p_off++) {
+        if (!(dirty_mask & (1 << p_off)))
+            continue;
         SET_WRITE_MASK(1 << (p_off + 8)); // set musk for the plane we want
-        addr=tex_VGA_buffer+p_off*SCROLL_X_WIDTH*182; //18 is the hight of the bar
-        copy_mp4(addr, target_img); //(num_of_pixel_in_plane=SCROLL_X_WIDTH*(200-18)) 
-    }  
+        copy_mp4(planes + p_off*SCROLL_X_WIDTH*182, target_img);
+    }
+    mp4_blit_account(start);
 
-        /*
+    /*
      * Change the VGA registers to point the top left of the screen
      * to the video memory that we just filled.
      */
@@ -1396,6 +1764,7 @@ void draw_full_block(int pos_x, int pos_y, unsigned char* blk) {
     if (pos_x + BLOCK_X_DIM <= show_x || pos_x >= show_x + SCROLL_X_DIM ||
         pos_y + BLOCK_Y_DIM <= show_y || pos_y >= show_y + SCROLL_Y_DIM)
         return;
+    mark_dirty(pos_x, pos_y, BLOCK_X_DIM, BLOCK_Y_DIM);
 
     /* Clip any pixels falling off the left side of screen. */
     if ((x_left = show_x - pos_x) < 0)
@@ -1465,6 +1834,7 @@ void draw_full_block_with_mask(int pos_x, int pos_y, unsigned char* blk, unsigne
     if (pos_x + BLOCK_X_DIM <= show_x || pos_x >= show_x + SCROLL_X_DIM ||
         pos_y + BLOCK_Y_DIM <= show_y || pos_y >= show_y + SCROLL_Y_DIM)
         return;
+    mark_dirty(pos_x, pos_y, BLOCK_X_DIM, BLOCK_Y_DIM);
 
     /* Clip any pixels falling off the left side of screen. */
     if ((x_left = show_x - pos_x) < 0)
@@ -1542,6 +1912,7 @@ void restore_full_block_with_mask(int pos_x, int pos_y, unsigned char* blk, unsi
     if (pos_x + BLOCK_X_DIM <= show_x || pos_x >= show_x + SCROLL_X_DIM ||
         pos_y + BLOCK_Y_DIM <= show_y || pos_y >= show_y + SCROLL_Y_DIM)
         return;
+    mark_dirty(pos_x, pos_y, BLOCK_X_DIM, BLOCK_Y_DIM);
 
     /* Clip any pixels falling off the left side of screen. */
     if ((x_left = show_x - pos_x) < 0)
@@ -1618,6 +1989,7 @@ void draw_fruit_text_with_mask(int pos_x, int pos_y, unsigned char* mask, unsign
     if (pos_x + BLOCK_FRT_TXT_X_DIM <= show_x || pos_x >= show_x + SCROLL_X_DIM ||
         pos_y + BLOCK_FRT_TXT_Y_DIM <= show_y || pos_y >= show_y + SCROLL_Y_DIM)
         return;
+    mark_dirty(pos_x, pos_y, BLOCK_FRT_TXT_X_DIM, BLOCK_FRT_TXT_Y_DIM);
 
     /* Clip any pixels falling off the left side of screen. */
     if ((x_left = show_x - pos_x) < 0)
@@ -1692,6 +2064,7 @@ void restore_fruit_text_with_mask(int pos_x, int pos_y, unsigned char* mask, uns
     if (pos_x + BLOCK_FRT_TXT_X_DIM <= show_x || pos_x >= show_x + SCROLL_X_DIM ||
         pos_y + BLOCK_FRT_TXT_Y_DIM <= show_y || pos_y >= show_y + SCROLL_Y_DIM)
         return;
+    mark_dirty(pos_x, pos_y, BLOCK_FRT_TXT_X_DIM, BLOCK_FRT_TXT_Y_DIM);
 
     /* Clip any pixels falling off the left side of screen. */
     if ((x_left = show_x - pos_x) < 0)
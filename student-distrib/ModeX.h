@@ -90,12 +90,24 @@ extern void restore_fruit_text_with_mask(int pos_x, int pos_y, unsigned char* ma
  */
 extern void set_palette_color(unsigned char color_index, unsigned char* RGB);
 
+/*
+ * move the 12x12 pointer sprite to logical position (pos_x,pos_y), drawn
+ * straight on the visible page; img == NULL brightens the pixels under the
+ * mask instead of drawing an image
+ */
+extern void sprite_move(int pos_x, int pos_y, unsigned char* img, unsigned char* mask);
+/* remove the pointer sprite from the visible page */
+extern void sprite_hide();
+
 extern void switch_another_screen();
 extern void clear_screens_manul();
 extern void change_top_left();
 extern unsigned char* get_block_img(int32_t block_name);
 extern void refresh_mp4(unsigned char* pt_2_mp4_buffer);
 extern void copy_mp4(unsigned char* img, unsigned short scr_addr);
+extern void refresh_mp4_planes(unsigned char* planes, int dirty_mask);
+/* frames drawn by the two above and TSC cycles per frame, then clears them */
+extern void mp4_blit_stats(uint32_t* frames, uint32_t* avg, uint32_t* max);
 void fill_palette_vedio();
 
 #endif
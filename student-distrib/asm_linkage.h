@@ -15,7 +15,10 @@ extern void irq_Eth0();
 extern void irq_PS2_Mouse();
 extern void irq_Ide0();
 extern void irq_sb16();
+extern void irq_Lapic_Timer();
+extern void irq_Lapic_Spurious();
 extern void asm_sys_linkage();
+extern void asm_sysenter_linkage();
 extern void page_excpt_asmlink();
 
 #endif
@@ -0,0 +1,480 @@
+/* bcache.c - Block buffer cache in front of the ATA disks
+ * vim:ts=4 noexpandtab
+ */
+
+#include "bcache.h"
+#include "lib.h"
+#include "clock.h"
+#include "spinlock.h"
+#include "./dev/ata.h"
+
+#define BHASH(dev, blockno)     (((blockno) ^ ((uint32_t)(dev) << 4)) & (BCACHE_HASH - 1))
+
+/* global section */
+bcache_stat_t bcache_stat;
+
+static buf_t bufs[BCACHE_BLOCKS];
+static uint8_t bcache_data[BCACHE_BLOCKS][BLOCK_SIZE] __attribute__((aligned(BLOCK_SIZE)));
+static buf_t lru;                               /* list head, lru.lru_next is the newest */
+static buf_t* bhash[BCACHE_HASH];
+static uint32_t next_block[ATA_MAX_DRIVES];     /* where a sequential scan misses next */
+static spinlock_t bcache_lock = SPINLOCK_UNLOCKED;
+static buf_t* prefetch_list[ATA_MAX_PRD];       /* blocks of the bprefetch in flight */
+static uint32_t prefetch_n;
+
+/*
+ * lru_unlink / lru_push
+ *   DESCRIPTION: take a buffer off the LRU list / put it at the head
+ *   INPUTS: b -- the buffer
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: caller holds bcache_lock
+ */
+static void lru_unlink(buf_t* b){
+    b->lru_prev->lru_next = b->lru_next;
+    b->lru_next->lru_prev = b->lru_prev;
+}
+
+static void lru_push(buf_t* b){
+    b->lru_next = lru.lru_next;
+    b->lru_prev = &lru;
+    lru.lru_next->lru_prev = b;
+    lru.lru_next = b;
+}
+
+/*
+ * bhash_remove
+ *   DESCRIPTION: take a buffer out of its hash chain
+ *   INPUTS: b -- the buffer
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: caller holds bcache_lock
+ */
+static void bhash_remove(buf_t* b){
+    buf_t** p;
+
+    if (b->dev < 0)
+        return;
+    for (p = &bhash[BHASH(b->dev, b->blockno)]; *p != NULL; p = &(*p)->hash_next){
+        if (*p == b){
+            *p = b->hash_next;
+            break;
+        }
+    }
+    b->dev = -1;
+}
+
+/*
+ * bcache_find
+ *   DESCRIPTION: look a block up
+ *   INPUTS: dev / blockno -- the block
+ *   OUTPUTS: none
+ *   RETURN VALUE: its buffer, NULL if not cached
+ *   SIDE EFFECTS: caller holds bcache_lock
+ */
+static buf_t* bcache_find(int32_t dev, uint32_t blockno){
+    buf_t* b;
+
+    for (b = bhash[BHASH(dev, blockno)]; b != NULL; b = b->hash_next)
+        if (b->dev == dev && b->blockno == blockno)
+            return b;
+    return NULL;
+}
+
+/*
+ * bcache_victim
+ *   DESCRIPTION: the least recently released buffer nobody holds
+ *   INPUTS: clean_only -- 1 to pass over dirty buffers
+ *   OUTPUTS: none
+ *   RETURN VALUE: the buffer, NULL if all are in use
+ *   SIDE EFFECTS: caller holds bcache_lock
+ */
+static buf_t* bcache_victim(int32_t clean_only){
+    buf_t* b;
+
+    for (b = lru.lru_prev; b != &lru; b = b->lru_prev)
+        if (b->refcnt == 0 && !(b->flags & B_BUSY) && !(clean_only && (b->flags & B_DIRTY)))
+            return b;
+    return NULL;
+}
+
+/*
+ * bcache_assign
+ *   DESCRIPTION: give a clean victim to a block that is about to be read
+ *   INPUTS: b -- the buffer
+ *           dev / blockno -- the block
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: caller holds bcache_lock; b is B_BUSY until the read ends
+ */
+static void bcache_assign(buf_t* b, int32_t dev, uint32_t blockno){
+    uint32_t h = BHASH(dev, blockno);
+
+    bhash_remove(b);
+    b->dev = dev;
+    b->blockno = blockno;
+    b->flags = B_BUSY;
+    b->hash_next = bhash[h];
+    bhash[h] = b;
+    lru_unlink(b);
+    lru_push(b);
+}
+
+/*
+ * bcache_flush
+ *   DESCRIPTION: write a dirty buffer back to its disk
+ *   INPUTS: b -- the buffer, the caller set B_BUSY on it
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 on an I/O error (the buffer stays dirty)
+ *   SIDE EFFECTS: clears B_BUSY
+ */
+static int32_t bcache_flush(buf_t* b){
+    uint8_t* data = b->data;
+    uint32_t flags;
+    int32_t ret;
+
+    ret = ata_rw(b->dev, b->blockno * BLOCK_SECTORS, &data, 1, BLOCK_SECTORS, 1);
+    spin_lock_irqsave(&bcache_lock, flags);
+    if (ret == 0){
+        b->flags &= ~B_DIRTY;
+        bcache_stat.writeback++;
+    }
+    b->flags &= ~B_BUSY;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    return ret;
+}
+
+/*
+ * bcache_wait
+ *   DESCRIPTION: halt until the disk I/O on a buffer ended; with
+ *                interrupts off, poll for the end of a bprefetch instead
+ *   INPUTS: b -- the buffer
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may return with interrupts on
+ */
+static void bcache_wait(buf_t* b){
+    uint32_t flags;
+
+    cli_and_save(flags);
+    restore_flags(flags);
+    while (b->flags & B_BUSY){
+        if (flags & EFLAGS_IF)
+            cpu_idle();
+        else
+            ata_poll();
+    }
+}
+
+/*
+ * bcache_read_done
+ *   DESCRIPTION: completion of the read started by bprefetch
+ *   INPUTS: ret -- 0, -1 on an I/O error
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called from IRQ 14 with interrupts off; the blocks
+ *                 become valid, or leave the cache on an error
+ */
+static void bcache_read_done(int32_t ret){
+    uint32_t flags, i;
+
+    spin_lock_irqsave(&bcache_lock, flags);
+    for (i = 0; i < prefetch_n; i++){
+        prefetch_list[i]->flags = (ret == 0) ? B_VALID : 0;
+        if (ret != 0)
+            bhash_remove(prefetch_list[i]);
+    }
+    if (ret == 0)
+        bcache_stat.readahead += prefetch_n;
+    prefetch_n = 0;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+/*
+ * bcache_init
+ *   DESCRIPTION: put every buffer on the LRU list, empty
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void bcache_init(void){
+    int32_t i;
+
+    lru.lru_next = lru.lru_prev = &lru;
+    for (i = 0; i < BCACHE_BLOCKS; i++){
+        bufs[i].dev = -1;
+        bufs[i].data = bcache_data[i];
+        lru_push(&bufs[i]);
+    }
+}
+
+/*
+ * bread
+ *   DESCRIPTION: get a block, reading it on a miss. A miss on the block
+ *                right after the previous miss is taken as a sequential
+ *                scan and the next BCACHE_READAHEAD blocks come in with it,
+ *                in the same disk command
+ *   INPUTS: dev -- the ATA drive
+ *           blockno -- the block, in BLOCK_SIZE units
+ *   OUTPUTS: none
+ *   RETURN VALUE: the buffer, to be given back with brelse; NULL on an I/O
+ *                 error or when every buffer is held
+ *   SIDE EFFECTS: may write back a dirty buffer to make room; if that
+ *                 fails a clean buffer is evicted instead
+ */
+buf_t* bread(int32_t dev, uint32_t blockno){
+    buf_t* list[BCACHE_READAHEAD + 1];
+    uint8_t* data[BCACHE_READAHEAD + 1];
+    uint32_t flags, n, i, limit;
+    buf_t* b;
+    int32_t ret, clean_only = 0;
+
+    if (dev < 0 || dev >= ATA_MAX_DRIVES)
+        return NULL;
+    while (1){
+        spin_lock_irqsave(&bcache_lock, flags);
+        b = bcache_find(dev, blockno);
+        if (b != NULL){
+            b->refcnt++;
+            bcache_stat.hits++;
+            spin_unlock_irqrestore(&bcache_lock, flags);
+            bcache_wait(b);
+            /* the read that was bringing it in failed */
+            if (!(b->flags & B_VALID)){
+                brelse(b);
+                return NULL;
+            }
+            return b;
+        }
+        b = bcache_victim(clean_only);
+        if (b == NULL){
+            spin_unlock_irqrestore(&bcache_lock, flags);
+            return NULL;
+        }
+        if (!(b->flags & B_DIRTY))
+            break;
+        /* write back and look again, the block may have come in meanwhile */
+        b->flags |= B_BUSY;
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        /* a buffer that cannot be written back stays dirty, evict a clean one */
+        if (bcache_flush(b) < 0)
+            clean_only = 1;
+    }
+
+    bcache_stat.misses++;
+    bcache_assign(b, dev, blockno);
+    b->refcnt = 1;
+    list[0] = b;
+    n = 1;
+    if (blockno == next_block[dev]){
+        limit = ata_drives[dev].sectors / BLOCK_SECTORS;
+        while (n <= BCACHE_READAHEAD && blockno + n < limit && bcache_find(dev, blockno + n) == NULL){
+            b = bcache_victim(1);
+            if (b == NULL)
+                break;
+            bcache_assign(b, dev, blockno + n);
+            list[n++] = b;
+        }
+        bcache_stat.readahead += n - 1;
+    }
+    next_block[dev] = blockno + n;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    for (i = 0; i < n; i++)
+        data[i] = list[i]->data;
+    ret = ata_rw(dev, blockno * BLOCK_SECTORS, data, n, BLOCK_SECTORS, 0);
+
+    spin_lock_irqsave(&bcache_lock, flags);
+    for (i = 0; i < n; i++){
+        list[i]->flags = (ret == 0) ? B_VALID : 0;
+        if (ret != 0)
+            bhash_remove(list[i]);
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    if (ret != 0){
+        brelse(list[0]);
+        return NULL;
+    }
+    return list[0];
+}
+
+/*
+ * bprefetch
+ *   DESCRIPTION: start reading blocks into the cache without waiting:
+ *                cached blocks at the front are passed over, then the
+ *                uncached ones up to the next cached block are read in one
+ *                DMA command that IRQ 14 finishes. Safe in a softirq or
+ *                tasklet, which take the blocks with bpeek once they came in
+ *   INPUTS: dev -- the ATA drive
+ *           blockno -- the first block
+ *           n -- blocks wanted, at most ATA_MAX_PRD are read
+ *   OUTPUTS: none
+ *   RETURN VALUE: blocks being read, 0 if all are cached, -1 if the disk
+ *                 is busy, has no bus master, or no clean buffer is free
+ *   SIDE EFFECTS: none
+ */
+int32_t bprefetch(int32_t dev, uint32_t blockno, uint32_t n){
+    uint8_t* data[ATA_MAX_PRD];
+    uint32_t flags, i, limit;
+    buf_t* b;
+
+    if (dev < 0 || dev >= ATA_MAX_DRIVES)
+        return -1;
+    limit = ata_drives[dev].sectors / BLOCK_SECTORS;
+    if (blockno >= limit)
+        return -1;
+    if (n > limit - blockno)
+        n = limit - blockno;
+
+    spin_lock_irqsave(&bcache_lock, flags);
+    for (; n > 0 && bcache_find(dev, blockno) != NULL; n--)
+        blockno++;
+    if (n == 0){
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        return 0;
+    }
+    if (prefetch_n != 0){
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        return -1;
+    }
+    for (i = 0; i < n && i < ATA_MAX_PRD && bcache_find(dev, blockno + i) == NULL; i++){
+        b = bcache_victim(1);
+        if (b == NULL)
+            break;
+        bcache_assign(b, dev, blockno + i);
+        prefetch_list[i] = b;
+        data[i] = b->data;
+    }
+    prefetch_n = i;
+    /* nobody can see the buffers before the lock is dropped, so a read
+     * that did not start is simply undone */
+    if (i == 0 || ata_read_async(dev, blockno * BLOCK_SECTORS, data, i, BLOCK_SECTORS, bcache_read_done) < 0){
+        for (i = 0; i < prefetch_n; i++){
+            prefetch_list[i]->flags = 0;
+            bhash_remove(prefetch_list[i]);
+        }
+        prefetch_n = 0;
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        return -1;
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    return i;
+}
+
+/*
+ * bpeek
+ *   DESCRIPTION: get a block only if it is in the cache and valid; never
+ *                waits for the disk
+ *   INPUTS: dev / blockno -- the block
+ *   OUTPUTS: none
+ *   RETURN VALUE: the buffer, to be given back with brelse; NULL if it is
+ *                 not cached or still being read
+ *   SIDE EFFECTS: none
+ */
+buf_t* bpeek(int32_t dev, uint32_t blockno){
+    uint32_t flags;
+    buf_t* b;
+
+    spin_lock_irqsave(&bcache_lock, flags);
+    b = bcache_find(dev, blockno);
+    if (b != NULL && (b->flags & (B_VALID | B_BUSY)) == B_VALID){
+        b->refcnt++;
+        bcache_stat.hits++;
+    } else {
+        b = NULL;
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    return b;
+}
+
+/*
+ * brelse
+ *   DESCRIPTION: give back a buffer from bread; the last holder makes it
+ *                the most recently used
+ *   INPUTS: b -- the buffer
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void brelse(buf_t* b){
+    uint32_t flags;
+
+    if (b == NULL)
+        return;
+    spin_lock_irqsave(&bcache_lock, flags);
+    if (b->refcnt > 0 && --b->refcnt == 0){
+        lru_unlink(b);
+        lru_push(b);
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+/*
+ * bdirty
+ *   DESCRIPTION: mark a held buffer changed; it goes to disk when it is
+ *                evicted or on bsync
+ *   INPUTS: b -- the buffer
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void bdirty(buf_t* b){
+    uint32_t flags;
+
+    spin_lock_irqsave(&bcache_lock, flags);
+    b->flags |= B_DIRTY;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+/*
+ * bwrite
+ *   DESCRIPTION: write a held buffer to disk now
+ *   INPUTS: b -- the buffer
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 on an I/O error
+ *   SIDE EFFECTS: none
+ */
+int32_t bwrite(buf_t* b){
+    uint32_t flags;
+
+    while (1){
+        bcache_wait(b);
+        spin_lock_irqsave(&bcache_lock, flags);
+        if (!(b->flags & B_BUSY))
+            break;
+        spin_unlock_irqrestore(&bcache_lock, flags);
+    }
+    b->flags |= B_DIRTY | B_BUSY;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    return bcache_flush(b);
+}
+
+/*
+ * bsync
+ *   DESCRIPTION: write every dirty buffer back
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if a write failed
+ *   SIDE EFFECTS: none
+ */
+int32_t bsync(void){
+    uint32_t flags;
+    int32_t i, ret = 0;
+    buf_t* b;
+
+    for (i = 0; i < BCACHE_BLOCKS; i++){
+        b = &bufs[i];
+        spin_lock_irqsave(&bcache_lock, flags);
+        if ((b->flags & (B_DIRTY | B_BUSY)) != B_DIRTY){
+            spin_unlock_irqrestore(&bcache_lock, flags);
+            continue;
+        }
+        b->flags |= B_BUSY;
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        if (bcache_flush(b) < 0)
+            ret = -1;
+    }
+    return ret;
+}
@@ -0,0 +1,54 @@
+/* bcache.h - Block buffer cache in front of the ATA disks
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _BCACHE_H
+#define _BCACHE_H
+
+#include "types.h"
+
+#define BLOCK_SIZE          4096    /* the file system block */
+#define BLOCK_SECTORS       (BLOCK_SIZE / 512)
+#define BCACHE_BLOCKS       64
+#define BCACHE_HASH         32      /* power of two */
+#define BCACHE_READAHEAD    8       /* blocks read past a sequential miss */
+#define BCACHE_DEV          1       /* the file system disk, QEMU -hdb */
+
+#define B_VALID             0x1     /* data holds the block */
+#define B_DIRTY             0x2     /* data is newer than the disk */
+#define B_BUSY              0x4     /* disk I/O in flight */
+
+/*
+ * A cached block. bread hands it out with refcnt raised, brelse gives it
+ * back; an unreferenced buffer is reused least recently released first.
+ */
+typedef struct buf_t {
+    struct buf_t* lru_prev;         /* most recently released at the head */
+    struct buf_t* lru_next;
+    struct buf_t* hash_next;
+    int32_t dev;
+    uint32_t blockno;
+    volatile uint32_t flags;
+    uint32_t refcnt;
+    uint8_t* data;
+} buf_t;
+
+typedef struct bcache_stat_t {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t readahead;             /* blocks brought in ahead of a read */
+    uint32_t writeback;             /* dirty blocks written */
+} bcache_stat_t;
+
+extern bcache_stat_t bcache_stat;
+
+void bcache_init(void);
+buf_t* bread(int32_t dev, uint32_t blockno);
+int32_t bprefetch(int32_t dev, uint32_t blockno, uint32_t n);
+buf_t* bpeek(int32_t dev, uint32_t blockno);
+void brelse(buf_t* b);
+void bdirty(buf_t* b);
+int32_t bwrite(buf_t* b);
+int32_t bsync(void);
+
+#endif /* _BCACHE_H */
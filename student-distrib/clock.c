@@ -0,0 +1,355 @@
+/* clock.c - Monotonic clock and clock event devices
+ * vim:ts=4 noexpandtab
+ */
+
+#include "clock.h"
+#include "lib.h"
+#include "i8259.h"
+#include "spinlock.h"
+#include "scheduler.h"
+#include "mouse.h"
+#include "ktimer.h"
+#include "softirq.h"
+#include "irqstat.h"
+#include "prof.h"
+#include "./dev/apic.h"
+#include "./dev/video_player.h"
+#include "./dev/uart.h"
+
+extern volatile int time_tick;
+extern clock_event_t pit_clock_event;
+
+/* TSC to time: t = (cycles * mult) >> shift */
+#define NS_SHIFT        22
+#define US_SHIFT        32
+
+static int32_t tsc_ok = 0;
+static uint64_t tsc_base;           /* TSC when the clock switched to it */
+static uint64_t base_us;            /* clock_us() at tsc_base */
+static uint32_t mult_ns, mult_us;
+static uint32_t tsc_khz = 0;
+
+static clock_event_t* clock_dev = NULL;     /* NULL: periodic PIT, jiffies only */
+static uint64_t next_wakeup = CLOCK_NEVER;  /* earliest sleeper */
+static uint64_t next_event = CLOCK_NEVER;   /* what the device is programmed for */
+static spinlock_t clock_lock = SPINLOCK_UNLOCKED;
+
+static void clock_softirq(void);
+
+/*
+ * div64_32
+ *   DESCRIPTION: 64 by 32 bit division without libgcc
+ *   INPUTS: n -- dividend
+ *           d -- divisor, not 0
+ *   OUTPUTS: none
+ *   RETURN VALUE: n / d
+ *   SIDE EFFECTS: none
+ */
+uint64_t div64_32(uint64_t n, uint32_t d){
+    uint32_t hi = (uint32_t)(n >> 32), lo = (uint32_t)n;
+    uint32_t q_hi = hi / d, r = hi % d, q_lo;
+
+    asm ("divl %4" : "=a"(q_lo), "=d"(r) : "a"(lo), "d"(r), "rm"(d));
+    return ((uint64_t)q_hi << 32) | q_lo;
+}
+
+/*
+ * mul_shift
+ *   DESCRIPTION: (c * mult) >> shift with a 96 bit intermediate
+ *   INPUTS: c -- cycles, mult / shift -- the scale
+ *   OUTPUTS: none
+ *   RETURN VALUE: the scaled value
+ *   SIDE EFFECTS: none
+ */
+static uint64_t mul_shift(uint64_t c, uint32_t mult, uint32_t shift){
+    return (((uint64_t)(uint32_t)(c >> 32) * mult) << (32 - shift))
+         + (((uint64_t)(uint32_t)c * mult) >> shift);
+}
+
+/*
+ * clock_init
+ *   DESCRIPTION: calibrate the TSC and the local APIC timer against PIT
+ *                channel 2, then pick the event device: the local APIC
+ *                timer if it is enabled, else the PIT in one-shot mode.
+ *                Without a TSC nothing can measure time between events, so
+ *                the PIT stays periodic
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called after smp_init with interrupts off
+ */
+void clock_init(void){
+    uint32_t eax, ebx, ecx, edx;
+    uint64_t t0, t1, m_ns, m_us;
+
+    open_softirq(SOFTIRQ_TIMER, clock_softirq);
+
+    asm volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    if (!(edx & CPUID_TSC))
+        return;
+
+    if (lapic_enabled)
+        lapic_timer_calibrate_begin();
+    t0 = rdtsc();
+    pit_ch2_wait_ms(CALIBRATE_MS);
+    t1 = rdtsc();
+    if (lapic_enabled)
+        lapic_timer_calibrate_end(CALIBRATE_MS);
+
+    t1 = div64_32(t1 - t0, CALIBRATE_MS);
+    if (t1 == 0 || t1 > 0xFFFFFFFFULL)
+        return;
+    tsc_khz = (uint32_t)t1;
+
+    /* a TSC of 1 MHz or less would need multipliers past 32 bits */
+    m_ns = div64_32(1000000ULL << NS_SHIFT, tsc_khz);
+    m_us = div64_32(1000ULL << US_SHIFT, tsc_khz);
+    if (m_ns > 0xFFFFFFFFULL || m_us > 0xFFFFFFFFULL){
+        klog("clock: tsc %d kHz too slow, staying on ticks\n", tsc_khz);
+        return;
+    }
+    mult_ns = (uint32_t)m_ns;
+    mult_us = (uint32_t)m_us;
+    base_us = (uint64_t)time_tick * TICK_US;
+    tsc_base = rdtsc();
+    tsc_ok = 1;
+
+    if (lapic_enabled && lapic_clock_event.max_us != 0){
+        disable_irq(PIT_IRQ);
+        clock_dev = &lapic_clock_event;
+    } else {
+        clock_dev = &pit_clock_event;
+    }
+    klog("clock: tsc %d kHz, events from %s\n", tsc_khz, clock_dev->name);
+
+    /* first event, the handler takes it from there */
+    next_event = clock_us() + TICK_US;
+    clock_dev->set_oneshot(TICK_US);
+}
+
+/*
+ * clock_ns / clock_us
+ *   DESCRIPTION: time since boot, monotonic
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: nanoseconds / microseconds; tick resolution without a TSC
+ *   SIDE EFFECTS: none
+ */
+uint64_t clock_ns(void){
+    if (!tsc_ok)
+        return (uint64_t)time_tick * TICK_US * 1000;
+    return base_us * 1000 + mul_shift(rdtsc() - tsc_base, mult_ns, NS_SHIFT);
+}
+
+uint64_t clock_us(void){
+    if (!tsc_ok)
+        return (uint64_t)time_tick * TICK_US;
+    return base_us + mul_shift(rdtsc() - tsc_base, mult_us, US_SHIFT);
+}
+
+/*
+ * clock_cyc2ns
+ *   DESCRIPTION: convert a TSC interval to nanoseconds
+ *   INPUTS: cyc -- the interval in cycles
+ *   OUTPUTS: none
+ *   RETURN VALUE: nanoseconds, 0 without a calibrated TSC
+ *   SIDE EFFECTS: none
+ */
+uint64_t clock_cyc2ns(uint64_t cyc){
+    if (!tsc_ok)
+        return 0;
+    return mul_shift(cyc, mult_ns, NS_SHIFT);
+}
+
+/*
+ * clock_tsc_khz
+ *   DESCRIPTION: the calibrated TSC frequency
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: kHz, 0 without a TSC
+ *   SIDE EFFECTS: none
+ */
+uint32_t clock_tsc_khz(void){
+    return tsc_ok ? tsc_khz : 0;
+}
+
+/*
+ * clock_ticks
+ *   DESCRIPTION: the current tick; time_tick is only brought up to date by
+ *                the clock interrupt, which an idle system skips
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: clock_us() in TICK_US units
+ *   SIDE EFFECTS: none
+ */
+uint32_t clock_ticks(void){
+    if (!tsc_ok)
+        return (uint32_t)time_tick;
+    return (uint32_t)div64_32(clock_us(), TICK_US);
+}
+
+/*
+ * clock_program
+ *   DESCRIPTION: program the event device for the earliest of the next
+ *                housekeeping tick (if anything needs one), the earliest
+ *                sleeper and the next tick the timer wheel needs, or stop
+ *                it if none is pending
+ *   INPUTS: now -- clock_us()
+ *           need_tick -- 1 if a tick is due in TICK_US, PROF_PERIOD_US
+ *                        while profiling
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: caller holds clock_lock with interrupts off
+ */
+static void clock_program(uint64_t now, int32_t need_tick){
+    uint64_t when = next_wakeup;
+    uint64_t delta;
+    uint32_t expires;
+
+    if (need_tick && now + (prof_active ? PROF_PERIOD_US : TICK_US) < when)
+        when = now + (prof_active ? PROF_PERIOD_US : TICK_US);
+    if (ktimer_next(&expires) && (uint64_t)expires * TICK_US < when)
+        when = (uint64_t)expires * TICK_US;
+    next_event = when;
+    if (when == CLOCK_NEVER){
+        clock_dev->stop();
+        return;
+    }
+
+    delta = (when > now) ? when - now : 0;
+    if (delta < CLOCK_MIN_DELAY_US)
+        delta = CLOCK_MIN_DELAY_US;
+    if (delta > clock_dev->max_us)
+        delta = clock_dev->max_us;
+    clock_dev->set_oneshot((uint32_t)delta);
+}
+
+/*
+ * clock_event_handler
+ *   DESCRIPTION: top half of the PIT or local APIC timer interrupt. Keeps
+ *                time_tick in step with the clock and leaves the rest to
+ *                clock_softirq; asks for a task switch if the scheduler is on
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called with interrupts off and the EOI already sent
+ */
+void clock_event_handler(void){
+    uint64_t now;
+
+    if (clock_dev == NULL){
+        time_tick++;
+    } else {
+        spin_lock(&clock_lock);
+        now = clock_us();
+        if (now >= next_event && next_event != CLOCK_NEVER)
+            irq_stat_timer_late((uint32_t)(now - next_event));
+        time_tick = (int)div64_32(now, TICK_US);
+        if (next_wakeup <= now)
+            next_wakeup = CLOCK_NEVER;
+        spin_unlock(&clock_lock);
+    }
+    raise_softirq(SOFTIRQ_TIMER);
+    if (ENABLE_SCHE)
+        need_resched = 1;
+}
+
+/*
+ * clock_softirq
+ *   DESCRIPTION: bottom half of the clock interrupt: fire the due timers,
+ *                rearm the device, then the per-tick work: video frames
+ *                and the mouse
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: runs with interrupts on
+ */
+static void clock_softirq(void){
+    uint32_t flags;
+    int32_t need_tick;
+
+    ktimer_run((uint32_t)time_tick);
+
+    /* the callbacks may add timers, program the device after them */
+    if (clock_dev != NULL){
+        spin_lock_irqsave(&clock_lock, flags);
+        need_tick = (video_status == PLAY_VID) || ENABLE_SCHE || mouse_pending() || prof_active;
+        clock_program(clock_us(), need_tick);
+        spin_unlock_irqrestore(&clock_lock, flags);
+    }
+
+    video_handler();
+    mouse_deferred_render();
+}
+
+/*
+ * clock_kick
+ *   DESCRIPTION: make sure a housekeeping tick comes within TICK_US, for
+ *                work that shows up while the device is stopped (a mouse
+ *                packet, a video starting, the profiler)
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may reprogram the event device
+ */
+void clock_kick(void){
+    uint32_t flags;
+    uint64_t now;
+
+    if (clock_dev == NULL)
+        return;
+    spin_lock_irqsave(&clock_lock, flags);
+    now = clock_us();
+    if (next_event > now + (prof_active ? PROF_PERIOD_US : TICK_US))
+        clock_program(now, 1);
+    spin_unlock_irqrestore(&clock_lock, flags);
+}
+
+/*
+ * clock_sleep_us
+ *   DESCRIPTION: wait at least us microseconds. With interrupts on the CPU
+ *                halts until the deadline event (or any other interrupt);
+ *                with interrupts off it spins on the clock
+ *   INPUTS: us -- the delay
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: leaves the interrupt flag as it found it
+ */
+void clock_sleep_us(uint32_t us){
+    uint64_t deadline = clock_us() + us;
+    uint32_t flags;
+
+    while (clock_us() < deadline){
+        cli_and_save(flags);
+        if (!(flags & EFLAGS_IF)){
+            restore_flags(flags);
+            continue;
+        }
+        if (clock_dev != NULL){
+            spin_lock(&clock_lock);
+            if (deadline < next_wakeup)
+                next_wakeup = deadline;
+            if (deadline < next_event)
+                clock_program(clock_us(), 0);
+            spin_unlock(&clock_lock);
+        }
+        if (clock_us() < deadline)
+            cpu_idle();
+        restore_flags(flags);
+    }
+}
+
+/*
+ * cpu_idle
+ *   DESCRIPTION: enable interrupts and halt until the next one; sti holds
+ *                them off for one more instruction, so a wakeup that is
+ *                already pending cannot slip in before the hlt
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: returns with interrupts on
+ */
+void cpu_idle(void){
+    irqoff_idle();
+    asm volatile ("sti; hlt" : : : "memory");
+}
@@ -0,0 +1,50 @@
+/* clock.h - Monotonic clock and clock event devices
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _CLOCK_H
+#define _CLOCK_H
+
+#include "types.h"
+#include "timer.h"
+
+#define TICK_US             (EXP_TIME * 1000)   /* period of the housekeeping tick */
+#define CLOCK_NEVER         0xFFFFFFFFFFFFFFFFULL
+#define CLOCK_MIN_DELAY_US  20                  /* shortest one-shot we program */
+#define CALIBRATE_MS        10                  /* PIT window for the TSC and APIC timer */
+#define EFLAGS_IF           0x200
+#define CPUID_TSC           0x10                /* CPUID.1:EDX bit 4 */
+
+/*
+ * A device that can raise one interrupt after a delay. The clock keeps at
+ * most one event programmed: the next housekeeping tick while something
+ * needs it (video, mouse, scheduler), or the earliest sleeper. With
+ * nothing pending the device is stopped and an idle CPU stays in hlt
+ * until some other interrupt comes in.
+ */
+typedef struct clock_event_t {
+    const char* name;
+    uint32_t max_us;                    /* longest delay set_oneshot accepts */
+    void (*set_oneshot)(uint32_t us);   /* one interrupt, us from now */
+    void (*stop)(void);                 /* no more interrupts */
+} clock_event_t;
+
+static inline uint64_t rdtsc(void){
+    uint64_t t;
+    asm volatile ("rdtsc" : "=A"(t));
+    return t;
+}
+
+void clock_init(void);
+uint64_t clock_ns(void);
+uint64_t clock_us(void);
+uint32_t clock_ticks(void);
+uint64_t clock_cyc2ns(uint64_t cyc);
+uint32_t clock_tsc_khz(void);
+uint64_t div64_32(uint64_t n, uint32_t d);
+void clock_event_handler(void);
+void clock_kick(void);
+void clock_sleep_us(uint32_t us);
+void cpu_idle(void);
+
+#endif /* _CLOCK_H */
@@ -62,6 +62,7 @@ int32_t desktop_open(const uint8_t* filename) {
     WARNING_PCS();
     cli();
 
+    mouse_init();       /* first time only, kept off the boot path */
     switch_to_modeX();
     // //stop schedule
     // disable_irq(PIT_IRQ);        
@@ -0,0 +1,200 @@
+#include "apic.h"
+#include "../lib.h"
+#include "../x86_desc.h"
+
+/* global section */
+int32_t lapic_enabled = 0;
+static volatile uint32_t* lapic_base = (volatile uint32_t*)LAPIC_DEFAULT_BASE;
+static volatile uint32_t* ioapic_base = (volatile uint32_t*)IOAPIC_DEFAULT_BASE;
+
+#define LAPIC_REG(off)      lapic_base[(off) >> 2]
+
+static uint32_t lapic_timer_per_ms = 0;    /* timer counts per ms at divide 16 */
+
+static void lapic_timer_set_oneshot(uint32_t us);
+static void lapic_timer_stop(void);
+
+clock_event_t lapic_clock_event = {
+    "lapic", 0, lapic_timer_set_oneshot, lapic_timer_stop
+};
+
+/*
+ * lapic_present
+ *   DESCRIPTION: ask CPUID whether this processor has a local APIC
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if it has one, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t lapic_present(void){
+    uint32_t eax, ebx, ecx, edx;
+
+    asm volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    return (edx & CPUID_APIC) != 0;
+}
+
+/*
+ * lapic_init
+ *   DESCRIPTION: software-enable the local APIC of the calling processor. On
+ *                the boot processor LINT0 is set up as the virtual wire of
+ *                the 8259, so the PIC keeps delivering the legacy IRQs
+ *   INPUTS: base -- physical address of the local APIC (from the MP table)
+ *           is_bsp -- 1 on the boot processor
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes local APIC registers
+ */
+void lapic_init(uint32_t base, int32_t is_bsp){
+    lapic_base = (volatile uint32_t*)base;
+
+    LAPIC_REG(LAPIC_SVR) = LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VEC;
+    LAPIC_REG(LAPIC_TPR) = 0;                               /* accept everything */
+    LAPIC_REG(LAPIC_LVT_TIMER) = LAPIC_LVT_MASKED;
+    LAPIC_REG(LAPIC_LVT_ERROR) = LAPIC_LVT_MASKED;
+    if (is_bsp){
+        LAPIC_REG(LAPIC_LVT_LINT0) = LAPIC_DM_EXTINT;
+        LAPIC_REG(LAPIC_LVT_LINT1) = LAPIC_DM_NMI;
+        lapic_enabled = 1;
+    } else {
+        LAPIC_REG(LAPIC_LVT_LINT0) = LAPIC_LVT_MASKED;
+        LAPIC_REG(LAPIC_LVT_LINT1) = LAPIC_LVT_MASKED;
+    }
+
+    /* the error status register must be written before it is read */
+    LAPIC_REG(LAPIC_ESR) = 0;
+    LAPIC_REG(LAPIC_ESR) = 0;
+    LAPIC_REG(LAPIC_EOI) = 0;
+}
+
+/*
+ * lapic_id
+ *   DESCRIPTION: get the APIC ID of the calling processor
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the APIC ID, 0 if the local APIC is not in use
+ *   SIDE EFFECTS: none
+ */
+uint32_t lapic_id(void){
+    if (!lapic_enabled)
+        return 0;
+    return LAPIC_REG(LAPIC_ID) >> 24;
+}
+
+/*
+ * lapic_eoi
+ *   DESCRIPTION: signal the end of an interrupt delivered by the local APIC
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void lapic_eoi(void){
+    LAPIC_REG(LAPIC_EOI) = 0;
+}
+
+/*
+ * ioapic_read / ioapic_write
+ *   DESCRIPTION: access an IOAPIC register through the select/window pair
+ */
+static uint32_t ioapic_read(uint32_t reg){
+    ioapic_base[IOAPIC_REGSEL >> 2] = reg;
+    return ioapic_base[IOAPIC_WIN >> 2];
+}
+
+static void ioapic_write(uint32_t reg, uint32_t val){
+    ioapic_base[IOAPIC_REGSEL >> 2] = reg;
+    ioapic_base[IOAPIC_WIN >> 2] = val;
+}
+
+/*
+ * ioapic_init
+ *   DESCRIPTION: mask every redirection entry of the IOAPIC. The legacy IRQs
+ *                stay on the 8259, which reaches the boot processor through
+ *                LINT0, so i8259.c and every send_eoi keep working
+ *   INPUTS: base -- physical address of the IOAPIC (from the MP table)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the redirection table
+ */
+void ioapic_init(uint32_t base){
+    uint32_t i, n_pins;
+
+    ioapic_base = (volatile uint32_t*)base;
+    n_pins = ((ioapic_read(IOAPIC_REG_VER) >> 16) & 0xFF) + 1;
+    for (i = 0; i < n_pins; i++){
+        ioapic_write(IOAPIC_REG_TABLE + 2 * i, IOAPIC_MASKED);
+        ioapic_write(IOAPIC_REG_TABLE + 2 * i + 1, 0);
+    }
+}
+
+/*
+ * lapic_timer_calibrate_begin / lapic_timer_calibrate_end
+ *   DESCRIPTION: let the timer count down from its maximum, masked, while
+ *                the caller waits ms milliseconds on the PIT, then derive
+ *                its rate. The rate is that of the bus clock, which is not
+ *                reported anywhere
+ *   INPUTS: ms -- length of the wait
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets lapic_clock_event.max_us
+ */
+void lapic_timer_calibrate_begin(void){
+    LAPIC_REG(LAPIC_TIMER_DIV) = LAPIC_TIMER_DIV16;
+    LAPIC_REG(LAPIC_LVT_TIMER) = LAPIC_LVT_MASKED | IRQ_Lapic_Timer;
+    LAPIC_REG(LAPIC_TIMER_INIT) = 0xFFFFFFFF;
+}
+
+void lapic_timer_calibrate_end(uint32_t ms){
+    uint32_t elapsed = 0xFFFFFFFF - LAPIC_REG(LAPIC_TIMER_CUR);
+
+    LAPIC_REG(LAPIC_TIMER_INIT) = 0;
+    lapic_timer_per_ms = elapsed / ms;
+    if (lapic_timer_per_ms == 0)
+        return;
+    /* keep us * per_ms within 32 bits in lapic_timer_set_oneshot */
+    lapic_clock_event.max_us = 0xFFFFFFFF / lapic_timer_per_ms;
+    if (lapic_clock_event.max_us > 1000000)
+        lapic_clock_event.max_us = 1000000;
+}
+
+/*
+ * lapic_timer_set_oneshot
+ *   DESCRIPTION: raise IRQ_Lapic_Timer once, us microseconds from now
+ *   INPUTS: us -- the delay, at most lapic_clock_event.max_us
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: a new count replaces the one in progress
+ */
+static void lapic_timer_set_oneshot(uint32_t us){
+    uint32_t count = us * lapic_timer_per_ms / 1000;
+
+    if (count == 0)
+        count = 1;
+    LAPIC_REG(LAPIC_LVT_TIMER) = IRQ_Lapic_Timer;      /* one-shot, unmasked */
+    LAPIC_REG(LAPIC_TIMER_INIT) = count;
+}
+
+/*
+ * lapic_timer_stop
+ *   DESCRIPTION: cancel the count in progress
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void lapic_timer_stop(void){
+    LAPIC_REG(LAPIC_TIMER_INIT) = 0;
+}
+
+/*
+ * lapic_timer_handler
+ *   DESCRIPTION: IRQ_Lapic_Timer, hand the event to the clock
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: see clock_event_handler
+ */
+void lapic_timer_handler(void){
+    lapic_eoi();
+    clock_event_handler();
+}
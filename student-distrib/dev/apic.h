@@ -0,0 +1,61 @@
+#ifndef _APIC_H
+#define _APIC_H
+
+#include "../types.h"
+#include "../clock.h"
+
+/* Default physical addresses, both live in the 4MB page at APIC_PD_IDX */
+#define LAPIC_DEFAULT_BASE  0xFEE00000
+#define IOAPIC_DEFAULT_BASE 0xFEC00000
+#define APIC_WINDOW_START   0xFEC00000
+#define APIC_WINDOW_END     0xFF000000
+
+/* Local APIC registers (byte offsets) */
+#define LAPIC_ID            0x020
+#define LAPIC_VER           0x030
+#define LAPIC_TPR           0x080
+#define LAPIC_EOI           0x0B0
+#define LAPIC_SVR           0x0F0
+#define LAPIC_ESR           0x280
+#define LAPIC_ICR_LO        0x300
+#define LAPIC_ICR_HI        0x310
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_LVT_LINT0     0x350
+#define LAPIC_LVT_LINT1     0x360
+#define LAPIC_LVT_ERROR     0x370
+#define LAPIC_TIMER_INIT    0x380
+#define LAPIC_TIMER_CUR     0x390
+#define LAPIC_TIMER_DIV     0x3E0
+
+#define LAPIC_SVR_ENABLE    0x100
+#define LAPIC_SPURIOUS_VEC  0xFF       /* low 4 bits must be 1 on old APICs */
+#define LAPIC_LVT_MASKED    0x10000
+#define LAPIC_DM_EXTINT     0x700       /* LINT0 as the 8259 virtual wire */
+#define LAPIC_DM_NMI        0x400
+#define LAPIC_TIMER_DIV16   0x3
+
+/* IOAPIC registers, reached through the select/window pair */
+#define IOAPIC_REGSEL       0x00
+#define IOAPIC_WIN          0x10
+#define IOAPIC_REG_ID       0x00
+#define IOAPIC_REG_VER      0x01
+#define IOAPIC_REG_TABLE    0x10        /* two 32-bit registers per pin */
+#define IOAPIC_MASKED       0x10000
+
+#define CPUID_APIC          (1 << 9)
+
+/* 1 once lapic_init has enabled the local APIC of the boot processor */
+extern int32_t lapic_enabled;
+/* one-shot clock event on IRQ_Lapic_Timer, max_us is 0 until calibrated */
+extern clock_event_t lapic_clock_event;
+
+int32_t lapic_present(void);
+void lapic_init(uint32_t base, int32_t is_bsp);
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+void ioapic_init(uint32_t base);
+void lapic_timer_calibrate_begin(void);
+void lapic_timer_calibrate_end(uint32_t ms);
+void lapic_timer_handler(void);
+
+#endif
@@ -0,0 +1,489 @@
+#include "ata.h"
+#include "pci.h"
+#include "uart.h"
+#include "../lib.h"
+#include "../i8259.h"
+#include "../clock.h"
+#include "../ktimer.h"
+#include "../softirq.h"
+#include "../debug.h"
+
+/* global section */
+ata_drive_t ata_drives[ATA_MAX_DRIVES];
+
+static uint16_t bm_base = 0;                /* bus master registers, 0: PIO only */
+static prd_t prdt[ATA_MAX_PRD] __attribute__((aligned(sizeof(prd_t) * ATA_MAX_PRD)));
+static volatile int32_t ata_busy = 0;       /* a command is in flight */
+static volatile int32_t dma_active = 0;
+static volatile int32_t dma_done = 0;
+static volatile uint8_t dma_bm_status, dma_ata_status;
+static ktimer_t dma_timer;                  /* wakes a DMA wait whose IRQ never came */
+static void (*dma_async)(int32_t ret);      /* completion of an ata_read_async, NULL otherwise */
+static int32_t dma_async_drive;
+
+/*
+ * insw / outsw
+ *   DESCRIPTION: move count words between a buffer and the data port
+ *   INPUTS: port -- the port
+ *           buf -- the buffer
+ *           count -- words
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static inline void insw(uint16_t port, void* buf, uint32_t count){
+    asm volatile ("rep insw" : "+D"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
+static inline void outsw(uint16_t port, const void* buf, uint32_t count){
+    asm volatile ("rep outsw" : "+S"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
+/*
+ * ata_select
+ *   DESCRIPTION: select a drive and the top bits of an LBA, then give it the
+ *                400ns the spec asks for by reading the alternate status
+ *   INPUTS: drive -- 0 or 1
+ *           lba -- the address
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void ata_select(int32_t drive, uint32_t lba){
+    int32_t i;
+
+    outb(ATA_DRIVE_LBA | (drive << 4) | ((lba >> 24) & 0x0F), ATA_IO_BASE + ATA_REG_DRIVE);
+    for (i = 0; i < 4; i++)
+        inb(ATA_CTRL_BASE);
+}
+
+/*
+ * ata_wait
+ *   DESCRIPTION: poll the status until BSY is clear and the bits in want
+ *                are set, or the drive reports an error
+ *   INPUTS: want -- e.g. ATA_SR_DRQ, or 0 for not busy
+ *   OUTPUTS: none
+ *   RETURN VALUE: the status, -1 on an error or timeout
+ *   SIDE EFFECTS: none
+ */
+static int32_t ata_wait(uint8_t want){
+    int32_t spins = ATA_TIMEOUT;
+    uint8_t st;
+
+    while (spins-- > 0){
+        st = inb(ATA_IO_BASE + ATA_REG_STATUS);
+        if (st & ATA_SR_BSY)
+            continue;
+        if (st & (ATA_SR_ERR | ATA_SR_DF))
+            return -1;
+        if ((st & want) == want)
+            return st;
+    }
+    return -1;
+}
+
+/*
+ * ata_identify
+ *   DESCRIPTION: ask a drive for its capacity and model
+ *   INPUTS: drive -- 0 or 1
+ *   OUTPUTS: ata_drives[drive]
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none, present stays 0 for ATAPI or no drive
+ */
+static void ata_identify(int32_t drive){
+    static uint16_t id[ATA_SECTOR_SIZE / 2];
+    ata_drive_t* d = &ata_drives[drive];
+    uint8_t st;
+    int32_t i;
+
+    ata_select(drive, 0);
+    outb(0, ATA_IO_BASE + ATA_REG_SECCOUNT);
+    outb(0, ATA_IO_BASE + ATA_REG_LBA0);
+    outb(0, ATA_IO_BASE + ATA_REG_LBA1);
+    outb(0, ATA_IO_BASE + ATA_REG_LBA2);
+    outb(ATA_CMD_IDENTIFY, ATA_IO_BASE + ATA_REG_COMMAND);
+
+    st = inb(ATA_IO_BASE + ATA_REG_STATUS);
+    if (st == 0 || st == 0xFF)
+        return;
+    if (ata_wait(0) < 0)
+        return;
+    /* packet devices put a signature here and do not take IDENTIFY */
+    if (inb(ATA_IO_BASE + ATA_REG_LBA1) || inb(ATA_IO_BASE + ATA_REG_LBA2))
+        return;
+    if (ata_wait(ATA_SR_DRQ) < 0)
+        return;
+    insw(ATA_IO_BASE + ATA_REG_DATA, id, ATA_SECTOR_SIZE / 2);
+
+    d->sectors = id[60] | ((uint32_t)id[61] << 16);
+    for (i = 0; i < 20; i++){
+        d->model[2 * i] = id[27 + i] >> 8;
+        d->model[2 * i + 1] = id[27 + i] & 0xFF;
+    }
+    for (i = 40; i > 0 && (d->model[i - 1] == ' ' || d->model[i - 1] == '\0'); i--)
+        ;
+    d->model[i] = '\0';
+    d->present = (d->sectors != 0);
+}
+
+/*
+ * ata_dma_end
+ *   DESCRIPTION: stop the bus master and tell how the DMA command went
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if it never completed or the drive or bus failed
+ *   SIDE EFFECTS: none
+ */
+static int32_t ata_dma_end(void){
+    outb(0, bm_base + BM_CMD);
+    if (!dma_done || (dma_bm_status & BM_STATUS_ERR) || (dma_ata_status & (ATA_SR_ERR | ATA_SR_DF)))
+        return -1;
+    return 0;
+}
+
+/*
+ * ata_async_end
+ *   DESCRIPTION: finish an ata_read_async: free the channel and call its
+ *                completion
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called with interrupts off, from IRQ 14 or dma_timer
+ */
+static void ata_async_end(void){
+    void (*done)(int32_t ret) = dma_async;
+    int32_t ret;
+
+    dma_async = NULL;
+    dma_active = 0;
+    ktimer_del(&dma_timer);
+    ret = ata_dma_end();
+    ata_busy = 0;
+    done(ret);
+}
+
+/*
+ * ata_dma_timeout
+ *   DESCRIPTION: dma_timer callback; a waiting ata_dma has already been
+ *                woken by the timer interrupt, an ata_read_async whose IRQ
+ *                never came is failed here
+ *   INPUTS: data -- unused
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: stops the bus master
+ */
+static void ata_dma_timeout(uint32_t data){
+    uint32_t flags;
+
+    cli_and_save(flags);
+    if (dma_async != NULL && dma_active){
+        klog("ata%d: DMA timed out\n", dma_async_drive);
+        ata_async_end();
+    }
+    restore_flags(flags);
+}
+
+/*
+ * ata_init
+ *   DESCRIPTION: find the bus master registers of the IDE controller on
+ *                PCI, identify both drives of the primary channel and turn
+ *                on IRQ 14
+ *   INPUTS: none
+ *   OUTPUTS: one log line per drive
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: enables bus mastering on the controller
+ */
+void ata_init(void){
+    uint32_t bdf, bar4;
+    int32_t i;
+
+    if (pci_find_class(0x01, 0x01, &bdf) == 0){
+        bar4 = pci_read32(bdf, PCI_BAR4);
+        if (bar4 & 1){
+            bm_base = bar4 & 0xFFFC;
+            pci_write32(bdf, PCI_COMMAND,
+                        pci_read32(bdf, PCI_COMMAND) | PCI_CMD_IO | PCI_CMD_MASTER);
+        }
+    }
+
+    ktimer_init(&dma_timer, ata_dma_timeout, 0);
+
+    /* nothing on the channel: the bus floats high */
+    if (inb(ATA_IO_BASE + ATA_REG_STATUS) == 0xFF)
+        return;
+    outb(0, ATA_CTRL_BASE);
+    for (i = 0; i < ATA_MAX_DRIVES; i++){
+        ata_identify(i);
+        if (ata_drives[i].present)
+            klog("ata%d: %s, %d sectors, %s\n", i, ata_drives[i].model,
+                 ata_drives[i].sectors, bm_base ? "DMA" : "PIO");
+    }
+    enable_irq(ATA_IRQ);
+}
+
+/*
+ * ata_handler
+ *   DESCRIPTION: IRQ 14: acknowledge the drive and finish a DMA transfer
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sends EOI
+ */
+void ata_handler(void){
+    uint8_t bm = bm_base ? inb(bm_base + BM_STATUS) : 0;
+    uint8_t st = inb(ATA_IO_BASE + ATA_REG_STATUS);
+
+    if (dma_active && (bm & BM_STATUS_IRQ)){
+        outb(bm | BM_STATUS_IRQ | BM_STATUS_ERR, bm_base + BM_STATUS);
+        dma_bm_status = bm;
+        dma_ata_status = st;
+        dma_active = 0;
+        dma_done = 1;
+        if (dma_async != NULL)
+            ata_async_end();
+    }
+    send_eoi(ATA_IRQ);
+}
+
+/*
+ * ata_poll
+ *   DESCRIPTION: finish a DMA command whose IRQ cannot come in because the
+ *                caller runs with interrupts off
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may call the completion of an ata_read_async
+ */
+void ata_poll(void){
+    uint32_t flags;
+
+    cli_and_save(flags);
+    if (dma_active && (inb(bm_base + BM_STATUS) & BM_STATUS_IRQ))
+        ata_handler();
+    restore_flags(flags);
+}
+
+/*
+ * ata_setup
+ *   DESCRIPTION: load the task file for a command on n sectors
+ *   INPUTS: drive / lba / n -- where and how much
+ *           cmd -- the command
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: starts the command
+ */
+static void ata_setup(int32_t drive, uint32_t lba, uint32_t n, uint8_t cmd){
+    ata_select(drive, lba);
+    outb(n & 0xFF, ATA_IO_BASE + ATA_REG_SECCOUNT);     /* 0 is 256 */
+    outb(lba & 0xFF, ATA_IO_BASE + ATA_REG_LBA0);
+    outb((lba >> 8) & 0xFF, ATA_IO_BASE + ATA_REG_LBA1);
+    outb((lba >> 16) & 0xFF, ATA_IO_BASE + ATA_REG_LBA2);
+    outb(cmd, ATA_IO_BASE + ATA_REG_COMMAND);
+}
+
+/*
+ * ata_pio
+ *   DESCRIPTION: polled transfer, for a controller without bus mastering
+ *   INPUTS: as ata_rw
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 on a drive error
+ *   SIDE EFFECTS: none
+ */
+static int32_t ata_pio(int32_t drive, uint32_t lba, uint8_t** bufs, uint32_t n_bufs,
+                       uint32_t sect_per_buf, int32_t write){
+    uint32_t b, s;
+
+    ata_setup(drive, lba, n_bufs * sect_per_buf, write ? ATA_CMD_WRITE_PIO : ATA_CMD_READ_PIO);
+    for (b = 0; b < n_bufs; b++){
+        for (s = 0; s < sect_per_buf; s++){
+            if (ata_wait(ATA_SR_DRQ) < 0)
+                return -1;
+            if (write)
+                outsw(ATA_IO_BASE + ATA_REG_DATA, bufs[b] + s * ATA_SECTOR_SIZE, ATA_SECTOR_SIZE / 2);
+            else
+                insw(ATA_IO_BASE + ATA_REG_DATA, bufs[b] + s * ATA_SECTOR_SIZE, ATA_SECTOR_SIZE / 2);
+        }
+    }
+    if (write){
+        outb(ATA_CMD_FLUSH, ATA_IO_BASE + ATA_REG_COMMAND);
+        if (ata_wait(0) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * ata_dma_start
+ *   DESCRIPTION: load the PRD table and start a bus master transfer
+ *   INPUTS: as ata_rw
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called with interrupts off; IRQ 14 ends the command
+ */
+static void ata_dma_start(int32_t drive, uint32_t lba, uint8_t** bufs, uint32_t n_bufs,
+                          uint32_t sect_per_buf, int32_t write){
+    uint32_t b;
+
+    for (b = 0; b < n_bufs; b++){
+        prdt[b].addr = (uint32_t)bufs[b];
+        prdt[b].count = (uint16_t)(sect_per_buf * ATA_SECTOR_SIZE);
+        prdt[b].flags = (b == n_bufs - 1) ? PRD_EOT : 0;
+    }
+    outb(0, bm_base + BM_CMD);
+    outl((uint32_t)prdt, bm_base + BM_PRDT);
+    outb(write ? 0 : BM_CMD_TO_MEM, bm_base + BM_CMD);
+    outb(BM_STATUS_IRQ | BM_STATUS_ERR, bm_base + BM_STATUS);
+
+    dma_done = 0;
+    dma_active = 1;
+    ata_setup(drive, lba, n_bufs * sect_per_buf, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+    outb((write ? 0 : BM_CMD_TO_MEM) | BM_CMD_START, bm_base + BM_CMD);
+}
+
+/*
+ * ata_dma
+ *   DESCRIPTION: bus master transfer; halts until IRQ 14 if interrupts are
+ *                on, at most ATA_DMA_TIMEOUT_MS, polls the bus master status
+ *                otherwise. A write is followed by FLUSH CACHE
+ *   INPUTS: as ata_rw
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 on a drive or bus error, a timeout or a failed flush
+ *   SIDE EFFECTS: stops the bus master on a timeout
+ */
+static int32_t ata_dma(int32_t drive, uint32_t lba, uint8_t** bufs, uint32_t n_bufs,
+                       uint32_t sect_per_buf, int32_t write){
+    uint32_t flags, deadline;
+    int32_t spins = ATA_TIMEOUT;
+
+    cli_and_save(flags);
+    ata_dma_start(drive, lba, bufs, n_bufs, sect_per_buf, write);
+
+    if (flags & EFLAGS_IF){
+        deadline = clock_ticks() + MS_TO_TICKS(ATA_DMA_TIMEOUT_MS);
+        ktimer_add(&dma_timer, MS_TO_TICKS(ATA_DMA_TIMEOUT_MS));
+        while (!dma_done && (int32_t)(clock_ticks() - deadline) < 0){
+            cpu_idle();
+            cli();
+        }
+        ktimer_del(&dma_timer);
+        if (!dma_done)
+            klog("ata%d: DMA timed out\n", drive);
+    } else {
+        while (!dma_done && spins-- > 0)
+            if (inb(bm_base + BM_STATUS) & BM_STATUS_IRQ)
+                ata_handler();
+    }
+    dma_active = 0;
+    restore_flags(flags);
+
+    if (ata_dma_end() < 0)
+        return -1;
+    /* the drive may hold the data in its write cache, as in ata_pio */
+    if (write){
+        outb(ATA_CMD_FLUSH, ATA_IO_BASE + ATA_REG_COMMAND);
+        if (ata_wait(0) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * ata_check
+ *   DESCRIPTION: check the arguments of a transfer
+ *   INPUTS: as ata_rw
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if the drive is missing or the range is bad
+ *   SIDE EFFECTS: none
+ */
+static int32_t ata_check(int32_t drive, uint32_t lba, uint32_t n_bufs, uint32_t sect_per_buf){
+    return (drive < 0 || drive >= ATA_MAX_DRIVES || !ata_drives[drive].present
+            || n_bufs == 0 || n_bufs > ATA_MAX_PRD || sect_per_buf == 0
+            || n_bufs * sect_per_buf > ATA_MAX_SECTORS
+            || lba + n_bufs * sect_per_buf > ata_drives[drive].sectors) ? -1 : 0;
+}
+
+/*
+ * ata_rw
+ *   DESCRIPTION: read or write consecutive sectors, spread over n_bufs
+ *                buffers of sect_per_buf sectors each. The buffers must be
+ *                kernel memory (identity mapped) and a buffer must not
+ *                cross a 64 KB boundary, as for a page aligned 4 KB block
+ *   INPUTS: drive -- 0 or 1
+ *           lba -- first sector
+ *           bufs / n_bufs / sect_per_buf -- the buffers
+ *           write -- 1 to write
+ *   OUTPUTS: the data in the buffers for a read
+ *   RETURN VALUE: 0, -1 on a bad argument or I/O error, or when called
+ *                 from a softirq or tasklet
+ *   SIDE EFFECTS: one command at a time, others wait
+ */
+int32_t ata_rw(int32_t drive, uint32_t lba, uint8_t** bufs, uint32_t n_bufs,
+               uint32_t sect_per_buf, int32_t write){
+    uint32_t flags;
+    int32_t ret;
+    int32_t spins = ATA_TIMEOUT;
+
+    if (ata_check(drive, lba, n_bufs, sect_per_buf) < 0)
+        return -1;
+    /* waiting below halts in cpu_idle, which a softirq or tasklet must not */
+    ASSERT(!in_softirq());
+    if (in_softirq())
+        return -1;
+
+    while (1){
+        cli_and_save(flags);
+        if (!ata_busy)
+            break;
+        restore_flags(flags);
+        if (flags & EFLAGS_IF){
+            cpu_idle();
+        } else {
+            /* an ata_read_async is in flight and its IRQ cannot come in */
+            if (spins-- <= 0)
+                return -1;
+            ata_poll();
+        }
+    }
+    ata_busy = 1;
+    restore_flags(flags);
+
+    if (bm_base)
+        ret = ata_dma(drive, lba, bufs, n_bufs, sect_per_buf, write);
+    else
+        ret = ata_pio(drive, lba, bufs, n_bufs, sect_per_buf, write);
+
+    ata_busy = 0;
+    return ret;
+}
+
+/*
+ * ata_read_async
+ *   DESCRIPTION: start a bus master read and return at once; IRQ 14 calls
+ *                done when it ends, or dma_timer after ATA_DMA_TIMEOUT_MS.
+ *                This is how a softirq or tasklet reads the disk
+ *   INPUTS: as ata_rw
+ *           done -- completion, called with 0 or -1 and interrupts off
+ *   OUTPUTS: the data in the buffers, once done is called
+ *   RETURN VALUE: 0 if the read started, -1 on a bad argument, without a
+ *                 bus master or while another command is in flight
+ *   SIDE EFFECTS: ata_rw callers wait until it ends
+ */
+int32_t ata_read_async(int32_t drive, uint32_t lba, uint8_t** bufs, uint32_t n_bufs,
+                       uint32_t sect_per_buf, void (*done)(int32_t ret)){
+    uint32_t flags;
+
+    if (!bm_base || done == NULL || ata_check(drive, lba, n_bufs, sect_per_buf) < 0)
+        return -1;
+    cli_and_save(flags);
+    if (ata_busy){
+        restore_flags(flags);
+        return -1;
+    }
+    ata_busy = 1;
+    dma_async = done;
+    dma_async_drive = drive;
+    ata_dma_start(drive, lba, bufs, n_bufs, sect_per_buf, 0);
+    ktimer_add(&dma_timer, MS_TO_TICKS(ATA_DMA_TIMEOUT_MS));
+    restore_flags(flags);
+    return 0;
+}
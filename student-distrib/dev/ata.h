@@ -0,0 +1,80 @@
+#ifndef _ATA_H
+#define _ATA_H
+
+#include "../types.h"
+
+/* Primary channel, IRQ 14. Drive 0 is the master (QEMU -hda, the boot
+ * disk), drive 1 the slave (-hdb) */
+#define ATA_IO_BASE         0x1F0
+#define ATA_CTRL_BASE       0x3F6
+#define ATA_IRQ             14
+#define ATA_MAX_DRIVES      2
+
+/* Task file registers, offsets from ATA_IO_BASE */
+#define ATA_REG_DATA        0
+#define ATA_REG_ERROR       1
+#define ATA_REG_SECCOUNT    2
+#define ATA_REG_LBA0        3
+#define ATA_REG_LBA1        4
+#define ATA_REG_LBA2        5
+#define ATA_REG_DRIVE       6
+#define ATA_REG_STATUS      7       /* command on write */
+#define ATA_REG_COMMAND     7
+
+#define ATA_SR_BSY          0x80
+#define ATA_SR_DRDY         0x40
+#define ATA_SR_DF           0x20
+#define ATA_SR_DRQ          0x08
+#define ATA_SR_ERR          0x01
+
+#define ATA_CMD_READ_PIO    0x20
+#define ATA_CMD_WRITE_PIO   0x30
+#define ATA_CMD_READ_DMA    0xC8
+#define ATA_CMD_WRITE_DMA   0xCA
+#define ATA_CMD_FLUSH       0xE7
+#define ATA_CMD_IDENTIFY    0xEC
+
+#define ATA_DRIVE_LBA       0xE0    /* LBA mode, bits 24-27 of the LBA below */
+#define ATA_CTRL_NIEN       0x02
+
+/* Bus master IDE registers of the primary channel, offsets from BAR4 */
+#define BM_CMD              0
+#define BM_STATUS           2
+#define BM_PRDT             4
+#define BM_CMD_START        0x01
+#define BM_CMD_TO_MEM       0x08    /* a disk read */
+#define BM_STATUS_ERR       0x02
+#define BM_STATUS_IRQ       0x04
+
+#define ATA_SECTOR_SIZE     512
+#define ATA_MAX_SECTORS     256     /* per command, LBA28 */
+#define ATA_MAX_PRD         16      /* buffers per DMA command */
+#define PRD_EOT             0x8000
+#define ATA_TIMEOUT         1000000 /* status polls */
+#define ATA_DMA_TIMEOUT_MS  5000    /* for the IRQ of a DMA command */
+
+/* Physical region descriptor: one buffer of a DMA transfer, it must not
+ * cross a 64 KB boundary */
+typedef struct __attribute__((packed)) prd_t {
+    uint32_t addr;
+    uint16_t count;                 /* bytes, 0 means 64 KB */
+    uint16_t flags;                 /* PRD_EOT on the last one */
+} prd_t;
+
+typedef struct ata_drive_t {
+    int32_t present;
+    uint32_t sectors;               /* LBA28 capacity */
+    int8_t model[41];
+} ata_drive_t;
+
+extern ata_drive_t ata_drives[ATA_MAX_DRIVES];
+
+void ata_init(void);
+void ata_handler(void);
+void ata_poll(void);
+int32_t ata_rw(int32_t drive, uint32_t lba, uint8_t** bufs, uint32_t n_bufs,
+               uint32_t sect_per_buf, int32_t write);
+int32_t ata_read_async(int32_t drive, uint32_t lba, uint8_t** bufs, uint32_t n_bufs,
+                       uint32_t sect_per_buf, void (*done)(int32_t ret));
+
+#endif /* _ATA_H */
@@ -0,0 +1,57 @@
+#include "pci.h"
+#include "../lib.h"
+
+/*
+ * pci_read32 / pci_write32
+ *   DESCRIPTION: access a dword of a function's configuration space
+ *   INPUTS: bdf -- the function, PCI_BDF
+ *           off -- dword aligned offset
+ *           val -- the value to write
+ *   OUTPUTS: none
+ *   RETURN VALUE: the dword read, 0xFFFFFFFF if nothing is there
+ *   SIDE EFFECTS: none
+ */
+uint32_t pci_read32(uint32_t bdf, uint32_t off){
+    outl(PCI_ENABLE | bdf | (off & 0xFC), PCI_CONFIG_ADDR);
+    return inl(PCI_CONFIG_DATA);
+}
+
+void pci_write32(uint32_t bdf, uint32_t off, uint32_t val){
+    outl(PCI_ENABLE | bdf | (off & 0xFC), PCI_CONFIG_ADDR);
+    outl(val, PCI_CONFIG_DATA);
+}
+
+/*
+ * pci_find_class
+ *   DESCRIPTION: find the first function of a class and subclass
+ *   INPUTS: class / subclass -- e.g. 0x01 / 0x01 for an IDE controller
+ *           bdf -- gets the function
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if found, -1 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t pci_find_class(uint8_t class, uint8_t subclass, uint32_t* bdf){
+    uint32_t bus, dev, func, id, cls;
+
+    for (bus = 0; bus < PCI_MAX_BUS; bus++){
+        for (dev = 0; dev < PCI_MAX_DEV; dev++){
+            for (func = 0; func < PCI_MAX_FUNC; func++){
+                id = pci_read32(PCI_BDF(bus, dev, func), PCI_ID);
+                if ((id & 0xFFFF) == 0xFFFF){
+                    if (func == 0)
+                        break;
+                    continue;
+                }
+                cls = pci_read32(PCI_BDF(bus, dev, func), PCI_CLASS_REV);
+                if ((cls >> 24) == class && ((cls >> 16) & 0xFF) == subclass){
+                    *bdf = PCI_BDF(bus, dev, func);
+                    return 0;
+                }
+                /* single function devices answer on every function number */
+                if (func == 0 && !(pci_read32(PCI_BDF(bus, dev, 0), PCI_HEADER) & PCI_HEADER_MULTI))
+                    break;
+            }
+        }
+    }
+    return -1;
+}
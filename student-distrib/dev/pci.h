@@ -0,0 +1,32 @@
+#ifndef _PCI_H
+#define _PCI_H
+
+#include "../types.h"
+
+/* Configuration mechanism #1 */
+#define PCI_CONFIG_ADDR     0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+#define PCI_ENABLE          0x80000000
+#define PCI_MAX_BUS         8       /* buses scanned, plenty for QEMU */
+#define PCI_MAX_DEV         32
+#define PCI_MAX_FUNC        8
+
+/* Configuration space offsets */
+#define PCI_ID              0x00
+#define PCI_COMMAND         0x04
+#define PCI_CLASS_REV       0x08
+#define PCI_HEADER          0x0C
+#define PCI_BAR4            0x20
+
+#define PCI_CMD_IO          0x0001
+#define PCI_CMD_MASTER      0x0004
+#define PCI_HEADER_MULTI    0x00800000
+
+/* A function is named by its config address: bus << 16 | dev << 11 | func << 8 */
+#define PCI_BDF(bus, dev, func)  (((bus) << 16) | ((dev) << 11) | ((func) << 8))
+
+uint32_t pci_read32(uint32_t bdf, uint32_t off);
+void pci_write32(uint32_t bdf, uint32_t off, uint32_t val);
+int32_t pci_find_class(uint8_t class, uint8_t subclass, uint32_t* bdf);
+
+#endif /* _PCI_H */
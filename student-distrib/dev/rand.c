@@ -1,8 +1,11 @@
 #include "rand.h"
+#include "../clock.h"
 
 uint32_t rand_seed = 0; /* seed for generate random number */
 
 uint32_t rand(uint32_t input_seed, uint32_t maximum){
+    /* the RTC no longer stirs the seed 1024 times a second, the clock does */
+    rand_seed += (uint32_t)clock_ns();
     rand_seed = rand_seed+ input_seed * 1103515245 +12345;
 	return (uint32_t)(rand_seed) % (maximum+1); 
 }
@@ -3,16 +3,28 @@
 #include "../lib.h"
 #include "../file_sys.h"
 #include "../i8259.h"
+#include "../ktimer.h"
+#include "../softirq.h"
 
 /* Global Section */
 volatile uint32_t total_samples; /* the remained unload date */
 volatile uint32_t chunk_off;    /* index to-loaded data from the start */
 // volatile uint8_t play_music = 0;
-dentry_t music_dent;   
+static stream_t music_stream;
 volatile uint8_t DMA_ADDR[Chunk_Size*2];
 // #include "../timer.h"
 uint8_t CH_Page_Port[4] = {0x87, 0x83, 0x81, 0x82};
 uint8_t music_states = STOP;
+
+static note_t sound_queue[SOUND_QUEUE_SIZE];
+static uint32_t sound_head = 0;
+static uint32_t sound_count = 0;
+static int32_t sound_busy = 0;
+static ktimer_t sound_timer;
+static void sound_next(uint32_t data);
+static void sb16_refill(uint32_t data);
+static void sb16_fill(uint32_t offset, volatile uint8_t* dst, uint32_t length);
+static tasklet_t sb16_tasklet = {NULL, 0, sb16_refill, 0};
 /* ================== PC Speaker ================= */
 /* Adapted from https://wiki.osdev.org/PC_Speaker  */
 void play_sound(uint32_t nFrequence) {
@@ -39,12 +51,61 @@ void nosound() {
  }
 
  
-//Make a beep
-void beep(uint32_t fre, uint32_t wait) {\
- 	 play_sound(fre);
- 	 timer_wait(wait);
- 	 nosound();
- }
+/*
+ * sound_next
+ *   DESCRIPTION: speaker timer callback, start the next queued note and
+ *                arm the timer for its length; silence when none is left
+ *   INPUTS: data -- unused
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called from the clock interrupt, or from beep with
+ *                 interrupts off
+ */
+static void sound_next(uint32_t data) {
+    note_t note;
+
+    if (sound_count == 0) {
+        nosound();
+        sound_busy = 0;
+        return;
+    }
+    note = sound_queue[sound_head];
+    sound_head = (sound_head + 1) % SOUND_QUEUE_SIZE;
+    sound_count--;
+
+    if (note.fre != 0)
+        play_sound(note.fre);
+    else
+        nosound();
+    ktimer_add(&sound_timer, note.ticks);
+}
+
+/*
+ * beep
+ *   DESCRIPTION: queue a note on the PC speaker and return at once; notes
+ *                play back to back from the speaker timer
+ *   INPUTS: fre -- frequency in Hz, 0 for a rest
+ *           wait -- length in ticks
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the note is dropped if the queue is full
+ */
+void beep(uint32_t fre, uint32_t wait) {
+    uint32_t flags;
+
+    cli_and_save(flags);
+    if (sound_count < SOUND_QUEUE_SIZE) {
+        sound_queue[(sound_head + sound_count) % SOUND_QUEUE_SIZE].fre = fre;
+        sound_queue[(sound_head + sound_count) % SOUND_QUEUE_SIZE].ticks = wait;
+        sound_count++;
+    }
+    if (!sound_busy) {
+        sound_busy = 1;
+        ktimer_init(&sound_timer, sound_next, 0);
+        sound_next(0);
+    }
+    restore_flags(flags);
+}
 
 void little_star(){
     // DO();
@@ -67,7 +128,8 @@ void little_star(){
 
 void sound_player(int32_t address, int32_t sample_rate, int32_t length){
     // uint8_t tmp;
-    reset_DSP();
+    if (reset_DSP() == -1)
+        return;
     
     
     // Load sound data to memory
@@ -96,25 +158,38 @@ void sound_player(int32_t address, int32_t sample_rate, int32_t length){
 }
 
 
-void reset_DSP(){
-    uint32_t i = 0;
-    // Reset DSP
-    outb(1, DSP_Reset);
-    // asm volatile (
-    //     "movb $0x86, %%AH;"
-    //     "movw $0, %%CX;"
-    //     "movw $0xFFFF, %%DX;"
-    //     "int $0x15;"
-    //     : /* No output */
-    //     : /* No input */
-    //     : "eax", "ecx", "edx"
-    // );
-    while (++i <5000000){}
+/* reset_DSP
+ *  Description: reset the SB16 DSP and wait for it to answer; this is also
+ *               the probe for the card, which is only done when something
+ *               wants to play, and a card that never answered is not asked
+ *               again
+ *  Input: none
+ *  Output: none
+ *  Return: 0 if the DSP is ready, -1 if there is no card
+ *  Side Effect: resets the DSP
+ */
+int32_t reset_DSP(){
+    static int32_t dsp_absent = 0;
+    static int32_t dsp_seen = 0;
+    int32_t i;
+
+    if (dsp_absent)
+        return -1;
 
+    outb(1, DSP_Reset);
+    for (i = 0; i < DSP_RESET_HOLD; i++)
+        inb(0x80);
     outb(0, DSP_Reset);
 
-    while ((inb(DSP_Read_buf_status) & 0x80) == 0){}
-    while ((inb(DSP_Read) != 0xAA)){}
+    for (i = 0; i < DSP_TIMEOUT; i++){
+        if ((inb(DSP_Read_buf_status) & 0x80) && inb(DSP_Read) == DSP_READY){
+            dsp_seen = 1;
+            return 0;
+        }
+    }
+    if (!dsp_seen)
+        dsp_absent = 1;
+    return -1;
 }
 
 
@@ -224,6 +299,9 @@ void player(const uint8_t* music_name){
     if (music_states == PLAY){
         printf("Other music are still playing\n");
         return ;
+    }else if (reset_DSP() == -1){
+        printf("no sound card\n");
+        return ;
     }else {
         /* pause or stop could go on */
         chunk_off = 0;
@@ -232,15 +310,16 @@ void player(const uint8_t* music_name){
     }
     
 
-    /* Get file dentry */
-    if (read_dentry_by_name(music_name, &music_dent) == -1){
+    /* Get file, from the disk if it is there */
+    stream_close(&music_stream);
+    if (stream_open(music_name, &music_stream) == -1){
         printf("fail to find the music file\n");
         return ;
     }
 
     /* Get wave info */
-    wav_file_len = get_file_size(music_dent.idx_inode);
-    read_data(music_dent.idx_inode, 0, wav_info, 36);
+    wav_file_len = music_stream.length;
+    stream_read(&music_stream, 0, wav_info, 36);
     wav_samples = *(uint32_t*)(wav_info+4) - 36;
     sample_rate = *(uint32_t*)(wav_info+24);
     channels = *(uint16_t*)(wav_info+22);
@@ -262,17 +341,17 @@ void player(const uint8_t* music_name){
         chunk_off = 2;
         if (wav_samples > Chunk_Size * 2){
 
-            read_data(music_dent.idx_inode, 44, (uint8_t*)DMA_ADDR, Chunk_Size*2);
+            sb16_fill(0, DMA_ADDR, Chunk_Size*2);
             // read_data(music_dent.idx_inode, 44, (uint8_t*)tmp, Chunk_Size*2);
             // memcpy((uint8_t*)DMA_ADDR , tmp, 4096 );
             
         } 
         else {
-            read_data(music_dent.idx_inode, 44, (uint8_t*)DMA_ADDR, Chunk_Size);
+            sb16_fill(0, DMA_ADDR, Chunk_Size);
         }
     } 
     else{
-        read_data(music_dent.idx_inode, 44, (uint8_t*)DMA_ADDR, wav_samples);
+        sb16_fill(0, DMA_ADDR, wav_samples);
     }
 
     enable_irq(DSP_IRQ);
@@ -365,27 +444,54 @@ void _set_irq(){
 
 // int handler_number = 0;
 void sb16_handler(){
-    uint8_t tmp;
-    // printf("handler called %d:\n", handler_number);
-    // handler_number++;
+    /* acknowledge the DSP, the refill reads the file system */
     outb(0x82, DSP_Mixer);
-    // printf("Current 0x82 is %x\n", inb(DSP_Mixer_data));
-    /* handler called when played done a chunk */
-    tmp = inb(DSP_Read_buf_status);
-    // printf("tmp = %x\n", tmp);
+    inb(DSP_Read_buf_status);
+    send_eoi(DSP_IRQ);
+    tasklet_schedule(&sb16_tasklet);
+}
 
+/*
+ * sb16_fill
+ *   DESCRIPTION: load samples of the playing tune into DMA_ADDR; from the
+ *                tasklet, what the disk has not brought in yet is played
+ *                as silence rather than waited for
+ *   INPUTS: offset -- first sample
+ *           dst -- where in DMA_ADDR
+ *           length -- samples
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void sb16_fill(uint32_t offset, volatile uint8_t* dst, uint32_t length){
+    int32_t got = stream_read(&music_stream, 44 + offset, (uint8_t*)dst, length);
+
+    if (got < 0)
+        got = 0;
+    if ((uint32_t)got < length)
+        memset((uint8_t*)dst + got, SB16_SILENCE, length - got);
+}
+
+/*
+ * sb16_refill
+ *   DESCRIPTION: bottom half of sb16_handler: the DSP has finished a chunk
+ *                and plays the other half of DMA_ADDR, load the next chunk
+ *                into the half it just finished, or stop at the end
+ *   INPUTS: data -- unused
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: runs with interrupts on
+ */
+static void sb16_refill(uint32_t data){
     if (total_samples > Chunk_Size){
         /* the remaining part is more than 1 chunk */
         /* prepare next next chunk */
         if (total_samples > Chunk_Size * 2){
-            if (Chunk_Size != read_data(music_dent.idx_inode, 44 + Chunk_Size * chunk_off, (uint8_t*)(DMA_ADDR + Chunk_Size * (chunk_off % 2)), Chunk_Size)){
-                printf("read data fail\n");
-            }
-            // read_data(music_dent.idx_inode, 44 + Chunk_Size * chunk_off, (uint8_t*)(DMA_ADDR + Chunk_Size * (chunk_off % 2)), Chunk_Size);
+            sb16_fill(Chunk_Size * chunk_off, DMA_ADDR + Chunk_Size * (chunk_off % 2), Chunk_Size);
             chunk_off++;
         }
         else {
-            read_data(music_dent.idx_inode, 44 + Chunk_Size * chunk_off, (uint8_t*)(DMA_ADDR + Chunk_Size * (chunk_off % 2)), total_samples - Chunk_Size);
+            sb16_fill(Chunk_Size * chunk_off, DMA_ADDR + Chunk_Size * (chunk_off % 2), total_samples - Chunk_Size);
             chunk_off++;
         }
         total_samples -= Chunk_Size;
@@ -397,8 +503,8 @@ void sb16_handler(){
         disable_irq(DSP_IRQ); /* Turn off the irq */
         // play_music = 0;
         music_states = STOP;
+        stream_close(&music_stream);
     } 
-    send_eoi(DSP_IRQ);
     return ;
 }
 
@@ -414,6 +520,7 @@ void player_stop(){
     /* set end sb16 mode */
     outb(0xDA, DSP_Write);
     disable_irq(DSP_IRQ); /* Turn off the irq */
+    stream_close(&music_stream);
     printf("Music stoped\n");
 }
 
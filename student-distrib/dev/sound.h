@@ -7,13 +7,20 @@
 #define PCS_PORT 0x61
 #define WARNING_PCS() do{beep(700, 20);} while(0)
 
-#define beat 100     /* ticks length */
+#define beat 20      /* ticks length */
 #define gap (beat * 5 / 20)
 #define PITCH(Fre, P_Len) do{                   \
         beep(Fre, P_Len-gap);                   \
-        timer_wait(gap);                        \
+        beep(0, gap);                           \
  } while (0)
 
+/* Notes wait here for the speaker timer, a beep never blocks */
+#define SOUND_QUEUE_SIZE 32
+typedef struct note_t {
+    uint32_t fre;               /* 0 for a rest */
+    uint32_t ticks;
+} note_t;
+
 /* 
 C - do - 261.6HZ
 D - re - 293.6HZ
@@ -70,9 +77,13 @@ void little_star();
 #define AutoMode        0x58
 
 #define DSP_IRQ         0x05
+#define DSP_READY       0xAA    /* what the DSP reads back after a reset */
+#define DSP_RESET_HOLD  4       /* port 0x80 reads, the reset needs 3us */
+#define DSP_TIMEOUT     1000    /* status polls, the DSP answers in 100us */
 /* =============================== */
 // #define Chunk_Size 2048
 #define Chunk_Size 0x1000
+#define SB16_SILENCE    0x80    /* 8-bit unsigned samples */
 #define STOP 0
 #define PLAY 1
 #define PAUSE 2
@@ -82,7 +93,7 @@ void little_star();
 #define Turn_ON_SB16()  do{outb(0xD1, DSP_Write);} while (0)
 
 void sound_player();
-void reset_DSP();
+int32_t reset_DSP();
 void Program_DMA_8b(int8_t chan_num, uint32_t address, uint16_t length);
 void Set_Sample_Rate(int32_t sample_rate, int8_t input_b);
 void test_play_music();
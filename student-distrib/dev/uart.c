@@ -0,0 +1,363 @@
+#include "uart.h"
+#include "../lib.h"
+#include "../i8259.h"
+#include "../clock.h"
+#include "../spinlock.h"
+#include "../softirq.h"
+#include "../terminal.h"
+
+/* global section */
+static int32_t uart_ok = 0;         /* a UART answered */
+static int32_t uart_irq_on = 0;     /* the THRE interrupt drains tx_ring */
+
+/* head counts bytes put in, tail bytes taken out */
+static uint8_t tx_ring[UART_TX_RING];
+static uint32_t tx_head = 0, tx_tail = 0;
+static uint8_t rx_ring[UART_RX_RING];
+static volatile uint32_t rx_head = 0, rx_tail = 0;
+static spinlock_t uart_lock = SPINLOCK_UNLOCKED;
+
+/* Without an open ttyS0, COM1 is a second keyboard and screen for the
+ * displayed terminal, from the first byte received on */
+int32_t uart_console = 0;
+static int32_t tty_users = 0;       /* ttyS0 descriptors open */
+static int32_t rx_last_cr = 0;      /* the "\n" of a "\r\n" is dropped */
+static tasklet_t console_tasklet;
+static void console_tasklet_func(uint32_t data);
+
+/*
+ * uart_init
+ *   DESCRIPTION: set COM1 to UART_BAUD 8N1 with FIFOs and turn on its
+ *                receive and transmit-empty interrupts
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: output is dropped until this ran; call after i8259_init
+ */
+void uart_init(void){
+    uint16_t div = UART_CLOCK / UART_BAUD;
+
+    outb(0, COM1_BASE + UART_IER);
+    outb(UART_LCR_DLAB, COM1_BASE + UART_LCR);
+    outb(div & 0xFF, COM1_BASE + UART_DATA);
+    outb(div >> 8, COM1_BASE + UART_IER);
+    outb(UART_LCR_8N1, COM1_BASE + UART_LCR);
+    outb(UART_FCR_ENABLE | UART_FCR_TRIGGER_8, COM1_BASE + UART_FCR);
+
+    /* no UART reads back 0xFF */
+    if (inb(COM1_BASE + UART_LSR) == 0xFF)
+        return;
+    uart_ok = 1;
+    tasklet_init(&console_tasklet, console_tasklet_func, 0);
+
+    outb(UART_MCR_DTR_RTS | UART_MCR_OUT2, COM1_BASE + UART_MCR);
+    outb(UART_IER_RX | UART_IER_THRE, COM1_BASE + UART_IER);
+    uart_irq_on = 1;
+    enable_irq(COM1_IRQ);
+}
+
+/*
+ * uart_tx_fill
+ *   DESCRIPTION: move up to a FIFO's worth of tx_ring into the UART if its
+ *                transmitter is empty
+ *   INPUTS: none
+ *   OUTPUTS: bytes on COM1
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: caller holds uart_lock with interrupts off
+ */
+static void uart_tx_fill(void){
+    int32_t n;
+
+    if (!(inb(COM1_BASE + UART_LSR) & UART_LSR_THRE))
+        return;
+    for (n = 0; n < UART_FIFO_SIZE && tx_tail != tx_head; n++)
+        outb(tx_ring[tx_tail++ & (UART_TX_RING - 1)], COM1_BASE + UART_DATA);
+}
+
+/*
+ * uart_tx_wait
+ *   DESCRIPTION: poll until the transmitter is empty
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: spins at most UART_TX_SPINS polls
+ */
+static void uart_tx_wait(void){
+    int32_t spins = UART_TX_SPINS;
+
+    while (!(inb(COM1_BASE + UART_LSR) & UART_LSR_THRE) && --spins > 0)
+        ;
+}
+
+/*
+ * uart_queue
+ *   DESCRIPTION: put bytes in tx_ring and start the transmitter. When the
+ *                ring is full a caller with interrupts on halts until the
+ *                interrupt made room, one with interrupts off pushes a
+ *                FIFO's worth out itself
+ *   INPUTS: buf -- the bytes
+ *           n -- how many
+ *           text -- 1 to send "\n" as "\r\n"
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void uart_queue(const uint8_t* buf, uint32_t n, int32_t text){
+    uint32_t flags;
+    uint8_t c;
+    int32_t cr = 0;         /* "\r" of a "\n" went in, the "\n" is next */
+
+    if (!uart_ok)
+        return;
+    spin_lock_irqsave(&uart_lock, flags);
+    while (n > 0){
+        while (tx_head - tx_tail == UART_TX_RING){
+            if ((flags & EFLAGS_IF) && uart_irq_on){
+                spin_unlock_irqrestore(&uart_lock, flags);
+                cpu_idle();
+                spin_lock_irqsave(&uart_lock, flags);
+            } else {
+                uart_tx_wait();
+                uart_tx_fill();
+            }
+        }
+        c = *buf;
+        if (text && c == '\n' && !cr){
+            c = '\r';
+            cr = 1;
+        } else {
+            cr = 0;
+            buf++;
+            n--;
+        }
+        tx_ring[tx_head++ & (UART_TX_RING - 1)] = c;
+    }
+    uart_tx_fill();
+    spin_unlock_irqrestore(&uart_lock, flags);
+}
+
+/*
+ * uart_putc / uart_puts
+ *   DESCRIPTION: send text, "\n" goes out as "\r\n"
+ *   INPUTS: c -- a character / s -- a string
+ *   OUTPUTS: the text on COM1
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void uart_putc(uint8_t c){
+    uart_queue(&c, 1, 1);
+}
+
+void uart_puts(const int8_t* s){
+    uart_queue((const uint8_t*)s, strlen(s), 1);
+}
+
+/*
+ * uart_write
+ *   DESCRIPTION: send binary data unchanged
+ *   INPUTS: buf -- the data
+ *           n -- its length
+ *   OUTPUTS: the data on COM1
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void uart_write(const void* buf, uint32_t n){
+    uart_queue((const uint8_t*)buf, n, 0);
+}
+
+/*
+ * klog
+ *   DESCRIPTION: printf to the serial log; unlike printf it never touches
+ *                video memory, so it is cheap to call under load
+ *   INPUTS: format -- as for printf, and its arguments
+ *   OUTPUTS: the text on COM1
+ *   RETURN VALUE: bytes of the format consumed
+ *   SIDE EFFECTS: none
+ */
+int32_t klog(int8_t* format, ...){
+    return format_out(uart_putc, format, (int32_t*)&format + 1);
+}
+
+/*
+ * uart_rx
+ *   DESCRIPTION: take a received byte into rx_ring for ttyS0 and echo it;
+ *                backspace takes back the last byte of the line
+ *   INPUTS: c -- the byte
+ *   OUTPUTS: the echo
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called from uart_handler
+ */
+static void uart_rx(uint8_t c){
+    uint8_t last;
+
+    if (tty_users == 0){
+        uart_console = 1;
+        if (c == '\n' && rx_last_cr){
+            rx_last_cr = 0;
+            return;
+        }
+        rx_last_cr = (c == '\r');
+        if (rx_head - rx_tail < UART_RX_RING)
+            rx_ring[rx_head++ & (UART_RX_RING - 1)] = c;
+        tasklet_schedule(&console_tasklet);
+        return;
+    }
+    if (c == '\b' || c == 0x7F){
+        if (rx_head == rx_tail)
+            return;
+        last = rx_ring[(rx_head - 1) & (UART_RX_RING - 1)];
+        if (last == '\n' || tx_head - tx_tail > UART_TX_RING - 3)
+            return;
+        rx_head--;
+        tx_ring[tx_head++ & (UART_TX_RING - 1)] = '\b';
+        tx_ring[tx_head++ & (UART_TX_RING - 1)] = ' ';
+        tx_ring[tx_head++ & (UART_TX_RING - 1)] = '\b';
+        return;
+    }
+    if (c == '\r')
+        c = '\n';
+    /* keep the last slot for a newline so a full line can end */
+    if (rx_head - rx_tail >= UART_RX_RING - 1 && c != '\n')
+        return;
+    if (rx_head - rx_tail == UART_RX_RING)
+        return;
+    rx_ring[rx_head++ & (UART_RX_RING - 1)] = c;
+    if (tx_head - tx_tail <= UART_TX_RING - 2){
+        if (c == '\n')
+            tx_ring[tx_head++ & (UART_TX_RING - 1)] = '\r';
+        tx_ring[tx_head++ & (UART_TX_RING - 1)] = c;
+    }
+}
+
+/*
+ * console_tasklet_func
+ *   DESCRIPTION: bottom half of the serial console, type the received bytes
+ *                into the displayed terminal; it echoes them back through
+ *                the mirror in terminal.c
+ *   INPUTS: data -- unused
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: runs with interrupts on
+ */
+static void console_tasklet_func(uint32_t data){
+    uint8_t c;
+
+    while (rx_tail != rx_head){
+        c = rx_ring[rx_tail & (UART_RX_RING - 1)];
+        rx_tail++;
+        if (c == '\r')
+            c = '\n';
+        else if (c == 0x7F)
+            c = BCKSPACE;
+        line_buf_in(c);
+    }
+}
+
+/*
+ * uart_handler
+ *   DESCRIPTION: IRQ 4 top half: take received bytes and refill the
+ *                transmit FIFO until the UART has nothing pending
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sends EOI
+ */
+void uart_handler(void){
+    uint8_t iir;
+
+    spin_lock(&uart_lock);
+    while (!((iir = inb(COM1_BASE + UART_IIR)) & UART_IIR_NONE)){
+        switch (iir & UART_IIR_ID){
+            case UART_IIR_RX:
+            case UART_IIR_RX_TIMEOUT:
+                while (inb(COM1_BASE + UART_LSR) & UART_LSR_DR)
+                    uart_rx(inb(COM1_BASE + UART_DATA));
+                break;
+            case UART_IIR_LSR:
+                inb(COM1_BASE + UART_LSR);
+                break;
+            default:
+                break;
+        }
+        uart_tx_fill();
+    }
+    /* echoes queued by uart_rx */
+    uart_tx_fill();
+    spin_unlock(&uart_lock);
+    send_eoi(COM1_IRQ);
+}
+
+/*
+ * ttyS0_read
+ *   DESCRIPTION: read a line typed on the serial console, waiting for the
+ *                newline
+ *   INPUTS: fd -- ignored
+ *           buf -- where to copy
+ *           nbytes -- how many bytes at most
+ *   OUTPUTS: the line in buf, with its "\n" if it fits
+ *   RETURN VALUE: bytes copied, -1 on a bad argument
+ *   SIDE EFFECTS: halts while waiting
+ */
+int32_t ttyS0_read(int32_t fd, void* buf, int32_t nbytes){
+    uint8_t* out = (uint8_t*)buf;
+    uint32_t flags, i, n;
+    int32_t line = 0;
+
+    if (buf == NULL || nbytes < 0)
+        return -1;
+    while (1){
+        spin_lock_irqsave(&uart_lock, flags);
+        n = rx_head - rx_tail;
+        for (i = 0; i < n && !line; i++)
+            line = (rx_ring[(rx_tail + i) & (UART_RX_RING - 1)] == '\n');
+        if (line || i >= (uint32_t)nbytes)
+            break;
+        spin_unlock_irqrestore(&uart_lock, flags);
+        cpu_idle();
+    }
+    if (i > (uint32_t)nbytes)
+        i = nbytes;
+    for (n = 0; n < i; n++)
+        out[n] = rx_ring[rx_tail++ & (UART_RX_RING - 1)];
+    spin_unlock_irqrestore(&uart_lock, flags);
+    return i;
+}
+
+/*
+ * ttyS0_write
+ *   DESCRIPTION: write text to the serial console
+ *   INPUTS: fd -- ignored
+ *           buf -- the text
+ *           nbytes -- its length
+ *   OUTPUTS: the text on COM1
+ *   RETURN VALUE: nbytes, -1 on a bad argument
+ *   SIDE EFFECTS: none
+ */
+int32_t ttyS0_write(int32_t fd, const void* buf, int32_t nbytes){
+    if (buf == NULL || nbytes < 0)
+        return -1;
+    uart_queue((const uint8_t*)buf, nbytes, 1);
+    return nbytes;
+}
+
+/*
+ * ttyS0_open / ttyS0_close
+ *   DESCRIPTION: count the users; while one is open the received lines go
+ *                to ttyS0_read instead of the serial console
+ *   INPUTS: fname / fd -- ignored
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 without a UART
+ *   SIDE EFFECTS: none
+ */
+int32_t ttyS0_open(const uint8_t* fname){
+    if (!uart_ok)
+        return -1;
+    tty_users++;
+    return 0;
+}
+
+int32_t ttyS0_close(int32_t fd){
+    if (tty_users > 0)
+        tty_users--;
+    return 0;
+}
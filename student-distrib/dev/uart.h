@@ -0,0 +1,58 @@
+#ifndef _UART_H
+#define _UART_H
+
+#include "../types.h"
+
+/* 16550 UART on COM1, IRQ 4 */
+#define COM1_BASE           0x3F8
+#define COM1_IRQ            4
+#define UART_DATA           0       /* THR / RBR, DLL when DLAB is set */
+#define UART_IER            1       /* DLM when DLAB is set */
+#define UART_IIR            2       /* FCR on write */
+#define UART_FCR            2
+#define UART_LCR            3
+#define UART_MCR            4
+#define UART_LSR            5
+
+#define UART_LCR_8N1        0x03
+#define UART_LCR_DLAB       0x80
+#define UART_FCR_ENABLE     0x07    /* enable and clear both FIFOs, RX trigger at 1 byte */
+#define UART_FCR_TRIGGER_8  0x80    /* RX trigger at 8 bytes */
+#define UART_MCR_DTR_RTS    0x03
+#define UART_MCR_OUT2       0x08    /* routes the UART interrupt to the PIC */
+#define UART_IER_RX         0x01
+#define UART_IER_THRE       0x02
+#define UART_IIR_NONE       0x01    /* no interrupt pending */
+#define UART_IIR_ID         0x0E
+#define UART_IIR_THRE       0x02
+#define UART_IIR_RX         0x04
+#define UART_IIR_RX_TIMEOUT 0x0C
+#define UART_IIR_LSR        0x06
+#define UART_LSR_DR         0x01    /* data ready */
+#define UART_LSR_THRE       0x20    /* transmit holding register empty */
+
+#define UART_CLOCK          115200
+#define UART_BAUD           115200
+#define UART_FIFO_SIZE      16      /* bytes the transmitter takes per THRE */
+#define UART_TX_SPINS       100000  /* polls of THRE before giving up on a byte */
+
+/* Software rings in front of the FIFOs, powers of two */
+#define UART_TX_RING        4096
+#define UART_RX_RING        256
+
+extern int32_t uart_console;        /* COM1 drives the displayed terminal */
+
+void uart_init(void);
+void uart_handler(void);
+void uart_putc(uint8_t c);
+void uart_puts(const int8_t* s);
+void uart_write(const void* buf, uint32_t n);
+int32_t klog(int8_t* format, ...);
+
+/* The "ttyS0" special file, a line based console on COM1 */
+int32_t ttyS0_read(int32_t fd, void* buf, int32_t nbytes);
+int32_t ttyS0_write(int32_t fd, const void* buf, int32_t nbytes);
+int32_t ttyS0_open(const uint8_t* fname);
+int32_t ttyS0_close(int32_t fd);
+
+#endif /* _UART_H */
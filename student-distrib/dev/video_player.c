@@ -3,71 +3,387 @@
 #include "../ModeX.h"
 #include "../lib.h"
 #include "../paging.h"
+#include "../timer.h"
+#include "../clock.h"
 #include "../vedio.h"
+#include "uart.h"
+#include "ata.h"
+
+/* A slot for a frame read ahead of when it is shown */
+#define VID_SLOT_EMPTY      0       /* free, or its fill could not start */
+#define VID_SLOT_LOADING    1       /* coming in by DMA */
+#define VID_SLOT_READY      2
+#define VID_SLOT_FAILED     3       /* past the end of the file, or a disk error */
+
+typedef struct vid_slot_t {
+    volatile int32_t state;
+    uint32_t pos;       /* offset of the frame in the file */
+    uint32_t length;    /* bytes of the file from there on in the slot */
+    uint8_t* frame;     /* where they are */
+} vid_slot_t;
 
 /* global section */
-uint32_t frame_index; 
-dentry_t vid_dent;
+uint32_t frame_index;
 uint32_t vid_width, vid_height, frame_num, frame_rate, palette_num;
-uint8_t video_status = PLAY_VID;
+uint8_t video_status = STOP_VID;
 extern unsigned char palette_RGB_vedio[256][3];
+extern volatile int time_tick;
 int32_t debug_counter;
-unsigned char debug_buffer[320*18]; 
+unsigned char debug_buffer[320*18];
+
+static stream_t vid_stream;         /* the open video, on the disk if it is there */
+static uint32_t vid_compressed;     /* 1 if the file uses the RLE/delta codec */
+static uint32_t vid_start_tick;     /* time_tick when frame 0 was shown */
+static uint32_t vid_next_tick;      /* time_tick at which the next frame is due */
+static int32_t  vid_prev_dirty;     /* planes changed by the previous frame */
+
+/* current frame in plane order, also the reference for delta frames */
+static uint8_t vid_planes[VID_FRAME_SIZE];
+
+/*
+ * Frames are read one ahead into two slots: while the clock softirq shows
+ * the frame in one, the next comes into the other by DMA (stream_fetch),
+ * or is pointed at in place in the boot image (stream_map), so the
+ * softirq only decodes. A slot holds a whole raw frame, or enough of the
+ * file for the largest encoded frame.
+ */
+static vid_slot_t vid_slot[2];
+static uint8_t vid_slot_data[2][STREAM_FETCH_MAX] __attribute__((aligned(BLOCK_SIZE)));
+static uint32_t vid_cur;                    /* slot of the next frame to show */
+static vid_slot_t* volatile vid_loading;    /* slot a stream_fetch reads into */
+
+/*
+ * vid_decode_frame
+ *   DESCRIPTION: apply one encoded frame on top of vid_planes
+ *   INPUTS: ops -- the encoded ops of a frame
+ *           length -- number of bytes in ops
+ *   OUTPUTS: none
+ *   RETURN VALUE: bitmask of the planes that were written, -1 on a corrupt frame
+ *   SIDE EFFECTS: modifies vid_planes
+ */
+static int32_t vid_decode_frame(const uint8_t* ops, uint32_t length){
+    uint32_t in = 0;        /* index into ops */
+    uint32_t pos = 0;       /* pixel index into vid_planes */
+    uint32_t kind, count;
+    int32_t dirty = 0;
+
+    while (in < length){
+        kind = ops[in] >> 6;
+        count = (ops[in] & (VID_OP_MAX_COUNT - 1)) + 1;
+        in++;
+        if (kind == VID_OP_SKIP_LONG)
+            count *= VID_OP_MAX_COUNT;
+        if (pos + count > VID_FRAME_SIZE)
+            return -1;
+
+        switch (kind){
+            case VID_OP_SKIP:
+            case VID_OP_SKIP_LONG:
+                break;
+            case VID_OP_RUN:
+                if (in >= length)
+                    return -1;
+                memset(vid_planes + pos, ops[in], count);
+                in++;
+                break;
+            case VID_OP_LIT:
+                if (in + count > length)
+                    return -1;
+                memcpy(vid_planes + pos, ops + in, count);
+                in += count;
+                break;
+        }
+        if (kind == VID_OP_RUN || kind == VID_OP_LIT){
+            /* a run may cross a plane boundary, mark every plane it covers */
+            dirty |= (1 << (pos / VID_PLANE_SIZE)) | (1 << ((pos + count - 1) / VID_PLANE_SIZE));
+        }
+        pos += count;
+    }
+    return dirty;
+}
+
+/*
+ * vid_fetch_done
+ *   DESCRIPTION: completion of the stream_fetch into vid_loading
+ *   INPUTS: ret -- 0, -1 on a disk error
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called from IRQ 14
+ */
+static void vid_fetch_done(int32_t ret){
+    vid_loading->state = (ret == 0) ? VID_SLOT_READY : VID_SLOT_FAILED;
+    vid_loading = NULL;
+}
+
+/*
+ * vid_fill
+ *   DESCRIPTION: bring the frame at slot->pos into a slot: in place from
+ *                the boot image, by DMA from the disk, or else copied
+ *                through the buffer cache (a fragmented file, or a disk
+ *                without DMA)
+ *   INPUTS: slot -- the slot, pos set
+ *           wait -- 1 to copy it now, waiting for the disk if need be
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the slot ends up READY, LOADING, FAILED past the end of
+ *                 the file, or stays EMPTY to be tried again
+ */
+static void vid_fill(vid_slot_t* slot, int32_t wait){
+    uint8_t* data = vid_slot_data[slot - vid_slot];
+    uint32_t length, flags;
+    int32_t at, got;
 
+    if (slot->pos >= vid_stream.length){
+        slot->state = VID_SLOT_FAILED;
+        return;
+    }
+    length = vid_compressed ? sizeof(vid_frame_hdr_t) + VID_MAX_PAYLOAD : vid_width * vid_height;
+    if (length > vid_stream.length - slot->pos)
+        length = vid_stream.length - slot->pos;
+    slot->length = length;
 
+    if ((slot->frame = stream_map(&vid_stream, slot->pos, length)) != NULL){
+        slot->state = VID_SLOT_READY;
+        return;
+    }
+    if (!wait){
+        /* the IRQ must not see the slot before frame is set */
+        cli_and_save(flags);
+        at = stream_fetch(&vid_stream, slot->pos, length, data, vid_fetch_done);
+        if (at >= 0){
+            slot->frame = data + at;
+            slot->state = VID_SLOT_LOADING;
+            vid_loading = slot;
+        }
+        restore_flags(flags);
+        if (at >= 0)
+            return;
+    }
+    got = stream_read(&vid_stream, slot->pos, data, length);
+    slot->frame = data;
+    if (got == (int32_t)length)
+        slot->state = VID_SLOT_READY;
+    else if (got < 0 || wait)
+        slot->state = VID_SLOT_FAILED;
+}
 
+/*
+ * vid_frame_end
+ *   DESCRIPTION: where the frame after the one in a slot starts
+ *   INPUTS: slot -- a READY slot
+ *   OUTPUTS: none
+ *   RETURN VALUE: its offset in the file, -1 on a corrupt frame
+ *   SIDE EFFECTS: none
+ */
+static uint32_t vid_frame_end(const vid_slot_t* slot){
+    vid_frame_hdr_t hdr;
 
+    if (!vid_compressed)
+        return slot->pos + vid_width * vid_height;
+    if (slot->length < sizeof(hdr))
+        return (uint32_t)-1;
+    memcpy(&hdr, slot->frame, sizeof(hdr));
+    if (hdr.length > VID_MAX_PAYLOAD || hdr.length > slot->length - sizeof(hdr))
+        return (uint32_t)-1;
+    return slot->pos + sizeof(hdr) + hdr.length;
+}
+
+/*
+ * vid_prefetch
+ *   DESCRIPTION: keep the two slots busy: retry a fill of the next frame
+ *                that could not start, and once it is in, start the one
+ *                after it in the other slot
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void vid_prefetch(){
+    vid_slot_t* cur = &vid_slot[vid_cur];
+    vid_slot_t* next = &vid_slot[vid_cur ^ 1];
+    uint32_t end;
+
+    if (cur->state == VID_SLOT_EMPTY)
+        vid_fill(cur, 0);
+    if (cur->state == VID_SLOT_READY && next->state == VID_SLOT_EMPTY
+        && (end = vid_frame_end(cur)) != (uint32_t)-1){
+        next->pos = end;
+        vid_fill(next, 0);
+    }
+}
 
+/*
+ * vid_show
+ *   DESCRIPTION: decode and show the frame in a slot, then free the slot
+ *   INPUTS: slot -- a READY slot
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the frame is corrupt or cut short
+ *   SIDE EFFECTS: updates vid_planes and the video memory
+ */
+static int32_t vid_show(vid_slot_t* slot){
+    vid_frame_hdr_t hdr;
+    int32_t dirty;
+
+    slot->state = VID_SLOT_EMPTY;
+    if (!vid_compressed){
+        if (slot->length != vid_width * vid_height)
+            return -1;
+        refresh_mp4(slot->frame);
+        return 0;
+    }
+
+    if (vid_frame_end(slot) == (uint32_t)-1)
+        return -1;
+    memcpy(&hdr, slot->frame, sizeof(hdr));
+    if ((dirty = vid_decode_frame(slot->frame + sizeof(hdr), hdr.length)) == -1)
+        return -1;
+    if (hdr.type == VID_FRAME_KEY)
+        dirty = 0xF;
+
+    /*
+     * The back page still holds the frame before the previous one, so it
+     * misses the planes changed by the previous frame as well as ours.
+     */
+    refresh_mp4_planes(vid_planes, dirty | vid_prev_dirty);
+    vid_prev_dirty = dirty;
+    return 0;
+}
+
+/*
+ * vid_frame_ticks
+ *   DESCRIPTION: ticks from frame 0 to frame n; counting from the start
+ *                keeps the rounding from adding up when frame_rate does not
+ *                divide the tick rate
+ *   INPUTS: n -- frame index
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of PIT ticks
+ *   SIDE EFFECTS: none
+ */
+static uint32_t vid_frame_ticks(uint32_t n){
+    return (uint32_t)div64_32((uint64_t)n * 1000, EXP_TIME * frame_rate);
+}
+
+/*
+ * vid_report
+ *   DESCRIPTION: log the cycles per frame spent drawing the video that
+ *                just ended
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: clears the blit statistics
+ */
+static void vid_report(){
+    uint32_t frames, avg, max;
+
+    mp4_blit_stats(&frames, &avg, &max);
+    klog("video: %d frames, blit %d cycles avg %d max\n", frames, avg, max);
+}
+
+/*
+ * video_player
+ *   DESCRIPTION: open a video file, show its first frame and start playback;
+ *                falls back to the built-in picture if the file is missing
+ *   INPUTS: video_name -- name of the video file
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the palette and the video memory
+ */
 void video_player(const uint8_t* video_name){
+    uint8_t  vid_info_buf[VID_HDR_SIZE];
+    uint32_t hdr_size;
+    uint32_t blits;                 /* what the last video left, dropped */
+    int32_t spins;
+
     cli();
-    
-    uint32_t vid_file_len;
-    uint8_t  vid_info_buf[vid_buf_size];
-    // uint8_t  palette_buf[256*3];
-    
-    uint8_t tmp[320*182];
-
-    // if (read_dentry_by_name(video_name, &vid_dent) == -1){
-    //     printf("fail to find the video file\n");
-    //     return ;
-    // }
-
-    /* get video info */
-    vid_file_len = get_file_size(vid_dent.idx_inode);
-    read_data(vid_dent.idx_inode, 0, vid_info_buf, vid_buf_size);
-    vid_width = *(uint32_t*)vid_info_buf;
-    vid_height = *(uint32_t*)(vid_info_buf + 4);
-    frame_num = *(uint32_t*)(vid_info_buf + 8);
-    frame_rate = *(uint32_t*)(vid_info_buf + 12);
-    palette_num = *(uint32_t*)(vid_info_buf + 16);
-
-    // printf("Video width: %d\n", vid_width);
-    // printf("Video height: %d\n", vid_height);
-    // printf("Frame number: %d\n", frame_num);
-    // printf("Frame rate: %d\n", frame_rate);
-    // printf("Palette Entry: %d\n", palette_num);
-
-    //read_data(vid_dent.idx_inode, 20, (uint8_t*)palette_RGB_vedio, palette_num);
-    read_data(vid_dent.idx_inode, 20+palette_num, tmp, vid_width * vid_height);
+    video_status = STOP_VID;
+    /* the last video may still have a frame coming in by DMA */
+    for (spins = ATA_TIMEOUT; vid_loading != NULL && spins > 0; spins--)
+        ata_poll();
+    if (vid_loading != NULL)
+        return ;
+    stream_close(&vid_stream);
+
+    if (stream_open(video_name, &vid_stream) == -1
+        || stream_read(&vid_stream, 0, vid_info_buf, VID_HDR_SIZE) != VID_HDR_SIZE){
+        fill_palette_vedio();
+        refresh_mp4(vedio_data);
+        return ;
+    }
+
+    /* get video info, the compressed format has a magic word in front */
+    vid_compressed = (*(uint32_t*)vid_info_buf == VID_MAGIC);
+    hdr_size = vid_compressed ? VID_HDR_SIZE : vid_buf_size;
+    vid_width = *(uint32_t*)(vid_info_buf + hdr_size - 20);
+    vid_height = *(uint32_t*)(vid_info_buf + hdr_size - 16);
+    frame_num = *(uint32_t*)(vid_info_buf + hdr_size - 12);
+    frame_rate = *(uint32_t*)(vid_info_buf + hdr_size - 8);
+    palette_num = *(uint32_t*)(vid_info_buf + hdr_size - 4);
+
+    if (vid_width != VID_X_DIM || vid_height != VID_Y_DIM || frame_rate == 0){
+        printf("unsupported video format\n");
+        return ;
+    }
+
+    //read_data(vid_dent.idx_inode, hdr_size, (uint8_t*)palette_RGB_vedio, palette_num * 3);
     fill_palette_vedio();
-    //refresh_mp4(debug_buffer);
 
-    //refresh_mp4(debug_counter+_4KB_);
-    //refresh_mp4(tmp);
-    refresh_mp4(vedio_data);
+    vid_prev_dirty = 0xF;
+    mp4_blit_stats(&blits, &blits, &blits);     /* count from frame 0 on */
+    frame_index = 0;
+    vid_cur = 0;
+    vid_slot[0].pos = hdr_size + palette_num * 3;
+    vid_slot[1].state = VID_SLOT_EMPTY;
+    vid_fill(&vid_slot[0], 1);
+    if (vid_slot[0].state != VID_SLOT_READY || vid_show(&vid_slot[0]) == -1)
+        return ;
 
     frame_index = 1; /* the next to be displayed  */
+    vid_slot[1].pos = vid_frame_end(&vid_slot[0]);
+    vid_cur = 1;
+    vid_fill(&vid_slot[1], 0);
+    vid_start_tick = time_tick;
+    vid_next_tick = vid_start_tick + vid_frame_ticks(frame_index);
     video_status = PLAY_VID;
+    clock_kick();
     return ;
 }
 
-/* update the video frame by interrupt */
+/*
+ * video_handler
+ *   DESCRIPTION: called on every PIT tick from the clock softirq, shows the
+ *                next frame once it is due and keeps the one after it
+ *                coming in
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: stops playback at the end of the file; a frame the
+ *                 disk has not brought in yet is shown late
+ */
 void video_handler(){
-    uint8_t tmp[320*182];
-    /*  */
-    if (frame_index < frame_num){
-        read_data(vid_dent.idx_inode, 20+palette_num, tmp, vid_width * vid_height);
-        frame_index++;
+    vid_slot_t* slot;
+    uint32_t end;
+
+    if (video_status != PLAY_VID)
+        return ;
+    vid_prefetch();
+    if ((int)(time_tick - vid_next_tick) < 0)
+        return ;
+
+    slot = &vid_slot[vid_cur];
+    if (frame_index < frame_num && (slot->state == VID_SLOT_EMPTY || slot->state == VID_SLOT_LOADING))
+        return ;
+    if (frame_index >= frame_num || slot->state != VID_SLOT_READY
+        || (end = vid_frame_end(slot)) == (uint32_t)-1 || vid_show(slot) == -1){
+        video_status = STOP_VID;
+        stream_close(&vid_stream);
+        vid_report();
+        return ;
     }
+    vid_cur ^= 1;
+    /* a fill of the next frame that has not started yet starts from here */
+    if (vid_slot[vid_cur].state == VID_SLOT_EMPTY)
+        vid_slot[vid_cur].pos = end;
+    frame_index++;
+    vid_next_tick = vid_start_tick + vid_frame_ticks(frame_index);
+    vid_prefetch();
 }
-
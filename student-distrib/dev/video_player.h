@@ -1,10 +1,55 @@
+#ifndef _VIDEO_PLAYER_H
+#define _VIDEO_PLAYER_H
+
 #define vid_buf_size 20
 #define IF_VIEW_VID_INFO 1
 #include "../types.h"
 
-#define RICKROLL_VID "rickroll_inone.mp4" 
+#define RICKROLL_VID "rickroll_inone.mp4"
 #define PLAY_VID 1
 #define STOP_VID 0
 
+/* Video geometry (the mp4 area below the status bar) */
+#define VID_X_DIM       320
+#define VID_Y_DIM       182
+#define VID_PLANE_SIZE  (VID_X_DIM / 4 * VID_Y_DIM)     /* 14560 */
+#define VID_FRAME_SIZE  (VID_PLANE_SIZE * 4)
+
+/*
+ * Compressed video format (produced by tools/videnc.c)
+ *   header : magic, width, height, frame_num, frame_rate, palette_num (6 x uint32)
+ *   palette: palette_num * 3 bytes
+ *   frames : vid_frame_hdr_t followed by `length` bytes of ops
+ * Pixels are addressed plane by plane (plane p holds x&3 == p, the same
+ * layout refresh_mp4 hands to copy_mp4), so decoding writes straight into
+ * the planar frame and we know which planes a frame touched.
+ * Each op byte is (kind << 6) | (count - 1):
+ *   SKIP      -- leave count pixels as in the previous frame
+ *   RUN       -- next byte is a color, repeat it count times
+ *   LIT       -- next count bytes are copied as-is
+ *   SKIP_LONG -- leave count * 64 pixels as in the previous frame
+ * A keyframe only uses RUN/LIT and covers the whole frame.
+ */
+#define VID_MAGIC           0x31564C52  /* "RLV1" */
+#define VID_HDR_SIZE        24
+#define VID_FRAME_KEY       0
+#define VID_FRAME_DELTA     1
+#define VID_OP_SKIP         0
+#define VID_OP_RUN          1
+#define VID_OP_LIT          2
+#define VID_OP_SKIP_LONG    3
+#define VID_OP_MAX_COUNT    64
+/* worst case: all literals, one op byte per 64 pixels */
+#define VID_MAX_PAYLOAD     (VID_FRAME_SIZE + VID_FRAME_SIZE / VID_OP_MAX_COUNT + 1)
+
+typedef struct vid_frame_hdr_t {
+    uint32_t type;      /* VID_FRAME_KEY or VID_FRAME_DELTA */
+    uint32_t length;    /* bytes of ops following the header */
+} vid_frame_hdr_t;
+
+extern uint8_t video_status;
+
 void video_player(const uint8_t* video_name);
 void video_handler();
+
+#endif
@@ -0,0 +1,144 @@
+/* devfs.c - Device files, mounted at /dev
+ * vim:ts=4 noexpandtab
+ */
+
+#include "devfs.h"
+#include "vfs.h"
+#include "lib.h"
+#include "rtc.h"
+#include "terminal.h"
+#include "irqstat.h"
+#include "./dev/uart.h"
+#include "./dev/sound.h"
+
+static int32_t audio_write(int32_t fd, const void* buf, int32_t nbytes);
+static int32_t audio_open(const uint8_t* fname);
+static int32_t audio_close(int32_t fd);
+
+/* Operations of the nodes, in fop_t order: read, write, open, close */
+static fop_t term_fops = { terminal_read, terminal_write, terminal_open, terminal_close };
+static fop_t audio_fops = { badread, audio_write, audio_open, audio_close };
+static fop_t irqstat_fops = { irqstat_read, irqstat_write, irqstat_open, irqstat_close };
+static fop_t ttyS0_fops = { ttyS0_read, ttyS0_write, ttyS0_open, ttyS0_close };
+
+typedef struct devfs_node_t {
+    const int8_t* name;
+    fop_t* fops;
+} devfs_node_t;
+
+/* ino i + 1 is node i */
+static devfs_node_t devfs_nodes[] = {
+    { "rtc", &rtc_fop_t },
+    { "terminal", &term_fops },
+    { "audio", &audio_fops },
+    { "irqstat", &irqstat_fops },
+    { "ttyS0", &ttyS0_fops },
+};
+#define N_DEVFS_NODES (sizeof(devfs_nodes) / sizeof(devfs_nodes[0]))
+
+/*
+ * devfs_lookup
+ *   DESCRIPTION: find a node of /dev
+ *   INPUTS: mnt -- the mount
+ *           dir -- must be DEVFS_ROOT
+ *           name / len -- the name
+ *           attr -- gets the node
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if there is no such node
+ *   SIDE EFFECTS: none
+ */
+static int32_t devfs_lookup(mount_t* mnt, uint32_t dir, const uint8_t* name, uint32_t len, vattr_t* attr){
+    uint32_t i;
+
+    if (dir != DEVFS_ROOT)
+        return -1;
+    for (i = 0; i < N_DEVFS_NODES; i++){
+        if (len == strlen(devfs_nodes[i].name)
+            && strncmp(devfs_nodes[i].name, (const int8_t*)name, len) == 0){
+            attr->ino = i + 1;
+            attr->type = FILE_DEV;
+            attr->size = 0;
+            attr->fops = devfs_nodes[i].fops;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * devfs_readdir
+ *   DESCRIPTION: name of a node of /dev
+ *   INPUTS: mnt -- the mount
+ *           dir -- must be DEVFS_ROOT
+ *           idx -- the node
+ *           name -- FILENAME_LEN + 1 bytes
+ *   OUTPUTS: the name
+ *   RETURN VALUE: 0, -1 past the last node
+ *   SIDE EFFECTS: none
+ */
+static int32_t devfs_readdir(mount_t* mnt, uint32_t dir, uint32_t idx, uint8_t* name){
+    if (dir != DEVFS_ROOT || idx >= N_DEVFS_NODES)
+        return -1;
+    strncpy((int8_t*)name, devfs_nodes[idx].name, FILENAME_LEN);
+    name[FILENAME_LEN] = '\0';
+    return 0;
+}
+
+/* devices are not read through vfs_read */
+static fs_ops_t devfs_ops = { devfs_lookup, NULL, devfs_readdir };
+
+/*
+ * devfs_init
+ *   DESCRIPTION: mount /dev; it is searched after "/" so the nodes also
+ *                open by their bare names
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: call after filesys_init
+ */
+void devfs_init(void){
+    vfs_mount("/dev", &devfs_ops, NULL, DEVFS_ROOT, VFS_SEARCH);
+}
+
+/*
+ * audio_write
+ *   DESCRIPTION: play a .wav file of the boot image on the SB16; writing
+ *                the name of the file starts it
+ *   INPUTS: fd -- ignored
+ *           buf -- the file name, a trailing newline is dropped
+ *           nbytes -- its length
+ *   OUTPUTS: none
+ *   RETURN VALUE: nbytes, -1 on a bad name
+ *   SIDE EFFECTS: none if a tune is already playing
+ */
+static int32_t audio_write(int32_t fd, const void* buf, int32_t nbytes){
+    uint8_t name[FILENAME_LEN + 1];
+    uint32_t flags;
+
+    if (buf == NULL || nbytes <= 0 || nbytes > FILENAME_LEN)
+        return -1;
+    memcpy(name, buf, nbytes);
+    name[nbytes] = '\0';
+    if (name[nbytes - 1] == '\n')
+        name[nbytes - 1] = '\0';
+    cli_and_save(flags);
+    player(name);
+    restore_flags(flags);
+    return nbytes;
+}
+
+/*
+ * audio_open / audio_close
+ *   DESCRIPTION: nothing to set up
+ *   INPUTS: fname / fd -- ignored
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: none
+ */
+static int32_t audio_open(const uint8_t* fname){
+    return 0;
+}
+
+static int32_t audio_close(int32_t fd){
+    return 0;
+}
@@ -0,0 +1,14 @@
+/* devfs.h - Device files, mounted at /dev
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _DEVFS_H
+#define _DEVFS_H
+
+#include "types.h"
+
+#define DEVFS_ROOT          0       /* ino of /dev, the nodes follow */
+
+void devfs_init(void);
+
+#endif /* _DEVFS_H */
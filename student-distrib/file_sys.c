@@ -5,132 +5,625 @@
 #include "file_sys.h"
 #include "sys_calls.h"
 #include "lib.h"
+#include "paging.h"
+#include "bcache.h"
+#include "./dev/ata.h"
+#include "./dev/uart.h"
+#include "spinlock.h"
+#include "softirq.h"
 
-/* Parameters of first entry in boot block */
-static uint32_t n_dentry_b;
-static uint32_t n_inode_b;
-static uint32_t n_data_block_b;
-
-/* Casting file_sys_addr to different type of pointers for convenience */
-static struct dentry_t* p_dentry;              // pointer to dentry array (start from 0)
-static struct inode_block_t* p_inode;          // pointer to inode block array
-static struct data_block_t* p_data;            // pointer to data block array
+/* The boot module, mounted at "/", and a disk image */
+static ece391_fs_t boot_fs;
+static ece391_fs_t disk_fs;
 
 /* Some parameters */
 #define STR_LEN 32
-#define BLOCK_SIZE 4096
+#define DENTRY_MAX (BLOCK_SIZE / sizeof(dentry_t) - 1)   // dentries after the boot block header
+#define DIR_HASH_BUCKETS 256    // power of two
+#define DIR_MAX_ENTRIES 1024    // larger directories are searched linearly
+#define DIR_INDEXES 8           // directories with a hash index at a time
+#define STREAM_AHEAD ATA_MAX_PRD    // blocks read ahead of a stream, one disk command
+
+/* Hash index of one directory, built on its first lookup. Chains hold
+ * entry + 1 so that 0 ends them */
+typedef struct dir_index_t {
+    ece391_fs_t*    fs;         // NULL if the slot is free
+    uint32_t        dir;
+    uint32_t        users;      // lookups using it, it is not reused meanwhile
+    uint16_t        head[DIR_HASH_BUCKETS];
+    uint16_t        next[DIR_MAX_ENTRIES];
+    uint32_t        hash[DIR_MAX_ENTRIES];
+} dir_index_t;
+
+static dir_index_t dir_index[DIR_INDEXES];
+static uint32_t dir_index_next = 0;     // slot to reuse next
+static spinlock_t dir_index_lock = SPINLOCK_UNLOCKED;
 
 extern int32_t pid;     // current number of process, from system call
 
+static data_block_t* _file_extent_(ece391_fs_t* fs, uint32_t inode, uint32_t blk, uint32_t* run);
+
 /*-------------------- Helper functions --------------------*/ 
 
 /* Note
- * 1. file_sys_addr indicate the starting address of file system 
- * 2. Cases that should return -1
- *      a. file name does not exists (read_dentry_by_name)
- *      b. invalde file index (read_dentry_by_index)
- *      c. inode number out of range (read_data)
+ * 1. Block 0 is the boot block, 1 to n_inode the inodes, then the data
+ * 2. Blocks of an image in memory are addressed directly, blocks of a
+ *    disk image are borrowed from the buffer cache and given back
+ * 3. The root directory is the dentry list of the boot block; any other
+ *    directory is an inode whose data is an array of dentry_t, starting
+ *    with "." and ".."
+ * 4. Cases that should return -1
+ *      a. file name does not exists (fs_find)
+ *      b. invalde file index (fs_dentry)
+ *      c. inode number out of range (fs_read)
  */ 
 
 /* 
- * filesys_init
- *   DESCRIPTION: initialize pointers and parameters using file_sys_addr
- *   INPUTS: none
+ * fs_block
+ *   DESCRIPTION: get a block of an image
+ *   INPUTS: fs - the image
+ *           blockno - block number within the image
+ *           held - gets the cache buffer to give back with brelse, NULL
+ *                  for an image in memory
  *   OUTPUTS: none
- *   RETURN VALUE: none
- *   SIDE EFFECTS: pointers initialized
+ *   RETURN VALUE: pointer to the block, NULL on an I/O error
+ *   SIDE EFFECTS: none
  */
-void filesys_init() {
-    n_dentry_b = ((boot_block_t*)file_sys_addr)->n_dentry;
-    n_inode_b = ((boot_block_t*)file_sys_addr)->n_inode;
-    n_data_block_b = ((boot_block_t*)file_sys_addr)->n_data_block;
-    p_dentry = ((dentry_t*)file_sys_addr) + 1;        // skip the firt segment of boot block
-    p_inode = ((inode_block_t*)file_sys_addr) + 1;    // skip the boot block 
-    p_data = ((data_block_t*)file_sys_addr) + n_inode_b + 1;      // skip the boot block and inode blocks
+static uint8_t* fs_block(ece391_fs_t* fs, uint32_t blockno, buf_t** held) {
+    if (fs->base != NULL) {
+        *held = NULL;
+        return fs->base + blockno * BLOCK_SIZE;
+    }
+    *held = bread(fs->dev, blockno);
+    return (*held != NULL) ? (*held)->data : NULL;
 }
 
 /* 
- * read_dentry_by_name
- *   DESCRIPTION: find the dir entry that has the given name
- *   INPUTS: fname - string of file name
+ * fs_setup
+ *   DESCRIPTION: read the counts of the boot block and check they fit
+ *   INPUTS: fs - the image, base or dev already set
+ *           n_blocks - blocks the image may span
+ *   OUTPUTS: the counts in fs
+ *   RETURN VALUE: 0 if success, -1 if this is no ece391 image
+ *   SIDE EFFECTS: none
+ */
+static int32_t fs_setup(ece391_fs_t* fs, uint32_t n_blocks) {
+    boot_block_t* boot;
+    buf_t* held;
+
+    boot = (boot_block_t*)fs_block(fs, 0, &held);
+    if (boot == NULL) {
+        return -1;
+    }
+    fs->n_dentry = boot->n_dentry;
+    fs->n_inode = boot->n_inode;
+    fs->n_data_block = boot->n_data_block;
+    brelse(held);
+
+    if (fs->n_dentry == 0 || fs->n_dentry > DENTRY_MAX || fs->n_inode == 0
+        || 1 + fs->n_inode + fs->n_data_block > n_blocks) {
+        return -1;
+    }
+    return 0;
+}
+
+/* 
+ * fs_dentry
+ *   DESCRIPTION: copy the dir entry at given index
+ *   INPUTS: fs - the image
+ *           index - index in boot block
  *           dentry - structure to pass output
  *   OUTPUTS: dentry structure
  *   RETURN VALUE: 0 if success, -1 if anything bad happened
  *   SIDE EFFECTS: none
  */
-int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry) {
+static int32_t fs_dentry(ece391_fs_t* fs, uint32_t index, dentry_t* dentry) {
+    dentry_t* p_dentry;
+    buf_t* held;
+
+    // Check index
+    if (index >= fs->n_dentry) {
+        return -1;
+    }
+    p_dentry = (dentry_t*)fs_block(fs, 0, &held);
+    if (p_dentry == NULL) {
+        return -1;
+    }
+    *dentry = p_dentry[index + 1];        // skip the firt segment of boot block
+    brelse(held);
+    return 0;
+}
+
+/* 
+ * fs_read
+ *   DESCRIPTION: read data in certain file
+ *   INPUTS: fs - the image
+ *           inode - inode number of file
+ *           offset - starting index (in byte) of reading
+ *           buf - buffer that stores the data
+ *           length - amount of bytes to read
+ *   OUTPUTS: buf that contains data
+ *   RETURN VALUE: number of bytes readed, -1 if anything bad happened
+ *   SIDE EFFECTS: none
+ */
+static int32_t fs_read(ece391_fs_t* fs, uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length) {
 
-    int32_t i, j;               // Loop counter
-    uint8_t* fname_d;           // store name in dentry temporally
-    int32_t find_flage = 0;
-    int32_t length = strlen((int8_t*)fname);    // without '\0'
+    uint32_t byte_count = 0;            // number of bytes being readed
+    uint32_t chunk;                     // bytes taken from the current block
+    uint32_t start;                     // where the read is within it
+    uint32_t span;                      // bytes from the block on that are contiguous
+    uint32_t run;                       // blocks in that extent
+    uint32_t idx_data_block;
+    inode_block_t* file;
+    uint8_t* data_block;                // pointer to the data block 
+    data_block_t* extent;
+    buf_t* inode_held;
+    buf_t* data_held;
 
-    // Check the length of input string
-    if (length > STR_LEN) {
+    if (buf == NULL) {
         return -1;
     }
 
-    // Go through all dentries
-    for (i = 0; i < n_dentry_b; i++) {
+    // Check inode number
+    if (inode >= fs->n_inode) {
+        return -1;
+    }
+    file = (inode_block_t*)fs_block(fs, 1 + inode, &inode_held);
+    if (file == NULL) {
+        return -1;
+    }
 
-        fname_d = (uint8_t*)(p_dentry[i].f_name);
-        find_flage = 1;
+    // Nothing to read past the end, otherwise stop at the end of the file
+    if (offset >= file->length) {
+        brelse(inode_held);
+        return 0;
+    }
+    if (length > file->length - offset) {
+        length = file->length - offset;
+    }
 
-        // compare the name until a different characters or number 32 is reached
-        for (j = 0; j < length; j++) {
-            if (fname[j] != fname_d[j]) {
-                find_flage = 0;
+    // Copy block by block, in memory a whole extent at a time
+    while (byte_count < length) {
+        start = (offset + byte_count) % BLOCK_SIZE;
+        if (fs->base != NULL) {
+            extent = _file_extent_(fs, inode, (offset + byte_count) / BLOCK_SIZE, &run);
+            if (extent == NULL) {
+                break;
+            }
+            data_block = extent->data;
+            data_held = NULL;
+            span = run * BLOCK_SIZE;
+        } else {
+            idx_data_block = file->idx_block[(offset + byte_count) / BLOCK_SIZE];
+            if (idx_data_block >= fs->n_data_block) {
+                break;
+            }
+            data_block = fs_block(fs, 1 + fs->n_inode + idx_data_block, &data_held);
+            if (data_block == NULL) {
                 break;
             }
+            span = BLOCK_SIZE;
+        }
+        chunk = span - start;
+        if (chunk > length - byte_count) {
+            chunk = length - byte_count;
+        }
+        memcpy(buf + byte_count, data_block + start, chunk);
+        brelse(data_held);
+        byte_count += chunk;
+    }
+
+    brelse(inode_held);
+    return (byte_count > 0 || length == 0) ? (int32_t)byte_count : -1;
+}
+
+/* 
+ * fs_size
+ *   DESCRIPTION: get size of file
+ *   INPUTS: fs - the image
+ *           inode - number of inode
+ *   OUTPUTS: none
+ *   RETURN VALUE: size of file if success, -1 if anything bad happened
+ *   SIDE EFFECTS: none
+ */
+static int32_t fs_size(ece391_fs_t* fs, uint32_t inode) {
+    inode_block_t* file;
+    buf_t* held;
+    int32_t length;
+
+    if (inode >= fs->n_inode)
+        return -1;
+    file = (inode_block_t*)fs_block(fs, 1 + inode, &held);
+    if (file == NULL)
+        return -1;
+    length = file->length;
+    brelse(held);
+    return length;
+}
+
+/* 
+ * fs_dir_entry
+ *   DESCRIPTION: copy the entry at given index of a directory
+ *   INPUTS: fs - the image
+ *           dir - inode of the directory, ECE391_ROOT for the boot block
+ *           index - index in the directory
+ *           dentry - structure to pass output
+ *   OUTPUTS: dentry structure
+ *   RETURN VALUE: 0 if success, -1 past the last entry
+ *   SIDE EFFECTS: none
+ */
+static int32_t fs_dir_entry(ece391_fs_t* fs, uint32_t dir, uint32_t index, dentry_t* dentry) {
+    if (dir == ECE391_ROOT) {
+        return fs_dentry(fs, index, dentry);
+    }
+    if (sizeof(dentry_t) != fs_read(fs, dir, index * sizeof(dentry_t), (uint8_t*)dentry, sizeof(dentry_t))) {
+        return -1;
+    }
+    return 0;
+}
+
+/* 
+ * fs_dir_count
+ *   DESCRIPTION: number of entries of a directory
+ *   INPUTS: fs - the image
+ *           dir - inode of the directory
+ *   OUTPUTS: none
+ *   RETURN VALUE: the count, 0 on a bad inode
+ *   SIDE EFFECTS: none
+ */
+static uint32_t fs_dir_count(ece391_fs_t* fs, uint32_t dir) {
+    int32_t size;
+
+    if (dir == ECE391_ROOT) {
+        return fs->n_dentry;
+    }
+    size = fs_size(fs, dir);
+    return (size > 0) ? size / sizeof(dentry_t) : 0;
+}
+
+/* 
+ * _name_hash_
+ *   DESCRIPTION: FNV-1a of a file name
+ *   INPUTS: name - the name, ends at its length or a '\0'
+ *           length - at most STR_LEN
+ *   OUTPUTS: none
+ *   RETURN VALUE: the hash
+ *   SIDE EFFECTS: none
+ */
+static uint32_t _name_hash_(const int8_t* name, uint32_t length) {
+    uint32_t h = 2166136261u;
+    uint32_t i;
+
+    for (i = 0; i < length && name[i] != '\0'; i++) {
+        h = (h ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return h;
+}
+
+/* 
+ * fs_dir_index
+ *   DESCRIPTION: get the hash index of a directory, building it from the
+ *                entries if the directory has none yet
+ *   INPUTS: fs - the image
+ *           dir - inode of the directory
+ *   OUTPUTS: none
+ *   RETURN VALUE: the index, give it back with fs_dir_index_put; NULL if
+ *                 the directory is too large or every slot is in use
+ *   SIDE EFFECTS: may replace the index of another directory
+ */
+static dir_index_t* fs_dir_index(ece391_fs_t* fs, uint32_t dir) {
+    dir_index_t* idx = NULL;
+    dentry_t dentry;
+    uint32_t flags, n, i, b;
+
+    spin_lock_irqsave(&dir_index_lock, flags);
+    for (i = 0; i < DIR_INDEXES; i++) {
+        if (dir_index[i].fs == fs && dir_index[i].dir == dir) {
+            dir_index[i].users++;
+            spin_unlock_irqrestore(&dir_index_lock, flags);
+            return &dir_index[i];
+        }
+    }
+    for (i = 0; i < DIR_INDEXES && idx == NULL; i++) {
+        b = dir_index_next++ % DIR_INDEXES;
+        if (dir_index[b].users == 0) {
+            idx = &dir_index[b];
+            idx->fs = NULL;
+            idx->users = 1;
         }
+    }
+    spin_unlock_irqrestore(&dir_index_lock, flags);
+    if (idx == NULL) {
+        return NULL;
+    }
+
+    // Chain every entry into the bucket of its name
+    n = fs_dir_count(fs, dir);
+    memset(idx->head, 0, sizeof(idx->head));
+    for (i = 0; i < n && n <= DIR_MAX_ENTRIES; i++) {
+        if (0 != fs_dir_entry(fs, dir, i, &dentry)) {
+            break;
+        }
+        idx->hash[i] = _name_hash_(dentry.f_name, STR_LEN);
+        b = idx->hash[i] & (DIR_HASH_BUCKETS - 1);
+        idx->next[i] = idx->head[b];
+        idx->head[b] = i + 1;
+    }
+
+    spin_lock_irqsave(&dir_index_lock, flags);
+    if (i == n && n <= DIR_MAX_ENTRIES) {
+        idx->fs = fs;
+        idx->dir = dir;
+    } else {
+        idx->users = 0;
+        idx = NULL;
+    }
+    spin_unlock_irqrestore(&dir_index_lock, flags);
+    return idx;
+}
+
+/* 
+ * fs_dir_index_put
+ *   DESCRIPTION: give back an index from fs_dir_index
+ *   INPUTS: idx - the index
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void fs_dir_index_put(dir_index_t* idx) {
+    uint32_t flags;
+
+    spin_lock_irqsave(&dir_index_lock, flags);
+    idx->users--;
+    spin_unlock_irqrestore(&dir_index_lock, flags);
+}
+
+/* 
+ * _name_match_
+ *   DESCRIPTION: compare a name with the name of a dir entry; a name of
+ *                STR_LEN characters has no '\0' in the entry
+ *   INPUTS: dentry - the entry
+ *           fname / length - the name, length at most STR_LEN
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if they are the same
+ *   SIDE EFFECTS: none
+ */
+static int32_t _name_match_(const dentry_t* dentry, const uint8_t* fname, uint32_t length) {
+    return 0 == strncmp(dentry->f_name, (const int8_t*)fname, length)
+        && (length == STR_LEN || dentry->f_name[length] == '\0');
+}
+
+/* 
+ * fs_find
+ *   DESCRIPTION: find the dir entry that has the given name, through the
+ *                hash index of the directory
+ *   INPUTS: fs - the image
+ *           dir - inode of the directory
+ *           fname - the name, not necessarily NUL terminated
+ *           length - its length, at most STR_LEN
+ *           dentry - structure to pass output
+ *   OUTPUTS: dentry structure
+ *   RETURN VALUE: 0 if success, -1 if anything bad happened
+ *   SIDE EFFECTS: none
+ */
+static int32_t fs_find(ece391_fs_t* fs, uint32_t dir, const uint8_t* fname, uint32_t length, dentry_t* dentry) {
+    dir_index_t* idx;
+    uint32_t hash, e, n;
 
-        // After end, check if fname_d still have character
-        if ((length < STR_LEN) && (fname_d[j] != '\0')) {
-            find_flage = 0;
+    if (length == 0 || length > STR_LEN) {
+        return -1;
+    }
+
+    // Without an index go through all dentries
+    idx = fs_dir_index(fs, dir);
+    if (idx == NULL) {
+        n = fs_dir_count(fs, dir);
+        for (e = 0; e < n; e++) {
+            if (0 == fs_dir_entry(fs, dir, e, dentry) && _name_match_(dentry, fname, length)) {
+                return 0;
+            }
         }
+        return -1;
+    }
 
-        // Check flage
-        if (find_flage == 1) {
-            strncpy((int8_t*)(dentry->f_name), (int8_t*)(p_dentry[i].f_name), length);
-            if (length < STR_LEN)
-                dentry->f_name[length] = '\0';
-            dentry->f_type = p_dentry[i].f_type;
-            dentry->idx_inode = p_dentry[i].idx_inode; 
+    hash = _name_hash_((const int8_t*)fname, length);
+    for (e = idx->head[hash & (DIR_HASH_BUCKETS - 1)]; e != 0; e = idx->next[e - 1]) {
+        if (idx->hash[e - 1] == hash && 0 == fs_dir_entry(fs, dir, e - 1, dentry)
+            && _name_match_(dentry, fname, length)) {
+            fs_dir_index_put(idx);
             return 0;
         }
     }
 
     // Not found, return -1
+    fs_dir_index_put(idx);
     return -1;
 }
 
 /* 
- * read_dentry_by_index
- *   DESCRIPTION: find the dir entry at given index
- *   INPUTS: index - index in boot block
- *           dentry - structure to pass output
- *   OUTPUTS: dentry structure
- *   RETURN VALUE: 0 if success, -1 if anything bad happened
+ * _file_extent_
+ *   DESCRIPTION: find a data block of a file of an image in memory, and how
+ *                many blocks of the file from there on follow it directly in
+ *                the image. mkfs391 lays every file out in one extent, so a
+ *                whole file is usually a single run
+ *   INPUTS: fs - the image, base is set
+ *           inode - inode number of file (already checked)
+ *           blk - index of the block within the file
+ *           run - gets the length of the extent in blocks, at least 1
+ *   OUTPUTS: *run
+ *   RETURN VALUE: pointer to the data block, NULL if blk is past the end
+ *                 of the file or the inode holds a bad block number
  *   SIDE EFFECTS: none
  */
-int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry) {
+static data_block_t* _file_extent_(ece391_fs_t* fs, uint32_t inode, uint32_t blk, uint32_t* run) {
+    inode_block_t* p_inode = ((inode_block_t*)fs->base) + 1 + inode;     // skip the boot block
+    uint32_t n_blocks = (p_inode->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t idx_data_block;
+    uint32_t n;
 
-    int32_t length = strlen((int8_t*)(p_dentry[index].f_name));    // without '\0'
+    if (blk >= n_blocks) {
+        return NULL;
+    }
+    idx_data_block = p_inode->idx_block[blk];
+    if (idx_data_block >= fs->n_data_block) {
+        return NULL;
+    }
+    for (n = 1; blk + n < n_blocks && p_inode->idx_block[blk + n] == idx_data_block + n; n++) {
+        if (idx_data_block + n >= fs->n_data_block) {
+            break;
+        }
+    }
+    *run = n;
+    return ((data_block_t*)fs->base) + 1 + fs->n_inode + idx_data_block;
+}
 
-    // Check index
-    if (index < 0 || index >= n_dentry_b) {
+/*-------------------- VFS operations --------------------*/ 
+
+/* 
+ * ece391_lookup
+ *   DESCRIPTION: find a name in a directory of an image
+ *   INPUTS: mnt - the mount
+ *           dir - inode of the directory
+ *           name / len - the name
+ *           attr - structure to pass output
+ *   OUTPUTS: attr
+ *   RETURN VALUE: 0 if success, -1 if not found
+ *   SIDE EFFECTS: none
+ */
+static int32_t ece391_lookup(mount_t* mnt, uint32_t dir, const uint8_t* name, uint32_t len, vattr_t* attr) {
+    ece391_fs_t* fs = (ece391_fs_t*)mnt->sb;
+    dentry_t dentry;
+
+    if (0 != fs_find(fs, dir, name, len, &dentry)) {
+        return -1;
+    }
+    attr->ino = dentry.idx_inode;
+    attr->type = dentry.f_type;
+    attr->size = 0;
+    switch (dentry.f_type) {
+        case FILE_RTC:
+            attr->fops = &rtc_fop_t;
+            break;
+        case FILE_DIREC:
+            attr->fops = &dir_fop_t;
+            break;
+        case FILE_REG:
+            attr->size = fs_size(fs, dentry.idx_inode);
+            attr->fops = &reg_fop_t;
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+/* 
+ * ece391_read
+ *   DESCRIPTION: read a file of an image, see fs_read
+ */
+static int32_t ece391_read(mount_t* mnt, uint32_t ino, uint32_t offset, uint8_t* buf, uint32_t length) {
+    return fs_read((ece391_fs_t*)mnt->sb, ino, offset, buf, length);
+}
+
+/* 
+ * ece391_readdir
+ *   DESCRIPTION: name of the dir entry at given index
+ *   INPUTS: mnt - the mount
+ *           dir - inode of the directory
+ *           idx - index in boot block
+ *           name - STR_LEN + 1 bytes
+ *   OUTPUTS: the name
+ *   RETURN VALUE: 0 if success, -1 past the last entry
+ *   SIDE EFFECTS: none
+ */
+static int32_t ece391_readdir(mount_t* mnt, uint32_t dir, uint32_t idx, uint8_t* name) {
+    dentry_t dentry;
+
+    if (0 != fs_dir_entry((ece391_fs_t*)mnt->sb, dir, idx, &dentry)) {
         return -1;
     }
+    strncpy((int8_t*)name, dentry.f_name, STR_LEN);
+    name[STR_LEN] = '\0';
+    return 0;
+}
+
+fs_ops_t ece391_ops = { ece391_lookup, ece391_read, ece391_readdir };
 
-    strncpy((int8_t*)(dentry->f_name), (int8_t*)(p_dentry[index].f_name), length);
-    if (length < STR_LEN)
-        dentry->f_name[length] = '\0';
-    dentry->f_type = p_dentry[index].f_type;
-    dentry->idx_inode = p_dentry[index].idx_inode; 
+/* 
+ * filesys_init
+ *   DESCRIPTION: mount the boot module at "/" and, if the file system disk
+ *                holds an image, that at "/disk"
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: call after vfs_init and bcache_init
+ */
+void filesys_init() {
+    boot_fs.base = (uint8_t*)file_sys_addr;
+    boot_fs.dev = -1;
+    fs_setup(&boot_fs, (uint32_t)-1);
+    vfs_mount("/", &ece391_ops, &boot_fs, ECE391_ROOT, VFS_SEARCH);
+
+    filesys_mount_disk(BCACHE_DEV, "/disk");
+}
 
+/* 
+ * filesys_mount_disk
+ *   DESCRIPTION: mount the image on an ATA drive; its blocks are read
+ *                through the buffer cache
+ *   INPUTS: dev - the drive
+ *           path - where to mount it
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if success, -1 if there is no image or a disk is
+ *                 already mounted
+ *   SIDE EFFECTS: none
+ */
+int32_t filesys_mount_disk(int32_t dev, const int8_t* path) {
+    if (disk_fs.n_inode != 0 || dev < 0 || dev >= ATA_MAX_DRIVES || !ata_drives[dev].present) {
+        return -1;
+    }
+    disk_fs.base = NULL;
+    disk_fs.dev = dev;
+    if (0 != fs_setup(&disk_fs, ata_drives[dev].sectors / BLOCK_SECTORS)) {
+        disk_fs.n_inode = 0;
+        return -1;
+    }
+    if (0 != vfs_mount(path, &ece391_ops, &disk_fs, ECE391_ROOT, 0)) {
+        disk_fs.n_inode = 0;
+        return -1;
+    }
+    klog("ata%d: ece391 image with %d files mounted at %s\n", dev, disk_fs.n_dentry, path);
     return 0;
 }
 
+/*-------------------- The boot image --------------------*/ 
+
+/* 
+ * read_dentry_by_name
+ *   DESCRIPTION: find the dir entry that has the given name
+ *   INPUTS: fname - string of file name
+ *           dentry - structure to pass output
+ *   OUTPUTS: dentry structure
+ *   RETURN VALUE: 0 if success, -1 if anything bad happened
+ *   SIDE EFFECTS: none
+ */
+int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry) {
+    return fs_find(&boot_fs, ECE391_ROOT, fname, strlen((const int8_t*)fname), dentry);
+}
+
+/* 
+ * read_dentry_by_index
+ *   DESCRIPTION: find the dir entry at given index
+ *   INPUTS: index - index in boot block
+ *           dentry - structure to pass output
+ *   OUTPUTS: dentry structure
+ *   RETURN VALUE: 0 if success, -1 if anything bad happened
+ *   SIDE EFFECTS: none
+ */
+int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry) {
+    return fs_dentry(&boot_fs, index, dentry);
+}
+
 /* 
  * read_data
  *   DESCRIPTION: read data in certain file
@@ -143,86 +636,216 @@ int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry) {
  *   SIDE EFFECTS: none
  */
 int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length) {
+    return fs_read(&boot_fs, inode, offset, buf, length);
+}
 
-    uint32_t byte_count = 0;            // number of bytes being readed
-    uint32_t start_block, end_block;    // index of start and end data blocks (0 based, both edge included)
-    uint32_t start_idx, end_idx;        // start and end index within the block (0 based, only lower edge included)
-    uint32_t i, j;                      // loop counter
-    inode_block_t file;
-    uint32_t file_size;                 // size of file in terms of blocks
-    uint32_t idx_data_block;
-    data_block_t* data_block;           // pointer to the data block 
+/*-------------------- Streams --------------------*/ 
 
-    if (buf == NULL) {
-        return -1;
+/* 
+ * stream_prefetch
+ *   DESCRIPTION: start reading the blocks of a disk file from blk on, as
+ *                far as they lie one after the other on the disk
+ *   INPUTS: s - the stream, on the disk
+ *           blk - index of the block within the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: never waits, the read ends in IRQ 14
+ */
+static void stream_prefetch(stream_t* s, uint32_t blk) {
+    inode_block_t* file = (inode_block_t*)s->inode_buf->data;
+    uint32_t n_blocks = (s->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t first, n;
+
+    if (blk >= n_blocks || file->idx_block[blk] >= s->fs->n_data_block) {
+        return;
     }
+    first = file->idx_block[blk];
+    for (n = 1; n < STREAM_AHEAD && blk + n < n_blocks && file->idx_block[blk + n] == first + n; n++) {
+        if (first + n >= s->fs->n_data_block) {
+            break;
+        }
+    }
+    bprefetch(s->fs->dev, 1 + s->fs->n_inode + first, n);
+}
 
-    // Check inode number
-    if (inode < 0 || inode >= n_inode_b) {
-        return -1;
+/* 
+ * stream_open
+ *   DESCRIPTION: open a file for the players, taking the copy on the disk
+ *                image if there is one and the boot image otherwise. The
+ *                inode of a disk file stays in the cache until stream_close
+ *   INPUTS: fname - file name, in the root directory
+ *           s - the stream to set up
+ *   OUTPUTS: s
+ *   RETURN VALUE: 0 if success, -1 if no image has a regular file of that name
+ *   SIDE EFFECTS: reads the disk unless called from a softirq or tasklet,
+ *                 where only the boot image is searched; starts reading
+ *                 the first blocks of a disk file
+ */
+int32_t stream_open(const uint8_t* fname, stream_t* s) {
+    uint32_t length = strlen((const int8_t*)fname);
+    dentry_t dentry;
+
+    s->inode_buf = NULL;
+    if (disk_fs.n_inode != 0 && !in_softirq()
+        && 0 == fs_find(&disk_fs, ECE391_ROOT, fname, length, &dentry)
+        && dentry.f_type == FILE_REG && dentry.idx_inode < disk_fs.n_inode) {
+        s->inode_buf = bread(disk_fs.dev, 1 + dentry.idx_inode);
     }
-    file = p_inode[inode];
-    file_size = file.length / BLOCK_SIZE;
-    if (file.length % BLOCK_SIZE != 0) {
-        file_size += 1;
+    if (s->inode_buf != NULL) {
+        s->fs = &disk_fs;
+        s->inode = dentry.idx_inode;
+        s->length = ((inode_block_t*)s->inode_buf->data)->length;
+        stream_prefetch(s, 0);
+        return 0;
     }
 
-    // Check range of reading (only lower boundary)
-    if ((length + offset) < 0 || offset < 0 || length < 0) {
+    if (0 != fs_find(&boot_fs, ECE391_ROOT, fname, length, &dentry) || dentry.f_type != FILE_REG) {
         return -1;
     }
+    s->fs = &boot_fs;
+    s->inode = dentry.idx_inode;
+    s->length = fs_size(&boot_fs, dentry.idx_inode);
+    return (s->length == (uint32_t)-1) ? -1 : 0;
+}
 
-    // Calculate start and end index
-    start_block = offset / BLOCK_SIZE;
-    end_block = (length + offset) / BLOCK_SIZE;
-    start_idx = offset % BLOCK_SIZE;
-    end_idx = (length + offset) % BLOCK_SIZE;
+/* 
+ * stream_read
+ *   DESCRIPTION: read from an open stream. From a softirq or tasklet only
+ *                the blocks already in the cache are copied: the read stops
+ *                at the first one that is not and starts bringing it in.
+ *                Each read starts bringing in the blocks after it
+ *   INPUTS: s - the stream
+ *           offset - starting index (in byte) of reading
+ *           buf - buffer that stores the data
+ *           length - amount of bytes to read
+ *   OUTPUTS: buf that contains data
+ *   RETURN VALUE: number of bytes readed, short if the disk has not caught
+ *                 up or at the end of the file; -1 on a bad block number
+ *   SIDE EFFECTS: none
+ */
+int32_t stream_read(stream_t* s, uint32_t offset, uint8_t* buf, uint32_t length) {
+    inode_block_t* file;
+    uint32_t byte_count = 0;
+    uint32_t start, chunk, blk;
+    int32_t atomic = in_softirq();
+    buf_t* held;
 
-    // Loop through all relevant blocks
-    for (i = start_block; i <= end_block; i++) {
+    if (s->inode_buf == NULL) {
+        return fs_read(s->fs, s->inode, offset, buf, length);
+    }
+    if (offset >= s->length) {
+        return 0;
+    }
+    if (length > s->length - offset) {
+        length = s->length - offset;
+    }
 
-        // Check file (upper) boudary
-        if (i >= file_size) {
-            return byte_count;
+    file = (inode_block_t*)s->inode_buf->data;
+    while (byte_count < length) {
+        blk = (offset + byte_count) / BLOCK_SIZE;
+        if (file->idx_block[blk] >= s->fs->n_data_block) {
+            return -1;
+        }
+        held = atomic ? bpeek(s->fs->dev, 1 + s->fs->n_inode + file->idx_block[blk])
+                      : bread(s->fs->dev, 1 + s->fs->n_inode + file->idx_block[blk]);
+        if (held == NULL) {
+            break;
+        }
+        start = (offset + byte_count) % BLOCK_SIZE;
+        chunk = BLOCK_SIZE - start;
+        if (chunk > length - byte_count) {
+            chunk = length - byte_count;
         }
+        memcpy(buf + byte_count, held->data + start, chunk);
+        brelse(held);
+        byte_count += chunk;
+    }
+    stream_prefetch(s, (offset + byte_count) / BLOCK_SIZE);
+    return byte_count;
+}
+
+/* 
+ * stream_map
+ *   DESCRIPTION: point at part of a file of the boot image in place,
+ *                without copying it
+ *   INPUTS: s - the stream
+ *           offset / length - the part, inside the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to it, NULL on the disk or if the part does not
+ *                 lie in one extent of the image
+ *   SIDE EFFECTS: none
+ */
+uint8_t* stream_map(stream_t* s, uint32_t offset, uint32_t length) {
+    data_block_t* extent;
+    uint32_t run;
 
-        // Check whether the corresponding data block exists
-        idx_data_block = file.idx_block[i];
-        if (idx_data_block < 0 || idx_data_block >= n_data_block_b) {
+    if (s->inode_buf != NULL || offset > s->length || length > s->length - offset) {
+        return NULL;
+    }
+    extent = _file_extent_(s->fs, s->inode, offset / BLOCK_SIZE, &run);
+    if (extent == NULL || offset % BLOCK_SIZE + length > run * BLOCK_SIZE) {
+        return NULL;
+    }
+    return extent->data + offset % BLOCK_SIZE;
+}
+
+/* 
+ * stream_fetch
+ *   DESCRIPTION: read part of a disk file straight into buf by DMA, past
+ *                the buffer cache (the image is never written); done is
+ *                called from IRQ 14 when it is in. The part must lie in
+ *                consecutive blocks on the disk
+ *   INPUTS: s - the stream
+ *           offset / length - the part, inside the file
+ *           buf - STREAM_FETCH_MAX bytes, 4 KB aligned kernel memory
+ *           done - completion, see ata_read_async
+ *   OUTPUTS: buf, once done is called
+ *   RETURN VALUE: where the part starts in buf, -1 if it cannot be read
+ *                 this way or the disk is busy
+ *   SIDE EFFECTS: whole 4 KB pages of buf are written
+ */
+int32_t stream_fetch(stream_t* s, uint32_t offset, uint32_t length, uint8_t* buf, void (*done)(int32_t ret)) {
+    inode_block_t* file;
+    uint8_t* bufs[ATA_MAX_PRD];
+    uint32_t first, last, blk, lba, n_bufs, i;
+
+    if (s->inode_buf == NULL || length == 0 || offset > s->length || length > s->length - offset) {
+        return -1;
+    }
+    n_bufs = (offset % ATA_SECTOR_SIZE + length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (n_bufs > ATA_MAX_PRD) {
+        return -1;
+    }
+    file = (inode_block_t*)s->inode_buf->data;
+    first = offset / BLOCK_SIZE;
+    last = (offset + length - 1) / BLOCK_SIZE;
+    for (blk = first; blk <= last; blk++) {
+        if (file->idx_block[blk] >= s->fs->n_data_block
+            || file->idx_block[blk] != file->idx_block[first] + (blk - first)) {
             return -1;
         }
-        data_block = p_data + idx_data_block;
-
-        // Read data to buffer
-        if (i == start_block && i == end_block) {
-            // Read part of single block
-            for (j = start_idx; j < end_idx; j++) {
-                buf[byte_count] = data_block->data[j];
-                byte_count += 1;
-            }
-        } else if (i == start_block) {
-            // Read to the end of block
-            for (j = start_idx; j < BLOCK_SIZE; j++) {
-                buf[byte_count] = data_block->data[j];
-                byte_count += 1;
-            } 
-        } else if (i == end_block) {
-            // Read from start of the block
-            for (j = 0; j < end_idx; j++) {
-                buf[byte_count] = data_block->data[j];
-                byte_count += 1;
-            } 
-        } else {
-            // Read whole block
-            // Read from start of the block
-            for (j = 0; j < BLOCK_SIZE; j++) {
-                buf[byte_count] = data_block->data[j];
-                byte_count += 1;
-            } 
-        }
     }
+    for (i = 0; i < n_bufs; i++) {
+        bufs[i] = buf + i * BLOCK_SIZE;
+    }
+    lba = (1 + s->fs->n_inode + file->idx_block[first]) * BLOCK_SECTORS + offset % BLOCK_SIZE / ATA_SECTOR_SIZE;
+    if (0 != ata_read_async(s->fs->dev, lba, bufs, n_bufs, BLOCK_SECTORS, done)) {
+        return -1;
+    }
+    return offset % ATA_SECTOR_SIZE;
+}
 
-    return byte_count;
+/* 
+ * stream_close
+ *   DESCRIPTION: give back what stream_open held
+ *   INPUTS: s - the stream
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void stream_close(stream_t* s) {
+    brelse(s->inode_buf);
+    s->inode_buf = NULL;
 }
 
 /*-------------------- Wrapper functions --------------------*/ 
@@ -251,36 +874,176 @@ int32_t file_open(const uint8_t* filename) {
  */
 int32_t file_read(int32_t fd, void* buf, int32_t nbytes) {
 
-    uint32_t idx_inode;     // index of inode block
-    uint32_t offset;        // starting address in file
+    file_des_t* file;       // the descriptor, holds the block cursor
+    ece391_fs_t* fs;        // the image the file is in
     uint32_t f_size;        // file size
-    int32_t length;         // length of reading
+    uint32_t blk;           // block of the file that file_pos is in
+    uint32_t start;         // index of file_pos within the cursor extent
+    int32_t length = 0;     // length of reading
+    int32_t chunk;          // bytes taken from the current block
 
-    if (buf == NULL) {
+    if (buf == NULL || nbytes < 0 || fd < 0 || fd >= N_FILES) {
         return -1;
     }
 
     // Find the pcb
     // pcb* cur_pcb = (pcb*)(_8MB_ - _8KB_*(pid+1));
     pcb* cur_pcb = get_pcb_ptr(pid);
+    file = &cur_pcb->file_array[fd];
 
     // Calculate parameters
-    idx_inode = cur_pcb->file_array[fd].idx_inode;
-    offset = cur_pcb->file_array[fd].file_pos;
-    f_size = p_inode[idx_inode].length;
-    if (offset + nbytes > f_size) {
-        nbytes = f_size - offset;
+    fs = (ece391_fs_t*)file->vnode->mnt->sb;
+    f_size = file->vnode->size;
+    if (file->file_pos >= f_size) {
+        return 0;
+    }
+    if (nbytes > f_size - file->file_pos) {
+        nbytes = f_size - file->file_pos;
     }
 
-    // Read the file
-    length = read_data(idx_inode, offset, (uint8_t*)buf, nbytes);
-    if (length >= 0) {
-        cur_pcb->file_array[fd].file_pos += length;
+    // On a disk the buffer cache keeps the blocks, there is no cursor
+    if (fs->base == NULL) {
+        length = fs_read(fs, file->idx_inode, file->file_pos, (uint8_t*)buf, nbytes);
+        if (length > 0) {
+            file->file_pos += length;
+        }
+        return length;
+    }
+
+    // Read the file, continuing in the extent the last read ended in
+    while (length < nbytes) {
+        blk = file->file_pos / BLOCK_SIZE;
+        if (file->blk_ptr == NULL || blk < file->blk_idx || blk >= file->blk_idx + file->blk_run) {
+            file->blk_ptr = _file_extent_(fs, file->idx_inode, blk, &file->blk_run);
+            if (file->blk_ptr == NULL) {
+                return (length > 0) ? length : -1;
+            }
+            file->blk_idx = blk;
+        }
+        start = file->file_pos - file->blk_idx * BLOCK_SIZE;
+        chunk = file->blk_run * BLOCK_SIZE - start;
+        if (chunk > nbytes - length) {
+            chunk = nbytes - length;
+        }
+        memcpy((uint8_t*)buf + length, file->blk_ptr->data + start, chunk);
+        length += chunk;
+        file->file_pos += chunk;
     }
     
     return length;
 }
 
+/* 
+ * file_pread
+ *   DESCRIPTION: read content of file at a given offset, file_pos is unchanged
+ *   INPUTS: fd - file discriptor
+ *           buf - store the content of reading
+ *           nbytes - number of bytes to read
+ *           offset - starting index (in byte) of reading
+ *   OUTPUTS: nbytes of file contents
+ *   RETURN VALUE: number of bytes read, -1 if anything bad happened
+ *   SIDE EFFECTS: none 
+ */
+int32_t file_pread(int32_t fd, void* buf, int32_t nbytes, int32_t offset) {
+    pcb* cur_pcb = get_pcb_ptr(pid);
+    file_des_t* file = &cur_pcb->file_array[fd];
+    return fs_read((ece391_fs_t*)file->vnode->mnt->sb, file->idx_inode, offset, (uint8_t*)buf, nbytes);
+}
+
+/* 
+ * file_seek
+ *   DESCRIPTION: move file_pos of a regular file
+ *   INPUTS: fd - file discriptor
+ *           offset - new position relative to whence
+ *           whence - SEEK_SET, SEEK_CUR or SEEK_END
+ *   OUTPUTS: none
+ *   RETURN VALUE: the new position, -1 if it is outside [0, file size]
+ *   SIDE EFFECTS: the block cursor is reloaded by the next file_read if needed
+ */
+int32_t file_seek(int32_t fd, int32_t offset, int32_t whence) {
+    pcb* cur_pcb = get_pcb_ptr(pid);
+    file_des_t* file = &cur_pcb->file_array[fd];
+    int32_t f_size = file->vnode->size;
+    int32_t pos;
+
+    switch (whence) {
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            pos = file->file_pos + offset;
+            break;
+        case SEEK_END:
+            pos = f_size + offset;
+            break;
+        default:
+            return -1;
+    }
+    if (pos < 0 || pos > f_size) {
+        return -1;
+    }
+    file->file_pos = pos;
+    return pos;
+}
+
+/* 
+ * file_mmap
+ *   DESCRIPTION: map a file into the mmap area of the current process. Every
+ *                data block gets its own 4KB page, so the blocks do not need
+ *                to be contiguous in the image; they are mapped read-only in
+ *                place. Only if the image is not page aligned is the file
+ *                copied into the private copy pages of the process instead.
+ *   INPUTS: fd - file discriptor (already checked)
+ *           start - where to store the address of the mapping
+ *   OUTPUTS: *start is set
+ *   RETURN VALUE: length of the file, -1 if the area is full
+ *   SIDE EFFECTS: changes the page table of the mmap area
+ */
+int32_t file_mmap(int32_t fd, void** start) {
+
+    pcb* cur_pcb = get_pcb_ptr(pid);
+    ece391_fs_t* fs = (ece391_fs_t*)cur_pcb->file_array[fd].vnode->mnt->sb;
+    uint32_t inode = cur_pcb->file_array[fd].idx_inode;
+    uint32_t f_size = cur_pcb->file_array[fd].vnode->size;
+    uint32_t n_pages = (f_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t first = cur_pcb->mmap_next;
+    int32_t copy = fs->base == NULL || ((uint32_t)fs->base & (BLOCK_SIZE - 1)) != 0;
+    uint8_t* addr = (uint8_t*)(MMAP_ADDR + first * BLOCK_SIZE);
+    data_block_t* data_block = NULL;
+    uint32_t run = 0;
+    uint32_t i;
+
+    if (first + n_pages > (copy ? MMAP_COPY_PAGES : PT_SIZE)) {
+        return -1;
+    }
+
+    for (i = 0; i < n_pages; i++) {
+        if (copy) {
+            paging_set_mmap_page(pid, first + i, MMAP_COPY_PHYS + (pid * MMAP_COPY_PAGES + first + i) * BLOCK_SIZE, 1);
+        } else {
+            // one inode walk per extent, then the pages of it in a row
+            if (run == 0) {
+                data_block = _file_extent_(fs, inode, i, &run);
+                if (data_block == NULL) {
+                    return -1;
+                }
+            }
+            paging_set_mmap_page(pid, first + i, (uint32_t)data_block++, 0);
+            run--;
+        }
+    }
+    TLB_flush();
+
+    // the copy pages are now mapped at addr
+    if (copy && fs_read(fs, inode, 0, addr, f_size) != f_size) {
+        return -1;
+    }
+
+    cur_pcb->mmap_next = first + n_pages;
+    *start = addr;
+    return f_size;
+}
+
 /* 
  * file_write
  *   DESCRIPTION: write content to file (but should do nothing in this mp)
@@ -331,8 +1094,7 @@ int32_t direct_open(const uint8_t* directname) {
  */
 int32_t direct_read(int32_t fd, void* buf, int32_t nbytes) {
 
-    struct dentry_t temp;   // store temp dentry in loop
-    int8_t* string = buf;
+    uint8_t name[STR_LEN + 1];  // name of the entry
 
     if (buf == NULL) {
         return -1;
@@ -342,15 +1104,15 @@ int32_t direct_read(int32_t fd, void* buf, int32_t nbytes) {
     // pcb* cur_pcb = (pcb*)(_8MB_ - _8KB_*(pid+1));
     pcb* cur_pcb = get_pcb_ptr(pid);
     
-    if (0 != read_dentry_by_index(cur_pcb->file_array[fd].file_pos, &temp)) {
+    // Ask the file system of the directory
+    if (0 != vfs_readdir(cur_pcb->file_array[fd].vnode, cur_pcb->file_array[fd].file_pos, name)) {
         return 0;
     }
     
     cur_pcb->file_array[fd].file_pos += 1;
 
     // Read file name
-    strncpy((int8_t*)buf, (int8_t*)temp.f_name, 33);
-    string[32] = '\0';
+    strncpy((int8_t*)buf, (int8_t*)name, 33);
 
     return strlen(buf);
 }
@@ -393,8 +1155,6 @@ int32_t direct_close(int32_t fd) {
  *   SIDE EFFECTS: none
  */
 int32_t get_file_size(uint32_t inode) {
-    if (inode >= n_inode_b)
-        return -1;
-    return p_inode[inode].length;
+    return fs_size(&boot_fs, inode);
 }
 
@@ -3,20 +3,59 @@
 
 #include "types.h"
 #include "sys_calls.h"
+#include "vfs.h"
+#include "bcache.h"
+#include "./dev/ata.h"
+
+#define ECE391_ROOT 0           // ino of the root directory (the "." entry)
+
+/* One ece391 image, either the boot module in memory or on a disk */
+typedef struct ece391_fs_t {
+    uint32_t    n_dentry;
+    uint32_t    n_inode;
+    uint32_t    n_data_block;
+    uint8_t*    base;           // the image, NULL if it is on a disk
+    int32_t     dev;            // its ATA drive otherwise
+} ece391_fs_t;
+
+#define STREAM_FETCH_MAX    (ATA_MAX_PRD * BLOCK_SIZE)  // see stream_fetch
+
+/* A file the players read from a softirq or tasklet, see stream_read */
+typedef struct stream_t {
+    ece391_fs_t*    fs;
+    uint32_t        inode;
+    uint32_t        length;
+    buf_t*          inode_buf;  // inode of a disk file, NULL on the boot image
+} stream_t;
 
 // Starting address of file system
 uint32_t file_sys_addr;
 
+extern fs_ops_t ece391_ops;
+
 // Function declarations
 void filesys_init();
+int32_t filesys_mount_disk(int32_t dev, const int8_t* path);
+
+/* The boot image, mounted at "/" */
 int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry);
 int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry);
 int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length);
 
+/* Either image, without waiting for the disk from a softirq */
+int32_t stream_open(const uint8_t* fname, stream_t* s);
+int32_t stream_read(stream_t* s, uint32_t offset, uint8_t* buf, uint32_t length);
+uint8_t* stream_map(stream_t* s, uint32_t offset, uint32_t length);
+int32_t stream_fetch(stream_t* s, uint32_t offset, uint32_t length, uint8_t* buf, void (*done)(int32_t ret));
+void stream_close(stream_t* s);
+
 int32_t file_open(const uint8_t* filename);
 int32_t file_read(int32_t fd, void* buf, int32_t nbytes);
 int32_t file_write(int32_t fd, const void* buf, int32_t nbytes);
 int32_t file_close(int32_t fd);
+int32_t file_pread(int32_t fd, void* buf, int32_t nbytes, int32_t offset);
+int32_t file_seek(int32_t fd, int32_t offset, int32_t whence);
+int32_t file_mmap(int32_t fd, void** start);
 
 int32_t direct_open(const uint8_t* directname);
 int32_t direct_read(int32_t fd, void* buf, int32_t nbytes);
@@ -11,16 +11,28 @@
 #include "mouse.h"
 #include "./dev/sound.h"
 #include "ModeX.h"
+#include "./dev/apic.h"
+#include "./dev/uart.h"
+#include "./dev/ata.h"
+#include "softirq.h"
+#include "irqstat.h"
+#include "prof.h"
+#include "trace.h"
+#include "clock.h"
 extern int32_t in_modex;
 /*
  * irq_handler
- *   DESCRIPTION: save registers and pass control to a interrupt handler specified by irq_vect
- *   INPUTS: irq_num - index of interrupt in IDT
+ *   DESCRIPTION: save registers and pass control to a interrupt handler specified by irq_vect;
+ *                the handler is the top half, its bottom half runs from irq_exit
+ *   INPUTS: frame - the saved registers, frame->vect is the index of interrupt in IDT
+ *           entry_tsc - TSC when common_irq was entered
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: excute interrupt handler
  */
-void irq_handler(int irq_vect) {
+void irq_handler(irq_frame_t* frame, uint64_t entry_tsc) {
+    int irq_vect = frame->vect;
+    uint64_t start;
     /* Enable interrupt */
     // asm volatile("sti");
 
@@ -29,12 +41,16 @@ void irq_handler(int irq_vect) {
 
     /* For CP1, just print the message */
     cli();
+    irqoff_enter(IRQOFF_STI);       /* interrupts were on until the gate */
+    trace(TRACE_IRQ_ENTRY, irq_vect, 0, 0);
+    start = rdtsc();
     switch (irq_vect) {
         case IRQ_NMI_Interrupt:
             printf("INTERRUPT #0x%x: NMI Interrupt\n", irq_vect);
             break;
         case IRQ_Timer_Chip:
 //            printf("INTERRUPT #0x%x: Timer Chip\n", irq_vect);
+            prof_sample(frame);
             pit_handler();
             break;
         case IRQ_Keyboard:
@@ -42,35 +58,39 @@ void irq_handler(int irq_vect) {
             keyboard_handler();
             break;
         case IRQ_Serial_Port :
-            printf("INTERRUPT #0x%x: Serial Port\n", irq_vect);
+            uart_handler();
             break;
         case IRQ_Real_Time_Clock:
             //printf("INTERRUPT #0x%x: Real Time Clock\n", irq_vect);
             #if TEST_RTC==1
-            
-            if (in_modex){
-                refresh_bar(NULL, NULL, NULL);
-            }
             rtc_handler();
             #endif
             break;
         case IRQ_Eth0:
-            printf("INTERRUPT #0x%x: Eth0\n", irq_vect);
+            klog("INTERRUPT #0x%x: Eth0\n", irq_vect);
             break;
         case IRQ_PS2_Mouse:
             mouse_irq_handler();
             break;
         case IRQ_Ide0:
-            printf("INTERRUPT #0x%x: Ide0\n", irq_vect);
+            ata_handler();
             break;
         case IRQ_sb16:
             // printf("INTERRUPT #0x%x: SB16\n", irq_vect);
             sb16_handler();
             break;
+        case IRQ_Lapic_Timer:
+            prof_sample(frame);
+            lapic_timer_handler();
+            break;
         default:
-            printf("INTERRUPT #0x%x: not defined\n", irq_vect);
+            klog("INTERRUPT #0x%x: not defined\n", irq_vect);
             break;
     }
+    irq_stat_handler(irq_vect, entry_tsc, start, rdtsc());
+    /* top half done, run the deferred work with interrupts on */
+    irq_exit();
+    trace(TRACE_IRQ_EXIT, irq_vect, 0, 0);
     sti();
     return;
 }
@@ -5,7 +5,21 @@
 #ifndef HANDLERS_H
 #define HANDLERS_H
 
+#include "types.h"
+
+/* What asm_irq_linkage leaves on the stack, then the frame the CPU
+ * pushed; esp and ss only follow when the interrupt came from user mode */
+typedef struct __attribute__((packed)) irq_frame_t {
+    uint32_t vect;
+    uint32_t saved_eflags;
+    uint32_t ebx, ecx, edx, esi, edi, ebp, eax;
+    uint16_t ds, es, fs;
+    uint32_t eip;
+    uint32_t cs;
+    uint32_t eflags;
+} irq_frame_t;
+
 /* Save registers and pass control to a interrupt handler specified by irq_vect */
-extern void irq_handler(int irq_vect);
+extern void irq_handler(irq_frame_t* frame, uint64_t entry_tsc);
 
 #endif
@@ -9,6 +9,8 @@
 #include "asm_linkage.h"
 #include "sys_calls.h"
 #include "ModeX.h"
+#include "trace.h"
+#include "./dev/apic.h"
 
 
 
@@ -59,6 +61,7 @@ IDT_exp_entry(excp_General_Protection, EXCP_General_Protection, "General Protect
 void excp_Page_Fault_in_C(int32_t CR2, int32_t error_code, int32_t return_eip) {                               
     /* Suppress all interrupts (just in case) */ 
     asm volatile("cli");                      
+    trace(TRACE_PAGE_FAULT, CR2, error_code, return_eip);
     /* blue_screen(); */ 
     set_text_mode_3(0);
     printf("===============================================================================\n");   
@@ -152,9 +155,37 @@ void idt_init() {
     SET_IDT_ENTRY(idt[44], irq_PS2_Mouse);
     SET_IDT_ENTRY(idt[46], irq_Ide0);
     SET_IDT_ENTRY(idt[0x25], irq_sb16);
+    SET_IDT_ENTRY(idt[0x30], irq_Lapic_Timer);
+    SET_IDT_ENTRY(idt[LAPIC_SPURIOUS_VEC], irq_Lapic_Spurious);
     
     /* Set system call vector (0x80) */
     SET_IDT_ENTRY(idt[0x80], asm_sys_linkage);
+
+    /* Fast path next to int 0x80 */
+    sysenter_init();
+}
+
+/*
+ * sysenter_init
+ *   DESCRIPTION: set up the MSRs used by SYSENTER/SYSEXIT. SYSEXIT derives the
+ *                user selectors from KERNEL_CS (+16 = USER_CS, +24 = USER_DS),
+ *                which matches our GDT. The stack MSR points at tss.esp0 rather
+ *                than at a stack, so it never has to change on a task switch.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes MSRs; does nothing if the CPU lacks SYSENTER
+ */
+void sysenter_init() {
+    uint32_t eax, ebx, ecx, edx;
+
+    asm volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    if (!(edx & CPUID_SEP))
+        return;
+
+    asm volatile ("wrmsr" : : "c"(MSR_SYSENTER_CS), "a"(KERNEL_CS), "d"(0));
+    asm volatile ("wrmsr" : : "c"(MSR_SYSENTER_ESP), "a"((uint32_t)&tss.esp0), "d"(0));
+    asm volatile ("wrmsr" : : "c"(MSR_SYSENTER_EIP), "a"((uint32_t)asm_sysenter_linkage), "d"(0));
 }
 
 
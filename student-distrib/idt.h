@@ -5,10 +5,17 @@
 #define EXCP_NUM 20
 #define SYS_CALL_ID 0x80
 
+/* MSRs for the SYSENTER fast system call path */
+#define MSR_SYSENTER_CS     0x174
+#define MSR_SYSENTER_ESP    0x175
+#define MSR_SYSENTER_EIP    0x176
+#define CPUID_SEP           0x800   /* CPUID.1:EDX bit 11 */
+
 #define RETURN_FROM_EXP 0xFF    // indicating halt system call that it is called by an exception handler
 
 #ifndef ASM
     void idt_init();
+    void sysenter_init();
 #endif
 
 #endif
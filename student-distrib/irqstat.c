@@ -0,0 +1,443 @@
+/* irqstat.c - Interrupt latency, interrupts-off and system call instrumentation
+ * vim:ts=4 noexpandtab
+ */
+
+#include "irqstat.h"
+#include "lib.h"
+#include "x86_desc.h"
+#include "clock.h"
+#include "sys_calls.h"
+
+extern int32_t pid;
+
+/* global section */
+irq_stat_t irq_stats[IRQ_LINES];
+uint32_t syscall_counts[SYSCALL_SLOTS];
+
+static uint32_t timer_late_max = 0;        /* us past the programmed clock event */
+
+#if IRQ_INSTRUMENT
+static uint64_t irqoff_start = 0;           /* 0: not in a tracked section */
+static uint32_t irqoff_max = 0;
+static const char* irqoff_file = "";
+static int32_t irqoff_line = 0;
+static int32_t irqoff_nr = 0;               /* system call of the open section */
+#endif
+
+static const char* irq_names[IRQ_LINES] = {
+    "pit", "kbd", "cascade", "com2", "com1", "sb16", "fdc", "lpt1",
+    "rtc", "irq9", "irq10", "irq11", "mouse", "fpu", "ide0", "ide1", "lapic"
+};
+
+/* in call_table order */
+static const char* syscall_names[SYSCALL_SLOTS] = {
+    "null", "halt", "execute", "read", "write", "open", "close", "getargs",
+    "vidmap", "set_handler", "sigreturn", "readv", "writev", "io_enter",
+    "pread", "lseek", "mmap", "sleep", "gettime"
+};
+
+/* the report for readers of the special file, rendered at offset 0, and
+ * the one for the debug hotkey */
+static int8_t irqstat_text[IRQSTAT_TEXT_SIZE];
+static int32_t irqstat_len = 0;
+static int8_t print_text[IRQSTAT_TEXT_SIZE];
+
+/*
+ * irq_line
+ *   DESCRIPTION: map an IDT vector to its row in irq_stats
+ *   INPUTS: irq_vect -- the vector
+ *   OUTPUTS: none
+ *   RETURN VALUE: the row, -1 if the vector is not a device IRQ
+ *   SIDE EFFECTS: none
+ */
+static int32_t irq_line(int32_t irq_vect){
+    if (irq_vect >= IRQ_Timer_Chip && irq_vect < IRQ_Timer_Chip + 16)
+        return irq_vect - IRQ_Timer_Chip;
+    if (irq_vect == IRQ_Lapic_Timer)
+        return IRQ_LINE_LAPIC;
+    return -1;
+}
+
+/*
+ * cyc2ns32
+ *   DESCRIPTION: cycles to nanoseconds, saturated to 32 bits
+ *   INPUTS: cyc -- the interval
+ *   OUTPUTS: none
+ *   RETURN VALUE: nanoseconds
+ *   SIDE EFFECTS: none
+ */
+static uint32_t cyc2ns32(uint64_t cyc){
+    uint64_t ns = clock_cyc2ns(cyc);
+
+    return (ns > 0xFFFFFFFFULL) ? 0xFFFFFFFF : (uint32_t)ns;
+}
+
+/*
+ * irq_stat_handler
+ *   DESCRIPTION: account one run of a device handler (the top half)
+ *   INPUTS: irq_vect -- the vector
+ *           entry -- TSC at common_irq entry
+ *           start / end -- TSC around the handler
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called from irq_handler with interrupts off
+ */
+void irq_stat_handler(int32_t irq_vect, uint64_t entry, uint64_t start, uint64_t end){
+    int32_t line = irq_line(irq_vect), bucket = 0;
+    irq_stat_t* s;
+    uint32_t cyc, us;
+
+    if (!IRQ_INSTRUMENT || line < 0)
+        return;
+    s = &irq_stats[line];
+    cyc = (uint32_t)(end - start);
+    if (s->count == 0 || cyc < s->min)
+        s->min = cyc;
+    if (cyc > s->max)
+        s->max = cyc;
+    if ((uint32_t)(start - entry) > s->max_entry)
+        s->max_entry = (uint32_t)(start - entry);
+    s->sum += cyc;
+    s->count++;
+
+    us = cyc2ns32(cyc) >> 10;       /* ~us, cheaper than a divide */
+    while (us != 0 && bucket < IRQ_HIST_BUCKETS - 1){
+        us >>= 1;
+        bucket++;
+    }
+    s->hist[bucket]++;
+}
+
+/*
+ * irq_stat_exit
+ *   DESCRIPTION: account the whole interrupt, from common_irq entry to the
+ *                return to it, softirqs and nested interrupts included. The
+ *                argument order is the one common_irq leaves on the stack
+ *   INPUTS: exit_tsc -- TSC after irq_handler returned
+ *           frame -- the saved registers, with the vector
+ *           entry_tsc -- TSC at common_irq entry
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called from common_irq
+ */
+void irq_stat_exit(uint64_t exit_tsc, irq_frame_t* frame, uint64_t entry_tsc){
+    int32_t line = irq_line(frame->vect);
+    uint32_t flags, cyc = (uint32_t)(exit_tsc - entry_tsc);
+
+    if (!IRQ_INSTRUMENT || line < 0)
+        return;
+    cli_and_save(flags);
+    if (cyc > irq_stats[line].max_total)
+        irq_stats[line].max_total = cyc;
+    restore_flags(flags);
+}
+
+/*
+ * irq_stat_timer_late
+ *   DESCRIPTION: account how late a clock event came in
+ *   INPUTS: us -- clock_us() in the handler minus the programmed deadline
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called from the clock top half
+ */
+void irq_stat_timer_late(uint32_t us){
+    if (us > timer_late_max)
+        timer_late_max = us;
+}
+
+/*
+ * irq_stats_reset
+ *   DESCRIPTION: clear every counter
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void irq_stats_reset(void){
+    uint32_t flags;
+
+    cli_and_save(flags);
+    memset(irq_stats, 0, sizeof(irq_stats));
+    memset(syscall_counts, 0, sizeof(syscall_counts));
+    timer_late_max = 0;
+#if IRQ_INSTRUMENT
+    irqoff_max = 0;
+    irqoff_file = "";
+    irqoff_line = 0;
+#endif
+    restore_flags(flags);
+}
+
+#if IRQ_INSTRUMENT
+/*
+ * irqoff_enter
+ *   DESCRIPTION: start timing a section if it turned interrupts off
+ *   INPUTS: flags -- EFLAGS from before the cli
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called with interrupts off
+ */
+void irqoff_enter(uint32_t flags){
+    if (flags & EFLAGS_IF)
+        irqoff_start = rdtsc();
+}
+
+/*
+ * irqoff_exit
+ *   DESCRIPTION: end a section that turns interrupts back on and keep it if
+ *                it is the longest so far
+ *   INPUTS: flags -- the EFLAGS about to be restored
+ *           file / line -- where
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called with interrupts off
+ */
+void irqoff_exit(uint32_t flags, const char* file, int32_t line){
+    uint32_t cyc;
+
+    if (!(flags & EFLAGS_IF) || irqoff_start == 0)
+        return;
+    cyc = (uint32_t)(rdtsc() - irqoff_start);
+    irqoff_start = 0;
+    if (cyc > irqoff_max){
+        irqoff_max = cyc;
+        irqoff_file = file;
+        irqoff_line = line;
+    }
+}
+
+/*
+ * irqoff_idle
+ *   DESCRIPTION: forget the open section, cpu_idle turns interrupts on
+ *                before halting so the time asleep is not interrupts off
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void irqoff_idle(void){
+    irqoff_start = 0;
+}
+
+/*
+ * irqoff_syscall
+ *   DESCRIPTION: start a section at a system call gate, which turned
+ *                interrupts off in user code that had them on
+ *   INPUTS: nr -- the call number, reported if the section is the longest
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called from asm_sys_linkage / asm_sysenter_linkage
+ */
+void irqoff_syscall(int32_t nr){
+    irqoff_nr = nr;
+    irqoff_start = rdtsc();
+}
+
+/*
+ * irqoff_sysret
+ *   DESCRIPTION: end the section still open when a system call returns to
+ *                user code, whose iret or sysexit turns interrupts on
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called from the system call linkage with interrupts off
+ */
+void irqoff_sysret(void){
+    irqoff_exit(IRQOFF_STI, "syscall", irqoff_nr);
+}
+#endif
+
+/* Text output into a bounded buffer */
+static int8_t* out_buf;
+static int32_t out_len, out_size;
+
+/*
+ * put_str
+ *   DESCRIPTION: append a string, dropping what does not fit
+ *   INPUTS: s -- the string
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: advances out_len
+ */
+static void put_str(const char* s){
+    while (*s != '\0' && out_len < out_size)
+        out_buf[out_len++] = *s++;
+}
+
+/*
+ * put_num
+ *   DESCRIPTION: append a decimal number right aligned in width columns
+ *   INPUTS: value -- the number
+ *           width -- the column width, 0 for none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: advances out_len
+ */
+static void put_num(uint32_t value, int32_t width){
+    int8_t num[12];
+    int32_t pad;
+
+    itoa(value, num, 10);
+    for (pad = width - (int32_t)strlen(num); pad > 0; pad--)
+        put_str(" ");
+    put_str((char*)num);
+}
+
+/*
+ * irq_stats_render
+ *   DESCRIPTION: write the report: one line per IRQ seen with its count,
+ *                handler min / avg / max, worst entry-to-handler and
+ *                entry-to-exit times and the histogram, then the longest
+ *                interrupts-off section, the worst clock event lateness and
+ *                a "syscalls:" line of name=count for every call made
+ *   INPUTS: buf -- where to write
+ *           size -- room in buf
+ *   OUTPUTS: the text in buf, not terminated
+ *   RETURN VALUE: bytes written
+ *   SIDE EFFECTS: none
+ */
+int32_t irq_stats_render(int8_t* buf, int32_t size){
+    static irq_stat_t snap[IRQ_LINES];
+    static uint32_t calls[SYSCALL_SLOTS];
+    uint32_t flags, late;
+    int32_t line, b;
+#if IRQ_INSTRUMENT
+    uint32_t off_max;
+    int32_t off_line;
+    const char* off_file;
+#endif
+
+    /* copy first so a line is consistent with itself */
+    cli_and_save(flags);
+    memcpy(snap, irq_stats, sizeof(snap));
+    memcpy(calls, syscall_counts, sizeof(calls));
+    late = timer_late_max;
+#if IRQ_INSTRUMENT
+    off_max = irqoff_max;
+    off_file = irqoff_file;
+    off_line = irqoff_line;
+#endif
+    restore_flags(flags);
+
+    out_buf = buf;
+    out_len = 0;
+    out_size = size;
+
+    put_str("irq         count  min_ns  avg_ns  max_ns entry_ns total_ns | <1us then x2\n");
+    for (line = 0; line < IRQ_LINES; line++){
+        if (snap[line].count == 0)
+            continue;
+        put_num(line, 2);
+        put_str(" ");
+        put_str(irq_names[line]);
+        put_num(snap[line].count, 16 - strlen((int8_t*)irq_names[line]));
+        put_num(cyc2ns32(snap[line].min), 8);
+        put_num(cyc2ns32(div64_32(snap[line].sum, snap[line].count)), 8);
+        put_num(cyc2ns32(snap[line].max), 8);
+        put_num(cyc2ns32(snap[line].max_entry), 9);
+        put_num(cyc2ns32(snap[line].max_total), 9);
+        put_str(" |");
+        for (b = 0; b < IRQ_HIST_BUCKETS; b++){
+            put_str(" ");
+            put_num(snap[line].hist[b], 0);
+        }
+        put_str("\n");
+    }
+#if IRQ_INSTRUMENT
+    put_str("longest interrupts off: ");
+    put_num(cyc2ns32(off_max), 0);
+    put_str(" ns at ");
+    put_str(off_file);
+    put_str(":");
+    put_num(off_line, 0);
+    put_str("\n");
+#endif
+    put_str("clock event late by up to ");
+    put_num(late, 0);
+    put_str(" us\n");
+    put_str("syscalls:");
+    for (b = 1; b < SYSCALL_SLOTS; b++){
+        if (calls[b] == 0)
+            continue;
+        put_str(" ");
+        put_str(syscall_names[b]);
+        put_str("=");
+        put_num(calls[b], 0);
+    }
+    put_str("\n");
+    return out_len;
+}
+
+/*
+ * irq_stats_print
+ *   DESCRIPTION: print the report on the screen, for the debug hotkey
+ *   INPUTS: none
+ *   OUTPUTS: the report on the screen
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void irq_stats_print(void){
+    int32_t len = irq_stats_render(print_text, IRQSTAT_TEXT_SIZE - 1);
+
+    print_text[len] = '\0';
+    puts(print_text);
+}
+
+/*
+ * irqstat_read
+ *   DESCRIPTION: read the report; it is rendered when a read starts at
+ *                offset 0, so reading to the end gives one snapshot
+ *   INPUTS: fd -- the file descriptor
+ *           buf -- where to copy
+ *           nbytes -- how many bytes at most
+ *   OUTPUTS: the text in buf
+ *   RETURN VALUE: bytes copied, 0 at the end of the report
+ *   SIDE EFFECTS: advances file_pos
+ */
+int32_t irqstat_read(int32_t fd, void* buf, int32_t nbytes){
+    file_des_t* f = &get_pcb_ptr(pid)->file_array[fd];
+    int32_t n;
+
+    if (buf == NULL || nbytes < 0)
+        return SYS_CALL_FAIL;
+    if (f->file_pos == 0)
+        irqstat_len = irq_stats_render(irqstat_text, IRQSTAT_TEXT_SIZE);
+    if (f->file_pos >= (uint32_t)irqstat_len)
+        return 0;
+    n = irqstat_len - f->file_pos;
+    if (n > nbytes)
+        n = nbytes;
+    memcpy(buf, irqstat_text + f->file_pos, n);
+    f->file_pos += n;
+    return n;
+}
+
+/*
+ * irqstat_write
+ *   DESCRIPTION: clear the counters, whatever is written
+ *   INPUTS: fd / buf -- ignored
+ *           nbytes -- the size of the write
+ *   OUTPUTS: none
+ *   RETURN VALUE: nbytes
+ *   SIDE EFFECTS: resets irq_stats
+ */
+int32_t irqstat_write(int32_t fd, const void* buf, int32_t nbytes){
+    irq_stats_reset();
+    return nbytes;
+}
+
+/*
+ * irqstat_open / irqstat_close
+ *   DESCRIPTION: nothing to set up or release
+ *   INPUTS: fname / fd -- ignored
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: none
+ */
+int32_t irqstat_open(const uint8_t* fname){
+    return 0;
+}
+
+int32_t irqstat_close(int32_t fd){
+    return 0;
+}
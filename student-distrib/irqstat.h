@@ -0,0 +1,78 @@
+/* irqstat.h - Interrupt latency, interrupts-off and system call instrumentation
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _IRQSTAT_H
+#define _IRQSTAT_H
+
+/* 0 compiles the interrupts-off hooks out of cli()/sti(), cli_and_save /
+ * restore_flags and the kernel entries; the per-IRQ hooks are still
+ * called but return at once */
+#define IRQ_INSTRUMENT      1
+
+#define IRQOFF_STI          0x200   /* EFLAGS.IF, the flags sti() leaves */
+
+#ifndef ASM
+
+#include "types.h"
+#include "handlers.h"
+
+/* Per-IRQ histograms of the time spent in the device handler with
+ * interrupts off: bucket 0 is < 1us, bucket k is [2^(k-1), 2^k) us, the
+ * last one takes everything longer */
+#define IRQ_LINES           17      /* the 16 PIC lines and the local APIC timer */
+#define IRQ_LINE_LAPIC      16
+#define IRQ_HIST_BUCKETS    12
+
+#define IRQSTAT_TEXT_SIZE   2048    /* rendered report */
+
+/* System calls counted by number; call_table in asm_linkage.S has
+ * SYS_LAST + 1 entries, entry 0 unused */
+#define SYSCALL_SLOTS       19
+
+/* All times in TSC cycles, converted when the report is rendered */
+typedef struct irq_stat_t {
+    uint32_t count;
+    uint32_t min, max;              /* device handler */
+    uint64_t sum;
+    uint32_t max_entry;             /* common_irq entry to handler start */
+    uint32_t max_total;             /* common_irq entry to exit, softirqs included */
+    uint32_t hist[IRQ_HIST_BUCKETS];
+} irq_stat_t;
+
+extern irq_stat_t irq_stats[IRQ_LINES];
+extern uint32_t syscall_counts[SYSCALL_SLOTS];  /* bumped by the syscall linkage */
+
+void irq_stat_handler(int32_t irq_vect, uint64_t entry, uint64_t start, uint64_t end);
+void irq_stat_exit(uint64_t exit_tsc, irq_frame_t* frame, uint64_t entry_tsc);
+void irq_stat_timer_late(uint32_t us);
+void irq_stats_reset(void);
+int32_t irq_stats_render(int8_t* buf, int32_t size);
+void irq_stats_print(void);
+
+/* The "irqstat" special file: read gives the report, any write clears it
+ * (the system call counts too) */
+int32_t irqstat_read(int32_t fd, void* buf, int32_t nbytes);
+int32_t irqstat_write(int32_t fd, const void* buf, int32_t nbytes);
+int32_t irqstat_open(const uint8_t* fname);
+int32_t irqstat_close(int32_t fd);
+
+/* Called by cli()/sti() and cli_and_save / restore_flags to find the
+ * longest section run with interrupts off; only the outermost section
+ * counts. An interrupt or system call gate starts a section as well, the
+ * system call ones end in irqoff_sysret if nothing turned interrupts on */
+#if IRQ_INSTRUMENT
+void irqoff_enter(uint32_t flags);
+void irqoff_exit(uint32_t flags, const char* file, int32_t line);
+void irqoff_idle(void);
+void irqoff_syscall(int32_t nr);
+void irqoff_sysret(void);
+#else
+#define irqoff_enter(flags)             do { } while (0)
+#define irqoff_exit(flags, file, line)  do { } while (0)
+#define irqoff_idle()                   do { } while (0)
+#endif
+
+#endif /* ASM */
+
+#endif /* _IRQSTAT_H */
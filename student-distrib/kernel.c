@@ -22,18 +22,105 @@
 #include "mouse.h"
 #include "sys_calls.h"
 #include "desktop.h"
+#include "smp.h"
+#include "clock.h"
+#include "softirq.h"
+#include "./dev/uart.h"
+#include "./dev/ata.h"
+#include "bcache.h"
+#include "vfs.h"
+#include "devfs.h"
 #define RUN_TESTS
 
 /* Macros. */
 /* Check if the bit BIT in FLAGS is set. */
 #define CHECK_FLAG(flags, bit)   ((flags) & (1 << (bit)))
 
-/* Check if MAGIC is valid and print the Multiboot information structure
-   pointed by ADDR. */
+/* Boot phases as cycles of the TSC; the rate is only known once clock_init
+ * has calibrated it, so boot_report converts them at the end */
+#define BOOT_PHASES         24
+#define BOOT_STEP(call)     do { call; boot_mark(#call); } while (0)
+
+typedef struct boot_phase_t {
+    const char* name;
+    uint32_t cyc;
+} boot_phase_t;
+
+static boot_phase_t boot_phases[BOOT_PHASES];
+static uint32_t n_boot_phases = 0;
+static uint64_t boot_start;         /* TSC on entry */
+static uint64_t boot_tsc;           /* TSC at the end of the last phase */
+
+/*
+ * boot_mark
+ *   DESCRIPTION: end a boot phase, it ran since the previous boot_mark
+ *   INPUTS: name -- what the phase did
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: phases past BOOT_PHASES are dropped
+ */
+static void boot_mark(const char* name) {
+    uint64_t now = rdtsc();
+
+    if (n_boot_phases < BOOT_PHASES) {
+        boot_phases[n_boot_phases].name = name;
+        boot_phases[n_boot_phases].cyc = (uint32_t)(now - boot_tsc);
+        n_boot_phases++;
+    }
+    boot_tsc = now;
+}
+
+/*
+ * boot_us
+ *   DESCRIPTION: convert TSC cycles to microseconds
+ *   INPUTS: cyc -- cycles
+ *   OUTPUTS: none
+ *   RETURN VALUE: microseconds, 0 without a calibrated TSC
+ *   SIDE EFFECTS: none
+ */
+static uint32_t boot_us(uint64_t cyc) {
+    uint32_t khz = clock_tsc_khz();
+
+    return khz ? (uint32_t)div64_32(cyc * 1000, khz) : 0;
+}
+
+/*
+ * boot_report
+ *   DESCRIPTION: log what the boot loader handed over and how long each
+ *                boot phase took, the slowest marked with a '*'
+ *   INPUTS: mbi -- the multiboot information
+ *   OUTPUTS: "multiboot:" and "boot:" lines in the serial log
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void boot_report(multiboot_info_t* mbi) {
+    uint32_t i, slow = 0;
+
+    klog("multiboot: flags 0x%x, mem %dKB + %dKB, %d module(s), fs at 0x%x\n",
+         mbi->flags, mbi->mem_lower, mbi->mem_upper,
+         CHECK_FLAG(mbi->flags, 3) ? mbi->mods_count : 0, file_sys_addr);
+
+    if (clock_tsc_khz() == 0) {
+        klog("boot: no TSC rate, phases not timed\n");
+        return;
+    }
+    for (i = 1; i < n_boot_phases; i++)
+        if (boot_phases[i].cyc > boot_phases[slow].cyc)
+            slow = i;
+    for (i = 0; i < n_boot_phases; i++)
+        klog("boot: %d us %s%s\n", boot_us(boot_phases[i].cyc),
+             boot_phases[i].name, i == slow ? " *" : "");
+    klog("boot: %d us total to the shell\n", boot_us(boot_tsc - boot_start));
+}
+
+/* Check if MAGIC is valid, take the file system from the Multiboot information
+   structure pointed by ADDR and bring the kernel up. */
 void entry(unsigned long magic, unsigned long addr) {
 
     multiboot_info_t *mbi;
 
+    boot_tsc = boot_start = rdtsc();
+
     /* Clear the screen. */
     clear();
 
@@ -46,74 +133,20 @@ void entry(unsigned long magic, unsigned long addr) {
     /* Set MBI to the address of the Multiboot information structure. */
     mbi = (multiboot_info_t *) addr;
 
-    /* Print out the flags. */
-    printf("flags = 0x%#x\n", (unsigned)mbi->flags);
-
-    /* Are mem_* valid? */
-    if (CHECK_FLAG(mbi->flags, 0))
-        printf("mem_lower = %uKB, mem_upper = %uKB\n", (unsigned)mbi->mem_lower, (unsigned)mbi->mem_upper);
-
-    /* Is boot_device valid? */
-    if (CHECK_FLAG(mbi->flags, 1))
-        printf("boot_device = 0x%#x\n", (unsigned)mbi->boot_device);
-
-    /* Is the command line passed? */
-    if (CHECK_FLAG(mbi->flags, 2))
-        printf("cmdline = %s\n", (char *)mbi->cmdline);
-
-    if (CHECK_FLAG(mbi->flags, 3)) {
-        int mod_count = 0;
-        int i;
+    /* Only the file system module is needed here; boot_report logs the
+     * rest to serial, on screen clear() would wipe it before the shell */
+    if (CHECK_FLAG(mbi->flags, 3) && mbi->mods_count > 0) {
+        /* mod is a pointer to the starting address of sequence of modes to
+           be loaded, the first mode is file system image */
         module_t* mod = (module_t*)mbi->mods_addr;
-
-        /* Get the starting address of file system, we know it is here becasue
-           at the printout message of terminal only one module is loaded */
-        /* Actually, mod is a pointer to the starting address of sequence
-           of modes to be loaded, the first mode is file system image */
         file_sys_addr = (uint32_t)mod->mod_start;
-
-        while (mod_count < mbi->mods_count) {
-            printf("Module %d loaded at address: 0x%#x\n", mod_count, (unsigned int)mod->mod_start);
-            printf("Module %d ends at address: 0x%#x\n", mod_count, (unsigned int)mod->mod_end);
-            printf("First few bytes of module:\n");
-            for (i = 0; i < 16; i++) {
-                printf("0x%x ", *((char*)(mod->mod_start+i)));
-            }
-            printf("\n");
-            mod_count++;
-            mod++;
-        }
     }
     /* Bits 4 and 5 are mutually exclusive! */
     if (CHECK_FLAG(mbi->flags, 4) && CHECK_FLAG(mbi->flags, 5)) {
         printf("Both bits 4 and 5 are set.\n");
         return;
     }
-
-    /* Is the section header table of ELF valid? */
-    if (CHECK_FLAG(mbi->flags, 5)) {
-        elf_section_header_table_t *elf_sec = &(mbi->elf_sec);
-        printf("elf_sec: num = %u, size = 0x%#x, addr = 0x%#x, shndx = 0x%#x\n",
-                (unsigned)elf_sec->num, (unsigned)elf_sec->size,
-                (unsigned)elf_sec->addr, (unsigned)elf_sec->shndx);
-    }
-
-    /* Are mmap_* valid? */
-    if (CHECK_FLAG(mbi->flags, 6)) {
-        memory_map_t *mmap;
-        printf("mmap_addr = 0x%#x, mmap_length = 0x%x\n",
-                (unsigned)mbi->mmap_addr, (unsigned)mbi->mmap_length);
-        for (mmap = (memory_map_t *)mbi->mmap_addr;
-                (unsigned long)mmap < mbi->mmap_addr + mbi->mmap_length;
-                mmap = (memory_map_t *)((unsigned long)mmap + mmap->size + sizeof (mmap->size)))
-            printf("    size = 0x%x, base_addr = 0x%#x%#x\n    type = 0x%x,  length    = 0x%#x%#x\n",
-                    (unsigned)mmap->size,
-                    (unsigned)mmap->base_addr_high,
-                    (unsigned)mmap->base_addr_low,
-                    (unsigned)mmap->type,
-                    (unsigned)mmap->length_high,
-                    (unsigned)mmap->length_low);
-    }
+    boot_mark("multiboot");
 
     /* Construct an LDT entry in the GDT */
     {
@@ -156,24 +189,31 @@ void entry(unsigned long magic, unsigned long addr) {
         ltr(KERNEL_TSS);
     }
 
+    boot_mark("descriptors");
+
     /* Init the PIC */
-    i8259_init();
-    pit_init();
-    sti();
-    little_star();
-    cli();
+    BOOT_STEP(i8259_init());
+    BOOT_STEP(uart_init());
+    BOOT_STEP(pit_init());
     /* Initialize devices, memory, filesystem, enable device interrupts on the
-     * PIC, any other initialization stuff... */
-    keyboard_init();
-    mouse_init();
-    rtc_init();
-    filesys_init();
-   
+     * PIC, any other initialization stuff... The mouse waits for the first
+     * desktop_open and the SB16 for the first song */
+    BOOT_STEP(keyboard_init());
+    BOOT_STEP(rtc_init());
+    BOOT_STEP(ata_init());
+    BOOT_STEP(bcache_init());
+    BOOT_STEP(vfs_init());
+    BOOT_STEP(filesys_init());
+    BOOT_STEP(devfs_init());
 
     /* Init the file operations table pointer */
-    fop_t_init();
-    scheduler_init();
-    paging_init();
+    BOOT_STEP(fop_t_init());
+    BOOT_STEP(scheduler_init());
+    BOOT_STEP(paging_init());
+    BOOT_STEP(smp_init());
+    BOOT_STEP(softirq_init());
+    BOOT_STEP(clock_init());
+    little_star();      /* plays from the timer wheel once interrupts are on */
     paging_set_always_access_VEDEO(VIRTUAL_ADDR_AlWAYS_ACCESS_VEDIO_PAGE,VIDEO);
     // printf("All Init Correctly");
 
@@ -190,6 +230,8 @@ void entry(unsigned long magic, unsigned long addr) {
     // beep(500, 50);
     // video_player((uint8_t*)"rickroll_inone.mp4");
 
+    boot_mark("rest");
+    boot_report(mbi);
     execute((uint8_t*) "shell");
     // test_play_music();
     // sti();
@@ -9,6 +9,10 @@
 #include "desktop.h"
 #include "blocks.h"
 #include "text.h"
+#include "softirq.h"
+#include "irqstat.h"
+#include "prof.h"
+#include "trace.h"
 
 #define SCANCODE_SET_SIZE 58
 #define EMP 0x0
@@ -48,6 +52,15 @@ static uint8_t alt_flag = OFF;
 
 #define SHIFT_FLAG              (l_shift_flag | r_shift_flag)
 
+/* Scancodes read by the top half, waiting for keyboard_tasklet */
+#define KBD_RING_SIZE           16
+static uint8_t kbd_ring[KBD_RING_SIZE];
+static volatile uint32_t kbd_ring_head;     // only written by keyboard_handler
+static volatile uint32_t kbd_ring_tail;     // only written by keyboard_tasklet
+static tasklet_t kbd_tasklet;
+static void keyboard_tasklet(uint32_t data);
+static void keyboard_process(uint8_t scan_code);
+
 /* Multi-Terminals */
 extern int32_t terminal_tick;
 extern int32_t terminal_display;
@@ -100,27 +113,62 @@ uint8_t scancode_to_ascii[SCANCODE_SET_SIZE][2] = {     // two ascii char for ea
  *   SIDE EFFECTS:  initialize the keyboard
  */
 void keyboard_init() {
+    tasklet_init(&kbd_tasklet, keyboard_tasklet, 0);
     enable_irq(IRQ_NUM_KEYBOARD);
 }
 
 /*
  * keyboard_handler
- *   DESCRIPTION: IRQ handler for keyboard
+ *   DESCRIPTION: IRQ handler for keyboard, top half: take the scancode off
+ *                the controller and queue it for keyboard_tasklet
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS:  convert the scancode (from port) to ascii, and pass it to terminal
+ *   SIDE EFFECTS:  drops the scancode if the ring is full
  */
 void keyboard_handler() {
-    cli();
+    uint8_t scan_code = inb(KEYBOARD_DATA_PORT);
+
+    send_eoi(IRQ_NUM_KEYBOARD);
+    if (kbd_ring_head - kbd_ring_tail >= KBD_RING_SIZE)
+        return;
+    kbd_ring[kbd_ring_head & (KBD_RING_SIZE - 1)] = scan_code;
+    kbd_ring_head++;
+    tasklet_schedule(&kbd_tasklet);
+}
 
-    uint8_t scan_code = inb(KEYBOARD_DATA_PORT);            // Store scan code from keyboard
+/*
+ * keyboard_tasklet
+ *   DESCRIPTION: bottom half, handle every queued scancode in order
+ *   INPUTS: data -- unused
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: runs with interrupts on
+ */
+static void keyboard_tasklet(uint32_t data) {
+    uint8_t scan_code;
+
+    while (kbd_ring_tail != kbd_ring_head) {
+        scan_code = kbd_ring[kbd_ring_tail & (KBD_RING_SIZE - 1)];
+        kbd_ring_tail++;
+        keyboard_process(scan_code);
+    }
+}
+
+/*
+ * keyboard_process
+ *   DESCRIPTION: convert one scancode to ascii and pass it to the terminal,
+ *                or run the key combination it completes
+ *   INPUTS: scan_code -- from the controller
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS:  updates the key flags
+ */
+static void keyboard_process(uint8_t scan_code) {
     uint8_t ascii_code;                                     // Store the corresponding ascii_code
 
     // Check for special keys
     if (spe_key_check(scan_code)) {
-        send_eoi(IRQ_NUM_KEYBOARD);
-        sti();
         return;
     }
 
@@ -140,15 +188,11 @@ void keyboard_handler() {
             default:
                 break;
         }
-        send_eoi(IRQ_NUM_KEYBOARD);
-        sti();
         return;
     }
 
     // make sure inside legit range
     if ((scan_code >= SCANCODE_SET_SIZE) || (scan_code < 0x02)){    // < 0x02 since the first two are empty
-        send_eoi(IRQ_NUM_KEYBOARD);
-        sti();
         return;
     }
 
@@ -205,6 +249,15 @@ void keyboard_handler() {
                 case 'k':
                     player_stop();
                     break;
+                case 'h':
+                    irq_stats_print();
+                    break;
+                case 'f':
+                    prof_toggle();
+                    break;
+                case 't':
+                    trace_dump();
+                    break;
                 default:
                     break;
             }
@@ -247,8 +300,6 @@ void keyboard_handler() {
             line_buf_in(ascii_code);
         }
     }
-    send_eoi(IRQ_NUM_KEYBOARD);
-    sti();
     return;
 }
 
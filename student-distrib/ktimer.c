@@ -0,0 +1,235 @@
+/* ktimer.c - Timer wheel for kernel timeouts and deferred work
+ * vim:ts=4 noexpandtab
+ */
+
+#include "ktimer.h"
+#include "clock.h"
+#include "lib.h"
+#include "spinlock.h"
+
+/* wheel[level][slot] is a list of timers; level 0 holds the timers due in
+ * the next WHEEL_SIZE ticks, one slot per tick */
+static ktimer_t* wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static uint32_t wheel_base = 0;         /* next tick ktimer_run handles */
+static uint32_t wheel_count = 0;        /* queued timers */
+static spinlock_t ktimer_lock = SPINLOCK_UNLOCKED;
+
+/*
+ * ktimer_init
+ *   DESCRIPTION: set up a timer before its first ktimer_add
+ *   INPUTS: t -- the timer
+ *           func -- called with data when it fires
+ *           data -- passed to func
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void ktimer_init(ktimer_t* t, void (*func)(uint32_t data), uint32_t data){
+    t->next = NULL;
+    t->pprev = NULL;
+    t->expires = 0;
+    t->func = func;
+    t->data = data;
+}
+
+/*
+ * ktimer_queue
+ *   DESCRIPTION: put a timer in the slot for its expiry: the lowest level
+ *                whose range from wheel_base covers it
+ *   INPUTS: t -- the timer, not queued
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: caller holds ktimer_lock
+ */
+static void ktimer_queue(ktimer_t* t){
+    uint32_t delta = t->expires - wheel_base;
+    uint32_t level = 0, slot;
+    ktimer_t** head;
+
+    if ((int32_t)delta < 0){
+        /* already due, run it on the next tick */
+        t->expires = wheel_base;
+        delta = 0;
+    }
+    if (delta > WHEEL_MAX_DELAY){
+        t->expires = wheel_base + WHEEL_MAX_DELAY;
+        delta = WHEEL_MAX_DELAY;
+    }
+    while (delta >= (1U << (WHEEL_BITS * (level + 1))))
+        level++;
+    slot = (t->expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+    head = &wheel[level][slot];
+    t->next = *head;
+    if (*head != NULL)
+        (*head)->pprev = &t->next;
+    *head = t;
+    t->pprev = head;
+}
+
+/*
+ * ktimer_unlink
+ *   DESCRIPTION: take a queued timer off its slot
+ *   INPUTS: t -- the timer
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: caller holds ktimer_lock
+ */
+static void ktimer_unlink(ktimer_t* t){
+    *t->pprev = t->next;
+    if (t->next != NULL)
+        t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+/*
+ * ktimer_add
+ *   DESCRIPTION: (re)arm a timer ticks ticks from now; a timer that is
+ *                already queued is moved
+ *   INPUTS: t -- the timer, from ktimer_init
+ *           ticks -- the delay, 0 for the next tick
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: makes sure the clock delivers a tick soon
+ */
+void ktimer_add(ktimer_t* t, uint32_t ticks){
+    uint32_t flags;
+    uint32_t now = clock_ticks();
+
+    spin_lock_irqsave(&ktimer_lock, flags);
+    if (t->pprev != NULL)
+        ktimer_unlink(t);
+    else
+        wheel_count++;
+    /* an empty wheel is not run, bring it up to date first */
+    if (wheel_count == 1 && (int32_t)(now - wheel_base) > 0)
+        wheel_base = now;
+    t->expires = now + ticks;
+    ktimer_queue(t);
+    spin_unlock_irqrestore(&ktimer_lock, flags);
+    clock_kick();
+}
+
+/*
+ * ktimer_del
+ *   DESCRIPTION: cancel a timer
+ *   INPUTS: t -- the timer
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if it was queued, 0 if it had fired or never been added
+ *   SIDE EFFECTS: none
+ */
+int32_t ktimer_del(ktimer_t* t){
+    uint32_t flags;
+    int32_t queued = 0;
+
+    spin_lock_irqsave(&ktimer_lock, flags);
+    if (t->pprev != NULL){
+        ktimer_unlink(t);
+        wheel_count--;
+        queued = 1;
+    }
+    spin_unlock_irqrestore(&ktimer_lock, flags);
+    return queued;
+}
+
+/*
+ * ktimer_cascade
+ *   DESCRIPTION: when level 0 wraps, spread the next slot of level 1 over
+ *                level 0, and so on up while the level above wraps too
+ *   INPUTS: level -- the level to take a slot from, at least 1
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: caller holds ktimer_lock
+ */
+static void ktimer_cascade(uint32_t level){
+    uint32_t slot = (wheel_base >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    ktimer_t* t = wheel[level][slot];
+    ktimer_t* next;
+
+    wheel[level][slot] = NULL;
+    for (; t != NULL; t = next){
+        next = t->next;
+        t->pprev = NULL;
+        ktimer_queue(t);
+    }
+    if (slot == 0 && level + 1 < WHEEL_LEVELS)
+        ktimer_cascade(level + 1);
+}
+
+/*
+ * ktimer_run
+ *   DESCRIPTION: fire every timer due up to and including tick now,
+ *                catching up on the ticks the clock skipped while idle
+ *   INPUTS: now -- the current tick
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called from the timer softirq; the callbacks run with
+ *                 interrupts on and the lock dropped, so they may re-add
+ *                 their timer
+ */
+void ktimer_run(uint32_t now){
+    uint32_t flags;
+    ktimer_t* due;
+    ktimer_t* t;
+    uint32_t slot;
+
+    spin_lock_irqsave(&ktimer_lock, flags);
+    while ((int32_t)(now - wheel_base) >= 0){
+        if (wheel_count == 0){
+            wheel_base = now + 1;
+            break;
+        }
+        slot = wheel_base & WHEEL_MASK;
+        if (slot == 0)
+            ktimer_cascade(1);
+
+        /* move the slot to a local list and step the wheel first, so a
+         * callback re-adding its timer lands on the next tick */
+        due = wheel[0][slot];
+        wheel[0][slot] = NULL;
+        if (due != NULL)
+            due->pprev = &due;
+        wheel_base++;
+
+        while ((t = due) != NULL){
+            ktimer_unlink(t);
+            wheel_count--;
+            spin_unlock_irqrestore(&ktimer_lock, flags);
+            t->func(t->data);
+            spin_lock_irqsave(&ktimer_lock, flags);
+        }
+    }
+    spin_unlock_irqrestore(&ktimer_lock, flags);
+}
+
+/*
+ * ktimer_next
+ *   DESCRIPTION: the tick the clock has to deliver next for the wheel: the
+ *                first busy slot of level 0, or the next cascade if that
+ *                comes first and a higher level may need it
+ *   INPUTS: expires -- gets the tick
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if any timer is queued, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t ktimer_next(uint32_t* expires){
+    uint32_t flags, i, slot, cascade;
+
+    spin_lock_irqsave(&ktimer_lock, flags);
+    if (wheel_count == 0){
+        spin_unlock_irqrestore(&ktimer_lock, flags);
+        return 0;
+    }
+    slot = wheel_base & WHEEL_MASK;
+    cascade = wheel_base + WHEEL_SIZE - slot;
+    *expires = cascade;
+    for (i = 0; i < WHEEL_SIZE - slot; i++){
+        if (wheel[0][slot + i] != NULL){
+            *expires = wheel_base + i;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&ktimer_lock, flags);
+    return 1;
+}
@@ -0,0 +1,40 @@
+/* ktimer.h - Timer wheel for kernel timeouts and deferred work
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _KTIMER_H
+#define _KTIMER_H
+
+#include "types.h"
+#include "timer.h"
+
+/* Four levels of 64 slots: level 0 has one slot per tick, each level
+ * above covers 64 times the range of the one below, 2^24 ticks in all */
+#define WHEEL_BITS          6
+#define WHEEL_SIZE          (1 << WHEEL_BITS)
+#define WHEEL_MASK          (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS        4
+#define WHEEL_MAX_DELAY     ((1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+#define MS_TO_TICKS(ms)     (((ms) + EXP_TIME - 1) / EXP_TIME)
+
+/*
+ * A callback to run from the timer softirq once time_tick reaches
+ * expires. The caller owns the memory; a timer must stay alive until it
+ * has fired or ktimer_del returned.
+ */
+typedef struct ktimer_t {
+    struct ktimer_t* next;
+    struct ktimer_t** pprev;        /* NULL when not queued */
+    uint32_t expires;
+    void (*func)(uint32_t data);
+    uint32_t data;
+} ktimer_t;
+
+void ktimer_init(ktimer_t* t, void (*func)(uint32_t data), uint32_t data);
+void ktimer_add(ktimer_t* t, uint32_t ticks);
+int32_t ktimer_del(ktimer_t* t);
+void ktimer_run(uint32_t now);
+int32_t ktimer_next(uint32_t* expires);
+
+#endif /* _KTIMER_H */
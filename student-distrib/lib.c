@@ -85,6 +85,15 @@ void update_cursor(void) {
     outb((uint8_t) (pos), CURSOR_L);
 }
 
+/* void out_str(void (*out)(uint8_t c), int8_t* s);
+ *   Inputs: out = where each character goes, s = the string
+ *   Return Value: void
+ *    Function: puts() for format_out */
+static void out_str(void (*out)(uint8_t c), int8_t* s) {
+    while (*s != '\0')
+        out(*s++);
+}
+
 /* Standard printf().
  * Only supports the following format strings:
  * %%  - print a literal '%' character
@@ -103,14 +112,20 @@ void update_cursor(void) {
  *       Also note: %x is the only conversion specifier that can use
  *       the "#" modifier to alter output. */
 int32_t printf(int8_t *format, ...) {
+    return format_out(putc, format, (int32_t*)&format + 1);
+}
+
+/* int32_t format_out(void (*out)(uint8_t c), int8_t* format, int32_t* esp);
+ *   Inputs: out = where each character goes
+ *           format = as for printf
+ *           esp = the first argument after the format on the stack
+ *   Return Value: Number of bytes of the format consumed
+ *    Function: The printf() conversions, for printf and other consoles */
+int32_t format_out(void (*out)(uint8_t c), int8_t* format, int32_t* esp) {
 
     /* Pointer to the format string */
     int8_t* buf = format;
 
-    /* Stack pointer for the other parameters */
-    int32_t* esp = (void *)&format;
-    esp++;
-
     while (*buf != '\0') {
         switch (*buf) {
             case '%':
@@ -123,7 +138,7 @@ format_char_switch:
                     switch (*buf) {
                         /* Print a literal '%' character */
                         case '%':
-                            putc('%');
+                            out('%');
                             break;
 
                         /* Use alternate formatting */
@@ -141,7 +156,7 @@ format_char_switch:
                                 int8_t conv_buf[64];
                                 if (alternate == 0) {
                                     itoa(*((uint32_t *)esp), conv_buf, 16);
-                                    puts(conv_buf);
+                                    out_str(out, conv_buf);
                                 } else {
                                     int32_t starting_index;
                                     int32_t i;
@@ -151,7 +166,7 @@ format_char_switch:
                                         conv_buf[i] = '0';
                                         i++;
                                     }
-                                    puts(&conv_buf[starting_index]);
+                                    out_str(out, &conv_buf[starting_index]);
                                 }
                                 esp++;
                             }
@@ -162,7 +177,7 @@ format_char_switch:
                             {
                                 int8_t conv_buf[36];
                                 itoa(*((uint32_t *)esp), conv_buf, 10);
-                                puts(conv_buf);
+                                out_str(out, conv_buf);
                                 esp++;
                             }
                             break;
@@ -178,20 +193,20 @@ format_char_switch:
                                 } else {
                                     itoa(value, conv_buf, 10);
                                 }
-                                puts(conv_buf);
+                                out_str(out, conv_buf);
                                 esp++;
                             }
                             break;
 
                         /* Print a single character */
                         case 'c':
-                            putc((uint8_t) *((int32_t *)esp));
+                            out((uint8_t) *((int32_t *)esp));
                             esp++;
                             break;
 
                         /* Print a NULL-terminated string */
                         case 's':
-                            puts(*((int8_t **)esp));
+                            out_str(out, *((int8_t **)esp));
                             esp++;
                             break;
 
@@ -203,7 +218,7 @@ format_char_switch:
                 break;
 
             default:
-                putc(*buf);
+                out(*buf);
                 break;
         }
         buf++;
@@ -6,6 +6,7 @@
 #define _LIB_H
 
 #include "types.h"
+#include "irqstat.h"
 
 /*-------------------- Add --------------------*/
 void blue_screen(void);
@@ -15,6 +16,7 @@ void test_interrupts(void);
 int32_t printf(int8_t *format, ...);
 void putc(uint8_t c);
 int32_t puts(int8_t *s);
+int32_t format_out(void (*out)(uint8_t c), int8_t* format, int32_t* esp);
 int8_t *itoa(uint32_t value, int8_t* buf, int32_t radix);
 int8_t *strrev(int8_t* s);
 uint32_t strlen(const int8_t* s);
@@ -101,14 +103,22 @@ do {                                    \
 /* Writes four bytes to four consecutive ports */
 #define outl(data, port)                \
 do {                                    \
-    asm volatile ("outl %l1, (%w0)"     \
+    asm volatile ("outl %k1, (%w0)"     \
             :                           \
             : "d"(port), "a"(data)      \
             : "memory", "cc"            \
     );                                  \
 } while (0)
 
-/* Clear interrupt flag - disables interrupts on this processor */
+/* Clear interrupt flag - disables interrupts on this processor; timed
+ * like cli_and_save when IRQ_INSTRUMENT is on */
+#if IRQ_INSTRUMENT
+#define cli()                           \
+do {                                    \
+    uint32_t cli_flags_;                \
+    cli_and_save(cli_flags_);           \
+} while (0)
+#else
 #define cli()                           \
 do {                                    \
     asm volatile ("cli"                 \
@@ -117,6 +127,7 @@ do {                                    \
             : "memory", "cc"            \
     );                                  \
 } while (0)
+#endif
 
 /* Save flags and then clear interrupt flag
  * Saves the EFLAGS register into the variable "flags", and then
@@ -132,11 +143,13 @@ do {                                    \
             :                           \
             : "memory", "cc"            \
     );                                  \
+    irqoff_enter(flags);                \
 } while (0)
 
 /* Set interrupt flag - enable interrupts on this processor */
 #define sti()                           \
 do {                                    \
+    irqoff_exit(IRQOFF_STI, __FILE__, __LINE__); \
     asm volatile ("sti"                 \
             :                           \
             :                           \
@@ -149,6 +162,7 @@ do {                                    \
  * after a cli_and_save_flags(flags) */
 #define restore_flags(flags)            \
 do {                                    \
+    irqoff_exit(flags, __FILE__, __LINE__); \
     asm volatile ("                   \n\
             pushl %0                  \n\
             popfl                     \n\
@@ -1,4 +1,5 @@
 #include "mouse.h"
+#include "clock.h"
 #include "i8259.h"
 #include "ModeX.h"
 #include "blocks.h"
@@ -14,6 +15,11 @@ int32_t mouse_key_left;     // 1 means pressed, 0 means not
 int32_t mouse_key_right;    // 1 means pressed, 0 means not
 int32_t mouse_key_mid;      // 1 means pressed, 0 means not
 
+/* Packets queued by mouse_irq_handler for mouse_deferred_render */
+static mouse_packet_t mouse_ring[MOUSE_RING_SIZE];
+static volatile uint32_t mouse_ring_head;   // only written by the IRQ handler
+static volatile uint32_t mouse_ring_tail;   // only written by the renderer
+
 /* Multi-Terminals */
 extern int32_t terminal_tick;
 extern int32_t terminal_display;
@@ -48,16 +54,24 @@ char* instruction[NUM_ICON] = {
 };
 
 /* mouse_init
- *  Description: initialize the mouse device
+ *  Description: initialize the mouse device; the mouse only matters on the
+ *               desktop, so this runs the first time the desktop opens rather
+ *               than at boot, and does nothing after that
  *  Input: none
  *  Output: none
  *  Return: none
- *  Side Effect: initialize the mouse device
+ *  Side Effect: initialize the mouse device, leaves IRQ 12 off if the
+ *               controller has no auxiliary port that answers
  */
 
 void mouse_init() {
+    static int32_t mouse_ready = 0;
     uint8_t status;
 
+    if (mouse_ready)
+        return;
+    mouse_ready = 1;
+
     /* Initialize variables */
     mouse_x_move = 0;
     mouse_y_move = 0;
@@ -66,10 +80,12 @@ void mouse_init() {
     mouse_key_mid = 0;
     mouse_x_coor = SCROLL_X_DIM / 4;
     mouse_y_coor = SCROLL_Y_DIM / 4;
+    screen_layout_init();
 
 
     /* Enbale auxiliary input of the PS2 keyboard controller */
-    wait_out();
+    if (wait_out() == -1)
+        return;
     outb(0xA8, MOUSE_PORT_NUM);
 
     /* Get compaq status byte */
@@ -77,7 +93,8 @@ void mouse_init() {
     outb(0x20, MOUSE_PORT_NUM);
 
     /* Read the status byte */
-    wait_in();
+    if (wait_in() == -1)
+        return;
     status = inb(KETBOARD_PORT_NUM);
     status |= 2;        // set bit number 1 (IRQ 12)
     status &= 0xDF;     // clear bit number 5 (disable mouse clock)
@@ -102,11 +119,10 @@ void mouse_init() {
     read_port();
     wait_out();
     outb(60, KETBOARD_PORT_NUM);
+    read_port();
 
     /* Set i8259 */
     enable_irq(MOUSE_IRQ_NUM);
-
-    screen_layout_init();
 }
 
 /* screen_layout_init
@@ -148,89 +164,113 @@ void screen_layout_init() {
 
 
 /* mouse_irq_handler
- *  Description: read input data from mouse
+ *  Description: read one packet from the mouse and queue it for
+ *               mouse_deferred_render; nothing is drawn here
  *  Input: none
  *  Output: none
  *  Return: none
- *  Side Effect: write data to globle variables 
+ *  Side Effect: pushes a packet into mouse_ring, drops it if the ring is full
  */
 void mouse_irq_handler() {
-    uint8_t temp;
-    mouse_package mouse_in;
-    unsigned char restore_block[12*12];
-    unsigned char restore_block_cursor[12*12];
+    mouse_packet_t pkt;
 
     send_eoi(MOUSE_IRQ_NUM);
-    // sti();
-    // printf("[Test] is_ModX: %d\n", game_info.is_ModX);
 
     /* If not in GUI, do nothing */
     if (!game_info.is_ModX)
         return;
 
-    /* Read data */
-    temp = read_port();
-    mouse_in.left_btn = temp & 0x01;
-    mouse_in.right_btn = (temp & 0x02) >> 1;
-    mouse_in.mid_btn = (temp & 0x04) >> 2;  
-    mouse_in.always_1 = (temp & 0x08) >> 3; 
-    mouse_in.x_sign = (temp & 0x10) >> 4;   
-    mouse_in.y_sign = (temp & 0x20) >> 5;   
-    mouse_in.x_overflow = (temp & 0x40) >> 6;
-    mouse_in.y_overflow = (temp & 0x80) >> 7;
-
-    /* Sanity check */
-    if ((!mouse_in.always_1) || mouse_in.x_overflow || mouse_in.y_overflow)
+    /* Read data, sanity check */
+    pkt.flags = read_port();
+    if (!(pkt.flags & MOUSE_ALWAYS_1) || (pkt.flags & (MOUSE_X_OVERFLOW | MOUSE_Y_OVERFLOW)))
         return;
-    
-    mouse_x_move = read_port();
-    mouse_y_move = read_port();
-
-    /* Sign extention */
-    if (mouse_in.x_sign)
-        mouse_x_move |= SIGN_MASK;
-    if (mouse_in.y_sign)
-        mouse_y_move |= SIGN_MASK;
-    
-    
-    /* Update other parameters */
-    mouse_x_coor += mouse_x_move / MOUSE_SPEED_FACTOR;
-    mouse_y_coor -= mouse_y_move / MOUSE_SPEED_FACTOR;
-    if (mouse_x_coor < 0)
-        mouse_x_coor = 0;
-    if (mouse_y_coor < 0)
-        mouse_y_coor = 0;
-    if (mouse_x_coor >= SCROLL_X_DIM - 10)
-        mouse_x_coor = SCROLL_X_DIM - 11;
-    if (mouse_y_coor >= SCROLL_Y_DIM -10)
-        mouse_y_coor = SCROLL_Y_DIM - 11;
-
-    /* Update press state */
-    mouse_key_left = mouse_in.left_btn;
-    mouse_key_right = mouse_in.right_btn;
-    mouse_key_mid = mouse_in.mid_btn;
-
-    // printf("(Test) (blk_x, blk_y) (%d, %d)\n", mouse_x_coor / 12, mouse_y_coor / 12);
-    // return;
-
-    // printf("[Test] (left, right, mid): (%d, %d, %d)\n", mouse_key_left, mouse_key_right, mouse_key_mid);
-    cli();
-    if (mouse_key_left || mouse_key_right || mouse_key_mid) {
-        draw_full_block_with_mask(mouse_x_coor, mouse_y_coor, (unsigned char*)get_block_img(MOUSE_CURSOR), (unsigned char*)get_block_img(MOUSE_CURSOR_MASK_SOLID), restore_block_cursor);
-        show_screen();
-        restore_full_block_with_mask(mouse_x_coor, mouse_y_coor, (unsigned char*)get_block_img(MOUSE_CURSOR), (unsigned char*)get_block_img(MOUSE_CURSOR_MASK_SOLID), restore_block_cursor);
+    pkt.x_move = read_port();
+    pkt.y_move = read_port();
+
+    /* Single producer, single consumer: only this handler moves the head */
+    if (mouse_ring_head - mouse_ring_tail >= MOUSE_RING_SIZE)
+        return;
+    mouse_ring[mouse_ring_head & (MOUSE_RING_SIZE - 1)] = pkt;
+    asm volatile ("" : : : "memory");   /* publish the packet before the head */
+    mouse_ring_head++;
+    clock_kick();
+}
+
+
+/* mouse_pending
+ *  Description: tell the clock whether mouse_deferred_render has work
+ *  Input: none
+ *  Output: none
+ *  Return: 1 if packets are queued, 0 otherwise
+ *  Side Effect: none
+ */
+int32_t mouse_pending() {
+    return mouse_ring_tail != mouse_ring_head;
+}
+
+
+/* mouse_deferred_render
+ *  Description: drain every packet queued since the last call, apply all the
+ *               motion at once and redraw the cursor (and icon highlight) once;
+ *               called from the timer softirq with interrupts on
+ *  Input: none
+ *  Output: none
+ *  Return: none
+ *  Side Effect: updates the mouse globals, the cursor sprite and the screen
+ */
+void mouse_deferred_render() {
+    mouse_packet_t pkt;
+    uint8_t pressed = 0;        // buttons held in any of the packets
+    unsigned char restore_block[12*12];
+
+    if (mouse_ring_tail == mouse_ring_head)
+        return;
+
+    while (mouse_ring_tail != mouse_ring_head) {
+        pkt = mouse_ring[mouse_ring_tail & (MOUSE_RING_SIZE - 1)];
+        mouse_ring_tail++;
+
+        mouse_x_move = pkt.x_move;
+        mouse_y_move = pkt.y_move;
+
+        /* Sign extention */
+        if (pkt.flags & MOUSE_X_SIGN)
+            mouse_x_move |= SIGN_MASK;
+        if (pkt.flags & MOUSE_Y_SIGN)
+            mouse_y_move |= SIGN_MASK;
+
+        /* Update other parameters */
+        mouse_x_coor += mouse_x_move / MOUSE_SPEED_FACTOR;
+        mouse_y_coor -= mouse_y_move / MOUSE_SPEED_FACTOR;
+        if (mouse_x_coor < 0)
+            mouse_x_coor = 0;
+        if (mouse_y_coor < 0)
+            mouse_y_coor = 0;
+        if (mouse_x_coor >= SCROLL_X_DIM - 10)
+            mouse_x_coor = SCROLL_X_DIM - 11;
+        if (mouse_y_coor >= SCROLL_Y_DIM -10)
+            mouse_y_coor = SCROLL_Y_DIM - 11;
+
+        pressed |= pkt.flags;
+    }
+
+    /* Update press state; a click inside the batch must not be lost */
+    mouse_key_left = (pressed & MOUSE_LEFT_BTN) != 0;
+    mouse_key_right = (pressed & MOUSE_RIGHT_BTN) != 0;
+    mouse_key_mid = (pressed & MOUSE_MID_BTN) != 0;
+
+    /* The cursor is a sprite on the visible page, no need to flip the screen */
+    if (pressed & (MOUSE_LEFT_BTN | MOUSE_RIGHT_BTN | MOUSE_MID_BTN)) {
+        sprite_move(mouse_x_coor, mouse_y_coor, (unsigned char*)get_block_img(MOUSE_CURSOR), (unsigned char*)get_block_img(MOUSE_CURSOR_MASK_SOLID));
     } else {
-        draw_fruit_text_with_mask(mouse_x_coor, mouse_y_coor, (unsigned char*)get_block_img(MOUSE_CURSOR_MASK_TRANS), restore_block_cursor);
-        show_screen();
-        restore_fruit_text_with_mask(mouse_x_coor, mouse_y_coor, (unsigned char*)get_block_img(MOUSE_CURSOR_MASK_TRANS), restore_block_cursor);
+        sprite_move(mouse_x_coor, mouse_y_coor, NULL, (unsigned char*)get_block_img(MOUSE_CURSOR_MASK_TRANS));
     }
-    sti();
 
     /* Determine location of mouse w.r.t icon */
     int blk_x = mouse_x_coor / 12;
     int blk_y = mouse_y_coor / 12;
     int offset[4][2] = {{0,0}, {0,1}, {1,0}, {1,1}};
-    int i, j;
+    int i, j = NUM_ICON;
     int blk_x_i, blk_y_i;
     int coor_x, coor_y;
     int f_num;
@@ -254,7 +294,6 @@ void mouse_irq_handler() {
             }
             coor_x = 12 * center_blk_idx[j][0];
             coor_y = 12 * center_blk_idx[j][1];
-            cli();
 
             draw_full_block_with_mask(coor_x-12, coor_y-12, (unsigned char*)get_block_img(ICON_EDGE_1), (unsigned char*)get_block_img(ICON_EDGE_MASK_1), restore_block);
             draw_full_block_with_mask(coor_x, coor_y-12, (unsigned char*)get_block_img(ICON_EDGE_2), (unsigned char*)get_block_img(ICON_EDGE_MASK_2), restore_block);
@@ -265,16 +304,9 @@ void mouse_irq_handler() {
             draw_full_block_with_mask(coor_x-12, coor_y+12, (unsigned char*)get_block_img(ICON_EDGE_7), (unsigned char*)get_block_img(ICON_EDGE_MASK_7), restore_block);
             draw_full_block_with_mask(coor_x, coor_y+12, (unsigned char*)get_block_img(ICON_EDGE_8), (unsigned char*)get_block_img(ICON_EDGE_MASK_8), restore_block);
             draw_full_block_with_mask(coor_x+12, coor_y+12, (unsigned char*)get_block_img(ICON_EDGE_9), (unsigned char*)get_block_img(ICON_EDGE_MASK_9), restore_block);
-            
-            if (mouse_key_left || mouse_key_right || mouse_key_mid) {
-                draw_full_block_with_mask(mouse_x_coor, mouse_y_coor, (unsigned char*)get_block_img(MOUSE_CURSOR), (unsigned char*)get_block_img(MOUSE_CURSOR_MASK_SOLID), restore_block_cursor);
-                show_screen();
-                restore_full_block_with_mask(mouse_x_coor, mouse_y_coor, (unsigned char*)get_block_img(MOUSE_CURSOR), (unsigned char*)get_block_img(MOUSE_CURSOR_MASK_SOLID), restore_block_cursor);
-            } else {
-                draw_fruit_text_with_mask(mouse_x_coor, mouse_y_coor, (unsigned char*)get_block_img(MOUSE_CURSOR_MASK_TRANS), restore_block_cursor);
-                show_screen();
-                restore_fruit_text_with_mask(mouse_x_coor, mouse_y_coor, (unsigned char*)get_block_img(MOUSE_CURSOR_MASK_TRANS), restore_block_cursor);
-            }
+
+            /* show_screen puts the cursor sprite back on the new page */
+            show_screen();
 
             restore_full_block_with_mask(coor_x-12, coor_y-12, (unsigned char*)get_block_img(ICON_EDGE_1), (unsigned char*)get_block_img(ICON_EDGE_MASK_1), restore_block);
             restore_full_block_with_mask(coor_x, coor_y-12, (unsigned char*)get_block_img(ICON_EDGE_2), (unsigned char*)get_block_img(ICON_EDGE_MASK_2), restore_block);
@@ -289,7 +321,6 @@ void mouse_irq_handler() {
             strcpy(tm_array[0].kb_buf, instruction[j]);
             strcpy(tm_array[1].kb_buf, instruction[j]);
             strcpy(tm_array[2].kb_buf, instruction[j]);
-            sti();
             break;
         }
     }
@@ -304,40 +335,40 @@ void mouse_irq_handler() {
     if (mouse_key_left) {
         click_flag = 1;
     }
-
-    sti();
 }
 
 
 /* wait_in
- *  Description: waiting to read bytes from port 0x60 or 0x64
+ *  Description: wait until the controller has a byte for port 0x60
  *  Input: none
  *  Output: none
- *  Return: none
+ *  Return: 0 when there is one, -1 after VERY_LONG_TIME polls (about 0.1 s)
  *  Side Effect: none 
  */
-void wait_in() {
+int32_t wait_in() {
     int32_t wait_time = VERY_LONG_TIME;
     while (wait_time--) {
-        if (!(inb(MOUSE_PORT_NUM) & WAIT_IN_MASK));
-            break;
+        if (inb(MOUSE_PORT_NUM) & WAIT_IN_MASK)
+            return 0;
     }
+    return -1;
 }
 
 
 /* wait_out
- *  Description: waiting to send bytes to port 0x60 or 0x64
+ *  Description: wait until the controller can take a byte on port 0x60 or 0x64
  *  Input: none
  *  Output: none
- *  Return: none
+ *  Return: 0 when it can, -1 after VERY_LONG_TIME polls (about 0.1 s)
  *  Side Effect: none 
  */
-void wait_out() {
+int32_t wait_out() {
     int32_t wait_time = VERY_LONG_TIME;
     while (wait_time--) {
-        if (!(inb(MOUSE_PORT_NUM) & WAIT_OUT_MASK));
-            break;
+        if (!(inb(MOUSE_PORT_NUM) & WAIT_OUT_MASK))
+            return 0;
     }
+    return -1;
 }
 
 
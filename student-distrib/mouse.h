@@ -9,7 +9,7 @@
 #define MOUSE_PORT_NUM      0x64
 #define KETBOARD_PORT_NUM   0x60
 
-#define VERY_LONG_TIME      100000
+#define VERY_LONG_TIME      100000      /* status polls, about 1us each */
 #define WAIT_OUT_MASK       2
 #define WAIT_IN_MASK        1
 
@@ -20,6 +20,19 @@
 
 #define MOUSE_SPEED_FACTOR  3
 
+/* Bits of the first byte of a mouse packet */
+#define MOUSE_LEFT_BTN      0x01
+#define MOUSE_RIGHT_BTN     0x02
+#define MOUSE_MID_BTN       0x04
+#define MOUSE_ALWAYS_1      0x08
+#define MOUSE_X_SIGN        0x10
+#define MOUSE_Y_SIGN        0x20
+#define MOUSE_X_OVERFLOW    0x40
+#define MOUSE_Y_OVERFLOW    0x80
+
+/* Packets waiting for the deferred render, must be a power of two */
+#define MOUSE_RING_SIZE     64
+
 /* Number of icon in screen */
 #define NUM_ICON 5
 
@@ -56,13 +69,22 @@ typedef struct mouse_package {
     uint8_t y_overflow  : 1;
 } mouse_package;
 
+/* Raw mouse packet as queued by the IRQ handler */
+typedef struct mouse_packet_t {
+    uint8_t flags;
+    uint8_t x_move;
+    uint8_t y_move;
+} mouse_packet_t;
+
 /* Function define */
 void mouse_init();
-void wait_in();
-void wait_out();
+int32_t wait_in();
+int32_t wait_out();
 uint8_t read_port();
 void write_port(uint8_t data);
 void mouse_irq_handler();
+void mouse_deferred_render();
+int32_t mouse_pending();
 void screen_layout_init();
 
 #endif
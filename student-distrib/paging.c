@@ -8,6 +8,9 @@ uint8_t task_use_vidmem = 0;            /* bitmap for the number of task using t
 uint8_t vidmem_bitmap[3] = {1, 2, 4};   /* for mask the using vidmap task */
 extern int32_t in_modex;
 
+/* Page tables for the mmap area, one per process, switched with the user page */
+static volatile PTE page_table_mmap[MAX_PROC][PT_SIZE] __attribute__((aligned (_4KB_)));
+
 /* paging_init
  *  Description: Initialize the paging dict and paging table, also mapping the video memory
  *  Input:  none
@@ -88,6 +91,27 @@ void paging_init(void){
                     break ;
 
 
+                case APIC_PD_IDX: /* 0xFEC00000 - 0xFEFFFFFF */
+                    /* IOAPIC and local APIC registers, 4MB page, uncached */
+                    page_dict[i].P = 1;         /* make it present */
+                    page_dict[i].RW = 1;        /* RW enable */
+                    page_dict[i].US = 0;        /* for kernel */
+                    page_dict[i].PWT = 1;       /* write-through */
+                    page_dict[i].PCD = 1;       /* memory mapped registers */
+                    page_dict[i].A = 0;         /* set to 1 by processor */
+
+                    page_dict[i].bit6 = 0;      /* set to 0 as Dirty for 4MB */
+                    page_dict[i].PS = 1;        /* for 4MB */
+                    page_dict[i].G = 1;         /* kernel only */
+                    page_dict[i].Avail = 0;     /* not used */
+
+                    /* setting address */
+                    page_dict[i].bit12 = 0;     /* PAT not used */
+                    page_dict[i].bit21_13 = 0;  /* reserved, must be 0 */
+                    page_dict[i].bit31_22 = i;  /* identity mapped */
+
+                    break ;
+
                 default: /* handle all rest PDE */
                     if (KERNEL_Base > 0x80000 && i * _4MB_ < KERNEL_Base){
                         /* if kernel is not 8M base, then extend the kernel page */
@@ -205,6 +229,15 @@ void paging_set_user_mapping(int32_t pid){
     }
     page_dict[USER_PROG_ADDR].bit31_22 = pid+ KERNEL_Base / _4MB_;  /* start from 8MB */
 
+    /* the mmap area right after the user page, 4KB pages of this process */
+    page_dict[MMAP_PROG_ADDR].P = 1;         /* make it present */
+    page_dict[MMAP_PROG_ADDR].RW = 1;        /* each PTE decides */
+    page_dict[MMAP_PROG_ADDR].US = 1;        /* for user code */
+    page_dict[MMAP_PROG_ADDR].PS = 0;        /* for 4KB */
+    page_dict[MMAP_PROG_ADDR].bit12 = (((int) page_table_mmap[pid]) >> (ADDR_OFF)) & (_1BIT_);
+    page_dict[MMAP_PROG_ADDR].bit21_13 = (((int) page_table_mmap[pid]) >> (ADDR_OFF + 1 )) & (_9BIT_);
+    page_dict[MMAP_PROG_ADDR].bit31_22 = (((int) page_table_mmap[pid]) >> (ADDR_OFF + 10 )) & (_10BIT_);
+
     /* set video memory map */
     page_table[VIDEO_REGION_START_K].address = VIDEO_REGION_START_K +  (terminal_display != terminal_tick) * (terminal_tick + 1) +in_modex*(TEMP_ADDR_VEDIO_PAGE-VIDEO)/_4KB_; /* set for kernel */
     page_table_vedio_mem[VIDEO_REGION_START_U].address =  VIDEO_REGION_START_K + (terminal_display != terminal_tick) * (terminal_tick + 1) +in_modex*(TEMP_ADDR_VEDIO_PAGE-VIDEO)/_4KB_; /* set for user */
@@ -213,6 +246,49 @@ void paging_set_user_mapping(int32_t pid){
 }
 
 
+/*
+ * paging_set_mmap_page
+ *   DESCRIPTION: map one 4KB page of a process's mmap area
+ *   INPUTS: pid - the process owning the area
+ *           page - index of the page in the area (0 is MMAP_ADDR)
+ *           phys_addr - 4KB aligned physical address to map
+ *           writable - 0 for a read-only page
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the caller flushes the TLB once it has mapped all its pages
+ */
+void paging_set_mmap_page(int32_t pid, uint32_t page, uint32_t phys_addr, int32_t writable){
+    volatile PTE* pte = &page_table_mmap[pid][page];
+
+    pte->P = 1;
+    pte->RW = (writable != 0);
+    pte->US = 1;                            /* user */
+    pte->PWT = 0;
+    pte->PCD = 0;
+    pte->A = 0;
+    pte->D = 0;                             /* Set by processor */
+    pte->PAT = 0;                           /* not used */
+    pte->G = 0;                             /* user */
+    pte->Avail = 0;                         /* not used */
+    pte->address = phys_addr >> ADDR_OFF;   /* Physical Address MSB 20bits */
+}
+
+/*
+ * paging_clear_mmap
+ *   DESCRIPTION: unmap the whole mmap area of a process
+ *   INPUTS: pid - the process owning the area
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: flushes the TLB
+ */
+void paging_clear_mmap(int32_t pid){
+    int i;
+    for (i = 0; i < PT_SIZE; i++){
+        page_table_mmap[pid][i].P = 0;
+    }
+    TLB_flush();
+}
+
 /*
  * paging_set_for_vedio_mem
  *   DESCRIPTION: set the page dic and page table for 4KB user level vedio memory
@@ -4,6 +4,7 @@
 #include "types.h"
 #include "x86_desc.h"
 #include "lib.h"
+#include "trace.h"
 
 #define PD_SIZE         1024            // 2^10 = 1024
 #define PT_SIZE         1024            // page table size, 4KB / 4B = 1024
@@ -17,6 +18,8 @@
 #define ADDR_OFF        12              // skip 12 LSB to get address filed
 
 #define USER_PROG_ADDR 32               /* 128 MB / 4MB per entry */
+#define MMAP_PROG_ADDR 33               /* 132 MB, the mmap area after the user page */
+#define APIC_PD_IDX    1019             /* 0xFEC00000 / 4MB, IOAPIC and local APIC */
 #define VIDEO_REGION_START_K (VIDEO / _4KB_)
 #define VIDEO_REGION_START_U 0
 
@@ -62,6 +65,7 @@ do {                                        \
  */
 #define TLB_flush()                 \
 do {                                \
+    trace(TRACE_TLB_FLUSH, TRACE_HERE(), 0, 0); \
     asm volatile ("               \n\
     movl %%cr3, %%eax             \n\
     movl %%eax, %%cr3             \n\
@@ -126,6 +130,8 @@ volatile PTE page_table_temp_vmem[PT_SIZE] __attribute__((aligned (_4KB_)));   /
 /* function prototype */
 void paging_init(void);
 extern void paging_set_user_mapping(int32_t pid);
+extern void paging_set_mmap_page(int32_t pid, uint32_t page, uint32_t phys_addr, int32_t writable);
+extern void paging_clear_mmap(int32_t pid);
 extern void paging_set_for_vedio_mem(int32_t virtual_addr_for_vedio, int32_t phys_addr_for_vedio);
 extern void paging_restore_for_vedio_mem(int32_t virtual_addr_for_vedio);
 extern void paging_set_always_access_VEDEO(int32_t virtual_addr_for_vedio, int32_t phys_addr_for_vedio);
@@ -0,0 +1,198 @@
+/* prof.c - Sampling profiler driven by the clock interrupt
+ * vim:ts=4 noexpandtab
+ */
+
+#include "prof.h"
+#include "lib.h"
+#include "clock.h"
+#include "smp.h"
+#include "sys_calls.h"
+#include "./dev/uart.h"
+
+extern int32_t pid;
+
+/* global section */
+volatile int32_t prof_active = 0;
+
+static prof_ring_t prof_rings[MAX_CPU];
+static uint8_t prof_names[PROF_MAX_PROGS][FILENAME_LEN + 1];
+static uint32_t prof_n_names = 0;
+static uint16_t prof_prog[MAX_PROC];        /* program each pid runs */
+static uint64_t prof_start_us;
+
+/*
+ * prof_sample
+ *   DESCRIPTION: record the instruction a clock interrupt came in on
+ *   INPUTS: frame -- the registers saved by the IRQ linkage
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called from irq_handler with interrupts off
+ */
+void prof_sample(irq_frame_t* frame){
+    prof_ring_t* ring;
+    prof_sample_t* s;
+
+    if (!prof_active)
+        return;
+    ring = &prof_rings[this_cpu() - cpus];
+    s = &ring->samples[ring->head & (PROF_RING_SIZE - 1)];
+    s->eip = frame->eip;
+    s->pid = (uint16_t)pid;
+    s->prog = ((frame->cs & 3) == 3 && pid >= 0 && pid < MAX_PROC) ? prof_prog[pid] : PROF_KERNEL;
+    ring->head++;
+}
+
+/*
+ * prof_exec
+ *   DESCRIPTION: note the program a process runs, so its samples can be
+ *                matched against the right executable
+ *   INPUTS: pid -- the process
+ *           name -- the file it executes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called from execute
+ */
+void prof_exec(int32_t pid, const uint8_t* name){
+    uint32_t i;
+
+    if (pid < 0 || pid >= MAX_PROC)
+        return;
+    for (i = 0; i < prof_n_names; i++){
+        if (0 == strncmp((int8_t*)prof_names[i], (const int8_t*)name, FILENAME_LEN))
+            break;
+    }
+    if (i == prof_n_names){
+        if (prof_n_names == PROF_MAX_PROGS){
+            prof_prog[pid] = PROF_KERNEL;
+            return;
+        }
+        strncpy((int8_t*)prof_names[i], (const int8_t*)name, FILENAME_LEN);
+        prof_names[i][FILENAME_LEN] = '\0';
+        prof_n_names++;
+    }
+    prof_prog[pid] = (uint16_t)i;
+}
+
+/*
+ * prof_start
+ *   DESCRIPTION: drop the old samples and start sampling every
+ *                PROF_PERIOD_US
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the clock keeps ticking while profiling
+ */
+void prof_start(void){
+    uint32_t flags, i;
+
+    cli_and_save(flags);
+    for (i = 0; i < MAX_CPU; i++)
+        prof_rings[i].head = 0;
+    prof_start_us = clock_us();
+    prof_active = 1;
+    restore_flags(flags);
+    clock_kick();
+}
+
+/*
+ * prof_stop
+ *   DESCRIPTION: stop sampling, the samples stay until the next prof_start
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void prof_stop(void){
+    prof_active = 0;
+}
+
+/*
+ * prof_toggle
+ *   DESCRIPTION: debug hotkey: start profiling, or stop and dump
+ *   INPUTS: none
+ *   OUTPUTS: a line on the screen
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: see prof_start / prof_dump
+ */
+void prof_toggle(void){
+    if (!prof_active){
+        prof_start();
+        printf("profile: started\n");
+    } else {
+        prof_stop();
+        prof_dump();
+    }
+}
+
+/*
+ * put_field
+ *   DESCRIPTION: send a number and a separator over the serial port
+ *   INPUTS: value -- the number
+ *           radix -- 10 or 16
+ *           sep -- what follows it
+ *   OUTPUTS: the text on COM1
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void put_field(uint32_t value, int32_t radix, const char* sep){
+    int8_t num[12];
+
+    if (radix == 16)
+        uart_puts("0x");
+    uart_puts(itoa(value, num, radix));
+    uart_puts((const int8_t*)sep);
+}
+
+/*
+ * prof_dump
+ *   DESCRIPTION: send the samples over COM1 for tools/profsym.py, one per
+ *                line, between "PROF BEGIN" and "PROF END":
+ *                  PROG <index> <name>
+ *                  S <cpu> <pid> K <eip>           (kernel)
+ *                  S <cpu> <pid> U <index> <eip>   (user program)
+ *   INPUTS: none
+ *   OUTPUTS: the dump on COM1, a summary on the screen
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: call with sampling stopped
+ */
+void prof_dump(void){
+    uint32_t cpu, i, n, total = 0, lost = 0;
+    uint32_t ms = (uint32_t)div64_32(clock_us() - prof_start_us, 1000);
+    prof_ring_t* ring;
+    prof_sample_t* s;
+
+    uart_puts("PROF BEGIN period_us=");
+    put_field(PROF_PERIOD_US, 10, " ms=");
+    put_field(ms, 10, "\n");
+    for (i = 0; i < prof_n_names; i++){
+        uart_puts("PROG ");
+        put_field(i, 10, " ");
+        uart_puts((int8_t*)prof_names[i]);
+        uart_puts("\n");
+    }
+    for (cpu = 0; cpu < MAX_CPU; cpu++){
+        ring = &prof_rings[cpu];
+        n = ring->head;
+        i = 0;
+        if (n > PROF_RING_SIZE){
+            lost += n - PROF_RING_SIZE;
+            i = n - PROF_RING_SIZE;
+        }
+        for (; i < n; i++){
+            s = &ring->samples[i & (PROF_RING_SIZE - 1)];
+            uart_puts("S ");
+            put_field(cpu, 10, " ");
+            put_field(s->pid, 10, " ");
+            if (s->prog == PROF_KERNEL){
+                uart_puts("K ");
+            } else {
+                uart_puts("U ");
+                put_field(s->prog, 10, " ");
+            }
+            put_field(s->eip, 16, "\n");
+            total++;
+        }
+    }
+    uart_puts("PROF END\n");
+    printf("profile: %d samples in %d ms sent to COM1, %d overwritten\n", total, ms, lost);
+}
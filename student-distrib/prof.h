@@ -0,0 +1,39 @@
+/* prof.h - Sampling profiler driven by the clock interrupt
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _PROF_H
+#define _PROF_H
+
+#include "types.h"
+#include "handlers.h"
+
+#define PROF_RING_SIZE      4096    /* samples per CPU, power of two */
+#define PROF_PERIOD_US      1000    /* clock event period while profiling */
+#define PROF_MAX_PROGS      32      /* distinct user programs named in a dump */
+#define PROF_KERNEL         0xFFFF  /* prog of a sample taken in the kernel */
+
+/* One interrupted instruction; prog indexes the program names */
+typedef struct prof_sample_t {
+    uint32_t eip;
+    uint16_t prog;
+    uint16_t pid;
+} prof_sample_t;
+
+/* Written only by its own CPU from the clock interrupt, the oldest
+ * samples are overwritten once it is full */
+typedef struct prof_ring_t {
+    uint32_t head;                  /* samples taken, next slot is head % size */
+    prof_sample_t samples[PROF_RING_SIZE];
+} prof_ring_t;
+
+extern volatile int32_t prof_active;
+
+void prof_sample(irq_frame_t* frame);
+void prof_exec(int32_t pid, const uint8_t* name);
+void prof_start(void);
+void prof_stop(void);
+void prof_toggle(void);
+void prof_dump(void);
+
+#endif /* _PROF_H */
@@ -2,6 +2,7 @@
 #include "i8259.h"
 #include "lib.h"
 #include "./dev/rand.h"
+#include "clock.h"
 
 #define IRQ_NUM_RTC 0x08
 #define RTC_IDX_PORT 0x70
@@ -15,11 +16,19 @@
 #define MIN_FREQ 2
 #define NULL 0
 
+#define RTC_PF 0x40     // register C: periodic interrupt flag
+
 extern int32_t pid;
-extern int8_t task_array[MAX_PROC];
 static void rtc_byte_write(int8_t rtc_register, int8_t rtc_data);
 static int8_t rtc_byte_read(int8_t rtc_register);
 static void rtc_set_real_freq_level(int8_t freq_level);
+static void rtc_program();
+
+/* Min-heap of the pids blocked in rtc_read, keyed on their deadline */
+static int32_t rtc_heap[MAX_PROC];
+static int32_t rtc_heap_n = 0;
+static uint32_t rtc_now = 0;        // in 1/MAX_FREQ s, only runs while somebody waits
+static int8_t rtc_level = 0;        // hardware rate is 2^rtc_level, 0 when the periodic IRQ is off
 
 // all register handling codes for RTC are adapt from https://wiki.osdev.org/RTC
 /* 
@@ -31,16 +40,103 @@ static void rtc_set_real_freq_level(int8_t freq_level);
  *   SIDE EFFECTS:  initialize the rtc
  */
 void rtc_init(){
-      int8_t prev;
       cli();
-      //This will turn on the IRQ with the default 1024 Hz rate. 
-      prev=rtc_byte_read(RTC_REG_B);  // read the current value of register B
-      rtc_byte_write(RTC_REG_B,  prev | BIT_6 ); //  This turns on bit 6 of register B
-      //unmask pic for rtc
-      enable_irq(IRQ_NUM_RTC);
-      //a read on RTC_REG_C to allow next irq
+      //nothing waits yet, rtc_program leaves the IRQ off and IRQ 8 masked
+      rtc_heap_n = 0;
+      rtc_level = 0;
+      rtc_program();
+      //a read on RTC_REG_C to clear anything pending
       rtc_byte_read(RTC_REG_C);
-      rtc_set_real_freq_level(MAX_FREQ_LEVEL);
+}
+
+/*
+ * rtc_heap_before
+ *   DESCRIPTION: heap order, wrap-around safe
+ *   INPUTS: a, b -- pids in the heap
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if a is due before b
+ *   SIDE EFFECTS: none
+ */
+static int32_t rtc_heap_before(int32_t a, int32_t b){
+    return (int32_t)(get_pcb_ptr(a)->rtc_deadline - get_pcb_ptr(b)->rtc_deadline) < 0;
+}
+
+/*
+ * rtc_heap_push
+ *   DESCRIPTION: add a waiting pid and sift it up
+ *   INPUTS: new_pid -- the pid, its rtc_deadline already set
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called with interrupts off
+ */
+static void rtc_heap_push(int32_t new_pid){
+    int32_t i = rtc_heap_n++;
+
+    while (i > 0 && rtc_heap_before(new_pid, rtc_heap[(i - 1) / 2])){
+        rtc_heap[i] = rtc_heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    rtc_heap[i] = new_pid;
+}
+
+/*
+ * rtc_heap_pop
+ *   DESCRIPTION: remove the earliest deadline and sift the last entry down
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the pid that was at the top
+ *   SIDE EFFECTS: called with interrupts off and a non-empty heap
+ */
+static int32_t rtc_heap_pop(){
+    int32_t top = rtc_heap[0];
+    int32_t last = rtc_heap[--rtc_heap_n];
+    int32_t i = 0, child;
+
+    while ((child = 2 * i + 1) < rtc_heap_n){
+        if (child + 1 < rtc_heap_n && rtc_heap_before(rtc_heap[child + 1], rtc_heap[child]))
+            child++;
+        if (!rtc_heap_before(rtc_heap[child], last))
+            break;
+        rtc_heap[i] = rtc_heap[child];
+        i = child;
+    }
+    rtc_heap[i] = last;
+    return top;
+}
+
+/*
+ * rtc_program
+ *   DESCRIPTION: run the periodic interrupt at the highest frequency any
+ *                waiter asked for, and only while somebody waits; IRQ 8 is
+ *                masked otherwise
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes registers A and B, called with interrupts off
+ */
+static void rtc_program(){
+    int32_t i, max_freq = 0;
+    int8_t level = 0, prev;
+
+    for (i = 0; i < rtc_heap_n; i++){
+        if (get_pcb_ptr(rtc_heap[i])->virtual_freq > max_freq)
+            max_freq = get_pcb_ptr(rtc_heap[i])->virtual_freq;
+    }
+    while ((1 << level) < max_freq)
+        level++;
+    if (level != rtc_level && level != 0)
+        rtc_set_real_freq_level(level);
+    rtc_level = level;
+
+    prev = rtc_byte_read(RTC_REG_B) & ~BIT_6;
+    if (rtc_level != 0)
+        prev |= BIT_6;
+    rtc_byte_write(RTC_REG_B, prev);
+
+    if (rtc_level != 0)
+        enable_irq(IRQ_NUM_RTC);
+    else
+        disable_irq(IRQ_NUM_RTC);
 }
 
 /* 
@@ -49,29 +145,25 @@ void rtc_init(){
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS:  call test_interrupts() to refresh the screen
+ *   SIDE EFFECTS:  wakes every rtc_read whose deadline has passed
  */
 void rtc_handler(){
-    int32_t cur_pid;
-    pcb* cur_pcb_ptr;
-    cli();
-    for (cur_pid=0;cur_pid<MAX_PROC;cur_pid++){
-        //check if the process for this pid is on
-        if (task_array[cur_pid]==0){continue;}
-        cur_pcb_ptr = get_pcb_ptr(cur_pid);
-        if (cur_pcb_ptr->rtc_opened==1){
-            cur_pcb_ptr->current_count=cur_pcb_ptr->current_count-cur_pcb_ptr->virtual_freq;
-            if (cur_pcb_ptr->current_count==0){
-                cur_pcb_ptr->virtual_iqr_got=1;
-                cur_pcb_ptr->current_count=MAX_FREQ;
-            }
-        }  
+    int8_t flags;
+    int32_t woken = 0;
+    //a read on RTC_REG_C to allow next irq, it also tells which one fired
+    flags = rtc_byte_read(RTC_REG_C);
+    send_eoi(IRQ_NUM_RTC);
+
+    if ((flags & RTC_PF) && rtc_level != 0){
+        rtc_now += MAX_FREQ >> rtc_level;
+        while (rtc_heap_n > 0 && (int32_t)(get_pcb_ptr(rtc_heap[0])->rtc_deadline - rtc_now) <= 0){
+            get_pcb_ptr(rtc_heap_pop())->virtual_iqr_got = 1;
+            woken = 1;
+        }
+        if (woken)
+            rtc_program();
     }
     update_seed();
-    //a read on RTC_REG_C to allow next irq
-    rtc_byte_read(RTC_REG_C);
-    send_eoi(IRQ_NUM_RTC);
-    sti();            
 }
 
 /* 
@@ -128,15 +220,16 @@ int32_t rtc_open(const uint8_t* filename) {
     cur_pcb_ptr = get_pcb_ptr(pid);
 
     cur_pcb_ptr->virtual_freq=2; // 2HZ is the defualt frequency
-    cur_pcb_ptr->current_count=MAX_FREQ;
+    cur_pcb_ptr->rtc_deadline=0;
     cur_pcb_ptr->virtual_iqr_got=0;
-    cur_pcb_ptr->rtc_opened=1;
+    cur_pcb_ptr->rtc_opened++;
     return 0;
 }
 
 /* 
  * rtc_close
- *   DESCRIPTION: close RTC file and reset the relate parameters
+ *   DESCRIPTION: close RTC file and reset the relate parameters once the
+ *                last RTC file of the process is closed
  *   INPUTS: filename  - String filename
  *   OUTPUTS: none
  *   RETURN VALUE: 0
@@ -145,8 +238,12 @@ int32_t rtc_open(const uint8_t* filename) {
 int32_t rtc_close(int32_t fd) {
     pcb* cur_pcb_ptr;
     cur_pcb_ptr = get_pcb_ptr(pid);
+    if (cur_pcb_ptr->rtc_opened > 1){
+        cur_pcb_ptr->rtc_opened--; // another RTC file still reads at this frequency
+        return 0;
+    }
     cur_pcb_ptr->virtual_freq=0; // change the freq to 0 to indicate the rtc is not opened
-    cur_pcb_ptr->current_count=MAX_FREQ;
+    cur_pcb_ptr->rtc_deadline=0;
     cur_pcb_ptr->virtual_iqr_got=0;
     cur_pcb_ptr->rtc_opened=0;
     return 0;
@@ -159,17 +256,28 @@ int32_t rtc_close(int32_t fd) {
  *           buf  (Output data pointer)
  *           nbytes (Number of bytes read)
  *   OUTPUTS: none
- *   RETURN VALUE: 0
- *   SIDE EFFECTS:
+ *   RETURN VALUE: 0, -1 if the process has no RTC file open
+ *   SIDE EFFECTS: queues the process on the deadline heap until one
+ *                 period of its virtual frequency has passed
  */
 int32_t rtc_read(int32_t fd, void* buf, int32_t nbytes) {
     pcb* cur_pcb_ptr;
     cli();
     cur_pcb_ptr = get_pcb_ptr(pid);
+    if (cur_pcb_ptr->virtual_freq == 0){
+        sti();
+        return -1;
+    }
     cur_pcb_ptr->virtual_iqr_got=0;
-    cur_pcb_ptr->current_count=MAX_FREQ;
+    cur_pcb_ptr->rtc_deadline=rtc_now + MAX_FREQ / cur_pcb_ptr->virtual_freq;
+    rtc_heap_push(pid);
+    rtc_program();
+    //halt until rtc_handler pops us
+    while (cur_pcb_ptr->virtual_iqr_got==0){
+        cpu_idle();
+        cli();
+    }
     sti();
-    while (cur_pcb_ptr->virtual_iqr_got==0){};
     return 0;
 }
 
@@ -1,4 +1,6 @@
 #include "scheduler.h"
+#include "spinlock.h"
+#include "trace.h"
 
 extern uint8_t enter_flag;
 extern int32_t pid;             /* in sys_call.c */
@@ -7,6 +9,7 @@ terminal_t tm_array[MAX_TM];    /* array for the states of all terminals */
 volatile int32_t terminal_tick = 0;      /* for the active running terminal, default the first terminal */
 volatile int32_t terminal_display = 0;   /* for the displayed terminal, only change when function-key pressed */
 extern int32_t in_modex;
+static spinlock_t sched_lock = SPINLOCK_UNLOCKED;   /* terminal_tick, terminal_display and tm_array */
 
 
 /*
@@ -54,12 +57,15 @@ void scheduler(){
     old_pcb->kernel_ebp_sch = k_ebp;
     old_pcb->kernel_esp_sch = k_esp;
 
-    /* switch terminal */
+    /* switch terminal; the lock is released by whichever task resumes below */
+    spin_lock(&sched_lock);
     terminal_tick = (terminal_tick + 1) % MAX_TM;
+    trace(TRACE_SWITCH, pid, tm_array[terminal_tick].tm_pid, terminal_tick);
 
     /* default to create a shell for each terminal */
     if (tm_array[terminal_tick].tm_pid == TM_UNUSED){
         running_terminal ++;
+        spin_unlock(&sched_lock);
         execute((uint8_t*)"shell");
     } else {
         
@@ -71,15 +77,8 @@ void scheduler(){
         // tss.esp0 = _8MB_ - (_8KB_ * pid) - 4;
         tss.esp0 = KERNEL_Base - (_8KB_ * (pid)) - 4;
 
-        /* paging setting */
-        /* set user program address */
-        page_dict[USER_PROG_ADDR].bit31_22 = pid + KERNEL_Base / _4MB_; /* start from 8MB */
-
-        /* set video memory map */
-        page_table[VIDEO_REGION_START_K].address = VIDEO_REGION_START_K +  (terminal_display != terminal_tick) * (terminal_tick + 1)+in_modex*(TEMP_ADDR_VEDIO_PAGE-VIDEO)/_4KB_; /* set for kernel */
-        page_table_vedio_mem[VIDEO_REGION_START_U].address =  VIDEO_REGION_START_K + (terminal_display != terminal_tick) * (terminal_tick + 1)+in_modex*(TEMP_ADDR_VEDIO_PAGE-VIDEO)/_4KB_; /* set for user */
-
-        TLB_flush();
+        /* paging setting: user program, its mmap area and video memory */
+        paging_set_user_mapping(pid);
 
         /* restore next task pcb */
         k_ebp = cur_pcb->kernel_ebp_sch;
@@ -93,6 +92,7 @@ void scheduler(){
             : "a"(k_ebp), "b"(k_esp)
             : "ebp", "esp"
         );
+        spin_unlock(&sched_lock);
 
     }
 
@@ -111,11 +111,15 @@ void scheduler(){
 void switch_visible_terminal(int new_tm_id){
     uint8_t* VM_addr = (uint8_t*)(VIDEO);                       /* physical displayed video memory base */
     int32_t i;                                                  /* loop index */
+    uint32_t flags;
 
     enter_flag = 0;             // 0 for OFF
 
+    spin_lock_irqsave(&sched_lock, flags);
+
     /* check if switch to the current terminal */
     if (new_tm_id == terminal_display) {
+        spin_unlock_irqrestore(&sched_lock, flags);
         return ;
     }
 
@@ -141,6 +145,7 @@ void switch_visible_terminal(int new_tm_id){
     TLB_flush();
 
     update_cursor();
+    spin_unlock_irqrestore(&sched_lock, flags);
      
     return ;
 }
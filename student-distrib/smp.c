@@ -0,0 +1,140 @@
+/* smp.c - APIC setup of the boot processor and per-CPU data
+ * vim:ts=4 noexpandtab
+ */
+
+#include "smp.h"
+#include "lib.h"
+#include "dev/apic.h"
+#include "dev/uart.h"
+
+/* global section */
+cpu_t cpus[MAX_CPU];
+
+static uint32_t lapic_addr = LAPIC_DEFAULT_BASE;
+
+/*
+ * mp_checksum
+ *   DESCRIPTION: MP structures sum to 0 over their length
+ *   INPUTS: p -- start of the structure
+ *           len -- its length in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the checksum is good
+ *   SIDE EFFECTS: none
+ */
+static int32_t mp_checksum(const uint8_t* p, uint32_t len){
+    uint8_t sum = 0;
+    while (len--)
+        sum += *p++;
+    return sum == 0;
+}
+
+/*
+ * mp_search
+ *   DESCRIPTION: look for the MP floating pointer in [start, start + len)
+ *   INPUTS: start -- physical start of the range, 16 byte aligned
+ *           len -- length of the range
+ *   OUTPUTS: none
+ *   RETURN VALUE: the floating pointer, NULL if it is not there
+ *   SIDE EFFECTS: none
+ */
+static mp_fp_t* mp_search(uint32_t start, uint32_t len){
+    mp_fp_t* fp;
+    for (fp = (mp_fp_t*)start; (uint32_t)fp < start + len; fp++){
+        if (fp->signature == MP_FP_SIG && mp_checksum((uint8_t*)fp, sizeof(mp_fp_t)))
+            return fp;
+    }
+    return NULL;
+}
+
+/*
+ * mp_parse
+ *   DESCRIPTION: find the processors and the IOAPIC in the MP configuration
+ *                table. The BDA pointer to the EBDA sits in page 0, which is
+ *                never mapped, so only the last KB of base memory and the
+ *                BIOS ROM are searched
+ *   INPUTS: n_found -- gets the number of processors found
+ *   OUTPUTS: cpus[0] gets the APIC ID of the BSP
+ *   RETURN VALUE: physical address of the IOAPIC, 0 if none;
+ *                 -1 if there is no usable table
+ *   SIDE EFFECTS: sets lapic_addr
+ */
+static int32_t mp_parse(uint32_t* n_found){
+    mp_fp_t* fp;
+    mp_config_t* cfg;
+    uint8_t* entry;
+    uint32_t i, ioapic = 0, n = 1;
+
+    if ((fp = mp_search(0x9FC00, 0x400)) == NULL && (fp = mp_search(0xF0000, 0x10000)) == NULL)
+        return -1;
+    /* a default configuration (no table) is not supported */
+    cfg = (mp_config_t*)fp->config;
+    if (cfg == NULL || cfg->signature != MP_CFG_SIG || !mp_checksum((uint8_t*)cfg, cfg->length))
+        return -1;
+    if (cfg->lapic_addr < APIC_WINDOW_START || cfg->lapic_addr >= APIC_WINDOW_END)
+        return -1;
+    lapic_addr = cfg->lapic_addr;
+
+    entry = (uint8_t*)(cfg + 1);
+    for (i = 0; i < cfg->entry_count; i++){
+        switch (entry[0]){
+            case MP_ENTRY_CPU:
+                if (!(entry[3] & MP_CPU_ENABLED))
+                    break;
+                if (entry[3] & MP_CPU_BSP)
+                    cpus[0].apic_id = entry[1];
+                else
+                    n++;
+                break;
+            case MP_ENTRY_IOAPIC:
+                if (ioapic == 0)
+                    ioapic = *(uint32_t*)(entry + 4);
+                break;
+        }
+        /* processor entries are 20 bytes, all others 8 */
+        entry += (entry[0] == MP_ENTRY_CPU) ? 20 : 8;
+    }
+    *n_found = n;
+    return ioapic;
+}
+
+/*
+ * smp_init
+ *   DESCRIPTION: enable the local APIC of the boot processor and mask the
+ *                IOAPIC, using the addresses in the MP table. Falls back to
+ *                the 8259 alone if there is no APIC or no table. The other
+ *                processors are counted but not started: all processes share
+ *                one page directory, and pid, the TSS and terminal_tick are
+ *                single-CPU state
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called after paging_init with interrupts off
+ */
+void smp_init(void){
+    uint32_t n_found = 1;
+    int32_t ioapic;
+
+    cpus[0].online = 1;
+    cpus[0].tss = &tss;
+
+    if (!lapic_present() || (ioapic = mp_parse(&n_found)) == -1)
+        return;
+
+    lapic_init(lapic_addr, 1);
+    if (ioapic >= APIC_WINDOW_START && ioapic < APIC_WINDOW_END)
+        ioapic_init(ioapic);
+    cpus[0].apic_id = lapic_id();
+    klog("SMP: %d processor(s) listed, running on the boot processor\n", n_found);
+}
+
+/*
+ * this_cpu
+ *   DESCRIPTION: find the per-CPU data of the calling processor
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer into cpus[]
+ *   SIDE EFFECTS: none
+ */
+cpu_t* this_cpu(void){
+    return &cpus[0];
+}
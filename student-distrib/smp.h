@@ -0,0 +1,59 @@
+/* smp.h - APIC setup of the boot processor and per-CPU data
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SMP_H
+#define _SMP_H
+
+#include "types.h"
+#include "x86_desc.h"
+
+/* Processors the kernel runs on; the other processors are not started */
+#define MAX_CPU             1
+
+/* MP floating pointer and configuration table (Intel MP spec 1.4) */
+#define MP_FP_SIG           0x5F504D5F  /* "_MP_" */
+#define MP_CFG_SIG          0x504D4350  /* "PCMP" */
+#define MP_ENTRY_CPU        0
+#define MP_ENTRY_IOAPIC     2
+#define MP_CPU_ENABLED      0x01
+#define MP_CPU_BSP          0x02
+
+typedef struct __attribute__((packed)) mp_fp_t {
+    uint32_t signature;
+    uint32_t config;            /* physical address of mp_config_t */
+    uint8_t  length;            /* in 16 byte units */
+    uint8_t  spec_rev;
+    uint8_t  checksum;
+    uint8_t  features[5];
+} mp_fp_t;
+
+typedef struct __attribute__((packed)) mp_config_t {
+    uint32_t signature;
+    uint16_t length;
+    uint8_t  spec_rev;
+    uint8_t  checksum;
+    uint8_t  oem_id[8];
+    uint8_t  product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_table_size;
+    uint16_t entry_count;
+    uint32_t lapic_addr;
+    uint16_t ext_length;
+    uint8_t  ext_checksum;
+    uint8_t  reserved;
+} mp_config_t;
+
+/* Per-CPU data */
+typedef struct cpu_t {
+    uint32_t apic_id;
+    volatile uint32_t online;
+    tss_t* tss;                 /* the global tss for CPU 0 */
+} cpu_t;
+
+extern cpu_t cpus[MAX_CPU];
+
+void smp_init(void);
+cpu_t* this_cpu(void);
+
+#endif /* _SMP_H */
@@ -0,0 +1,192 @@
+/* softirq.c - Deferred interrupt work (bottom halves)
+ * vim:ts=4 noexpandtab
+ */
+
+#include "softirq.h"
+#include "lib.h"
+#include "scheduler.h"
+
+/* global section */
+volatile int32_t need_resched = 0;
+
+static volatile uint32_t softirq_pending = 0;
+static int32_t softirq_running = 0;
+static void (*softirq_vec[NR_SOFTIRQS])(void);
+
+static tasklet_t* tasklet_head = NULL;
+static tasklet_t* tasklet_tail = NULL;
+
+static void tasklet_action(void);
+
+/*
+ * softirq_init
+ *   DESCRIPTION: register the tasklet softirq; the others are registered by
+ *                their owners with open_softirq
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void softirq_init(void){
+    open_softirq(SOFTIRQ_TASKLET, tasklet_action);
+}
+
+/*
+ * open_softirq
+ *   DESCRIPTION: set the function run for a softirq
+ *   INPUTS: nr -- the softirq, below NR_SOFTIRQS
+ *           action -- the function
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void open_softirq(int32_t nr, void (*action)(void)){
+    if (nr >= 0 && nr < NR_SOFTIRQS)
+        softirq_vec[nr] = action;
+}
+
+/*
+ * raise_softirq
+ *   DESCRIPTION: mark a softirq pending; it runs when the current interrupt
+ *                returns, or at the next one
+ *   INPUTS: nr -- the softirq
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void raise_softirq(int32_t nr){
+    uint32_t flags;
+
+    cli_and_save(flags);
+    softirq_pending |= 1 << nr;
+    restore_flags(flags);
+}
+
+/*
+ * do_softirq
+ *   DESCRIPTION: run the pending softirqs with interrupts on. A softirq
+ *                raised meanwhile is picked up by the next pass; after
+ *                SOFTIRQ_RESTART passes the rest waits for the next IRQ.
+ *                An interrupt that comes in while this runs finds
+ *                softirq_running set and only raises its bits
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called and returns with interrupts off
+ */
+static void do_softirq(void){
+    uint32_t pending;
+    int32_t nr, restart = SOFTIRQ_RESTART;
+
+    if (softirq_running)
+        return;
+    softirq_running = 1;
+    while ((pending = softirq_pending) != 0 && restart-- > 0){
+        softirq_pending = 0;
+        sti();
+        for (nr = 0; nr < NR_SOFTIRQS; nr++){
+            if ((pending & (1 << nr)) && softirq_vec[nr] != NULL)
+                softirq_vec[nr]();
+        }
+        cli();
+    }
+    softirq_running = 0;
+}
+
+/*
+ * in_softirq
+ *   DESCRIPTION: tell whether the caller runs in a softirq or a tasklet,
+ *                which must not halt to wait for an interrupt
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 inside do_softirq, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t in_softirq(void){
+    return softirq_running;
+}
+
+/*
+ * tasklet_init
+ *   DESCRIPTION: set up a tasklet before its first tasklet_schedule
+ *   INPUTS: t -- the tasklet
+ *           func -- called with data
+ *           data -- passed to func
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void tasklet_init(tasklet_t* t, void (*func)(uint32_t data), uint32_t data){
+    t->next = NULL;
+    t->queued = 0;
+    t->func = func;
+    t->data = data;
+}
+
+/*
+ * tasklet_schedule
+ *   DESCRIPTION: queue a tasklet to run once from the tasklet softirq
+ *   INPUTS: t -- the tasklet
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: raises SOFTIRQ_TASKLET
+ */
+void tasklet_schedule(tasklet_t* t){
+    uint32_t flags;
+
+    cli_and_save(flags);
+    if (!t->queued){
+        t->queued = 1;
+        t->next = NULL;
+        if (tasklet_tail != NULL)
+            tasklet_tail->next = t;
+        else
+            tasklet_head = t;
+        tasklet_tail = t;
+        softirq_pending |= 1 << SOFTIRQ_TASKLET;
+    }
+    restore_flags(flags);
+}
+
+/*
+ * tasklet_action
+ *   DESCRIPTION: run every tasklet queued so far, in order; a tasklet may
+ *                schedule itself again, it then runs on the next pass
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void tasklet_action(void){
+    tasklet_t* t;
+    tasklet_t* next;
+
+    cli();
+    t = tasklet_head;
+    tasklet_head = tasklet_tail = NULL;
+    sti();
+
+    for (; t != NULL; t = next){
+        next = t->next;
+        t->queued = 0;
+        t->func(t->data);
+    }
+}
+
+/*
+ * irq_exit
+ *   DESCRIPTION: end of irq_handler: run the softirqs, then switch task if
+ *                the tick asked for it. The switch waits until no softirq
+ *                is running on this stack
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called with interrupts off
+ */
+void irq_exit(void){
+    do_softirq();
+    if (need_resched && !softirq_running){
+        need_resched = 0;
+        scheduler();
+    }
+}
@@ -0,0 +1,37 @@
+/* softirq.h - Deferred interrupt work (bottom halves)
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SOFTIRQ_H
+#define _SOFTIRQ_H
+
+#include "types.h"
+
+/* Softirqs, run in this order by do_softirq */
+#define SOFTIRQ_TIMER       0       /* timer wheel, video frames, mouse redraw */
+#define SOFTIRQ_TASKLET     1       /* queued tasklets */
+#define NR_SOFTIRQS         2
+#define SOFTIRQ_RESTART     10      /* passes before leaving the rest for the next IRQ */
+
+/*
+ * A function to run once from softirq context with interrupts on.
+ * tasklet_schedule on a tasklet that is already queued does nothing.
+ */
+typedef struct tasklet_t {
+    struct tasklet_t* next;
+    volatile int32_t queued;
+    void (*func)(uint32_t data);
+    uint32_t data;
+} tasklet_t;
+
+extern volatile int32_t need_resched;
+
+void softirq_init(void);
+void open_softirq(int32_t nr, void (*action)(void));
+void raise_softirq(int32_t nr);
+void tasklet_init(tasklet_t* t, void (*func)(uint32_t data), uint32_t data);
+void tasklet_schedule(tasklet_t* t);
+void irq_exit(void);
+int32_t in_softirq(void);
+
+#endif /* _SOFTIRQ_H */
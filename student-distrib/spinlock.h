@@ -0,0 +1,60 @@
+/* spinlock.h - Spinlocks for sharing data between processors
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+#include "types.h"
+#include "lib.h"
+
+/* A lock is free when lock is 0 */
+typedef struct spinlock_t {
+    volatile uint32_t lock;
+} spinlock_t;
+
+#define SPINLOCK_UNLOCKED   { 0 }
+
+/* Spin until the lock is ours. xchg is atomic (and a full barrier) on
+ * its own, pause keeps the spinning processor from flooding the bus */
+#define spin_lock(l)                    \
+do {                                    \
+    uint32_t _old;                      \
+    while (1) {                         \
+        _old = 1;                       \
+        asm volatile ("xchgl %0, %1"    \
+                : "+r"(_old), "+m"((l)->lock) \
+                :                       \
+                : "memory"              \
+        );                              \
+        if (_old == 0)                  \
+            break;                      \
+        while ((l)->lock)               \
+            asm volatile ("pause");     \
+    }                                   \
+} while (0)
+
+/* Release the lock, stores are not reordered on x86 so a compiler
+ * barrier is enough */
+#define spin_unlock(l)                  \
+do {                                    \
+    asm volatile ("" : : : "memory");   \
+    (l)->lock = 0;                      \
+} while (0)
+
+/* Take the lock with interrupts off on this processor, this replaces a
+ * cli()/sti() pair around data an interrupt handler also touches */
+#define spin_lock_irqsave(l, flags)     \
+do {                                    \
+    cli_and_save(flags);                \
+    spin_lock(l);                       \
+} while (0)
+
+/* Release the lock and put IF back as it was */
+#define spin_unlock_irqrestore(l, flags) \
+do {                                    \
+    spin_unlock(l);                     \
+    restore_flags(flags);               \
+} while (0)
+
+#endif /* _SPINLOCK_H */
@@ -10,8 +10,13 @@
 #include "paging.h"
 #include "scheduler.h"
 #include "dev/sound.h"
+#include "spinlock.h"
+#include "clock.h"
+#include "prof.h"
+#include "vfs.h"
 /* Global Section */
 int8_t task_array[MAX_PROC] = {0};  /* for hold PID */
+static spinlock_t task_lock = SPINLOCK_UNLOCKED;    /* task_array */
 int32_t pid = 0, new_pid = 0;       /* pid cursor */
 extern terminal_t tm_array[];
 extern int32_t terminal_tick;   
@@ -67,14 +72,15 @@ int32_t open(const uint8_t* fname){
     // sti();
 
     int i;                          // Loop index
-    dentry_t dentry;               // pointer to dentry
+    vnode_t* vn;                    // what fname resolves to
 
     // check if buf is NULL
     if (NULL == fname)
         return SYS_CALL_FAIL;
 
     // if failed to find the entry, return -1
-    if (SYS_CALL_FAIL == read_dentry_by_name(fname, &dentry))
+    vn = vfs_lookup(fname);
+    if (vn == NULL)
         return SYS_CALL_FAIL;
 
     // get the pointer to current pcb
@@ -90,27 +96,25 @@ int32_t open(const uint8_t* fname){
                 uint32_t    file_pos;
                 uint32_t    flages;
              */
-            switch (dentry.f_type) {
-                case FILE_RTC:
-                    cur_pcb->file_array[i].file_ops_ptr = &rtc_fop_t;
-                    break;
-                case FILE_DIREC:
-                    cur_pcb->file_array[i].file_ops_ptr = &dir_fop_t;
-                    break;
-                case FILE_REG:
-                    cur_pcb->file_array[i].file_ops_ptr = &reg_fop_t;
-                    break;
-            }
-            cur_pcb->file_array[i].idx_inode = dentry.idx_inode;
+            cur_pcb->file_array[i].file_ops_ptr = vn->fops;     // chosen by the file system
+            cur_pcb->file_array[i].vnode = vn;
+            cur_pcb->file_array[i].idx_inode = vn->ino;
             cur_pcb->file_array[i].file_pos = 0;        // 0 as the file has not been read yet
+            cur_pcb->file_array[i].blk_ptr = NULL;      // block cursor is loaded on first read
             cur_pcb->file_array[i].flags = INUSE;
 
-            // call open for specific type
-            cur_pcb->file_array[i].file_ops_ptr->open(fname);
+            // call open for specific type, a device may be missing
+            if (SYS_CALL_FAIL == cur_pcb->file_array[i].file_ops_ptr->open(fname)) {
+                cur_pcb->file_array[i].vnode = NULL;
+                cur_pcb->file_array[i].flags = UNUSE;
+                vfs_put(vn);
+                return SYS_CALL_FAIL;
+            }
             return i;
         }
     }
     // exiting the while loop means all fds are full, fail
+    vfs_put(vn);
     return SYS_CALL_FAIL;
 }
 
@@ -141,6 +145,8 @@ int32_t close(int32_t fd){
     if (SYS_CALL_FAIL == cur_pcb->file_array[fd].file_ops_ptr->close(fd))
         return SYS_CALL_FAIL;
 
+    vfs_put(cur_pcb->file_array[fd].vnode);
+    cur_pcb->file_array[fd].vnode = NULL;
     cur_pcb->file_array[fd].flags = UNUSE;
 
     return 0;
@@ -216,6 +222,207 @@ int32_t write(int32_t fd, const void* buf, int32_t nbytes) {
     return ret;
 }
 
+/*
+ *   pread
+ *   DESCRIPTION: read a regular file at a given offset; the file position
+ *                (and its cached block) is left alone
+ *   INPUTS: fd - the file descriptor to read from
+ *           buf - the buffer to read into
+ *           nbytes - number of bytes to read
+ *           offset - where to start in the file
+ *   OUTPUTS: buf is filled
+ *   RETURN VALUE: number of bytes read, -1 if anything bad happened
+ *   SIDE EFFECTS: none
+ */
+int32_t pread(int32_t fd, void* buf, int32_t nbytes, int32_t offset){
+    pcb* cur_pcb;
+
+    if (fd < INI_FILES || fd >= N_FILES || buf == NULL || nbytes < 0 || offset < 0)
+        return SYS_CALL_FAIL;
+    cur_pcb = get_pcb_ptr(pid);
+    if (cur_pcb->file_array[fd].flags == UNUSE || cur_pcb->file_array[fd].file_ops_ptr != &reg_fop_t)
+        return SYS_CALL_FAIL;
+
+    return file_pread(fd, buf, nbytes, offset);
+}
+
+/*
+ *   lseek
+ *   DESCRIPTION: move the file position of a regular file
+ *   INPUTS: fd - the file descriptor
+ *           offset - new position, relative to whence
+ *           whence - SEEK_SET, SEEK_CUR or SEEK_END
+ *   OUTPUTS: none
+ *   RETURN VALUE: the new position, -1 if it is outside the file
+ *   SIDE EFFECTS: changes file_pos; the block cursor reloads on the next read
+ */
+int32_t lseek(int32_t fd, int32_t offset, int32_t whence){
+    pcb* cur_pcb;
+
+    if (fd < INI_FILES || fd >= N_FILES)
+        return SYS_CALL_FAIL;
+    cur_pcb = get_pcb_ptr(pid);
+    if (cur_pcb->file_array[fd].flags == UNUSE || cur_pcb->file_array[fd].file_ops_ptr != &reg_fop_t)
+        return SYS_CALL_FAIL;
+
+    return file_seek(fd, offset, whence);
+}
+
+/*
+ *   mmap
+ *   DESCRIPTION: map a regular file read-only into the mmap area of the
+ *                calling program, so it can be scanned without read
+ *   INPUTS: fd - the file descriptor
+ *           start - where to store the address of the mapping
+ *   OUTPUTS: *start is set
+ *   RETURN VALUE: length of the file, -1 if anything bad happened
+ *   SIDE EFFECTS: the mapping lasts until the program halts
+ */
+int32_t mmap(int32_t fd, void** start){
+    pcb* cur_pcb;
+
+    if (fd < INI_FILES || fd >= N_FILES || !_user_range_ok_(start, sizeof(void*)))
+        return SYS_CALL_FAIL;
+    cur_pcb = get_pcb_ptr(pid);
+    if (cur_pcb->file_array[fd].flags == UNUSE || cur_pcb->file_array[fd].file_ops_ptr != &reg_fop_t)
+        return SYS_CALL_FAIL;
+
+    return file_mmap(fd, start);
+}
+
+/*
+ *   sleep
+ *   DESCRIPTION: block the calling program for at least us microseconds;
+ *                the CPU halts in the meantime instead of polling
+ *   INPUTS: us - the delay
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if us is negative
+ *   SIDE EFFECTS: interrupts are on while sleeping
+ */
+int32_t sleep(int32_t us){
+    if (us < 0)
+        return SYS_CALL_FAIL;
+    sti();
+    clock_sleep_us((uint32_t)us);
+    return 0;
+}
+
+/*
+ *   gettime
+ *   DESCRIPTION: read the monotonic clock
+ *   INPUTS: ns - where to store the time
+ *   OUTPUTS: *ns gets the nanoseconds since boot
+ *   RETURN VALUE: 0, -1 if ns is not a user address
+ *   SIDE EFFECTS: none
+ */
+int32_t gettime(uint64_t* ns){
+    if (!_user_range_ok_(ns, sizeof(uint64_t)))
+        return SYS_CALL_FAIL;
+    *ns = clock_ns();
+    return 0;
+}
+
+/*
+ *   readv
+ *   DESCRIPTION: read from a file into several buffers, in order, with one
+ *                system call; stops early on a short read
+ *   INPUTS: fd - the file descriptor to read from
+ *           iov - array of buffers in user space
+ *           iovcnt - number of entries in iov
+ *   OUTPUTS: the buffers are filled
+ *   RETURN VALUE: total number of bytes read, -1 if the first read failed or
+ *                 iovcnt is more than IOV_MAX
+ *   SIDE EFFECTS: same as read
+ */
+int32_t readv(int32_t fd, const iovec_t* iov, int32_t iovcnt){
+    int32_t i, ret, total = 0;
+
+    if (iovcnt < 0 || iovcnt > IOV_MAX || !_user_range_ok_(iov, iovcnt * sizeof(iovec_t)))
+        return SYS_CALL_FAIL;
+
+    for (i = 0; i < iovcnt; i++) {
+        ret = read(fd, iov[i].base, iov[i].len);
+        if (ret == SYS_CALL_FAIL)
+            return (i == 0) ? SYS_CALL_FAIL : total;
+        total += ret;
+        if (ret < iov[i].len)
+            break;
+    }
+    return total;
+}
+
+/*
+ *   writev
+ *   DESCRIPTION: write several buffers, in order, with one system call
+ *   INPUTS: fd - the file descriptor to write to
+ *           iov - array of buffers in user space
+ *           iovcnt - number of entries in iov
+ *   OUTPUTS: none
+ *   RETURN VALUE: total number of bytes written, -1 if the first write failed or
+ *                 iovcnt is more than IOV_MAX
+ *   SIDE EFFECTS: same as write
+ */
+int32_t writev(int32_t fd, const iovec_t* iov, int32_t iovcnt){
+    int32_t i, ret, total = 0;
+
+    if (iovcnt < 0 || iovcnt > IOV_MAX || !_user_range_ok_(iov, iovcnt * sizeof(iovec_t)))
+        return SYS_CALL_FAIL;
+
+    for (i = 0; i < iovcnt; i++) {
+        ret = write(fd, iov[i].base, iov[i].len);
+        if (ret == SYS_CALL_FAIL)
+            return (i == 0) ? SYS_CALL_FAIL : total;
+        total += ret;
+    }
+    return total;
+}
+
+/*
+ *   io_enter
+ *   DESCRIPTION: run every request queued in the submission ring, in order,
+ *                and post one completion per request; stops early if the
+ *                completion ring is full
+ *   INPUTS: ring - io ring in user space
+ *   OUTPUTS: completions in ring->cq
+ *   RETURN VALUE: number of requests consumed, -1 if the ring is invalid
+ *   SIDE EFFECTS: advances ring->sq_head and ring->cq_tail
+ */
+int32_t io_enter(io_ring_t* ring){
+    io_sqe_t* sqe;
+    io_cqe_t* cqe;
+    int32_t res, done = 0;
+
+    if (!_user_range_ok_(ring, sizeof(io_ring_t)))
+        return SYS_CALL_FAIL;
+
+    while (ring->sq_head != ring->sq_tail) {
+        if (ring->cq_tail - ring->cq_head >= IO_RING_ENTRIES)
+            break;
+        sqe = &ring->sq[ring->sq_head & (IO_RING_ENTRIES - 1)];
+        switch (sqe->opcode) {
+            case IO_OP_READ:
+                res = read(sqe->fd, sqe->buf, sqe->nbytes);
+                break;
+            case IO_OP_WRITE:
+                res = write(sqe->fd, sqe->buf, sqe->nbytes);
+                break;
+            case IO_OP_CLOSE:
+                res = close(sqe->fd);
+                break;
+            default:
+                res = SYS_CALL_FAIL;
+                break;
+        }
+        cqe = &ring->cq[ring->cq_tail & (IO_RING_ENTRIES - 1)];
+        cqe->user_data = sqe->user_data;
+        cqe->res = res;
+        ring->cq_tail++;
+        ring->sq_head++;
+        done++;
+    }
+    return done;
+}
+
 /*
  *   badread
  *   DESCRIPTION: bad
@@ -363,9 +570,22 @@ int32_t halt(uint8_t status){
         /*--------------------------------------------------------------*/
     }
 
+    /* Close any relevant FDs, while pid is still ours for close() */
+    /* close normal file */
+    for (i = 2; i < N_FILES; i++){
+        if (cur_pcb_ptr->file_array[i].flags == INUSE){
+            close(i);
+        }
+    }
+    /* close stdin, stdout */
+    cur_pcb_ptr->file_array[0].flags = UNUSE;   /* stdi */
+    cur_pcb_ptr->file_array[1].flags = UNUSE;   /* stdo */
+
     /*  Restore parent data */
     prev_pcb_ptr = get_pcb_ptr(cur_pcb_ptr->prev_pid);
+    spin_lock(&task_lock);
     task_array[pid] = 0;        /* release the pid entry at task array */
+    spin_unlock(&task_lock);
     pid = prev_pcb_ptr->pid;    /* update pid */
     tm_array[terminal_tick].tm_pid = pid; 
     
@@ -377,17 +597,7 @@ int32_t halt(uint8_t status){
     /* Restore parent paging */
     paging_set_user_mapping(pid);
     paging_restore_for_vedio_mem(VIRTUAL_ADDR_VEDIO_PAGE);
-
-    /* Close any relevant FDs */
-    /* close normal file */
-    for (i = 2; i < N_FILES; i++){
-        if (cur_pcb_ptr->file_array[i].flags == INUSE){
-            close(i);
-        }
-    }
-    /* close stdin, stdout */
-    cur_pcb_ptr->file_array[0].flags = UNUSE;   /* stdi */
-    cur_pcb_ptr->file_array[1].flags = UNUSE;   /* stdo */
+    paging_clear_mmap(cur_pcb_ptr->pid);
 
     /* Jump to execute return */
     k_ebp = cur_pcb_ptr->kernel_ebp_exc;
@@ -451,6 +661,7 @@ int32_t execute(const uint8_t* command){
 
     /* setting PCB */
     if (SYS_CALL_FAIL == _PCB_setting_(filename, args, &eip)) return SYS_CALL_FAIL;
+    prof_exec(pid, filename);
 
     /* context switch */
     /*-------------------- Context switch micro --------------------*/
@@ -581,9 +792,22 @@ void exp_halt(){
         /*--------------------------------------------------------------*/
     }
 
+    /* Close any relevant FDs, while pid is still ours for close() */
+    /* close normal file */
+    for (i = 2; i < N_FILES; i++){
+        if (cur_pcb_ptr->file_array[i].flags == INUSE){
+            close(i);
+        }
+    }
+    /* close stdin, stdout */
+    cur_pcb_ptr->file_array[0].flags = UNUSE;   /* stdi */
+    cur_pcb_ptr->file_array[1].flags = UNUSE;   /* stdo */
+
     /*  Restore parent data */
     prev_pcb_ptr = get_pcb_ptr(cur_pcb_ptr->prev_pid);
+    spin_lock(&task_lock);
     task_array[pid] = 0;        /* release the pid entry at task array */
+    spin_unlock(&task_lock);
     pid = prev_pcb_ptr->pid;    /* update pid */
     tm_array[terminal_tick].tm_pid = pid; 
 
@@ -595,17 +819,7 @@ void exp_halt(){
     /* Restore parent paging */
     paging_set_user_mapping(pid);
     paging_restore_for_vedio_mem(VIRTUAL_ADDR_VEDIO_PAGE);
-
-    /* Close any relevant FDs */
-    /* close normal file */
-    for (i = 2; i < N_FILES; i++){
-        if (cur_pcb_ptr->file_array[i].flags == INUSE){
-            close(i);
-        }
-    }
-    /* close stdin, stdout */
-    cur_pcb_ptr->file_array[0].flags = UNUSE;   /* stdi */
-    cur_pcb_ptr->file_array[1].flags = UNUSE;   /* stdo */
+    paging_clear_mmap(cur_pcb_ptr->pid);
 
     /* Jump to execute return */
     k_esp = cur_pcb_ptr->kernel_esp_exc;
@@ -625,6 +839,20 @@ void exp_halt(){
 }
 
 
+/*
+ *   _user_range_ok_
+ *   DESCRIPTION: check that a buffer lies entirely inside the user page
+ *   INPUTS: addr - start of the buffer
+ *           len - size of the buffer in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if it does, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t _user_range_ok_(const void* addr, uint32_t len){
+    uint32_t start = (uint32_t)addr;
+    return start >= USER_PAGE_BASE && len <= _4MB_ && start + len <= USER_PAGE_BASE + _4MB_;
+}
+
 /*
  * _parse_cmd_
  *   DESCRIPTION: helper function to parse the command sting to filename and args
@@ -695,14 +923,18 @@ int32_t _parse_cmd_(const uint8_t* command, uint8_t* filename, uint8_t* args){
  *   SIDE EFFECTS:  none
  */
 int32_t _file_validation_(const uint8_t* filename){
-    dentry_t validation_dentry;                     /* dentry instance for validation */
-    uint8_t validation_buf[VALIDATION_READ_SIZE];   /* buf for read from dentry */
+    vnode_t* vn;                                    /* the file, from any mount */
+    uint8_t validation_buf[VALIDATION_READ_SIZE];   /* buf for read from the file */
+    int32_t n;
 
     /* Check if file exist */
-    if (SYS_CALL_FAIL == read_dentry_by_name(filename, &validation_dentry)) return SYS_CALL_FAIL;
+    vn = vfs_lookup(filename);
+    if (vn == NULL) return SYS_CALL_FAIL;
 
-    /* Valid if read dentry work */
-    if (VALIDATION_READ_SIZE != read_data(validation_dentry.idx_inode, 0, validation_buf, VALIDATION_READ_SIZE)){
+    /* Valid if it is a regular file and the read works */
+    n = (vn->fops == &reg_fop_t) ? vfs_read(vn, 0, validation_buf, VALIDATION_READ_SIZE) : SYS_CALL_FAIL;
+    vfs_put(vn);
+    if (VALIDATION_READ_SIZE != n){
         return SYS_CALL_FAIL;
     }
 
@@ -722,17 +954,29 @@ int32_t _file_validation_(const uint8_t* filename){
  *   DESCRIPTION: helper function to verify the file
  *   INPUTS: filename - filename array
  *   OUTPUTS: none
- *   RETURN VALUE: -1 - for invalid result
+ *   RETURN VALUE: -1 - for invalid result or a program too big for the
+ *                      user page
  *                  0 - for success
  *                  1 - for exe up limit
  *   SIDE EFFECTS:  none
  */
 int32_t _mem_setting_(const uint8_t* filename, int32_t* eip){
-    dentry_t den;               /* for loading user program */
+    vnode_t* vn;                /* for loading user program */
     uint8_t* Loading_address;   /* as the buf to load program */
     int32_t i;                  /* loop index */
+    uint32_t flags;
+
+    /* 0. Found by _file_validation_, now from the path cache */
+    vn = vfs_lookup(filename);
+    if (vn == NULL) return SYS_CALL_FAIL;
+    /* the image is loaded at 0x48000 into the 4 MB user page and must fit */
+    if (vn->size > _4MB_ - PROGRAM_OFFSET) {
+        vfs_put(vn);
+        return SYS_CALL_FAIL;
+    }
 
     /* 1. Find a free entry for new task */
+    spin_lock_irqsave(&task_lock, flags);
     for (i = 0; i < MAX_PROC; i++){
         if (task_array[i] == 0){
             new_pid = i;
@@ -741,9 +985,11 @@ int32_t _mem_setting_(const uint8_t* filename, int32_t* eip){
             break;
         }
     }
+    spin_unlock_irqrestore(&task_lock, flags);
 
     /* Check if new process request beyond ability */
     if (i == MAX_PROC) {
+        vfs_put(vn);
         sti();
         // WARNING_PCS();
         little_star();
@@ -755,10 +1001,10 @@ int32_t _mem_setting_(const uint8_t* filename, int32_t* eip){
     /* 2. Mapping virtual 128 MB to physical image address */
     paging_set_user_mapping(new_pid);
 
-    /* 3. Loading user program via read_data, copy from file system to memory */
-    read_dentry_by_name(filename, &den);
-    Loading_address = (uint8_t*)0x8048000; /* fixed address, according to Appendix C */
-    read_data(den.idx_inode, 0, Loading_address, get_file_size(den.idx_inode));
+    /* 3. Loading user program via vfs_read, copy from file system to memory */
+    Loading_address = (uint8_t*)(USER_PAGE_BASE + PROGRAM_OFFSET); /* fixed address, according to Appendix C */
+    vfs_read(vn, 0, Loading_address, vn->size);
+    vfs_put(vn);
 
     *eip = *(int32_t*)(Loading_address+24); // 24 is the offset address of the first instruction
     return SUCCESS;
@@ -795,7 +1041,8 @@ int32_t _PCB_setting_(const uint8_t* filename, const uint8_t* args, int32_t* eip
     // rtc info setting
     new_pcb_ptr->rtc_opened=0;
     new_pcb_ptr->virtual_freq=0;  
-    new_pcb_ptr->current_count=MAX_FREQ;
+    new_pcb_ptr->mmap_next = 0;
+    new_pcb_ptr->rtc_deadline=0;
     new_pcb_ptr->virtual_iqr_got=0;        
 
     /* move the reg value to variable */
@@ -829,12 +1076,14 @@ void _fd_init_(pcb* pcb_addr){
                 pcb_addr->file_array[i].file_ops_ptr = &stdi_fop_t;
                 pcb_addr->file_array[i].flags = INUSE;
                 pcb_addr->file_array[i].idx_inode = INVALID_NODE;
+                pcb_addr->file_array[i].vnode = NULL;
                 pcb_addr->file_array[i].file_pos = 0;    /* Not matter */
                 break;
             case 1: /* stdout */
                 pcb_addr->file_array[i].file_ops_ptr = &stdo_fop_t;
                 pcb_addr->file_array[i].flags = INUSE;
                 pcb_addr->file_array[i].idx_inode = INVALID_NODE;
+                pcb_addr->file_array[i].vnode = NULL;
                 pcb_addr->file_array[i].file_pos = 0;    /* Not matter */
                 break;
 
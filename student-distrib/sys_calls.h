@@ -22,11 +22,15 @@
 #define USER_START_SIZE 4
 #define ROOT_TASK -1
 #define USER_PAGE_BASE 0x8000000
+#define PROGRAM_OFFSET 0x48000     /* where the program image starts in the user page */
 #define USER_ESP (USER_PAGE_BASE + 0x400000 - 4) /* 128 MB for start user + 4 MB for page size - 4 entry */
 #define EXE_LIMIT 1
 #define VIRTUAL_ADDR_VEDIO_PAGE 0x8800000
 #define TEMP_ADDR_VEDIO_PAGE 0x9000000
 #define VIRTUAL_ADDR_AlWAYS_ACCESS_VEDIO_PAGE 0x9800000
+#define MMAP_ADDR 0x8400000             /* 4 MB of mmap area right after the user page */
+#define MMAP_COPY_PHYS 0x9400000        /* private copies, after the temp video memory */
+#define MMAP_COPY_PAGES 256             /* 1 MB of copies per process */
 
 
 
@@ -55,8 +59,57 @@ typedef struct file_des_t {
     uint32_t    idx_inode;
     uint32_t    file_pos;   // position where last read ends
     uint32_t    flags;     // flages that indicate file's state
+    uint32_t    blk_idx;    // index (in the file) of the block blk_ptr points to
+    uint32_t    blk_run;    // blocks of the file contiguous in the image from there
+    data_block_t* blk_ptr;  // cached extent for file_pos, NULL if not loaded
+    struct vnode_t* vnode;  // what was opened, NULL for stdin and stdout
 } file_des_t;
 
+/* whence for lseek */
+#define SEEK_SET    0
+#define SEEK_CUR    1
+#define SEEK_END    2
+
+/* One buffer of a readv/writev request; at most IOV_MAX in one call */
+#define IOV_MAX     1024
+
+typedef struct iovec_t {
+    void*   base;
+    int32_t len;
+} iovec_t;
+
+/*
+ * Submission/completion ring for io_enter. It lives in the user page; the
+ * program fills sq[] and advances sq_tail, the kernel advances sq_head and
+ * posts results to cq[], the program advances cq_head as it consumes them.
+ */
+#define IO_RING_ENTRIES 16      /* must be a power of two */
+#define IO_OP_READ      0
+#define IO_OP_WRITE     1
+#define IO_OP_CLOSE     2
+
+typedef struct io_sqe_t {
+    int32_t  opcode;
+    int32_t  fd;
+    void*    buf;
+    int32_t  nbytes;
+    uint32_t user_data;         /* copied to the completion */
+} io_sqe_t;
+
+typedef struct io_cqe_t {
+    uint32_t user_data;
+    int32_t  res;               /* what the single call would have returned */
+} io_cqe_t;
+
+typedef struct io_ring_t {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    io_sqe_t sq[IO_RING_ENTRIES];
+    io_cqe_t cq[IO_RING_ENTRIES];
+} io_ring_t;
+
 /* PCB struct */
 typedef struct pcb {
     file_des_t  file_array[N_FILES];
@@ -73,10 +126,12 @@ typedef struct pcb {
     uint32_t kernel_ebp_exc;
 
     // fileds for rtc
-    int rtc_opened; //indicate whether the rtc file is opened in this process
+    int rtc_opened; //number of rtc files opened in this process
     int virtual_freq;          
-    volatile int current_count; // when the current count reach zero, we indicate a virtual irq  （later for file position field of fd）
+    uint32_t rtc_deadline;      // rtc_read returns once the RTC count reaches it
     volatile int virtual_iqr_got; // gotten a virtual iqr
+
+    uint32_t mmap_next;         // next free page of the mmap area
 } pcb;
 
 fop_t rtc_fop_t;
@@ -97,6 +152,28 @@ int32_t read(int32_t fd, void* buf, int32_t nbytes);
 /* writes data to terminal or a device */
 int32_t write(int32_t fd, const void* buf, int32_t nbytes);
 
+/* read into / write from several buffers in one call */
+int32_t readv(int32_t fd, const iovec_t* iov, int32_t iovcnt);
+int32_t writev(int32_t fd, const iovec_t* iov, int32_t iovcnt);
+
+/* read at a given offset without moving the file position */
+int32_t pread(int32_t fd, void* buf, int32_t nbytes, int32_t offset);
+
+/* move the file position of a regular file */
+int32_t lseek(int32_t fd, int32_t offset, int32_t whence);
+
+/* map a regular file into the mmap area */
+int32_t mmap(int32_t fd, void** start);
+
+/* sleep for a number of microseconds */
+int32_t sleep(int32_t us);
+
+/* nanoseconds since boot, from the monotonic clock */
+int32_t gettime(uint64_t* ns);
+
+/* run every queued request of an io ring */
+int32_t io_enter(io_ring_t* ring);
+
 /* copy program args from kernel to user */
 int32_t getargs (uint8_t* buf, int32_t nbytes);
 
@@ -122,6 +199,7 @@ void fop_t_init();
 void exp_halt();
 
 /* Helper function for execute and halt */
+int32_t _user_range_ok_(const void* addr, uint32_t len);
 int32_t _parse_cmd_(const uint8_t* command, uint8_t* filename, uint8_t* args);
 int32_t _file_validation_(const uint8_t* filename);
 int32_t _mem_setting_(const uint8_t* filename, int32_t* eip);
@@ -8,12 +8,16 @@
 #include "lib.h"
 #include "paging.h"
 #include "desktop.h"
+#include "spinlock.h"
+#include "clock.h"
+#include "./dev/uart.h"
 
 #define ON          1
 #define OFF         0
 
 volatile uint8_t enter_flag = OFF;      /* Record the state of whether enter is pressed */
 volatile uint8_t click_flag = OFF;      /* Record the state of whether mouse is clicked */
+static spinlock_t term_lock = SPINLOCK_UNLOCKED;   /* line buffers and the screen */
 
 //static char line_buf[LINE_BUF_SIZE];    /* The line buffer */
 //static int num_char = 0;                /* Record current number of chars in line buffer */
@@ -62,6 +66,7 @@ int32_t terminal_close(int32_t fd) {
  */
 int32_t terminal_read(int32_t fd, void* buf, int32_t nbytes) {
     int i;                          // Loop index
+    uint32_t flags;
 
     // check NULL pointer and wrong nbytes
     if (buf == NULL)
@@ -69,10 +74,13 @@ int32_t terminal_read(int32_t fd, void* buf, int32_t nbytes) {
 
     // While enter not pressed, wait for enter
     while (1) {
+        cli();
         if (enter_flag && (terminal_tick == terminal_display)) break;
         if (click_flag) break;
+        cpu_idle();
     }
-    cli();
+    sti();
+    spin_lock_irqsave(&term_lock, flags);
 
     // Define a temp buffer for data transfer
     int8_t * temp_buf = (int8_t *)buf;
@@ -92,7 +100,7 @@ int32_t terminal_read(int32_t fd, void* buf, int32_t nbytes) {
     enter_flag = OFF;
     click_flag = OFF;
 
-    sti();
+    spin_unlock_irqrestore(&term_lock, flags);
     return i;
 }
 
@@ -109,18 +117,24 @@ int32_t terminal_read(int32_t fd, void* buf, int32_t nbytes) {
 int32_t terminal_write(int32_t fd, const void* buf, int32_t nbytes) {
     int i;                          // Loop index
     uint8_t curr;
+    uint32_t flags;
+    int32_t mirror;                 // the displayed terminal goes to the serial console too
 
     // check NULL pointer and wrong nbytes
     if (buf == NULL)
         return -1;
 
-    cli();
+    spin_lock_irqsave(&term_lock, flags);
+    mirror = uart_console && terminal_tick == terminal_display;
     for(i = 0; i < nbytes; ++i) {
         curr = ((char*) buf)[i];
-        if(curr != '\0')            // Skip null
+        if(curr != '\0') {          // Skip null
             putc(curr);             // Print other characters
+            if (mirror)
+                uart_putc(curr);
+        }
     }
-    sti();
+    spin_unlock_irqrestore(&term_lock, flags);
     return 0;
 }
 
@@ -133,7 +147,9 @@ int32_t terminal_write(int32_t fd, const void* buf, int32_t nbytes) {
  *   SIDE EFFECTS: change the line input buffer and char index
  */
 void line_buf_in(char curr) {
-    cli();
+    uint32_t flags;
+
+    spin_lock_irqsave(&term_lock, flags);
     // If the line buffer is already full, only change* when receiving line feed
     if (tm_array[terminal_display].num_char >= LINE_BUF_SIZE - 2) {        // minus 2 since the last two char of BUFFER must be '\n' and '\0'
         if (('\n' == curr) | ('\r' == curr)) {
@@ -172,6 +188,7 @@ void line_buf_in(char curr) {
             put_dis_ter(curr);
         }
     }
+    spin_unlock_irqrestore(&term_lock, flags);
 }
 
 /*
@@ -216,6 +233,8 @@ void put_dis_ter(char curr) {
 
     // do the actual display
     putc(curr);
+    if (uart_console)
+        uart_putc(curr);
 
     // restore original active terminal number
     terminal_tick = term_buf;
@@ -20,6 +20,7 @@
 	printf("[TEST %s] Result = %s\n", name, (result) ? "PASS" : "FAIL");
 
 int32_t test_PF;
+extern int32_t pid;             /* in sys_calls.c */
 static inline void assertion_failure(){
 	/* Use exception #15 for assertions, otherwise
 	   reserved by Intel */
@@ -569,6 +570,72 @@ int rtc_driver_edge_case_test(){
 }
 /* Checkpoint 3 tests */
 
+/* readv/writev with a huge iovcnt
+ * iovcnt * sizeof(iovec_t) wraps to 8 for 0x20000001, which would pass the
+ * user range check; both calls must fail before touching iov
+ * Outputs: PASS/FAIL
+ * Side Effects: None
+ * Coverage: readv, writev
+ * Files: sys_calls.c/h
+ */
+int iovec_overflow_test(){
+	const iovec_t* iov = (const iovec_t*)USER_PAGE_BASE;
+
+	TEST_HEADER;
+
+	if (readv(1, iov, 0x20000001) != -1)
+		return FAIL;
+	if (writev(1, iov, 0x20000001) != -1)
+		return FAIL;
+	if (writev(1, iov, IOV_MAX + 1) != -1)
+		return FAIL;
+	return PASS;
+}
+
+/* mmap area across a process switch
+ * Maps one page in the areas of two pids and switches between them the
+ * way scheduler does; each must see only its own page, and clearing one
+ * area must leave the other mapped
+ * Outputs: PASS/FAIL
+ * Side Effects: maps and clears the areas of the last two pids, switches
+ *               back to the current one
+ * Coverage: paging_set_user_mapping, paging_set_mmap_page, paging_clear_mmap
+ * Files: paging.c/h
+ */
+static uint8_t mmap_test_page[2][_4KB_] __attribute__((aligned (_4KB_)));
+
+int mmap_switch_test(){
+	volatile uint8_t* area = (volatile uint8_t*)MMAP_ADDR;
+	int32_t a = MAX_PROC - 2, b = MAX_PROC - 1;
+	int result = PASS;
+
+	TEST_HEADER;
+
+	mmap_test_page[0][0] = 'A';
+	mmap_test_page[1][0] = 'B';
+	paging_set_mmap_page(a, 0, (uint32_t)mmap_test_page[0], 1);
+	paging_set_mmap_page(b, 0, (uint32_t)mmap_test_page[1], 1);
+
+	paging_set_user_mapping(a);
+	if (area[0] != 'A')
+		result = FAIL;
+	area[1] = 'a';
+	paging_set_user_mapping(b);
+	if (area[0] != 'B' || area[1] == 'a')
+		result = FAIL;
+	area[1] = 'b';
+	/* a halting must not take b's page away */
+	paging_clear_mmap(a);
+	if (area[0] != 'B')
+		result = FAIL;
+	if (mmap_test_page[0][1] != 'a' || mmap_test_page[1][1] != 'b')
+		result = FAIL;
+
+	paging_clear_mmap(b);
+	paging_set_user_mapping(pid);
+	return result;
+}
+
 
 
 /* Checkpoint 4 tests */
@@ -595,6 +662,8 @@ void launch_tests(){
 	// TEST_OUTPUT("File System test 6", cp2_filesys_test_6());			// direct_read
 
 	/* Check point 3 */
+	TEST_OUTPUT("iovec_overflow_test", iovec_overflow_test());
+	TEST_OUTPUT("mmap_switch_test", mmap_switch_test());
 	/* Please just play the shell */
 	//test_PF=* (int32_t*)(VIRTUAL_ADDR_VEDIO_PAGE);
 	 * (int32_t*)(VIRTUAL_ADDR_VEDIO_PAGE)=5;
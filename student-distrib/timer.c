@@ -1,13 +1,24 @@
 #include "timer.h"
-#include "scheduler.h"
+#include "clock.h"
+#include "ktimer.h"
 volatile int time_tick;
-/* 
+
+static void pit_set_oneshot(uint32_t us);
+static void pit_stop(void);
+
+/* PIT channel 0 as a one-shot clock event device */
+clock_event_t pit_clock_event = {
+    "pit", PIT_MAX_US, pit_set_oneshot, pit_stop
+};
+
+/*
  * pic_init
  *   DESCRIPTION: initialize the pit as timer chip for multi-task scheduler system
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS:  initialize the pit, which will raise highest INT to PIC at period within 10ms - 50ms
+ *   SIDE EFFECTS:  initialize the pit, which will raise highest INT to PIC at period EXP_TIME;
+ *                  clock_init later turns it into a one-shot device
  */
 void pit_init(){
     /* Set the mode register */
@@ -16,7 +27,7 @@ void pit_init(){
     /* Set INT Frequency */
     // outw(FRE_DIVS, CH0_D_PORT);
     outb(FRE_DIVS & 0xFF, CH0_D_PORT);
-    outb((FRE_DIVS & 0xFF)>>8, CH0_D_PORT);
+    outb((FRE_DIVS >> 8) & 0xFF, CH0_D_PORT);
     /* enable INT */
     enable_irq((uint32_t) PIT_IRQ);
 
@@ -24,37 +35,110 @@ void pit_init(){
     return ;
 }
 
-/* 
- * pic_init
- *   DESCRIPTION: initialize the pit as timer chip for multi-task scheduler system
+/*
+ * pit_set_oneshot
+ *   DESCRIPTION: raise IRQ0 once, us microseconds from now
+ *   INPUTS: us -- the delay, at most PIT_MAX_US
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: reprograms channel 0 in mode 0
+ */
+static void pit_set_oneshot(uint32_t us){
+    uint32_t count = us * (FRE_DIVD / 1000) / 1000;
+
+    if (count == 0)
+        count = 1;
+    outb(MODE_ONESHOT, MODE_REG);
+    outb(count & 0xFF, CH0_D_PORT);
+    outb((count >> 8) & 0xFF, CH0_D_PORT);
+    enable_irq((uint32_t) PIT_IRQ);
+}
+
+/*
+ * pit_stop
+ *   DESCRIPTION: stop the interrupts of channel 0
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS:  initialize the pit, which will raise highest INT to PIC at period within 10ms - 50ms
+ *   SIDE EFFECTS: masks IRQ0
  */
-void pit_handler(){
-    time_tick++;
+static void pit_stop(void){
+    disable_irq((uint32_t) PIT_IRQ);
+}
 
-    cli();
+/*
+ * pit_ch2_wait_ms
+ *   DESCRIPTION: busy-wait ms milliseconds on PIT channel 2, used to
+ *                calibrate the other clocks before any of them is known
+ *   INPUTS: ms -- at most PIT_MAX_US / 1000
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: reprograms channel 2, the speaker is turned off
+ */
+void pit_ch2_wait_ms(uint32_t ms){
+    uint32_t count = FRE_DIVD / 1000 * ms;
+
+    outb((inb(CH2_GATE_PORT) & ~0x02) | 0x01, CH2_GATE_PORT);
+    outb(MODE_CH2_WAIT, MODE_REG);
+    outb(count & 0xFF, CH2_D_PORT);
+    outb((count >> 8) & 0xFF, CH2_D_PORT);
+    while (!(inb(CH2_GATE_PORT) & 0x20)) {}
+}
+
+/*
+ * pit_handler
+ *   DESCRIPTION: IRQ0, hand the tick to the clock
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: see clock_event_handler
+ */
+void pit_handler(){
     send_eoi(PIT_IRQ);
-    if (ENABLE_SCHE){
-        scheduler();
-    }
-    sti();
+    clock_event_handler();
     return ;
 }
 
+/*
+ * timer_wait_done
+ *   DESCRIPTION: ktimer callback of timer_wait
+ *   INPUTS: data -- address of the flag to set
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void timer_wait_done(uint32_t data){
+    *(volatile int32_t*)data = 1;
+}
+
 /* wait for desired ticks */
-/* 
+/*
  * timer_wait
  *   DESCRIPTION: wait for desired ticks
- *   INPUTS: to-wait ticks 
+ *   INPUTS: to-wait ticks
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS:  wait for desired ticks
+ *   SIDE EFFECTS:  sleeps in hlt on a wheel timer when interrupts are on,
+ *                  spins on the clock otherwise
  */
 void timer_wait(int ticks){
-    int eticks = time_tick + ticks;
+    ktimer_t t;
+    volatile int32_t done = 0;
+    uint32_t flags;
 
-    while(eticks > time_tick){} // wait
+    if (ticks <= 0)
+        return;
+    cli_and_save(flags);
+    if (!(flags & EFLAGS_IF)){
+        restore_flags(flags);
+        clock_sleep_us(ticks * TICK_US);
+        return;
+    }
+    ktimer_init(&t, timer_wait_done, (uint32_t)&done);
+    ktimer_add(&t, ticks);
+    while (!done){
+        cpu_idle();
+        cli();
+    }
+    restore_flags(flags);
 }
@@ -39,12 +39,18 @@ Bits         Usage
 * b0: 16-bit binary
 */
 #define MODE_CTL_WORD  0x36
+#define MODE_ONESHOT   0x30 /* channel 0, both bytes, mode 0 (interrupt on terminal count) */
+#define MODE_CH2_WAIT  0xB0 /* channel 2, both bytes, mode 0 */
+#define CH2_D_PORT 0x42
+#define CH2_GATE_PORT 0x61  /* bit 0 gate, bit 1 speaker, bit 5 channel 2 output */
 #define FRE_DIVD 1193180 /* from doc, in hz */
 #define EXP_TIME    20   /* ms */
 #define FRE_DIVS (FRE_DIVD / 1000 * EXP_TIME)
+#define PIT_MAX_US  54000    /* the counter is 16 bits */
 #define PIT_IRQ 0x00
 
 
 void pit_init();
 void pit_handler();
+void pit_ch2_wait_ms(uint32_t ms);
 void timer_wait(int ticks);
@@ -0,0 +1,104 @@
+/* trace.c - Binary trace ring for scheduler, syscall and IRQ events
+ * vim:ts=4 noexpandtab
+ */
+
+#include "trace.h"
+#include "lib.h"
+#include "clock.h"
+#include "smp.h"
+#include "./dev/uart.h"
+
+extern int32_t pid;
+
+/* global section */
+volatile int32_t trace_enabled = 1;         /* a flight recorder from boot on */
+
+static trace_ring_t trace_rings[MAX_CPU];
+
+/*
+ * trace_emit
+ *   DESCRIPTION: append one record to the ring of this CPU
+ *   INPUTS: type -- TRACE_*
+ *           a0, a1, a2 -- the arguments of the event
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: safe from any context, takes no lock
+ */
+void trace_emit(uint32_t type, uint32_t a0, uint32_t a1, uint32_t a2){
+    uint32_t cpu, slot = 1;
+    trace_ring_t* ring;
+    trace_rec_t* r;
+
+    if (!trace_enabled)
+        return;
+    cpu = this_cpu() - cpus;
+    ring = &trace_rings[cpu];
+    asm volatile ("lock xaddl %0, %1" : "+r"(slot), "+m"(ring->head) : : "memory");
+
+    r = &ring->recs[slot & (TRACE_RING_SIZE - 1)];
+    r->tsc = rdtsc();
+    r->type = (uint8_t)type;
+    r->cpu = (uint8_t)cpu;
+    r->pid = (uint16_t)pid;
+    r->arg0 = a0;
+    r->arg1 = a1;
+    r->arg2 = a2;
+}
+
+/*
+ * trace_syscall_enter / trace_syscall_exit
+ *   DESCRIPTION: the syscall tracepoints, called from the syscall linkage
+ *   INPUTS: nr -- the call number
+ *           a0, a1 -- its first two arguments
+ *           ret -- its return value
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void trace_syscall_enter(uint32_t nr, uint32_t a0, uint32_t a1){
+    trace(TRACE_SYSCALL_ENTER, nr, a0, a1);
+}
+
+void trace_syscall_exit(int32_t ret){
+    trace(TRACE_SYSCALL_EXIT, ret, 0, 0);
+}
+
+/*
+ * trace_dump
+ *   DESCRIPTION: send every ring over COM1 for tools/trace2json.py: a line
+ *                "TRACE BEGIN khz=<tsc kHz> records=<n>", then n raw
+ *                records, oldest first per CPU, then "TRACE END". Tracing
+ *                pauses for the dump and starts over afterwards
+ *   INPUTS: none
+ *   OUTPUTS: the dump on COM1, a summary on the screen
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: empties the rings
+ */
+void trace_dump(void){
+    uint32_t cpu, i, n, total = 0;
+    trace_ring_t* ring;
+    int8_t num[12];
+
+    trace_enabled = 0;
+    for (cpu = 0; cpu < MAX_CPU; cpu++){
+        n = trace_rings[cpu].head;
+        total += (n > TRACE_RING_SIZE) ? TRACE_RING_SIZE : n;
+    }
+
+    uart_puts("TRACE BEGIN khz=");
+    uart_puts(itoa(clock_tsc_khz(), num, 10));
+    uart_puts(" records=");
+    uart_puts(itoa(total, num, 10));
+    uart_puts("\n");
+    for (cpu = 0; cpu < MAX_CPU; cpu++){
+        ring = &trace_rings[cpu];
+        n = ring->head;
+        i = (n > TRACE_RING_SIZE) ? n - TRACE_RING_SIZE : 0;
+        for (; i < n; i++)
+            uart_write(&ring->recs[i & (TRACE_RING_SIZE - 1)], TRACE_REC_SIZE);
+        ring->head = 0;
+    }
+    uart_puts("TRACE END\n");
+    printf("trace: %d records sent to COM1\n", total);
+    trace_enabled = 1;
+}
@@ -0,0 +1,74 @@
+/* trace.h - Binary trace ring for scheduler, syscall and IRQ events
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+/* Event types */
+#define TRACE_SYSCALL_ENTER 1       /* nr, arg0, arg1 */
+#define TRACE_SYSCALL_EXIT  2       /* return value */
+#define TRACE_SWITCH        3       /* old pid, new pid, new terminal */
+#define TRACE_IRQ_ENTRY     4       /* vector */
+#define TRACE_IRQ_EXIT      5       /* vector */
+#define TRACE_PAGE_FAULT    6       /* cr2, error code, eip */
+#define TRACE_TLB_FLUSH     7       /* address of the flush */
+
+/* Tracepoints whose type is not in TRACE_MASK compile to nothing */
+#define TRACE_BIT(type)     (1 << (type))
+#define TRACE_MASK          (TRACE_BIT(TRACE_SYSCALL_ENTER) | TRACE_BIT(TRACE_SYSCALL_EXIT) \
+                           | TRACE_BIT(TRACE_SWITCH) | TRACE_BIT(TRACE_IRQ_ENTRY)          \
+                           | TRACE_BIT(TRACE_IRQ_EXIT) | TRACE_BIT(TRACE_PAGE_FAULT)        \
+                           | TRACE_BIT(TRACE_TLB_FLUSH))
+#define TRACE_ON(type)      (TRACE_MASK & TRACE_BIT(type))
+
+#define TRACE_RING_SIZE     4096    /* records per CPU, power of two */
+#define TRACE_REC_SIZE      24
+
+#ifndef ASM
+
+#include "types.h"
+
+/* One event, TRACE_REC_SIZE bytes, dumped as is (little endian) */
+typedef struct __attribute__((packed)) trace_rec_t {
+    uint64_t tsc;
+    uint8_t  type;
+    uint8_t  cpu;
+    uint16_t pid;
+    uint32_t arg0;
+    uint32_t arg1;
+    uint32_t arg2;
+} trace_rec_t;
+
+/* Any context on the CPU may write, a slot is claimed with one locked
+ * add so a nested interrupt takes the next one; full rings overwrite
+ * their oldest records */
+typedef struct trace_ring_t {
+    volatile uint32_t head;         /* records claimed */
+    trace_rec_t recs[TRACE_RING_SIZE];
+} trace_ring_t;
+
+extern volatile int32_t trace_enabled;
+
+#define trace(type, a0, a1, a2)                     \
+do {                                                \
+    if (TRACE_ON(type))                             \
+        trace_emit((type), (uint32_t)(a0), (uint32_t)(a1), (uint32_t)(a2)); \
+} while (0)
+
+/* Address of the instruction where it is used */
+#define TRACE_HERE()                                \
+({                                                  \
+    uint32_t _eip;                                  \
+    asm volatile ("movl $1f, %0\n1:" : "=r"(_eip)); \
+    _eip;                                           \
+})
+
+void trace_emit(uint32_t type, uint32_t a0, uint32_t a1, uint32_t a2);
+void trace_syscall_enter(uint32_t nr, uint32_t a0, uint32_t a1);
+void trace_syscall_exit(int32_t ret);
+void trace_dump(void);
+
+#endif /* ASM */
+
+#endif /* _TRACE_H */
@@ -0,0 +1,317 @@
+/* vfs.c - Mount table, vnode cache and path lookup
+ * vim:ts=4 noexpandtab
+ */
+
+#include "vfs.h"
+#include "lib.h"
+#include "spinlock.h"
+
+#define VHASH(mnt, ino)     ((((uint32_t)(mnt) >> 4) ^ (ino)) & (VFS_VHASH - 1))
+
+/* A resolved path; a hit costs one hash of the path and one compare */
+typedef struct dcache_t {
+    uint32_t hash;
+    uint32_t len;                   /* 0 for an empty slot */
+    int8_t path[VFS_PATH_LEN];
+    mount_t* mnt;
+    vattr_t attr;
+} dcache_t;
+
+/* global section */
+static mount_t mounts[VFS_MAX_MOUNTS];
+static uint32_t n_mounts = 0;
+static vnode_t vnodes[VFS_VNODES];
+static vnode_t* vhash[VFS_VHASH];
+static dcache_t dcache[VFS_DCACHE];
+static spinlock_t vfs_lock = SPINLOCK_UNLOCKED;
+
+/*
+ * vfs_hash
+ *   DESCRIPTION: FNV-1a of a path
+ *   INPUTS: s -- the path
+ *           len -- its length
+ *   OUTPUTS: none
+ *   RETURN VALUE: the hash
+ *   SIDE EFFECTS: none
+ */
+static uint32_t vfs_hash(const uint8_t* s, uint32_t len){
+    uint32_t h = 2166136261u;
+
+    while (len-- > 0)
+        h = (h ^ *s++) * 16777619u;
+    return h;
+}
+
+/*
+ * vfs_init
+ *   DESCRIPTION: empty the mount table and the caches
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: call before any file system mounts
+ */
+void vfs_init(void){
+    n_mounts = 0;
+    memset(vnodes, 0, sizeof(vnodes));
+    memset(vhash, 0, sizeof(vhash));
+    memset(dcache, 0, sizeof(dcache));
+}
+
+/*
+ * vfs_mount
+ *   DESCRIPTION: attach a file system at path. Mount "/" first; relative
+ *                names are tried in mount order on VFS_SEARCH mounts
+ *   INPUTS: path -- "/" or "/name"
+ *           ops -- its operations
+ *           sb -- its state, handed back in mount_t
+ *           root -- ino of its root directory
+ *           flags -- VFS_SEARCH or 0
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if the table is full or the path is bad
+ *   SIDE EFFECTS: drops the path cache, the new mount may hide names
+ */
+int32_t vfs_mount(const int8_t* path, fs_ops_t* ops, void* sb, uint32_t root, uint32_t flags){
+    uint32_t len = strlen(path), lock_flags;
+    mount_t* mnt;
+
+    if (n_mounts == VFS_MAX_MOUNTS || path[0] != '/' || len >= FILENAME_LEN)
+        return -1;
+    spin_lock_irqsave(&vfs_lock, lock_flags);
+    mnt = &mounts[n_mounts++];
+    strncpy(mnt->path, path, FILENAME_LEN);
+    mnt->path_len = len;
+    mnt->flags = flags;
+    mnt->ops = ops;
+    mnt->sb = sb;
+    mnt->root = root;
+    memset(dcache, 0, sizeof(dcache));
+    spin_unlock_irqrestore(&vfs_lock, lock_flags);
+    return 0;
+}
+
+/*
+ * vfs_find_mount
+ *   DESCRIPTION: the mount with the longest path that prefixes an
+ *                absolute path
+ *   INPUTS: path -- starts with "/"
+ *           rest -- gets what follows the mount path
+ *   OUTPUTS: none
+ *   RETURN VALUE: the mount, NULL if "/" is not mounted
+ *   SIDE EFFECTS: none
+ */
+static mount_t* vfs_find_mount(const uint8_t* path, const uint8_t** rest){
+    mount_t* best = NULL;
+    uint32_t i, len;
+
+    for (i = 0; i < n_mounts; i++){
+        len = mounts[i].path_len;
+        if (len == 1)
+            len = 0;        /* "/" prefixes everything */
+        if (strncmp((const int8_t*)path, mounts[i].path, len) != 0
+            || (path[len] != '/' && path[len] != '\0'))
+            continue;
+        if (best == NULL || len > best->path_len){
+            best = &mounts[i];
+            *rest = path + len;
+        }
+    }
+    return best;
+}
+
+/*
+ * vfs_walk
+ *   DESCRIPTION: resolve a path below the root of a mount, one component
+ *                at a time
+ *   INPUTS: mnt -- the mount
+ *           path -- components separated by "/"
+ *           attr -- gets the result
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if a component is missing or not a directory
+ *   SIDE EFFECTS: none
+ */
+static int32_t vfs_walk(mount_t* mnt, const uint8_t* path, vattr_t* attr){
+    uint32_t len;
+
+    attr->ino = mnt->root;
+    attr->type = FILE_DIREC;
+    attr->size = 0;
+    attr->fops = &dir_fop_t;
+    while (1){
+        while (*path == '/')
+            path++;
+        if (*path == '\0')
+            return 0;
+        for (len = 0; path[len] != '\0' && path[len] != '/'; len++)
+            ;
+        if (len > FILENAME_LEN || attr->type != FILE_DIREC)
+            return -1;
+        if (mnt->ops->lookup(mnt, attr->ino, path, len, attr) < 0)
+            return -1;
+        path += len;
+    }
+}
+
+/*
+ * vfs_resolve
+ *   DESCRIPTION: resolve an absolute path through the mount table, or a
+ *                relative one in each VFS_SEARCH mount in turn
+ *   INPUTS: path -- the path
+ *           mnt / attr -- get the result
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if not found
+ *   SIDE EFFECTS: none
+ */
+static int32_t vfs_resolve(const uint8_t* path, mount_t** mnt, vattr_t* attr){
+    const uint8_t* rest;
+    uint32_t i;
+
+    if (path[0] == '/'){
+        *mnt = vfs_find_mount(path, &rest);
+        return (*mnt != NULL) ? vfs_walk(*mnt, rest, attr) : -1;
+    }
+    for (i = 0; i < n_mounts; i++){
+        if ((mounts[i].flags & VFS_SEARCH) && vfs_walk(&mounts[i], path, attr) == 0){
+            *mnt = &mounts[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * vget
+ *   DESCRIPTION: the vnode of a resolved name, reusing a cached one; a new
+ *                one replaces the first unreferenced vnode
+ *   INPUTS: mnt / attr -- what was resolved
+ *   OUTPUTS: none
+ *   RETURN VALUE: the vnode with a reference taken, NULL if all are open
+ *   SIDE EFFECTS: caller holds vfs_lock
+ */
+static vnode_t* vget(mount_t* mnt, const vattr_t* attr){
+    vnode_t** p;
+    vnode_t* vn;
+    uint32_t i;
+
+    for (vn = vhash[VHASH(mnt, attr->ino)]; vn != NULL; vn = vn->hash_next){
+        if (vn->mnt == mnt && vn->ino == attr->ino && vn->type == attr->type){
+            vn->refcnt++;
+            return vn;
+        }
+    }
+    for (i = 0; i < VFS_VNODES && vnodes[i].refcnt != 0; i++)
+        ;
+    if (i == VFS_VNODES)
+        return NULL;
+    vn = &vnodes[i];
+    if (vn->mnt != NULL){
+        for (p = &vhash[VHASH(vn->mnt, vn->ino)]; *p != vn; p = &(*p)->hash_next)
+            ;
+        *p = vn->hash_next;
+    }
+    vn->mnt = mnt;
+    vn->ino = attr->ino;
+    vn->type = attr->type;
+    vn->size = attr->size;
+    vn->fops = attr->fops;
+    vn->refcnt = 1;
+    vn->hash_next = vhash[VHASH(mnt, attr->ino)];
+    vhash[VHASH(mnt, attr->ino)] = vn;
+    return vn;
+}
+
+/*
+ * vfs_lookup
+ *   DESCRIPTION: resolve a path to a vnode. Paths resolved before come
+ *                from the path cache without asking the file system
+ *   INPUTS: path -- absolute, or relative to the search mounts
+ *   OUTPUTS: none
+ *   RETURN VALUE: the vnode, to be given back with vfs_put; NULL if the
+ *                 path does not exist or every vnode is in use
+ *   SIDE EFFECTS: may read directories from disk on a cache miss
+ */
+vnode_t* vfs_lookup(const uint8_t* path){
+    uint32_t len, hash, flags;
+    dcache_t* d;
+    mount_t* mnt;
+    vattr_t attr;
+    vnode_t* vn;
+
+    len = strlen((const int8_t*)path);
+    if (len == 0)
+        return NULL;
+    hash = vfs_hash(path, len);
+    d = &dcache[hash & (VFS_DCACHE - 1)];
+
+    spin_lock_irqsave(&vfs_lock, flags);
+    if (d->len == len && d->hash == hash && strncmp(d->path, (const int8_t*)path, len) == 0){
+        vn = vget(d->mnt, &d->attr);
+        spin_unlock_irqrestore(&vfs_lock, flags);
+        return vn;
+    }
+    spin_unlock_irqrestore(&vfs_lock, flags);
+
+    if (vfs_resolve(path, &mnt, &attr) < 0)
+        return NULL;
+
+    spin_lock_irqsave(&vfs_lock, flags);
+    if (len < VFS_PATH_LEN){
+        d->hash = hash;
+        d->len = len;
+        strncpy(d->path, (const int8_t*)path, len);
+        d->mnt = mnt;
+        d->attr = attr;
+    }
+    vn = vget(mnt, &attr);
+    spin_unlock_irqrestore(&vfs_lock, flags);
+    return vn;
+}
+
+/*
+ * vfs_put
+ *   DESCRIPTION: give back a vnode from vfs_lookup; it stays cached
+ *   INPUTS: vn -- the vnode, NULL is ignored
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void vfs_put(vnode_t* vn){
+    uint32_t flags;
+
+    if (vn == NULL)
+        return;
+    spin_lock_irqsave(&vfs_lock, flags);
+    if (vn->refcnt > 0)
+        vn->refcnt--;
+    spin_unlock_irqrestore(&vfs_lock, flags);
+}
+
+/*
+ * vfs_read
+ *   DESCRIPTION: read a file through its file system
+ *   INPUTS: vn -- the file
+ *           offset / buf / length -- as read_data
+ *   OUTPUTS: the data in buf
+ *   RETURN VALUE: bytes read, -1 on an error
+ *   SIDE EFFECTS: none
+ */
+int32_t vfs_read(vnode_t* vn, uint32_t offset, uint8_t* buf, uint32_t length){
+    if (vn->mnt->ops->read == NULL)
+        return -1;
+    return vn->mnt->ops->read(vn->mnt, vn->ino, offset, buf, length);
+}
+
+/*
+ * vfs_readdir
+ *   DESCRIPTION: name of an entry of a directory
+ *   INPUTS: dir -- the directory
+ *           idx -- the entry
+ *           name -- FILENAME_LEN + 1 bytes
+ *   OUTPUTS: the name, NUL terminated
+ *   RETURN VALUE: 0, -1 past the last entry
+ *   SIDE EFFECTS: none
+ */
+int32_t vfs_readdir(vnode_t* dir, uint32_t idx, uint8_t* name){
+    if (dir->type != FILE_DIREC)
+        return -1;
+    return dir->mnt->ops->readdir(dir->mnt, dir->ino, idx, name);
+}
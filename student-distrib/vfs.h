@@ -0,0 +1,68 @@
+/* vfs.h - Mount table, vnode cache and path lookup
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _VFS_H
+#define _VFS_H
+
+#include "types.h"
+#include "sys_calls.h"
+
+#define FILE_DEV            3       /* a devfs node, after FILE_RTC/DIREC/REG */
+
+#define VFS_MAX_MOUNTS      4
+#define VFS_VNODES          64
+#define VFS_VHASH           32      /* power of two */
+#define VFS_DCACHE          128     /* path cache slots, power of two */
+#define VFS_PATH_LEN        64      /* longest path the cache keeps */
+
+#define VFS_SEARCH          0x1     /* relative names are looked up here too */
+
+struct mount_t;
+
+/* What a file system reports about a name */
+typedef struct vattr_t {
+    uint32_t ino;
+    uint32_t type;                  /* FILE_* */
+    uint32_t size;                  /* bytes, 0 for directories and devices */
+    fop_t* fops;                    /* what open installs in the fd */
+} vattr_t;
+
+/* Per file system operations, every one gets the mount it works on */
+typedef struct fs_ops_t {
+    /* find name (len bytes, no NUL) in directory dir */
+    int32_t (*lookup)(struct mount_t* mnt, uint32_t dir, const uint8_t* name, uint32_t len, vattr_t* attr);
+    /* read a file, returns bytes read */
+    int32_t (*read)(struct mount_t* mnt, uint32_t ino, uint32_t offset, uint8_t* buf, uint32_t length);
+    /* name of entry idx of directory dir, FILENAME_LEN + 1 bytes; -1 past the end */
+    int32_t (*readdir)(struct mount_t* mnt, uint32_t dir, uint32_t idx, uint8_t* name);
+} fs_ops_t;
+
+typedef struct mount_t {
+    int8_t path[FILENAME_LEN];      /* "/" or "/dev", no trailing slash */
+    uint32_t path_len;
+    uint32_t flags;                 /* VFS_SEARCH */
+    fs_ops_t* ops;
+    void* sb;                       /* the file system's own state */
+    uint32_t root;                  /* ino of its root directory */
+} mount_t;
+
+/* An open file system object; cached while unreferenced until reused */
+typedef struct vnode_t {
+    struct vnode_t* hash_next;
+    mount_t* mnt;
+    uint32_t ino;
+    uint32_t type;
+    uint32_t size;
+    fop_t* fops;
+    uint32_t refcnt;
+} vnode_t;
+
+void vfs_init(void);
+int32_t vfs_mount(const int8_t* path, fs_ops_t* ops, void* sb, uint32_t root, uint32_t flags);
+vnode_t* vfs_lookup(const uint8_t* path);
+void vfs_put(vnode_t* vn);
+int32_t vfs_read(vnode_t* vn, uint32_t offset, uint8_t* buf, uint32_t length);
+int32_t vfs_readdir(vnode_t* dir, uint32_t idx, uint8_t* name);
+
+#endif /* _VFS_H */
@@ -38,6 +38,7 @@
 #define IRQ_PS2_Mouse           44
 #define IRQ_Ide0                46
 #define IRQ_sb16                0x25
+#define IRQ_Lapic_Timer         0x30
 #define SYS_System_Call         128
 /*---------------------------------------------*/
 
@@ -0,0 +1,61 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define ITERATIONS 10000
+
+/* read the time stamp counter */
+static uint32_t rdtsc_lo ()
+{
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return lo;
+}
+
+/* time ITERATIONS calls of a null system call, return cycles per call */
+static uint32_t bench (int32_t (*call)(void))
+{
+    uint32_t start, end;
+    int32_t i;
+
+    call ();    /* warm up */
+    start = rdtsc_lo ();
+    for (i = 0; i < ITERATIONS; i++)
+        call ();
+    end = rdtsc_lo ();
+    return (end - start) / ITERATIONS;
+}
+
+static void report (const char* name, uint32_t cycles)
+{
+    uint8_t buf[16];
+
+    ece391_fdputs (1, (uint8_t*)name);
+    ece391_fdputs (1, ece391_itoa (cycles, buf, 10));
+    ece391_fdputs (1, (uint8_t*)" cycles per null syscall\n");
+}
+
+/* how long a 1 ms sleep really takes, in us */
+static uint32_t sleep_latency ()
+{
+    uint64_t start, end;
+
+    if (ece391_gettime (&start) == -1)
+        return 0;
+    ece391_sleep (1000);
+    ece391_gettime (&end);
+    return (uint32_t)(end - start) / 1000;
+}
+
+int main ()
+{
+    uint8_t buf[16];
+
+    report ("int 0x80: ", bench (ece391_null));
+    report ("sysenter: ", bench (ece391_null_fast));
+    ece391_fdputs (1, (uint8_t*)"sleep(1000): ");
+    ece391_fdputs (1, ece391_itoa (sleep_latency (), buf, 10));
+    ece391_fdputs (1, (uint8_t*)" us\n");
+    return 0;
+}
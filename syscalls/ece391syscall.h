@@ -5,6 +5,49 @@
 
 /* All calls return >= 0 on success or -1 on failure. */
 
+/* whence for ece391_lseek */
+#define SEEK_SET    0
+#define SEEK_CUR    1
+#define SEEK_END    2
+
+/* One buffer of a readv/writev request */
+typedef struct ece391_iovec {
+    void*   base;
+    int32_t len;
+} ece391_iovec_t;
+
+/*
+ * Submission/completion ring for ece391_io_enter: fill sq[] and advance
+ * sq_tail, enter the kernel once, then consume cq[] up to cq_tail and
+ * advance cq_head. Must match io_ring_t in the kernel.
+ */
+#define IO_RING_ENTRIES 16
+#define IO_OP_READ      0
+#define IO_OP_WRITE     1
+#define IO_OP_CLOSE     2
+
+typedef struct ece391_io_sqe {
+    int32_t  opcode;
+    int32_t  fd;
+    void*    buf;
+    int32_t  nbytes;
+    uint32_t user_data;
+} ece391_io_sqe_t;
+
+typedef struct ece391_io_cqe {
+    uint32_t user_data;
+    int32_t  res;
+} ece391_io_cqe_t;
+
+typedef struct ece391_io_ring {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    ece391_io_sqe_t sq[IO_RING_ENTRIES];
+    ece391_io_cqe_t cq[IO_RING_ENTRIES];
+} ece391_io_ring_t;
+
 /*  
  * Note that the system call for halt will have to make sure that only
  * the low byte of EBX (the status argument) is returned to the calling
@@ -21,6 +64,18 @@ extern int32_t ece391_getargs (uint8_t* buf, int32_t nbytes);
 extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
+extern int32_t ece391_readv (int32_t fd, const ece391_iovec_t* iov, int32_t iovcnt);
+extern int32_t ece391_writev (int32_t fd, const ece391_iovec_t* iov, int32_t iovcnt);
+extern int32_t ece391_io_enter (ece391_io_ring_t* ring);
+extern int32_t ece391_pread (int32_t fd, void* buf, int32_t nbytes, int32_t offset);
+extern int32_t ece391_lseek (int32_t fd, int32_t offset, int32_t whence);
+extern int32_t ece391_mmap (int32_t fd, void** start);
+extern int32_t ece391_sleep (int32_t us);
+extern int32_t ece391_gettime (uint64_t* ns);
+
+/* Always return -1; time a round trip through int 0x80 or SYSENTER. */
+extern int32_t ece391_null (void);
+extern int32_t ece391_null_fast (void);
 
 enum signums {
 	DIV_ZERO = 0,
@@ -1,6 +1,9 @@
 #if !defined(ECE391SYSNUM_H)
 #define ECE391SYSNUM_H
 
+/* not a real call, always fails; used to time the entry/exit path */
+#define SYS_NULL    0
+
 #define SYS_HALT    1
 #define SYS_EXECUTE 2
 #define SYS_READ    3
@@ -11,5 +14,13 @@
 #define SYS_VIDMAP  8
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
+#define SYS_READV   11
+#define SYS_WRITEV  12
+#define SYS_IO_ENTER 13
+#define SYS_PREAD   14
+#define SYS_LSEEK   15
+#define SYS_MMAP    16
+#define SYS_SLEEP   17
+#define SYS_GETTIME 18
 
 #endif /* ECE391SYSNUM_H */
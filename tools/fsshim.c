@@ -0,0 +1,153 @@
+/*
+ * fsshim.c -- the kernel services file_sys.c and vfs.c call, on a Linux host
+ *
+ * The buffer cache hands out blocks of shim_disk, an image the harness
+ * loads, as if it were ATA drive 1; the current process is one pcb.
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The kernel's types.h has its own idea of these */
+#undef NULL
+#define int8_t      kernel_int8_t
+#define int64_t     kernel_int64_t
+#define uint64_t    kernel_uint64_t
+
+#include "fsshim.h"
+#include "bcache.h"
+#include "sys_calls.h"
+#include "dev/ata.h"
+
+#undef memset
+#undef memcpy
+#undef strlen
+#undef strncmp
+#undef strncpy
+
+#define SHIM_BUFS   16
+
+uint8_t* shim_disk;
+uint32_t shim_breads;
+int32_t shim_softirq;
+
+ata_drive_t ata_drives[ATA_MAX_DRIVES];
+int32_t pid;
+
+static pcb shim_pcb;
+static buf_t shim_bufs[SHIM_BUFS];
+static uint8_t* shim_cached;            /* per block of drive 1, 1 once read */
+
+void* shim_memset(void* s, int32_t c, uint32_t n) { return memset(s, c, n); }
+void* shim_memcpy(void* dest, const void* src, uint32_t n) { return memcpy(dest, src, n); }
+uint32_t shim_strlen(const int8_t* s) { return strlen(s); }
+int32_t shim_strncmp(const int8_t* s1, const int8_t* s2, uint32_t n) { return strncmp(s1, s2, n); }
+int8_t* shim_strncpy(int8_t* dest, const int8_t* src, uint32_t n) { return strncpy(dest, src, n); }
+
+pcb* get_pcb_ptr(int32_t pid) {
+    return &shim_pcb;
+}
+
+void paging_set_mmap_page(int32_t pid, uint32_t page, uint32_t phys_addr, int32_t writable) {
+}
+
+int32_t klog(int8_t* format, ...) {
+    va_list ap;
+    int32_t n;
+
+    va_start(ap, format);
+    n = vfprintf(stderr, format, ap);
+    va_end(ap);
+    return n;
+}
+
+int32_t in_softirq(void) {
+    return shim_softirq;
+}
+
+/* Whether a block is past the drive; the cache map is set up on first use */
+static int32_t bad_block(int32_t dev, uint32_t blockno) {
+    if (dev < 0 || dev >= ATA_MAX_DRIVES || !ata_drives[dev].present
+        || blockno >= ata_drives[dev].sectors / BLOCK_SECTORS)
+        return 1;
+    if (shim_cached == NULL)
+        shim_cached = calloc(ata_drives[dev].sectors / BLOCK_SECTORS, 1);
+    return 0;
+}
+
+void shim_uncache(void) {
+    if (shim_cached != NULL)
+        memset(shim_cached, 0, ata_drives[BCACHE_DEV].sectors / BLOCK_SECTORS);
+}
+
+/* A block of shim_disk in a free buffer; blocks past the drive fail */
+buf_t* bread(int32_t dev, uint32_t blockno) {
+    uint32_t i;
+
+    shim_breads++;
+    if (bad_block(dev, blockno))
+        return NULL;
+    shim_cached[blockno] = 1;
+    for (i = 0; i < SHIM_BUFS; i++) {
+        if (shim_bufs[i].refcnt == 0) {
+            shim_bufs[i].dev = dev;
+            shim_bufs[i].blockno = blockno;
+            shim_bufs[i].flags = B_VALID;
+            shim_bufs[i].refcnt = 1;
+            shim_bufs[i].data = shim_disk + (size_t)blockno * BLOCK_SIZE;
+            return &shim_bufs[i];
+        }
+    }
+    fprintf(stderr, "fsshim: every buffer is held, a brelse is missing\n");
+    return NULL;
+}
+
+uint32_t shim_held(void) {
+    uint32_t i, n = 0;
+
+    for (i = 0; i < SHIM_BUFS; i++)
+        n += shim_bufs[i].refcnt;
+    return n;
+}
+
+void brelse(buf_t* b) {
+    if (b != NULL && b->refcnt > 0)
+        b->refcnt--;
+}
+
+/* bread, only for blocks read before */
+buf_t* bpeek(int32_t dev, uint32_t blockno) {
+    if (bad_block(dev, blockno) || !shim_cached[blockno])
+        return NULL;
+    return bread(dev, blockno);
+}
+
+/* The read ends at once; as in the kernel, cached blocks in front are
+ * passed over and the run stops at the next cached one */
+int32_t bprefetch(int32_t dev, uint32_t blockno, uint32_t n) {
+    uint32_t i;
+
+    if (bad_block(dev, blockno))
+        return -1;
+    for (; n > 0 && !bad_block(dev, blockno) && shim_cached[blockno]; n--)
+        blockno++;
+    for (i = 0; i < n && i < ATA_MAX_PRD && !bad_block(dev, blockno + i) && !shim_cached[blockno + i]; i++)
+        shim_cached[blockno + i] = 1;
+    return i;
+}
+
+/* The read is done before it returns */
+int32_t ata_read_async(int32_t drive, uint32_t lba, uint8_t** bufs, uint32_t n_bufs,
+                       uint32_t sect_per_buf, void (*done)(int32_t ret)) {
+    uint32_t i;
+
+    if (drive != BCACHE_DEV || !ata_drives[drive].present || n_bufs == 0 || n_bufs > ATA_MAX_PRD
+        || lba + n_bufs * sect_per_buf > ata_drives[drive].sectors)
+        return -1;
+    for (i = 0; i < n_bufs; i++)
+        memcpy(bufs[i], shim_disk + (size_t)(lba + i * sect_per_buf) * ATA_SECTOR_SIZE,
+               sect_per_buf * ATA_SECTOR_SIZE);
+    done(0);
+    return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * fsshim.h -- what file_sys.c and vfs.c need from the rest of the kernel,
+ * for building them on a Linux host (see fstest.c)
+ *
+ * gcc -include puts this ahead of the kernel sources. It claims the include
+ * guards of lib.h, spinlock.h and paging.h, whose inline asm (cli, cr3)
+ * cannot run in user mode, and stands in for them; the other headers are
+ * the kernel's own. The string functions keep their kernel signatures but
+ * go to libc under another name, so they do not clash with the builtins.
+ */
+#ifndef _FSSHIM_H
+#define _FSSHIM_H
+
+#define _LIB_H
+#define _SPINLOCK_H
+#define _paging_h_
+
+#include "types.h"
+
+/* lib.h */
+#define memset      shim_memset
+#define memcpy      shim_memcpy
+#define strlen      shim_strlen
+#define strncmp     shim_strncmp
+#define strncpy     shim_strncpy
+
+void* shim_memset(void* s, int32_t c, uint32_t n);
+void* shim_memcpy(void* dest, const void* src, uint32_t n);
+uint32_t shim_strlen(const int8_t* s);
+int32_t shim_strncmp(const int8_t* s1, const int8_t* s2, uint32_t n);
+int8_t* shim_strncpy(int8_t* dest, const int8_t* src, uint32_t n);
+
+#define cli_and_save(flags)     do { (flags) = 0; } while (0)
+#define restore_flags(flags)    do { (void)(flags); } while (0)
+
+/* spinlock.h, the harness runs on one thread */
+typedef struct spinlock_t {
+    volatile uint32_t lock;
+} spinlock_t;
+
+#define SPINLOCK_UNLOCKED               { 0 }
+#define spin_lock_irqsave(l, flags)     do { (flags) = 0; (l)->lock = 1; } while (0)
+#define spin_unlock_irqrestore(l, flags) do { (void)(flags); (l)->lock = 0; } while (0)
+
+/* paging.h, file_mmap is not run on the host */
+#define PT_SIZE         1024
+#define TLB_flush()     do { } while (0)
+void paging_set_mmap_page(int32_t pid, uint32_t page, uint32_t phys_addr, int32_t writable);
+
+/* The shim's own state, for the harness */
+extern uint8_t* shim_disk;          /* drive 1, what bread serves */
+extern uint32_t shim_breads;        /* bread calls so far */
+extern int32_t shim_softirq;        /* what in_softirq returns */
+uint32_t shim_held(void);           /* buffers not given back yet */
+void shim_uncache(void);            /* bpeek fails until a block is read again */
+
+#endif /* _FSSHIM_H */
@@ -0,0 +1,842 @@
+/*
+ * fstest -- tests and benchmarks of the kernel file system on the host
+ *
+ * Builds student-distrib/file_sys.c and vfs.c as they are, with fsshim.c
+ * standing in for the rest of the kernel, and runs them on a file system
+ * image: the boot image path ("/", read in place from memory) and the disk
+ * path ("/disk", the same image served block by block through bread). What
+ * the kernel returns is checked against a separate reading of the image,
+ * which walks every directory, so paths like /dir/sub/file are checked too.
+ * With -b it then times lookups and reads.
+ *
+ * -f gives every file of three or more blocks several extents before the
+ * tests, by laying its blocks out again in reversed runs of two. -t builds
+ * a tree for mkfs391 instead of testing: nested and long paths, names that
+ * share a hash bucket or the whole FNV-1a hash, files of sizes around the
+ * block size. -H makes the collisions of such a tree a requirement.
+ *
+ * usage: fstest [-b] [-f] [-H] [image]    (default ../student-distrib/filesys_img)
+ *        fstest -t <dir>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* The kernel's types.h has its own idea of these, and its system calls
+ * share names with libc; they are renamed while its headers are read */
+#undef NULL
+#define int8_t      kernel_int8_t
+#define int64_t     kernel_int64_t
+#define uint64_t    kernel_uint64_t
+#define read        kernel_read
+#define write       kernel_write
+#define pread       kernel_pread
+#define lseek       kernel_lseek
+#define mmap        kernel_mmap
+#define sleep       kernel_sleep
+#define close       kernel_close
+
+#include "fsshim.h"
+#include "file_sys.h"
+#include "vfs.h"
+#include "bcache.h"
+#include "dev/ata.h"
+
+#undef read
+#undef write
+#undef pread
+#undef lseek
+#undef mmap
+#undef sleep
+#undef close
+
+/* file_sys_addr is 32 bits wide, the image has to sit below 4 GB */
+#define IMAGE_ADDR      0x40000000UL
+#define DEFAULT_IMAGE   "../student-distrib/filesys_img"
+#define FD              2               /* the descriptor the tests use */
+#define CHUNK           1000            /* odd on purpose, reads straddle blocks */
+#define BENCH_NS        200000000LL     /* run every benchmark this long */
+#define PATH_LEN        256
+#define MAX_DEPTH       16
+#define FRAG_RUN        2               /* blocks per run of a fragmented file */
+#define HASH_BUCKETS    256             /* DIR_HASH_BUCKETS of file_sys.c */
+#define HASH_CANDIDATES (1 << 20)       /* names searched for equal hashes */
+#define HASH_DIR        "hash"          /* where -t puts the collisions */
+#define DENTRY(data, i) ((data) + 64 * (i))
+
+/* Every entry of every directory, the root's first in boot block order */
+typedef struct ref_file {
+    char name[FILENAME_LEN + 1];
+    char path[PATH_LEN];                /* from the root, no leading "/" */
+    uint32_t type;
+    uint32_t ino;
+    uint8_t* data;                      /* contents, the dentries of a directory */
+    uint32_t len;
+} ref_file;
+
+static uint8_t* image;
+static uint32_t image_len;
+static ref_file* ref;
+static uint32_t n_ref, n_root, n_inode, n_data;
+static int checks, failed;
+static long long bench_bytes;           /* read by the last bench_fd */
+static char pairs[2][2][8];             /* names with equal hashes, see hash_pairs */
+
+#define CHECK(cond, ...)                                \
+do {                                                    \
+    checks++;                                           \
+    if (!(cond)) {                                      \
+        failed++;                                       \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__);     \
+        printf(__VA_ARGS__);                            \
+        printf("\n");                                   \
+    }                                                   \
+} while (0)
+
+static long long now_ns(void) {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static uint32_t word(uint32_t off) {
+    uint32_t w;
+
+    memcpy(&w, image + off, 4);
+    return w;
+}
+
+static void not_image(const char* why) {
+    fprintf(stderr, "fstest: not an ece391 image: %s\n", why);
+    exit(2);
+}
+
+/* Block i of the file or directory with inode ino */
+static uint32_t file_block(uint32_t ino, uint32_t i) {
+    return word((1 + ino) * BLOCK_SIZE + 4 + 4 * i);
+}
+
+/* The contents of an inode, gathered from its blocks */
+static uint8_t* inode_data(uint32_t ino, uint32_t* len) {
+    uint32_t b, blk, n;
+    uint8_t* data;
+
+    if (ino >= n_inode)
+        not_image("inode out of range");
+    *len = word((1 + ino) * BLOCK_SIZE);
+    if (*len > (BLOCK_SIZE / 4 - 1) * BLOCK_SIZE)
+        not_image("file too long");
+    data = malloc(*len + 1);
+    for (b = 0; b * BLOCK_SIZE < *len; b++) {
+        blk = file_block(ino, b);
+        if (blk >= n_data)
+            not_image("data block out of range");
+        n = (*len - b * BLOCK_SIZE < BLOCK_SIZE) ? *len - b * BLOCK_SIZE : BLOCK_SIZE;
+        memcpy(data + b * BLOCK_SIZE, image + (1 + n_inode + blk) * BLOCK_SIZE, n);
+    }
+    return data;
+}
+
+/* Add the n dentries at dents, found in the directory at prefix, then
+ * what is in its subdirectories */
+static void load_dir(const uint8_t* dents, uint32_t n, const char* prefix, int depth) {
+    uint32_t i, first = n_ref;
+    ref_file* r;
+
+    if (depth > MAX_DEPTH)
+        not_image("directories nested too deep");
+    ref = realloc(ref, (n_ref + n) * sizeof(ref_file));
+    for (i = 0; i < n; i++) {
+        r = &ref[n_ref++];
+        memset(r, 0, sizeof(*r));
+        memcpy(r->name, DENTRY(dents, i), FILENAME_LEN);
+        snprintf(r->path, PATH_LEN, "%s%s", prefix, r->name);
+        memcpy(&r->type, DENTRY(dents, i) + 32, 4);
+        memcpy(&r->ino, DENTRY(dents, i) + 36, 4);
+        if (r->type == 2 || (r->type == 1 && r->ino != 0 && strcmp(r->name, ".") != 0
+                             && strcmp(r->name, "..") != 0))
+            r->data = inode_data(r->ino, &r->len);
+    }
+    for (i = first; i < first + n; i++) {
+        char sub[PATH_LEN];
+
+        if (ref[i].type != 1 || ref[i].data == NULL)
+            continue;
+        if (ref[i].len % 64 != 0)
+            not_image("directory of a partial dentry");
+        if (strlen(ref[i].path) + 2 + FILENAME_LEN > PATH_LEN)
+            not_image("paths too long");
+        strcpy(sub, ref[i].path);
+        strcat(sub, "/");
+        load_dir(ref[i].data, ref[i].len / 64, sub, depth + 1);
+    }
+}
+
+/* Read the image without the kernel: the entries of every directory and
+ * the contents of every file, gathered from its blocks */
+static void load_reference(void) {
+    n_root = word(0);
+    n_inode = word(4);
+    n_data = word(8);
+    if (n_root == 0 || n_root > BLOCK_SIZE / 64 - 1 || (1 + n_inode + n_data) * BLOCK_SIZE > image_len)
+        not_image("bad boot block");
+    load_dir(image + 64, n_root, "", 0);
+}
+
+/* Lay the blocks of every file of at least FRAG_RUN + 1 blocks out again,
+ * in runs of FRAG_RUN taken from the end of its old list, so the kernel
+ * sees several extents per file */
+static void fragment(void) {
+    uint32_t ino, len, n, i, j, k, files = 0, runs = 0;
+    uint32_t* old;
+    uint32_t* seq;
+    uint8_t* data;
+
+    for (ino = 1; ino < n_inode; ino++) {
+        len = word((1 + ino) * BLOCK_SIZE);
+        n = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (n <= FRAG_RUN || n > BLOCK_SIZE / 4 - 1)
+            continue;
+        old = malloc(n * 4);
+        seq = malloc(n * 4);
+        data = calloc(n, BLOCK_SIZE);
+        for (i = 0; i < n; i++) {
+            old[i] = file_block(ino, i);
+            if (old[i] >= n_data)
+                not_image("data block out of range");
+            memcpy(data + i * BLOCK_SIZE, image + (1 + n_inode + old[i]) * BLOCK_SIZE, BLOCK_SIZE);
+        }
+        for (i = 0, k = (n - 1) / FRAG_RUN * FRAG_RUN; i < n; k -= FRAG_RUN, runs++)
+            for (j = k; j < k + FRAG_RUN && j < n; j++)
+                seq[i++] = old[j];
+        for (i = 0; i < n; i++) {
+            memcpy(image + (1 + ino) * BLOCK_SIZE + 4 + 4 * i, &seq[i], 4);
+            memcpy(image + (1 + n_inode + seq[i]) * BLOCK_SIZE, data + i * BLOCK_SIZE, BLOCK_SIZE);
+        }
+        files++;
+        free(old);
+        free(seq);
+        free(data);
+    }
+    printf("fragmented %u files into %u runs\n", files, runs);
+}
+
+/* The image at IMAGE_ADDR for "/", and a copy as drive 1 for "/disk" */
+static void load_image(const char* path) {
+    FILE* f = fopen(path, "rb");
+    long len;
+
+    if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) <= 0) {
+        perror(path);
+        exit(2);
+    }
+    rewind(f);
+    image_len = len;
+    image = mmap((void*)IMAGE_ADDR, image_len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (image != (uint8_t*)IMAGE_ADDR || fread(image, 1, image_len, f) != image_len) {
+        fprintf(stderr, "fstest: cannot load %s at %#lx\n", path, IMAGE_ADDR);
+        exit(2);
+    }
+    fclose(f);
+}
+
+static void load_disk(void) {
+    shim_disk = malloc(image_len + BLOCK_SIZE);
+    memcpy(shim_disk, image, image_len);
+    ata_drives[BCACHE_DEV].present = 1;
+    ata_drives[BCACHE_DEV].sectors = image_len / ATA_SECTOR_SIZE;
+}
+
+/* Open a path on FD of the shim process, as the open system call does */
+static file_des_t* open_fd(const char* path) {
+    file_des_t* fd = &get_pcb_ptr(0)->file_array[FD];
+    vnode_t* vn = vfs_lookup((const uint8_t*)path);
+
+    memset(fd, 0, sizeof(*fd));
+    if (vn == NULL)
+        return NULL;
+    fd->file_ops_ptr = vn->fops;
+    fd->idx_inode = vn->ino;
+    fd->flags = INUSE;
+    fd->vnode = vn;
+    return fd;
+}
+
+static void close_fd(file_des_t* fd) {
+    vfs_put(fd->vnode);
+    memset(fd, 0, sizeof(*fd));
+}
+
+/* read_dentry_by_* only know the root */
+static void test_dentries(void) {
+    char name[FILENAME_LEN + 2];
+    dentry_t d;
+    uint32_t i;
+
+    for (i = 0; i < n_root; i++) {
+        CHECK(read_dentry_by_index(i, &d) == 0, "read_dentry_by_index(%u)", i);
+        CHECK(strncmp(d.f_name, ref[i].name, FILENAME_LEN) == 0 && d.f_type == ref[i].type
+              && d.idx_inode == ref[i].ino, "entry %u is %.32s", i, ref[i].name);
+        memset(&d, 0, sizeof(d));
+        CHECK(read_dentry_by_name((const uint8_t*)ref[i].name, &d) == 0 && d.idx_inode == ref[i].ino
+              && d.f_type == ref[i].type, "read_dentry_by_name(%s)", ref[i].name);
+        if (strlen(ref[i].name) > 1) {
+            snprintf(name, sizeof(name), "%.*s", (int)strlen(ref[i].name) - 1, ref[i].name);
+            CHECK(read_dentry_by_name((const uint8_t*)name, &d) != 0, "prefix %s found", name);
+        }
+        if (strlen(ref[i].name) == FILENAME_LEN) {
+            snprintf(name, sizeof(name), "%sx", ref[i].name);
+            CHECK(read_dentry_by_name((const uint8_t*)name, &d) != 0, "33 character name %s found", name);
+        }
+    }
+    for (i = n_root; i < n_ref; i++) {
+        if (strchr(ref[i].path, '/') != NULL && ref[i].type == 2)
+            CHECK(read_dentry_by_name((const uint8_t*)ref[i].path, &d) == -1,
+                  "read_dentry_by_name(%s) walked a path", ref[i].path);
+    }
+    CHECK(read_dentry_by_index(n_root, &d) == -1, "index past the end");
+    CHECK(read_dentry_by_name((const uint8_t*)"no such file", &d) == -1, "missing name found");
+    CHECK(read_dentry_by_name((const uint8_t*)"", &d) == -1, "empty name found");
+}
+
+static void test_read_data(void) {
+    static const uint32_t offs[] = { 0, 1, BLOCK_SIZE - 1, BLOCK_SIZE, BLOCK_SIZE + 1,
+                                     2 * BLOCK_SIZE - 1, 2 * BLOCK_SIZE, 3 * BLOCK_SIZE - 7 };
+    static const uint32_t lens[] = { 1, 17, BLOCK_SIZE, BLOCK_SIZE + 5000, 1 << 20 };
+    uint8_t* buf;
+    uint32_t i, o, l, want;
+    int32_t got;
+
+    for (i = 0; i < n_ref; i++) {
+        if (ref[i].type != 2)
+            continue;
+        buf = malloc(ref[i].len + 2 * BLOCK_SIZE);
+        CHECK(get_file_size(ref[i].ino) == (int32_t)ref[i].len, "get_file_size(%s)", ref[i].path);
+        got = read_data(ref[i].ino, 0, buf, ref[i].len + BLOCK_SIZE);
+        CHECK(got == (int32_t)ref[i].len && memcmp(buf, ref[i].data, ref[i].len) == 0,
+              "whole %s: got %d of %u bytes", ref[i].path, got, ref[i].len);
+        for (o = 0; o < sizeof(offs) / sizeof(offs[0]); o++) {
+            if (offs[o] >= ref[i].len)
+                continue;
+            for (l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+                want = (lens[l] < ref[i].len - offs[o]) ? lens[l] : ref[i].len - offs[o];
+                got = read_data(ref[i].ino, offs[o], buf, lens[l]);
+                CHECK(got == (int32_t)want && memcmp(buf, ref[i].data + offs[o], want) == 0,
+                      "%s at %u for %u: got %d", ref[i].path, offs[o], lens[l], got);
+            }
+        }
+        CHECK(read_data(ref[i].ino, ref[i].len, buf, 10) == 0, "%s: read at the end", ref[i].path);
+        free(buf);
+    }
+    CHECK(read_data(n_inode, 0, (uint8_t*)&i, 1) == -1, "inode past the end");
+    CHECK(read_data(0, 0, NULL, 1) == -1, "NULL buffer");
+}
+
+static int32_t fetch_ret;
+
+static void fetch_done(int32_t ret) {
+    fetch_ret = ret;
+}
+
+/* stream_fetch of part of an open disk stream, if it lies in one run */
+static void check_fetch(stream_t* s, const ref_file* r, uint32_t off, uint32_t len) {
+    static uint8_t fbuf[STREAM_FETCH_MAX] __attribute__((aligned(BLOCK_SIZE)));
+    int32_t at;
+
+    fetch_ret = 1;
+    at = stream_fetch(s, off, len, fbuf, fetch_done);
+    if (at < 0)
+        return;
+    CHECK(fetch_ret == 0 && memcmp(fbuf + at, r->data + off, len) == 0,
+          "%s: fetch at %u for %u", r->name, off, len);
+}
+
+/* The players' streams: the disk copy of a root file, read from a
+ * "softirq" with nothing cached, catches up one retry per missing block */
+static void test_stream(void) {
+    uint8_t* buf;
+    uint8_t* mapped;
+    stream_t s;
+    uint32_t i, off;
+    int32_t got, retries;
+
+    for (i = 0; i < n_root; i++) {
+        if (ref[i].type != 2)
+            continue;
+        buf = malloc(ref[i].len + CHUNK);
+        shim_uncache();
+        CHECK(stream_open((const uint8_t*)ref[i].name, &s) == 0 && s.inode_buf != NULL
+              && s.length == ref[i].len, "stream_open(%s) on the disk", ref[i].name);
+        CHECK(shim_held() == 1, "%s: open stream holds %u buffers", ref[i].name, shim_held());
+        shim_uncache();
+        shim_softirq = 1;
+        retries = 0;
+        for (off = 0; off < ref[i].len; off += got) {
+            got = stream_read(&s, off, buf + off, CHUNK);
+            if (got < CHUNK && off + got < ref[i].len)
+                retries++;
+        }
+        CHECK(memcmp(buf, ref[i].data, ref[i].len) == 0, "%s: streamed data differs", ref[i].name);
+        CHECK(retries <= (int32_t)(ref[i].len / BLOCK_SIZE + 1), "%s: %d short reads", ref[i].name, retries);
+        CHECK(stream_read(&s, ref[i].len, buf, 1) == 0, "%s: stream read at the end", ref[i].name);
+        for (off = 0; off < ref[i].len; off += 3 * BLOCK_SIZE - 7)
+            check_fetch(&s, &ref[i], off, (ref[i].len - off < 5 * BLOCK_SIZE) ? ref[i].len - off : 5 * BLOCK_SIZE);
+        CHECK(stream_fetch(&s, 1, STREAM_FETCH_MAX, buf, fetch_done) == -1, "%s: fetch too long", ref[i].name);
+        CHECK(stream_map(&s, 0, 1) == NULL, "%s: disk stream mapped", ref[i].name);
+        stream_close(&s);
+        CHECK(stream_open((const uint8_t*)ref[i].name, &s) == 0 && s.inode_buf == NULL,
+              "stream_open(%s) from a softirq took the disk", ref[i].name);
+        got = stream_read(&s, 0, buf, ref[i].len);
+        CHECK(got == (int32_t)ref[i].len && memcmp(buf, ref[i].data, ref[i].len) == 0,
+              "%s: boot image stream got %d bytes", ref[i].name, got);
+        mapped = stream_map(&s, 0, ref[i].len);
+        CHECK((mapped == NULL && (ref[i].len == 0 || ref[i].len > BLOCK_SIZE)) || (mapped != NULL && memcmp(mapped, ref[i].data, ref[i].len) == 0),
+              "%s: stream_map", ref[i].name);
+        CHECK(stream_map(&s, 1, ref[i].len) == NULL, "%s: mapped past the end", ref[i].name);
+        CHECK(stream_fetch(&s, 0, 1, buf, fetch_done) == -1, "%s: boot image fetched", ref[i].name);
+        stream_close(&s);
+        shim_softirq = 0;
+        CHECK(shim_held() == 0, "%s: closed stream holds %u buffers", ref[i].name, shim_held());
+        free(buf);
+    }
+    CHECK(stream_open((const uint8_t*)"no such file", &s) == -1, "stream of a missing file");
+}
+
+/* vfs_lookup(path) is the entry r, or nothing if r is NULL */
+static void check_lookup(const char* path, const ref_file* r) {
+    vnode_t* vn = vfs_lookup((const uint8_t*)path);
+
+    if (r == NULL) {
+        CHECK(vn == NULL, "%s found", path);
+    } else {
+        CHECK(vn != NULL && vn->ino == r->ino && vn->type == r->type
+              && (r->type != 2 || vn->size == r->len), "%s is %s", path, r->path);
+    }
+    vfs_put(vn);
+}
+
+static void test_vfs(void) {
+    vnode_t* a;
+    vnode_t* b;
+    uint32_t i;
+    char path[2 * PATH_LEN];
+    char* slash;
+
+    for (i = 0; i < n_ref; i++) {
+        if (ref[i].type != 2 && ref[i].data == NULL)
+            continue;
+        snprintf(path, sizeof(path), "/%s", ref[i].path);
+        a = vfs_lookup((const uint8_t*)path);
+        b = vfs_lookup((const uint8_t*)ref[i].path);
+        CHECK(a != NULL && a == b && a->ino == ref[i].ino && a->type == ref[i].type
+              && (ref[i].type != 2 || a->size == ref[i].len), "%s and %s are one vnode", path, ref[i].path);
+        vfs_put(a);
+        vfs_put(b);
+        snprintf(path, sizeof(path), "/disk/%s", ref[i].path);
+        a = vfs_lookup((const uint8_t*)path);
+        CHECK(a != NULL && a->ino == ref[i].ino && (ref[i].type != 2 || a->size == ref[i].len)
+              && strncmp(a->mnt->path, "/disk", FILENAME_LEN) == 0, "%s", path);
+        vfs_put(a);
+
+        if (ref[i].type == 2) {
+            /* a file is no directory */
+            snprintf(path, sizeof(path), "/%s/x", ref[i].path);
+            check_lookup(path, NULL);
+        }
+        if ((slash = strchr(ref[i].path, '/')) == NULL)
+            continue;
+        /* up and down again, doubled slashes */
+        snprintf(path, sizeof(path), "/%.*s/..//%s", (int)(slash - ref[i].path), ref[i].path, ref[i].path);
+        check_lookup(path, &ref[i]);
+        snprintf(path, sizeof(path), "/disk/%.*s/../%s", (int)(slash - ref[i].path), ref[i].path, ref[i].path);
+        check_lookup(path, &ref[i]);
+        /* a missing directory on the way */
+        snprintf(path, sizeof(path), "/%.*s/no such dir%s", (int)(slash - ref[i].path), ref[i].path, slash);
+        check_lookup(path, NULL);
+        snprintf(path, sizeof(path), "/no such dir/%s", ref[i].path);
+        check_lookup(path, NULL);
+        snprintf(path, sizeof(path), "/disk/no such dir/%s", ref[i].path);
+        check_lookup(path, NULL);
+    }
+    check_lookup("/no such file", NULL);
+    check_lookup("/disk/no such file", NULL);
+    check_lookup("/no such dir/no such file", NULL);
+    CHECK(shim_held() == 0, "%u buffers not released", shim_held());
+}
+
+/* FNV-1a, as file_sys.c hashes names for its directory index */
+static uint32_t name_hash(const char* name) {
+    uint32_t h = 2166136261u;
+    uint32_t i;
+
+    for (i = 0; i < FILENAME_LEN && name[i] != '\0'; i++)
+        h = (h ^ (uint8_t)name[i]) * 16777619u;
+    return h;
+}
+
+typedef struct cand_t {
+    uint32_t hash;
+    uint32_t n;
+} cand_t;
+
+static int by_hash(const void* a, const void* b) {
+    const cand_t* x = a;
+    const cand_t* y = b;
+
+    if (x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
+    return x->n < y->n ? -1 : x->n > y->n;
+}
+
+/* Two pairs of names with the same FNV-1a hash, the same ones every run */
+static void hash_pairs(void) {
+    cand_t* c = malloc(HASH_CANDIDATES * sizeof(cand_t));
+    char name[8];
+    uint32_t i, found = 0;
+
+    for (i = 0; i < HASH_CANDIDATES; i++) {
+        snprintf(name, sizeof(name), "h%05x", i);
+        c[i].hash = name_hash(name);
+        c[i].n = i;
+    }
+    qsort(c, HASH_CANDIDATES, sizeof(cand_t), by_hash);
+    for (i = 1; i < HASH_CANDIDATES && found < 2; i++) {
+        if (c[i].hash != c[i - 1].hash)
+            continue;
+        snprintf(pairs[found][0], sizeof(pairs[found][0]), "h%05x", c[i - 1].n);
+        snprintf(pairs[found][1], sizeof(pairs[found][1]), "h%05x", c[i].n);
+        found++;
+    }
+    free(c);
+    if (found < 2) {
+        fprintf(stderr, "fstest: no names with equal hashes\n");
+        exit(2);
+    }
+}
+
+static const ref_file* find_ref(const char* path) {
+    uint32_t i;
+
+    for (i = 0; i < n_ref; i++)
+        if (strcmp(ref[i].path, path) == 0)
+            return &ref[i];
+    return NULL;
+}
+
+/* Entries that share a bucket or the whole hash are told apart by name.
+ * HASH_DIR of a -t tree holds both names of pairs[0] and the first of
+ * pairs[1]: the second must not be found through the first. */
+static void test_hash(int required) {
+    uint32_t i, j, bucket = 0, full = 0;
+    char path[2 * PATH_LEN];
+    const ref_file* r;
+
+    for (i = 0; i < n_ref; i++) {
+        for (j = i + 1; j < n_ref; j++) {
+            char* a = strrchr(ref[i].path, '/');
+            char* b = strrchr(ref[j].path, '/');
+            int la = a ? a - ref[i].path : 0, lb = b ? b - ref[j].path : 0;
+
+            if (la != lb || strncmp(ref[i].path, ref[j].path, la) != 0)
+                continue;
+            if (name_hash(ref[i].name) == name_hash(ref[j].name))
+                full++;
+            else if ((name_hash(ref[i].name) ^ name_hash(ref[j].name)) % HASH_BUCKETS == 0)
+                bucket++;
+        }
+    }
+    printf("%u names share a bucket, %u the whole hash\n", bucket, full);
+    if (!required)
+        return;
+    CHECK(bucket > 0 && full > 0, "no hash collisions in the image");
+    for (i = 0; i < 2; i++) {
+        snprintf(path, sizeof(path), "%s/%s", HASH_DIR, pairs[0][i]);
+        r = find_ref(path);
+        CHECK(r != NULL, "%s missing from the image", path);
+        snprintf(path, sizeof(path), "/%s/%s", HASH_DIR, pairs[0][i]);
+        check_lookup(path, r);
+    }
+    snprintf(path, sizeof(path), "%s/%s", HASH_DIR, pairs[1][0]);
+    CHECK((r = find_ref(path)) != NULL, "%s missing from the image", path);
+    snprintf(path, sizeof(path), "/%s/%s", HASH_DIR, pairs[1][0]);
+    check_lookup(path, r);
+    snprintf(path, sizeof(path), "/%s/%s", HASH_DIR, pairs[1][1]);
+    check_lookup(path, NULL);
+    snprintf(path, sizeof(path), "/disk/%s/%s", HASH_DIR, pairs[1][1]);
+    check_lookup(path, NULL);
+}
+
+/* file_read in odd chunks, file_seek and file_pread on one mount */
+static void test_fd(const char* mount) {
+    char path[2 * PATH_LEN];
+    file_des_t* fd;
+    uint8_t* buf;
+    uint32_t i, pos;
+    int32_t got;
+
+    for (i = 0; i < n_ref; i++) {
+        if (ref[i].type != 2)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", mount, ref[i].path);
+        fd = open_fd(path);
+        CHECK(fd != NULL, "open %s", path);
+        if (fd == NULL)
+            continue;
+        buf = malloc(ref[i].len + CHUNK);
+        for (pos = 0; (got = file_read(FD, buf + pos, CHUNK)) > 0; pos += got)
+            ;
+        CHECK(got == 0 && pos == ref[i].len && memcmp(buf, ref[i].data, pos) == 0,
+              "%s read in chunks: %u of %u bytes", path, pos, ref[i].len);
+        if (ref[i].len > BLOCK_SIZE + 10) {
+            CHECK(file_seek(FD, BLOCK_SIZE - 3, SEEK_SET) == BLOCK_SIZE - 3, "%s: seek", path);
+            CHECK(file_read(FD, buf, 10) == 10 && memcmp(buf, ref[i].data + BLOCK_SIZE - 3, 10) == 0,
+                  "%s: read after a seek back", path);
+            CHECK(file_seek(FD, -5, SEEK_END) == (int32_t)ref[i].len - 5, "%s: seek from the end", path);
+            CHECK(file_read(FD, buf, 100) == 5, "%s: read to the end", path);
+            CHECK(file_pread(FD, buf, 100, 7) == 100 && memcmp(buf, ref[i].data + 7, 100) == 0,
+                  "%s: pread", path);
+        }
+        CHECK(file_seek(FD, ref[i].len + 1, SEEK_SET) == -1, "%s: seek past the end", path);
+        free(buf);
+        close_fd(fd);
+    }
+    CHECK(shim_held() == 0, "%u buffers not released", shim_held());
+}
+
+/* direct_read lists a directory as its n dentries are in the image */
+static void test_dir(const char* path, const uint8_t* dents, uint32_t n) {
+    char name[FILENAME_LEN + 8];
+    file_des_t* fd = open_fd(path);
+    uint32_t i;
+    int32_t got;
+
+    CHECK(fd != NULL && fd->vnode->type == FILE_DIREC, "open %s", path);
+    if (fd == NULL)
+        return;
+    for (i = 0; (got = direct_read(FD, name, sizeof(name))) > 0; i++) {
+        CHECK(i < n && strncmp(name, (const char*)DENTRY(dents, i), FILENAME_LEN) == 0
+              && got == (int32_t)strnlen((const char*)DENTRY(dents, i), FILENAME_LEN),
+              "%s: entry %u is %s", path, i, name);
+    }
+    CHECK(got == 0 && i == n, "%s: %u of %u entries", path, i, n);
+    close_fd(fd);
+}
+
+/* Every directory, on both mounts */
+static void test_dirs(void) {
+    char path[2 * PATH_LEN];
+    uint32_t i;
+
+    test_dir(".", image + 64, n_root);
+    test_dir("/disk", image + 64, n_root);
+    for (i = 0; i < n_ref; i++) {
+        if (ref[i].type != 1 || ref[i].data == NULL)
+            continue;
+        snprintf(path, sizeof(path), "/%s", ref[i].path);
+        test_dir(path, ref[i].data, ref[i].len / 64);
+        snprintf(path, sizeof(path), "/disk/%s/.", ref[i].path);
+        test_dir(path, ref[i].data, ref[i].len / 64);
+    }
+    CHECK(shim_held() == 0, "%u buffers not released", shim_held());
+}
+
+static void result(const char* what, double value, const char* unit) {
+    printf("  %-26s %10.1f %s\n", what, value, unit);
+}
+
+/* Bytes per second of reading the largest file through fd on a mount */
+static double bench_fd(const char* mount, const ref_file* big, uint32_t chunk) {
+    char path[2 * PATH_LEN];
+    uint8_t* buf = malloc(chunk);
+    long long start = now_ns(), bytes = 0;
+    file_des_t* fd;
+    int32_t got;
+
+    snprintf(path, sizeof(path), "%s/%s", mount, big->path);
+    do {
+        fd = open_fd(path);
+        while ((got = file_read(FD, buf, chunk)) > 0)
+            bytes += got;
+        close_fd(fd);
+    } while (now_ns() - start < BENCH_NS);
+    free(buf);
+    bench_bytes = bytes;
+    return bytes * 1e9 / (now_ns() - start);
+}
+
+static void bench(void) {
+    const ref_file* big = NULL;
+    long long start, n;
+    uint8_t* buf;
+    dentry_t d;
+    vnode_t* vn;
+    uint32_t i, breads;
+
+    for (i = 0; i < n_ref; i++)
+        if (ref[i].type == 2 && (big == NULL || ref[i].len > big->len))
+            big = &ref[i];
+    printf("benchmarks, reads are of %s (%u bytes)\n", big->path, big->len);
+
+    for (n = 0, start = now_ns(); now_ns() - start < BENCH_NS; n += n_root)
+        for (i = 0; i < n_root; i++)
+            read_dentry_by_name((const uint8_t*)ref[i].name, &d);
+    result("read_dentry_by_name", (double)(now_ns() - start) / n, "ns");
+
+    for (n = 0, start = now_ns(); now_ns() - start < BENCH_NS; n += n_ref) {
+        for (i = 0; i < n_ref; i++) {
+            vn = vfs_lookup((const uint8_t*)ref[i].path);
+            vfs_put(vn);
+        }
+    }
+    result("vfs_lookup, cached", (double)(now_ns() - start) / n, "ns");
+
+    buf = malloc(big->len);
+    for (n = 0, start = now_ns(); now_ns() - start < BENCH_NS; n += big->len)
+        read_data(big->ino, 0, buf, big->len);
+    result("read_data, whole file", n * 1e3 / (now_ns() - start), "MB/s");
+    free(buf);
+
+    result("file_read 4 KB, memory", bench_fd("", big, BLOCK_SIZE) / 1e6, "MB/s");
+    result("file_read 1000 B, memory", bench_fd("", big, CHUNK) / 1e6, "MB/s");
+    breads = shim_breads;
+    result("file_read 4 KB, disk", bench_fd("/disk", big, BLOCK_SIZE) / 1e6, "MB/s");
+    result("  breads per 4 KB read", (double)(shim_breads - breads) * BLOCK_SIZE / bench_bytes, "");
+
+    for (n = 0, start = now_ns(); now_ns() - start < BENCH_NS; n += n_root) {
+        open_fd(".");
+        while (direct_read(FD, (void*)&d, sizeof(d)) > 0)
+            ;
+        close_fd(&get_pcb_ptr(0)->file_array[FD]);
+    }
+    result("direct_read, per entry", (double)(now_ns() - start) / n, "ns");
+}
+
+/* A file of len bytes, a pattern that differs from file to file */
+static void make_file(const char* dir, const char* name, uint32_t len) {
+    char path[PATH_LEN * 2];
+    uint32_t i, seed = name_hash(name);
+    FILE* f;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if ((f = fopen(path, "wb")) == NULL) {
+        perror(path);
+        exit(2);
+    }
+    for (i = 0; i < len; i++)
+        fputc((uint8_t)(seed + i * 7 + (i >> 12)), f);
+    fclose(f);
+}
+
+static void make_dir(char* path, const char* parent, const char* name) {
+    snprintf(path, PATH_LEN * 2, "%s/%s", parent, name);
+    if (mkdir(path, 0755) != 0) {
+        perror(path);
+        exit(2);
+    }
+}
+
+/* Build a tree for mkfs391 in dir, see the top of the file */
+static void make_tree(const char* dir) {
+    static const uint32_t sizes[] = { 0, 1, BLOCK_SIZE - 1, BLOCK_SIZE, BLOCK_SIZE + 1,
+                                      3 * BLOCK_SIZE + 5, 40000, 200000 };
+    char path[PATH_LEN * 2], sub[PATH_LEN * 2], name[FILENAME_LEN + 1];
+    uint32_t i;
+
+    if (mkdir(dir, 0755) != 0) {
+        perror(dir);
+        exit(2);
+    }
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        snprintf(name, sizeof(name), "size%u", sizes[i]);
+        make_file(dir, name, sizes[i]);
+    }
+    make_file(dir, "a_name_of_exactly_32_characters_", 100);
+
+    make_dir(path, dir, "dir");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        snprintf(name, sizeof(name), "file%u", i);
+        make_file(path, name, sizes[i]);
+    }
+    make_dir(sub, path, "sub");
+    make_file(sub, "file", 3 * BLOCK_SIZE);
+    make_file(sub, "big", 300000);
+    make_dir(path, sub, "empty");
+
+    /* longer than the path cache holds */
+    strcpy(path, dir);
+    for (i = 0; i < 4; i++) {
+        snprintf(name, sizeof(name), "%c_deep_directory_name_32_chars__", 'a' + i);
+        make_dir(sub, path, name);
+        strcpy(path, sub);
+    }
+    make_file(path, "leaf", 5 * BLOCK_SIZE + 3);
+
+    /* more names than buckets, and names with one hash */
+    make_dir(path, dir, HASH_DIR);
+    for (i = 0; i < HASH_BUCKETS + 44; i++) {
+        snprintf(name, sizeof(name), "n%03u", i);
+        make_file(path, name, i % 3 == 0 ? 0 : i * 37);
+    }
+    make_file(path, pairs[0][0], 10);
+    make_file(path, pairs[0][1], 2 * BLOCK_SIZE + 20);
+    make_file(path, pairs[1][0], 30);
+}
+
+int main(int argc, char** argv) {
+    int opt, benchmark = 0, frag = 0, hash = 0;
+    const char* tree = NULL;
+
+    while ((opt = getopt(argc, argv, "bfHt:")) != -1) {
+        switch (opt) {
+        case 'b':
+            benchmark = 1;
+            break;
+        case 'f':
+            frag = 1;
+            break;
+        case 'H':
+            hash = 1;
+            break;
+        case 't':
+            tree = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-b] [-f] [-H] [image]\n       %s -t <dir>\n", argv[0], argv[0]);
+            return 2;
+        }
+    }
+    hash_pairs();
+    if (tree != NULL) {
+        make_tree(tree);
+        return 0;
+    }
+    load_image(optind < argc ? argv[optind] : DEFAULT_IMAGE);
+    load_reference();
+    if (frag)
+        fragment();
+    load_disk();
+
+    file_sys_addr = (uint32_t)(unsigned long)image;
+    vfs_init();
+    filesys_init();
+
+    test_dentries();
+    test_read_data();
+    test_stream();
+    test_vfs();
+    test_hash(hash);
+    test_fd("");
+    test_fd("/disk");
+    test_dirs();
+    printf("%d checks, %d failed\n", checks, failed);
+
+    if (benchmark && failed == 0)
+        bench();
+    return failed != 0;
+}
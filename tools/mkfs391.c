@@ -0,0 +1,347 @@
+/*
+ * mkfs391 -- host side builder of the ece391 file system image
+ *
+ * Replaces createfs. Every regular file under <dir> goes into the image;
+ * subdirectories become directory inodes whose data blocks hold 64-byte
+ * dentries, starting with "." and "..". The root directory stays in the
+ * boot block (at most 63 entries), with "." and the "rtc" device first,
+ * so an image of a flat directory reads like a createfs one. Names are cut
+ * to 32 characters with a warning; two names that are the same once cut,
+ * or an "rtc" in the root, are an error. See student-distrib/file_sys.c
+ * for the reader.
+ *
+ * Every file is one extent of data blocks in ascending order, which the
+ * kernel reads and maps a whole extent at a time. Directories come first,
+ * right after the inodes; then the executables, each starting on a multiple
+ * of -a blocks of the image (a block is a page, 8 blocks are one read-ahead
+ * of the disk buffer cache), with the gaps filled by small files; then the
+ * remaining files from the smallest to the largest, so the big streamed
+ * files (videos, wavs) sit at the end, undisturbed.
+ *
+ * usage: mkfs391 [-a blocks] [-r] <dir> <image>
+ *        -a  alignment of executables in blocks, default 8, 1 turns it off
+ *        -r  print where every file went
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define BLOCK_SIZE          4096
+#define NAME_LEN            32
+#define DENTRY_SIZE         64
+#define ROOT_MAX            (BLOCK_SIZE / DENTRY_SIZE - 1)
+#define INODE_MAX_BLOCKS    (BLOCK_SIZE / 4 - 1)
+#define MAX_FILE            (INODE_MAX_BLOCKS * BLOCK_SIZE)
+#define DEFAULT_ALIGN       8
+
+#define TYPE_RTC            0
+#define TYPE_DIR            1
+#define TYPE_REG            2
+
+typedef struct node {
+    char name[NAME_LEN + 1];
+    const char* path;               /* below <dir>, for the report */
+    int type;
+    int exec;                       /* an ELF file */
+    int placed;
+    uint32_t ino;                   /* 0 is the root and "rtc" */
+    uint8_t* data;                  /* file contents, or the dentries of a directory */
+    uint32_t len;
+    uint32_t first;                 /* first data block */
+    uint32_t n_blocks;
+    struct node** kids;
+    int n_kids;
+    struct node* parent;
+} node_t;
+
+static node_t** all;                /* every file and directory but the root, by ino - 1 */
+static uint32_t n_all;
+static uint32_t n_data;             /* data blocks laid out so far */
+static uint32_t n_pad;              /* of them, ones no file uses */
+
+static void die(const char* what, const char* why) {
+    fprintf(stderr, "mkfs391: %s: %s\n", what, why);
+    exit(1);
+}
+
+static void* xmalloc(size_t n) {
+    void* p = calloc(1, n ? n : 1);
+    if (p == NULL)
+        die("malloc", "out of memory");
+    return p;
+}
+
+static int by_name(const void* a, const void* b) {
+    return strcmp((*(node_t* const*)a)->name, (*(node_t* const*)b)->name);
+}
+
+static uint8_t* slurp(const char* path, uint32_t* len) {
+    FILE* f = fopen(path, "rb");
+    long n;
+    uint8_t* buf;
+
+    if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (n = ftell(f)) < 0)
+        die(path, "cannot read");
+    if (n > MAX_FILE)
+        die(path, "larger than an inode can hold");
+    rewind(f);
+    buf = xmalloc(n);
+    if (n > 0 && fread(buf, 1, n, f) != (size_t)n)
+        die(path, "short read");
+    fclose(f);
+    *len = n;
+    return buf;
+}
+
+/* Read a host directory into a tree, children sorted by name */
+static void scan(node_t* dir, const char* path) {
+    DIR* d = opendir(path);
+    struct dirent* e;
+    struct stat st;
+    char sub[4096];
+    char* name;
+    node_t* n;
+    int i;
+
+    if (d == NULL)
+        die(path, "cannot open directory");
+    while ((e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.')
+            continue;
+        snprintf(sub, sizeof(sub), "%s/%s", path, e->d_name);
+        if (stat(sub, &st) != 0 || !(S_ISREG(st.st_mode) || S_ISDIR(st.st_mode)))
+            continue;
+        n = xmalloc(sizeof(node_t));
+        memcpy(n->name, e->d_name, strnlen(e->d_name, NAME_LEN));
+        if (strlen(e->d_name) > NAME_LEN)
+            fprintf(stderr, "mkfs391: %s: name cut to %s\n", sub, n->name);
+        name = xmalloc(strlen(dir->path) + strlen(n->name) + 2);
+        sprintf(name, "%s/%s", dir->path, n->name);
+        n->path = name;
+        n->parent = dir;
+        dir->kids = realloc(dir->kids, (dir->n_kids + 1) * sizeof(node_t*));
+        if (dir->kids == NULL)
+            die("realloc", "out of memory");
+        dir->kids[dir->n_kids++] = n;
+        if (S_ISDIR(st.st_mode)) {
+            n->type = TYPE_DIR;
+            scan(n, sub);
+        } else {
+            n->type = TYPE_REG;
+            n->data = slurp(sub, &n->len);
+            n->exec = n->len >= 4 && memcmp(n->data, "\177ELF", 4) == 0;
+        }
+    }
+    closedir(d);
+    qsort(dir->kids, dir->n_kids, sizeof(node_t*), by_name);
+
+    /* the directory index would find only one of two equal names */
+    for (i = 1; i < dir->n_kids; i++)
+        if (strcmp(dir->kids[i - 1]->name, dir->kids[i]->name) == 0)
+            die(dir->kids[i]->path, "same name as another file once cut to 32 characters");
+    for (i = 0; dir->parent == NULL && i < dir->n_kids; i++)
+        if (strcmp(dir->kids[i]->name, "rtc") == 0)
+            die(dir->kids[i]->path, "the root has the rtc device under that name");
+}
+
+/* Inodes in depth first order, a directory before what is in it */
+static void number(node_t* dir) {
+    int i;
+
+    for (i = 0; i < dir->n_kids; i++) {
+        all = realloc(all, (n_all + 1) * sizeof(node_t*));
+        if (all == NULL)
+            die("realloc", "out of memory");
+        all[n_all++] = dir->kids[i];
+        dir->kids[i]->ino = n_all;
+        if (dir->kids[i]->type == TYPE_DIR)
+            number(dir->kids[i]);
+    }
+}
+
+static void put_dentry(uint8_t* p, const char* name, uint32_t type, uint32_t ino) {
+    memset(p, 0, DENTRY_SIZE);
+    memcpy(p, name, strnlen(name, NAME_LEN));
+    memcpy(p + NAME_LEN, &type, 4);
+    memcpy(p + NAME_LEN + 4, &ino, 4);
+}
+
+/* The dentry array of a subdirectory: ".", "..", then its children */
+static void fill_dir(node_t* dir) {
+    int i;
+
+    dir->len = (dir->n_kids + 2) * DENTRY_SIZE;
+    if (dir->len > MAX_FILE)
+        die(dir->name, "too many entries");
+    dir->data = xmalloc(dir->len);
+    put_dentry(dir->data, ".", TYPE_DIR, dir->ino);
+    put_dentry(dir->data + DENTRY_SIZE, "..", TYPE_DIR, dir->parent->ino);
+    for (i = 0; i < dir->n_kids; i++)
+        put_dentry(dir->data + (i + 2) * DENTRY_SIZE, dir->kids[i]->name,
+                   dir->kids[i]->type, dir->kids[i]->ino);
+}
+
+/* Give a file the next data blocks */
+static void place(node_t* n) {
+    n->first = n_data;
+    n->n_blocks = (n->len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    n->placed = 1;
+    n_data += n->n_blocks;
+}
+
+/* The largest plain file not laid out yet that fits in max blocks */
+static node_t* filler(uint32_t max) {
+    node_t* best = NULL;
+    uint32_t i, blocks;
+
+    for (i = 0; i < n_all; i++) {
+        blocks = (all[i]->len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (all[i]->placed || all[i]->type != TYPE_REG || all[i]->exec || blocks > max)
+            continue;
+        if (best == NULL || all[i]->len > best->len)
+            best = all[i];
+    }
+    return best;
+}
+
+static int by_size(const void* a, const void* b) {
+    uint32_t x = (*(node_t* const*)a)->len, y = (*(node_t* const*)b)->len;
+    return (x > y) - (x < y);
+}
+
+/* Choose the data blocks of every file, see the top of the file */
+static void layout(uint32_t align) {
+    node_t** rest;
+    node_t* n;
+    uint32_t i, gap, n_rest = 0;
+
+    for (i = 0; i < n_all; i++) {
+        if (all[i]->type == TYPE_DIR) {
+            fill_dir(all[i]);
+            place(all[i]);
+        }
+    }
+    for (i = 0; i < n_all; i++) {
+        if (!all[i]->exec)
+            continue;
+        /* image block of data block b is 2 + n_all + b */
+        gap = (align - (2 + n_all + n_data) % align) % align;
+        while (gap > 0 && (n = filler(gap)) != NULL) {
+            place(n);
+            gap -= n->n_blocks;
+        }
+        n_data += gap;
+        n_pad += gap;
+        place(all[i]);
+    }
+    rest = xmalloc(n_all * sizeof(node_t*));
+    for (i = 0; i < n_all; i++)
+        if (!all[i]->placed)
+            rest[n_rest++] = all[i];
+    qsort(rest, n_rest, sizeof(node_t*), by_size);
+    for (i = 0; i < n_rest; i++)
+        place(rest[i]);
+    free(rest);
+}
+
+static int by_block(const void* a, const void* b) {
+    const node_t* x = *(node_t* const*)a;
+    const node_t* y = *(node_t* const*)b;
+    if (x->first != y->first)
+        return (x->first > y->first) - (x->first < y->first);
+    return (x->ino > y->ino) - (x->ino < y->ino);
+}
+
+/* Where every file went, in the order of the image; executables are starred */
+static void report(void) {
+    node_t** order = xmalloc(n_all * sizeof(node_t*));
+    uint32_t i;
+
+    memcpy(order, all, n_all * sizeof(node_t*));
+    qsort(order, n_all, sizeof(node_t*), by_block);
+    printf("%5s %7s %6s %9s  %s\n", "ino", "block", "blocks", "bytes", "path");
+    for (i = 0; i < n_all; i++)
+        printf("%5u %7u %6u %9u  %s%s%s\n", order[i]->ino, 2 + n_all + order[i]->first,
+               order[i]->n_blocks, order[i]->len, order[i]->path,
+               order[i]->type == TYPE_DIR ? "/" : "", order[i]->exec ? " *" : "");
+    free(order);
+}
+
+int main(int argc, char** argv) {
+    static uint8_t block[BLOCK_SIZE];
+    node_t root;
+    uint32_t i, b, align = DEFAULT_ALIGN, hdr[3];
+    int opt, verbose = 0;
+    uint8_t* data;
+    FILE* out;
+
+    while ((opt = getopt(argc, argv, "a:r")) != -1) {
+        if (opt == 'a' && atoi(optarg) > 0) {
+            align = atoi(optarg);
+        } else if (opt == 'r') {
+            verbose = 1;
+        } else {
+            optind = argc;
+            break;
+        }
+    }
+    if (argc - optind != 2) {
+        fprintf(stderr, "usage: %s [-a blocks] [-r] <dir> <image>\n", argv[0]);
+        return 1;
+    }
+    memset(&root, 0, sizeof(root));
+    root.type = TYPE_DIR;
+    root.path = "";
+    scan(&root, argv[optind]);
+    if (root.n_kids + 2 > ROOT_MAX)
+        die(argv[optind], "more than 61 entries in the root directory");
+    number(&root);
+    layout(align);
+
+    if ((out = fopen(argv[optind + 1], "wb")) == NULL) {
+        perror(argv[optind + 1]);
+        return 1;
+    }
+
+    /* boot block: counts, then the root directory */
+    hdr[0] = root.n_kids + 2;
+    hdr[1] = n_all + 1;
+    hdr[2] = n_data;
+    memcpy(block, hdr, sizeof(hdr));
+    put_dentry(block + DENTRY_SIZE, ".", TYPE_DIR, 0);
+    put_dentry(block + 2 * DENTRY_SIZE, "rtc", TYPE_RTC, 0);
+    for (i = 0; i < (uint32_t)root.n_kids; i++)
+        put_dentry(block + (i + 3) * DENTRY_SIZE, root.kids[i]->name, root.kids[i]->type, root.kids[i]->ino);
+    fwrite(block, BLOCK_SIZE, 1, out);
+
+    /* inode 0 stays empty */
+    memset(block, 0, BLOCK_SIZE);
+    fwrite(block, BLOCK_SIZE, 1, out);
+    for (i = 0; i < n_all; i++) {
+        memset(block, 0, BLOCK_SIZE);
+        memcpy(block, &all[i]->len, 4);
+        for (b = 0; b < all[i]->n_blocks; b++) {
+            uint32_t idx = all[i]->first + b;
+            memcpy(block + 4 + 4 * b, &idx, 4);
+        }
+        fwrite(block, BLOCK_SIZE, 1, out);
+    }
+
+    /* the data blocks, padding stays zero */
+    data = xmalloc((size_t)n_data * BLOCK_SIZE);
+    for (i = 0; i < n_all; i++)
+        memcpy(data + (size_t)all[i]->first * BLOCK_SIZE, all[i]->data, all[i]->len);
+    fwrite(data, BLOCK_SIZE, n_data, out);
+
+    if (verbose)
+        report();
+    printf("%u entries in /, %u inodes, %u data blocks (%u padding), %u bytes\n",
+           hdr[0], hdr[1], hdr[2], n_pad, (1 + hdr[1] + hdr[2]) * BLOCK_SIZE);
+    if (fclose(out) != 0)
+        die(argv[optind + 1], "write failed");
+    return 0;
+}
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""profsym.py - flat profile from the sampling profiler dump.
+
+The kernel sends its samples over COM1 when profiling stops (ctrl+f
+starts and stops it). Run QEMU with `-serial file:serial.log`, then:
+
+    tools/profsym.py serial.log
+    tools/profsym.py --kernel student-distrib/bootimg --user syscalls serial.log
+
+Kernel samples are looked up in the bootimg symbols, user samples in
+<user dir>/<program>.exe, the ELF the program was converted from.
+Only the last dump in the log is used.
+"""
+
+import argparse
+import bisect
+import collections
+import os
+import subprocess
+import sys
+
+
+def load_symbols(elf):
+    """Sorted (address, name) list of the text symbols of an ELF, via nm."""
+    try:
+        out = subprocess.run(["nm", "-n", "--defined-only", elf],
+                             capture_output=True, text=True, check=True).stdout
+    except (OSError, subprocess.CalledProcessError):
+        return None
+    syms = []
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) == 3 and parts[1] in "tTwW":
+            syms.append((int(parts[0], 16), parts[2]))
+    return syms
+
+
+def lookup(syms, eip):
+    if not syms:
+        return "0x%08x" % eip
+    i = bisect.bisect_right(syms, (eip, "\xff")) - 1
+    if i < 0:
+        return "0x%08x" % eip
+    return syms[i][1]
+
+
+def parse_dump(lines):
+    """The programs and samples of the last PROF BEGIN / PROF END block."""
+    progs, samples, header = {}, [], ""
+    inside = False
+    for line in lines:
+        line = line.strip()
+        if line.startswith("PROF BEGIN"):
+            progs, samples, header, inside = {}, [], line, True
+        elif line == "PROF END":
+            inside = False
+        elif inside and line.startswith("PROG "):
+            _, idx, name = line.split(None, 2)
+            progs[int(idx)] = name
+        elif inside and line.startswith("S "):
+            f = line.split()
+            if f[3] == "K":
+                samples.append((None, int(f[4], 16)))
+            else:
+                samples.append((int(f[4]), int(f[5], 16)))
+    return header, progs, samples
+
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("log", help="serial output holding the dump")
+    ap.add_argument("--kernel", default=os.path.join(root, "student-distrib", "bootimg"))
+    ap.add_argument("--user", default=os.path.join(root, "syscalls"),
+                    help="directory of the user program .exe files")
+    ap.add_argument("-n", type=int, default=30, help="lines to print")
+    args = ap.parse_args()
+
+    with open(args.log, errors="replace") as f:
+        header, progs, samples = parse_dump(f)
+    if not samples:
+        sys.exit("no profile dump in %s" % args.log)
+
+    kernel_syms = load_symbols(args.kernel)
+    if kernel_syms is None:
+        print("warning: no symbols from %s" % args.kernel, file=sys.stderr)
+    user_syms = {}
+    for idx, name in progs.items():
+        user_syms[idx] = load_symbols(os.path.join(args.user, name + ".exe"))
+
+    counts = collections.Counter()
+    for prog, eip in samples:
+        if prog is None:
+            counts[("kernel", lookup(kernel_syms, eip))] += 1
+        else:
+            counts[(progs.get(prog, "?"), lookup(user_syms.get(prog), eip))] += 1
+
+    total = len(samples)
+    print(header)
+    print("%d samples\n" % total)
+    print("%7s %6s  %-10s %s" % ("samples", "%", "image", "function"))
+    for (image, func), n in counts.most_common(args.n):
+        print("%7d %6.2f  %-10s %s" % (n, 100.0 * n / total, image, func))
+
+
+if __name__ == "__main__":
+    main()
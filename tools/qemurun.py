@@ -0,0 +1,323 @@
+#!/usr/bin/env python3
+"""qemurun.py - boot the kernel in headless QEMU and time a shell workload.
+
+QEMU runs without a display and with COM1 on a pipe. The kernel treats
+COM1 as a second keyboard and screen for the displayed terminal once a byte
+arrives on it, so the runner types shell commands there and watches for the
+"391OS> " prompt. By default QEMU boots student-distrib/bootimg directly with
+filesys_img as the multiboot module; --disk boots a GRUB disk image instead.
+
+Recorded per run:
+  boot       seconds from starting QEMU to the first prompt
+  per cmd    wall milliseconds from the Enter to the next prompt, bytes of
+             output, and the system calls it made; these come from the
+             "syscalls:" line of the irqstat device, read with cat before
+             and after, with the cost of that cat taken off
+
+Workload lines are shell commands. A line "< text" is typed into the
+program started by the command above it once that program has printed
+something and gone quiet. A last line "cmd ~N" runs a program that never
+exits (pingpong) for N seconds and records its output lines per second.
+
+    tools/qemurun.py -o base.json
+    ... change the kernel, rebuild ...
+    tools/qemurun.py --baseline base.json
+
+exits 1 if a time or a syscall count grew by more than --threshold percent.
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import threading
+import time
+
+PROMPT = b"391OS> "
+
+DEFAULT_WORKLOAD = """
+ls
+cat frame0.txt
+cat verylargetextwithverylongname.txt
+grep very
+counter
+< 1
+hello
+< qemurun
+pingpong ~3
+"""
+
+SYSCALLS_RE = re.compile(rb"syscalls:([^\r\n]*)")
+
+
+class Serial:
+    """COM1 of QEMU: a reader thread collects output with arrival times."""
+
+    def __init__(self, proc, log):
+        self.proc = proc
+        self.log = log
+        self.buf = bytearray()
+        self.last = time.monotonic()
+        self.cond = threading.Condition()
+        threading.Thread(target=self._reader, daemon=True).start()
+
+    def _reader(self):
+        while True:
+            data = os.read(self.proc.stdout.fileno(), 4096)
+            with self.cond:
+                if not data:
+                    self.buf += b"\0EOF"
+                    self.cond.notify_all()
+                    return
+                self.buf += data
+                self.last = time.monotonic()
+                self.cond.notify_all()
+            if self.log:
+                self.log.write(data)
+
+    def send(self, text):
+        self.proc.stdin.write(text.encode() + b"\r")
+        self.proc.stdin.flush()
+
+    def mark(self):
+        with self.cond:
+            return len(self.buf)
+
+    def wait_for(self, pattern, start, timeout, poke=None):
+        """Wait until pattern is in the output after start; return its end
+        and the time it was seen. poke, if given, is called every 0.1 s."""
+        deadline = time.monotonic() + timeout
+        with self.cond:
+            while True:
+                i = self.buf.find(pattern, start)
+                if i >= 0:
+                    return i + len(pattern), time.monotonic()
+                if self.buf.endswith(b"\0EOF"):
+                    raise RuntimeError("QEMU exited")
+                left = deadline - time.monotonic()
+                if left <= 0:
+                    raise RuntimeError("timed out waiting for %r" % pattern)
+                self.cond.wait(min(left, 0.1))
+                if poke:
+                    self.cond.release()
+                    poke()
+                    self.cond.acquire()
+
+    def wait_quiet(self, start, quiet, timeout):
+        """Wait for output after start, then for quiet seconds of none."""
+        deadline = time.monotonic() + timeout
+        with self.cond:
+            while len(self.buf) <= start or time.monotonic() - self.last < quiet:
+                if time.monotonic() > deadline:
+                    raise RuntimeError("no output from the program")
+                self.cond.wait(0.05)
+
+    def text(self, start, end=None):
+        with self.cond:
+            return bytes(self.buf[start:end])
+
+
+def parse_workload(text):
+    steps = []
+    for line in text.splitlines():
+        line = line.rstrip()
+        if not line or line.startswith("#"):
+            continue
+        if line.startswith("<"):
+            if not steps:
+                sys.exit("workload: input before any command")
+            steps[-1]["input"].append(line[1:].strip())
+            continue
+        m = re.match(r"(.*?)\s+~(\d+(?:\.\d+)?)$", line)
+        if steps and steps[-1]["seconds"]:
+            sys.exit("workload: only the last command can be timed with ~N")
+        steps.append({"cmd": m.group(1) if m else line,
+                      "seconds": float(m.group(2)) if m else 0, "input": []})
+    return steps
+
+
+def run_cmd(ser, cmd, inputs, timeout):
+    """Type a command, its input lines, and wait for the prompt."""
+    start = ser.mark()
+    t0 = time.monotonic()
+    ser.send(cmd)
+    for line in inputs:
+        ser.wait_quiet(start + len(cmd) + 2, 0.2, timeout)
+        ser.send(line)
+    end, t1 = ser.wait_for(PROMPT, start, timeout)
+    return ser.text(start, end), (t1 - t0) * 1000.0
+
+
+def syscall_counts(ser, timeout):
+    out, _ = run_cmd(ser, "cat irqstat", [], timeout)
+    m = SYSCALLS_RE.search(out)
+    if not m:
+        return None
+    counts = {}
+    for item in m.group(1).split():
+        name, _, n = item.partition(b"=")
+        counts[name.decode()] = int(n)
+    return counts
+
+
+def diff(after, before, minus=None):
+    d = {}
+    for name, n in after.items():
+        v = n - before.get(name, 0) - (minus or {}).get(name, 0)
+        if v > 0:
+            d[name] = v
+    return d
+
+
+def run(args, steps):
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    kdir = os.path.join(root, "student-distrib")
+    cmd = [args.qemu, "-m", str(args.mem), "-display", "none", "-monitor", "none",
+           "-serial", "stdio", "-no-reboot"]
+    if args.disk:
+        cmd += ["-hda", args.disk]
+    else:
+        cmd += ["-kernel", args.kernel or os.path.join(kdir, "bootimg"),
+                "-initrd", args.fs or os.path.join(kdir, "filesys_img")]
+    if args.hdb:
+        cmd += ["-hdb", args.hdb]
+    if args.smp > 1:
+        cmd += ["-smp", str(args.smp)]
+    cmd += args.qemu_arg
+
+    log = open(args.log, "wb") if args.log else None
+    t0 = time.monotonic()
+    proc = subprocess.Popen(cmd, stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+    ser = Serial(proc, log)
+    result = {"qemu": " ".join(cmd), "commands": []}
+    try:
+        # Enter until the shell answers; the first byte turns the console on
+        _, seen = ser.wait_for(PROMPT, 0, args.boot_timeout, poke=lambda: ser.send(""))
+        result["boot_s"] = seen - t0
+        ser.wait_quiet(0, 0.5, args.timeout)
+        result["boot_log"] = [l.decode(errors="replace") for l in
+                              ser.text(0).splitlines() if l.startswith(b"boot")]
+
+        # what one "cat irqstat" costs, taken off every count below
+        first = syscall_counts(ser, args.timeout)
+        if first is None:
+            print("warning: no syscall counts in irqstat", file=sys.stderr)
+        second = syscall_counts(ser, args.timeout) if first is not None else None
+        probe = diff(second, first) if second is not None else None
+        before = second
+
+        for step in steps:
+            if step["seconds"]:
+                start = ser.mark()
+                ser.send(step["cmd"])
+                time.sleep(step["seconds"])
+                lines = ser.text(start).count(b"\n")
+                result["commands"].append({"cmd": step["cmd"], "seconds": step["seconds"],
+                                           "lines_per_s": lines / step["seconds"]})
+                break
+            out, ms = run_cmd(ser, step["cmd"], step["input"], args.timeout)
+            entry = {"cmd": step["cmd"], "wall_ms": round(ms, 2), "output_bytes": len(out)}
+            if before is not None:
+                after = syscall_counts(ser, args.timeout)
+                entry["syscalls"] = diff(after, before, probe)
+                entry["syscalls_total"] = sum(entry["syscalls"].values())
+                before = after
+            result["commands"].append(entry)
+    finally:
+        proc.kill()
+        proc.wait()
+        if log:
+            log.close()
+    return result
+
+
+def report(result, base, threshold):
+    """Print the run next to the baseline; return the regressions."""
+    old = {c["cmd"]: c for c in base["commands"]} if base else {}
+    bad = []
+
+    def col(name, new, ref):
+        if ref is None or ref == 0:
+            return "%10.1f" % new
+        pct = 100.0 * (new - ref) / ref
+        if pct > threshold:
+            bad.append("%s %+.1f%%" % (name, pct))
+        return "%10.1f (%+6.1f%% of %g)" % (new, pct, ref)
+
+    print("%-40s %s" % ("boot (s)", col("boot", result["boot_s"], base and base.get("boot_s"))))
+    for line in result.get("boot_log", []):
+        print("  " + line)
+    for c in result["commands"]:
+        ref = old.get(c["cmd"], {})
+        if "lines_per_s" in c:
+            print("%-40s %10.1f lines/s" % (c["cmd"], c["lines_per_s"]))
+            continue
+        print("%-40s %s ms" % (c["cmd"], col(c["cmd"] + " time", c["wall_ms"], ref.get("wall_ms"))))
+        if "syscalls_total" in c:
+            top = sorted(c["syscalls"].items(), key=lambda kv: -kv[1])[:4]
+            print("%-40s %s syscalls  %s" % ("", col(c["cmd"] + " syscalls", c["syscalls_total"],
+                                                   ref.get("syscalls_total")),
+                                           " ".join("%s=%d" % kv for kv in top)))
+    return bad
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("--qemu", default="qemu-system-i386")
+    ap.add_argument("--kernel", help="multiboot kernel, default student-distrib/bootimg")
+    ap.add_argument("--fs", help="file system module, default student-distrib/filesys_img")
+    ap.add_argument("--disk", help="boot this disk image (GRUB) instead of --kernel")
+    ap.add_argument("--hdb", help="second disk, mounted by the kernel at /disk")
+    ap.add_argument("--mem", type=int, default=256, help="MB of memory")
+    ap.add_argument("--smp", type=int, default=1)
+    ap.add_argument("--qemu-arg", action="append", default=[], help="extra QEMU argument")
+    ap.add_argument("-w", "--workload", help="file of commands, default the built-in one")
+    ap.add_argument("-n", "--runs", type=int, default=1, help="boots; the fastest time counts")
+    ap.add_argument("-o", "--output", help="write the results as JSON")
+    ap.add_argument("--baseline", help="JSON of an earlier run to compare with")
+    ap.add_argument("--threshold", type=float, default=10.0, help="percent that is a regression")
+    ap.add_argument("--log", help="save the serial output of the last run")
+    ap.add_argument("--timeout", type=float, default=60.0, help="seconds per command")
+    ap.add_argument("--boot-timeout", type=float, default=60.0)
+    args = ap.parse_args()
+
+    if args.workload:
+        with open(args.workload) as f:
+            steps = parse_workload(f.read())
+    else:
+        steps = parse_workload(DEFAULT_WORKLOAD)
+
+    best = None
+    for _ in range(args.runs):
+        try:
+            res = run(args, steps)
+        except (OSError, RuntimeError) as e:
+            sys.exit("qemurun: %s" % e)
+        if best is None:
+            best = res
+            continue
+        # keep the fastest of every number
+        best["boot_s"] = min(best["boot_s"], res["boot_s"])
+        for b, r in zip(best["commands"], res["commands"]):
+            if "wall_ms" in b:
+                b["wall_ms"] = min(b["wall_ms"], r["wall_ms"])
+            elif "lines_per_s" in b:
+                b["lines_per_s"] = max(b["lines_per_s"], r["lines_per_s"])
+
+    base = None
+    if args.baseline:
+        with open(args.baseline) as f:
+            base = json.load(f)
+    bad = report(best, base, args.threshold)
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(best, f, indent=2)
+    if bad:
+        print("\nregressions: " + ", ".join(bad))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
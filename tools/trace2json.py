@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""trace2json.py - Chrome trace JSON from the kernel trace dump.
+
+The kernel records syscalls, IRQs, task switches, page faults and TLB
+flushes into a ring per CPU and sends it over COM1 on ctrl+t. Run QEMU
+with `-serial file:serial.log`, then:
+
+    tools/trace2json.py serial.log > trace.json
+
+and open trace.json in chrome://tracing or https://ui.perfetto.dev.
+Every CPU is a process; syscalls are on a thread per pid, IRQs on an
+"irq" thread. Only the last dump in the log is used.
+"""
+
+import argparse
+import bisect
+import json
+import os
+import re
+import struct
+import subprocess
+import sys
+
+REC = struct.Struct("<QBBHIII")         # trace_rec_t, TRACE_REC_SIZE bytes
+
+SYSCALL_ENTER, SYSCALL_EXIT, SWITCH, IRQ_ENTRY, IRQ_EXIT, PAGE_FAULT, TLB_FLUSH = range(1, 8)
+
+SYSCALLS = ["null", "halt", "execute", "read", "write", "open", "close",
+            "getargs", "vidmap", "set_handler", "sigreturn", "readv",
+            "writev", "io_enter", "pread", "lseek", "mmap", "sleep", "gettime"]
+
+IRQS = {0x02: "nmi", 0x20: "pit", 0x21: "keyboard", 0x24: "serial",
+        0x25: "sb16", 0x28: "rtc", 0x2B: "eth0", 0x2C: "mouse",
+        0x2E: "ide0", 0x30: "lapic timer"}
+
+IRQ_TID = 1000                          # the IRQ thread of every CPU
+
+
+def load_symbols(elf):
+    try:
+        out = subprocess.run(["nm", "-n", "--defined-only", elf],
+                             capture_output=True, text=True, check=True).stdout
+    except (OSError, subprocess.CalledProcessError):
+        return []
+    syms = []
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) == 3 and parts[1] in "tT":
+            syms.append((int(parts[0], 16), parts[2]))
+    return syms
+
+
+def symbolize(syms, addr):
+    i = bisect.bisect_right(syms, (addr, "\xff")) - 1
+    if i < 0:
+        return "0x%08x" % addr
+    return "%s+0x%x" % (syms[i][1], addr - syms[i][0])
+
+
+def read_dump(data):
+    """The TSC frequency and the records of the last dump."""
+    start = data.rfind(b"TRACE BEGIN")
+    if start < 0:
+        sys.exit("no trace dump found")
+    eol = data.index(b"\n", start)
+    m = re.search(rb"khz=(\d+) records=(\d+)", data[start:eol])
+    khz, count = int(m.group(1)), int(m.group(2))
+    body = data[eol + 1:eol + 1 + count * REC.size]
+    if len(body) < count * REC.size:
+        print("warning: dump cut short", file=sys.stderr)
+        count = len(body) // REC.size
+    return khz, [REC.unpack_from(body, i * REC.size) for i in range(count)]
+
+
+def convert(khz, recs, syms):
+    recs = sorted(recs, key=lambda r: r[0])
+    t0 = recs[0][0] if recs else 0
+    scale = 1000.0 / khz if khz else 1.0   # TSC cycles to us
+    events, threads = [], set()
+
+    for tsc, typ, cpu, pid, a0, a1, a2 in recs:
+        ev = {"ts": (tsc - t0) * scale, "pid": cpu, "tid": pid}
+        if typ == SYSCALL_ENTER:
+            name = SYSCALLS[a0] if a0 < len(SYSCALLS) else "sys%d" % a0
+            ev.update(ph="B", name=name, cat="syscall", args={"arg0": a1, "arg1": a2})
+        elif typ == SYSCALL_EXIT:
+            ev.update(ph="E", cat="syscall", args={"ret": a0 - (1 << 32) if a0 >> 31 else a0})
+        elif typ in (IRQ_ENTRY, IRQ_EXIT):
+            ev.update(ph="B" if typ == IRQ_ENTRY else "E", tid=IRQ_TID, cat="irq",
+                      name=IRQS.get(a0, "irq 0x%x" % a0))
+        elif typ == SWITCH:
+            ev.update(ph="i", s="p", cat="sched", name="switch",
+                      args={"from": a0, "to": a1 - (1 << 32) if a1 >> 31 else a1, "terminal": a2})
+        elif typ == PAGE_FAULT:
+            ev.update(ph="i", s="t", cat="mm", name="page fault",
+                      args={"cr2": "0x%08x" % a0, "error": a1, "eip": "0x%08x" % a2})
+        elif typ == TLB_FLUSH:
+            ev.update(ph="i", s="t", cat="mm", name="tlb flush",
+                      args={"at": symbolize(syms, a0) if syms else "0x%08x" % a0})
+        else:
+            continue
+        threads.add((cpu, ev["tid"]))
+        events.append(ev)
+
+    for cpu in sorted({c for c, _ in threads}):
+        events.append({"ph": "M", "name": "process_name", "pid": cpu,
+                       "args": {"name": "CPU %d" % cpu}})
+    for cpu, tid in sorted(threads):
+        events.append({"ph": "M", "name": "thread_name", "pid": cpu, "tid": tid,
+                       "args": {"name": "irq" if tid == IRQ_TID else "pid %d" % tid}})
+    return {"traceEvents": events, "displayTimeUnit": "ns"}
+
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("log", help="serial output holding the dump")
+    ap.add_argument("--kernel", default=os.path.join(root, "student-distrib", "bootimg"),
+                    help="kernel ELF to name the TLB flush sites")
+    args = ap.parse_args()
+
+    with open(args.log, "rb") as f:
+        khz, recs = read_dump(f.read())
+    json.dump(convert(khz, recs, load_symbols(args.kernel)), sys.stdout)
+    sys.stdout.write("\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,191 @@
+/*
+ * videnc -- host side encoder for the kernel video player
+ *
+ * Converts a raw video (20-byte header {width, height, frame_num,
+ * frame_rate, palette_num}, palette_num*3 bytes of palette, then
+ * width*height bytes per frame) into the RLE/delta format decoded by
+ * student-distrib/dev/video_player.c. See video_player.h for the layout.
+ *
+ * usage: videnc <raw video> <output> [keyframe interval]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/* The format is the kernel's; its types.h has its own idea of these */
+#undef NULL
+#define int8_t      kernel_int8_t
+#define int64_t     kernel_int64_t
+#define uint64_t    kernel_uint64_t
+
+#include "../student-distrib/dev/video_player.h"
+
+#define MIN_RUN             3           /* shorter runs go into literals */
+#define DEFAULT_KEY_INTERVAL 30
+
+static uint8_t out_buf[VID_MAX_PAYLOAD];
+static uint32_t out_len;
+
+static void emit_op(int kind, uint32_t count) {
+    out_buf[out_len++] = (uint8_t)((kind << 6) | (count - 1));
+}
+
+static void emit_skip(uint32_t count) {
+    while (count >= VID_OP_MAX_COUNT) {
+        uint32_t n = count / VID_OP_MAX_COUNT;
+        if (n > VID_OP_MAX_COUNT)
+            n = VID_OP_MAX_COUNT;
+        emit_op(VID_OP_SKIP_LONG, n);
+        count -= n * VID_OP_MAX_COUNT;
+    }
+    if (count)
+        emit_op(VID_OP_SKIP, count);
+}
+
+static void emit_literal(const uint8_t* src, uint32_t count) {
+    while (count) {
+        uint32_t n = count > VID_OP_MAX_COUNT ? VID_OP_MAX_COUNT : count;
+        emit_op(VID_OP_LIT, n);
+        memcpy(out_buf + out_len, src, n);
+        out_len += n;
+        src += n;
+        count -= n;
+    }
+}
+
+/* length of the run of equal pixels starting at i, stopping at end */
+static uint32_t run_length(const uint8_t* cur, uint32_t i, uint32_t end) {
+    uint32_t j = i + 1;
+    while (j < end && cur[j] == cur[i] && j - i < VID_OP_MAX_COUNT)
+        j++;
+    return j - i;
+}
+
+/*
+ * Encode the pixels [start, end) of cur; they all changed (or this is a
+ * keyframe), so only RUN and LIT ops are used.
+ */
+static void encode_span(const uint8_t* cur, uint32_t start, uint32_t end) {
+    uint32_t i = start, lit = start, run;
+
+    while (i < end) {
+        run = run_length(cur, i, end);
+        if (run >= MIN_RUN) {
+            emit_literal(cur + lit, i - lit);
+            emit_op(VID_OP_RUN, run);
+            out_buf[out_len++] = cur[i];
+            i += run;
+            lit = i;
+        } else {
+            i += run;
+        }
+    }
+    emit_literal(cur + lit, end - lit);
+}
+
+/*
+ * Encode one planar frame. prev == NULL makes a keyframe. Short unchanged
+ * gaps inside a changed span are cheaper to resend than to skip.
+ */
+static void encode_frame(const uint8_t* cur, const uint8_t* prev) {
+    uint32_t i = 0, start;
+
+    out_len = 0;
+    if (prev == NULL) {
+        encode_span(cur, 0, VID_FRAME_SIZE);
+        return;
+    }
+    while (i < VID_FRAME_SIZE) {
+        start = i;
+        while (i < VID_FRAME_SIZE && cur[i] == prev[i])
+            i++;
+        emit_skip(i - start);
+        if (i == VID_FRAME_SIZE)
+            break;
+        start = i;
+        /* the span ends at two unchanged pixels in a row (or the frame end) */
+        while (i < VID_FRAME_SIZE && !(cur[i] == prev[i]
+               && (i + 1 == VID_FRAME_SIZE || cur[i + 1] == prev[i + 1])))
+            i++;
+        encode_span(cur, start, i);
+    }
+}
+
+/* reorder a row-major frame into the 4-plane layout used by the kernel */
+static void to_planes(const uint8_t* raw, uint8_t* planes) {
+    int x, y;
+    for (y = 0; y < VID_Y_DIM; y++)
+        for (x = 0; x < VID_X_DIM; x++)
+            planes[(x & 3) * VID_PLANE_SIZE + y * (VID_X_DIM / 4) + (x >> 2)] = raw[y * VID_X_DIM + x];
+}
+
+int main(int argc, char** argv) {
+    FILE *in, *out;
+    uint32_t hdr[5], frame, n_frames, key_interval = DEFAULT_KEY_INTERVAL;
+    uint32_t vid_hdr[VID_HDR_SIZE / 4];
+    vid_frame_hdr_t frame_hdr;
+    uint8_t *palette, raw[VID_FRAME_SIZE];
+    static uint8_t cur[VID_FRAME_SIZE], prev[VID_FRAME_SIZE];
+    unsigned long raw_total = 0, enc_total = 0;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <raw video> <output> [keyframe interval]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 3 && (key_interval = strtoul(argv[3], NULL, 0)) == 0)
+        key_interval = DEFAULT_KEY_INTERVAL;
+
+    if ((in = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (fread(hdr, sizeof(hdr), 1, in) != 1 || hdr[0] != VID_X_DIM || hdr[1] != VID_Y_DIM) {
+        fprintf(stderr, "%s: not a %dx%d raw video\n", argv[1], VID_X_DIM, VID_Y_DIM);
+        return 1;
+    }
+    palette = malloc(hdr[4] * 3);
+    if (palette == NULL || fread(palette, 3, hdr[4], in) != hdr[4]) {
+        fprintf(stderr, "%s: truncated palette\n", argv[1]);
+        return 1;
+    }
+
+    /* the header frame count may exceed what is actually stored */
+    for (n_frames = 0; n_frames < hdr[2] && fread(raw, VID_FRAME_SIZE, 1, in) == 1; n_frames++)
+        ;
+    fseek(in, sizeof(hdr) + hdr[4] * 3, SEEK_SET);
+
+    if ((out = fopen(argv[2], "wb")) == NULL) {
+        perror(argv[2]);
+        return 1;
+    }
+    vid_hdr[0] = VID_MAGIC;
+    vid_hdr[1] = hdr[0];
+    vid_hdr[2] = hdr[1];
+    vid_hdr[3] = n_frames;
+    vid_hdr[4] = hdr[3];
+    vid_hdr[5] = hdr[4];
+    fwrite(vid_hdr, sizeof(vid_hdr), 1, out);
+    fwrite(palette, 3, hdr[4], out);
+
+    for (frame = 0; frame < n_frames; frame++) {
+        int key = (frame % key_interval == 0);
+        if (fread(raw, VID_FRAME_SIZE, 1, in) != 1)
+            break;
+        to_planes(raw, cur);
+        encode_frame(cur, key ? NULL : prev);
+        frame_hdr.type = key ? VID_FRAME_KEY : VID_FRAME_DELTA;
+        frame_hdr.length = out_len;
+        fwrite(&frame_hdr, sizeof(frame_hdr), 1, out);
+        fwrite(out_buf, 1, out_len, out);
+        memcpy(prev, cur, VID_FRAME_SIZE);
+        raw_total += VID_FRAME_SIZE;
+        enc_total += out_len + sizeof(frame_hdr);
+    }
+
+    printf("%u frames, %lu -> %lu bytes of frame data\n", n_frames, raw_total, enc_total);
+    fclose(out);
+    fclose(in);
+    free(palette);
+    return 0;
+}